@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "platformsupport.h"
+
+#if _WIN32
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "cxxopts.hpp"
+#include "jsonutils.h"
+#include "midivorbisrenderer.h"
+#include "songrendercontainer.h"
+#include "syntheticmidi.h"
+
+using namespace midirenderer;
+
+namespace
+{
+	struct LoopModeEntry
+	{
+		const char* m_name;
+		MIDIVorbisRenderer::LoopMode m_loopMode;
+	};
+
+	const LoopModeEntry s_loopModes[] = {
+		{ "none", MIDIVorbisRenderer::LoopMode::None },
+		{ "short", MIDIVorbisRenderer::LoopMode::Short },
+		{ "double", MIDIVorbisRenderer::LoopMode::Double }
+	};
+
+	// Starts the resident set's high-water mark again from the current resident set, so that it covers
+	// one scenario instead of the whole run. Only Linux can do this, through clear_refs.
+	bool resetPeakResidentBytes()
+	{
+#if __linux__
+		std::ofstream clearRefs("/proc/self/clear_refs");
+		clearRefs << "5" << std::flush;
+		return static_cast<bool>(clearRefs);
+#else
+		return false;
+#endif
+	}
+
+	// The resident set's high-water mark since it was last reset, or over the process' whole run
+	uint64_t getPeakResidentBytes()
+	{
+#if __linux__
+		// VmHWM is the one clear_refs resets
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, 6, "VmHWM:") == 0)
+			{
+				return std::stoull(line.substr(6)) * 1024;
+			}
+		}
+#endif
+#if _WIN32
+		PROCESS_MEMORY_COUNTERS counters = {};
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+		return counters.PeakWorkingSetSize;
+#else
+		rusage usage = {};
+		if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#if __APPLE__
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+	}
+
+	// The granule position of the last page in an Ogg Vorbis file is its length in frames
+	uint64_t getOggFrameCount(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+		std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		for (size_t i = contents.size() >= 27 ? contents.size() - 26 : 0; i-- > 0;)
+		{
+			if (contents[i] == 'O' && contents[i + 1] == 'g' && contents[i + 2] == 'g' && contents[i + 3] == 'S')
+			{
+				uint64_t granulePosition = 0;
+				for (int byte = 7; byte >= 0; byte--)
+				{
+					granulePosition = (granulePosition << 8) | contents[i + 6 + byte];
+				}
+				return granulePosition;
+			}
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cxxopts::Options options(argv[0], "  Renders generated MIDI files and reports how fast each one renders as JSON");
+	options.add_options()
+		("help", "Show this help document")
+		("f,soundfont", "(Required) The path to the soundfont to use", cxxopts::value<std::string>(), "soundfont.sf2")
+		("scenario", "Only render the given scenario (default: all of them)", cxxopts::value<std::vector<std::string>>(), "NAME")
+		("loop-mode", "Only render with the given loop mode (default: none, short and double)", cxxopts::value<std::vector<std::string>>(), "none|short|double")
+		("repeat", "Render each combination this many times and report the fastest", cxxopts::value<int>()->default_value("1"), "N")
+		("pipeline", "Synthesize and encode on separate threads")
+		("stream", "Write each file as it's encoded")
+		("output-dir", "Where to write the generated MIDI files and renders (default: a folder in the system's temporary folder)",
+			cxxopts::value<std::string>(), "DIR")
+		("list", "List the scenarios and exit");
+
+	std::unique_ptr<cxxopts::ParseResult> parsedArgsPtr;
+	try
+	{
+		parsedArgsPtr = std::make_unique<cxxopts::ParseResult>(options.parse(argc, argv));
+	}
+	catch (cxxopts::OptionException& e)
+	{
+		std::cerr << "Invalid input arguments: " << e.what() << std::endl << options.help() << std::endl;
+		return 1;
+	}
+	cxxopts::ParseResult& parsedArgs = *parsedArgsPtr;
+
+	if (parsedArgs.count("help") > 0)
+	{
+		std::cout << options.help() << std::endl;
+		return 0;
+	}
+
+	if (parsedArgs.count("list") > 0)
+	{
+		for (const std::string& name : bench::getScenarioNames())
+		{
+			std::cout << name << std::endl;
+		}
+		return 0;
+	}
+
+	if (parsedArgs.count("f") == 0)
+	{
+		std::cerr << "No soundfont specified - use -f <path> or --soundfont <path>" << std::endl << options.help() << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> scenarios = bench::getScenarioNames();
+	if (parsedArgs.count("scenario") > 0)
+	{
+		scenarios = parsedArgs["scenario"].as<std::vector<std::string>>();
+		for (const std::string& scenario : scenarios)
+		{
+			const std::vector<std::string>& names = bench::getScenarioNames();
+			if (std::find(names.begin(), names.end(), scenario) == names.end())
+			{
+				std::cerr << "Unknown scenario " << scenario << " - use --list to see the scenarios" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	std::vector<LoopModeEntry> loopModes(std::begin(s_loopModes), std::end(s_loopModes));
+	if (parsedArgs.count("loop-mode") > 0)
+	{
+		loopModes.clear();
+		for (const std::string& modeName : parsedArgs["loop-mode"].as<std::vector<std::string>>())
+		{
+			auto entry = std::find_if(std::begin(s_loopModes), std::end(s_loopModes), [&](const LoopModeEntry& mode) { return modeName == mode.m_name; });
+			if (entry == std::end(s_loopModes))
+			{
+				std::cerr << "Invalid loop mode " << modeName << std::endl;
+				return 1;
+			}
+			loopModes.push_back(*entry);
+		}
+	}
+
+	int repeatCount = parsedArgs["repeat"].as<int>();
+	if (repeatCount <= 0)
+	{
+		std::cerr << "Invalid repeat count " << repeatCount << " given - please use at least 1" << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path outputFolder = std::filesystem::temp_directory_path() / "midirenderer-bench";
+	if (parsedArgs.count("output-dir") > 0)
+	{
+		outputFolder = std::filesystem::u8path(parsedArgs["output-dir"].as<std::string>());
+	}
+
+	std::string soundfontPath = parsedArgs["f"].as<std::string>();
+	MIDIVorbisRenderer renderer;
+	renderer.setPipelined(parsedArgs.count("pipeline") > 0);
+	renderer.setStreaming(parsedArgs.count("stream") > 0);
+
+	auto soundfontLoadStart = std::chrono::steady_clock::now();
+	try
+	{
+		std::filesystem::create_directories(outputFolder);
+		renderer.loadSoundfont(soundfontPath);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	double soundfontLoadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - soundfontLoadStart).count();
+
+	// One JSON object per scenario and loop mode, with the soundfont's load time kept separate
+	// since it's paid once per process rather than per render
+	std::cout << "{\"soundfont\":" << utils::toJSONString(soundfontPath) << ",\"soundfontLoadSeconds\":" << soundfontLoadSeconds <<
+		",\"pipelined\":" << (parsedArgs.count("pipeline") > 0 ? "true" : "false") <<
+		",\"streaming\":" << (parsedArgs.count("stream") > 0 ? "true" : "false") << ",\"results\":[" << std::endl;
+
+	bool isFirstResult = true;
+	for (const std::string& scenario : scenarios)
+	{
+		std::vector<unsigned char> midiData = bench::generateScenario(scenario);
+		std::filesystem::path midiPath = outputFolder / (scenario + ".mid");
+		std::ofstream(midiPath, std::ios_base::out | std::ios_base::binary).write(reinterpret_cast<const char*>(midiData.data()), midiData.size());
+
+		for (const LoopModeEntry& loopMode : loopModes)
+		{
+			std::filesystem::path outputPath = outputFolder / (scenario + "-" + loopMode.m_name + ".ogg");
+
+			std::ostringstream result;
+			result << "{\"scenario\":" << utils::toJSONString(scenario) << ",\"loopMode\":" << utils::toJSONString(loopMode.m_name);
+			try
+			{
+				bool isPeakPerScenario = resetPeakResidentBytes();
+				double fastestSeconds = 0;
+				for (int i = 0; i < repeatCount; i++)
+				{
+					auto renderStart = std::chrono::steady_clock::now();
+					renderer.renderFile(midiPath.u8string(), outputPath.u8string(), { loopMode.m_loopMode, -1 });
+					double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+					fastestSeconds = i == 0 ? seconds : std::min(fastestSeconds, seconds);
+				}
+
+				uint64_t frameCount = getOggFrameCount(outputPath);
+				result << ",\"frames\":" << frameCount << ",\"seconds\":" << fastestSeconds <<
+					",\"framesPerSecond\":" << frameCount / fastestSeconds <<
+					",\"realtimeFactor\":" << frameCount / SongRenderContainer::s_sampleRate / fastestSeconds <<
+					",\"bytesOut\":" << std::filesystem::file_size(outputPath) <<
+					",\"peakRSSBytes\":" << getPeakResidentBytes() <<
+					",\"peakRSSScope\":" << (isPeakPerScenario ? "\"scenario\"" : "\"cumulative\"") << "}";
+			}
+			catch (std::exception& e)
+			{
+				result << ",\"error\":" << utils::toJSONString(e.what()) << "}";
+			}
+
+			std::cout << (isFirstResult ? "" : ",\n") << result.str() << std::flush;
+			isFirstResult = false;
+		}
+	}
+	std::cout << "\n]}" << std::endl;
+
+	return 0;
+}
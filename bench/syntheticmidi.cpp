@@ -0,0 +1,296 @@
+#include "syntheticmidi.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+
+namespace midirenderer::bench
+{
+	namespace
+	{
+		constexpr int s_division = 480;
+
+		struct Event
+		{
+			uint32_t m_tick;
+			// Keeps events on the same tick in the order they were added
+			size_t m_order;
+			std::vector<unsigned char> m_bytes;
+		};
+
+		class TrackBuilder
+		{
+		public:
+			void add(uint32_t tick, std::vector<unsigned char> bytes)
+			{
+				m_events.push_back({ tick, m_events.size(), std::move(bytes) });
+			}
+
+			void addNote(int channel, uint32_t tick, uint32_t length, int key, int velocity)
+			{
+				// Note offs sort before note ons on the same tick, as a sequencer would write them
+				add(tick + length, { static_cast<unsigned char>(0x80 | channel), static_cast<unsigned char>(key), 0 });
+				add(tick, { static_cast<unsigned char>(0x90 | channel), static_cast<unsigned char>(key), static_cast<unsigned char>(velocity) });
+			}
+
+			void addControlChange(int channel, uint32_t tick, int control, int value)
+			{
+				add(tick, { static_cast<unsigned char>(0xb0 | channel), static_cast<unsigned char>(control), static_cast<unsigned char>(value) });
+			}
+
+			void addProgramChange(int channel, uint32_t tick, int program)
+			{
+				add(tick, { static_cast<unsigned char>(0xc0 | channel), static_cast<unsigned char>(program) });
+			}
+
+			void addTempo(uint32_t tick, int microsecondsPerQuarter)
+			{
+				add(tick, { 0xff, 0x51, 0x03, static_cast<unsigned char>(microsecondsPerQuarter >> 16),
+					static_cast<unsigned char>(microsecondsPerQuarter >> 8), static_cast<unsigned char>(microsecondsPerQuarter) });
+			}
+
+			void write(std::vector<unsigned char>& output)
+			{
+				std::stable_sort(m_events.begin(), m_events.end(), [](const Event& a, const Event& b)
+				{
+					if (a.m_tick != b.m_tick) { return a.m_tick < b.m_tick; }
+					// Note offs first so that a note ending where the next one of the same key starts isn't cut short
+					bool isANoteOff = (a.m_bytes[0] & 0xf0) == 0x80;
+					bool isBNoteOff = (b.m_bytes[0] & 0xf0) == 0x80;
+					if (isANoteOff != isBNoteOff) { return isANoteOff; }
+					return a.m_order < b.m_order;
+				});
+
+				std::vector<unsigned char> data;
+				uint32_t lastTick = 0;
+				for (const Event& event : m_events)
+				{
+					writeVariableLength(data, event.m_tick - lastTick);
+					data.insert(data.end(), event.m_bytes.begin(), event.m_bytes.end());
+					lastTick = event.m_tick;
+				}
+				writeVariableLength(data, 0);
+				data.insert(data.end(), { 0xff, 0x2f, 0x00 });
+
+				output.insert(output.end(), { 'M', 'T', 'r', 'k' });
+				writeBigEndian(output, static_cast<uint32_t>(data.size()), 4);
+				output.insert(output.end(), data.begin(), data.end());
+			}
+
+			static void writeBigEndian(std::vector<unsigned char>& output, uint32_t value, int byteCount)
+			{
+				for (int i = byteCount - 1; i >= 0; i--)
+				{
+					output.push_back(static_cast<unsigned char>(value >> (i * 8)));
+				}
+			}
+
+		private:
+			static void writeVariableLength(std::vector<unsigned char>& output, uint32_t value)
+			{
+				unsigned char bytes[5];
+				int byteCount = 0;
+				do
+				{
+					bytes[byteCount++] = value & 0x7f;
+					value >>= 7;
+				} while (value > 0);
+
+				while (byteCount > 1)
+				{
+					output.push_back(bytes[--byteCount] | 0x80);
+				}
+				output.push_back(bytes[0]);
+			}
+
+			std::vector<Event> m_events;
+		};
+
+		// std::mt19937's output is fully specified by the standard, unlike the distributions,
+		// so values are taken from it directly to generate the same files on every platform
+		class Random
+		{
+		public:
+			Random(uint32_t seed) : m_engine(seed) { }
+
+			int range(int min, int max)
+			{
+				return min + static_cast<int>(m_engine() % static_cast<uint32_t>(max - min + 1));
+			}
+
+		private:
+			std::mt19937 m_engine;
+		};
+
+		constexpr uint32_t s_beat = s_division;
+		constexpr uint32_t s_bar = s_division * 4;
+
+		// Notes of a C major scale, starting from the given octave
+		int getScaleKey(int octave, int degree)
+		{
+			static const int s_scale[] = { 0, 2, 4, 5, 7, 9, 11 };
+			return 12 * (octave + degree / 7) + s_scale[degree % 7];
+		}
+
+		std::vector<TrackBuilder> generateSparsePiano()
+		{
+			std::vector<TrackBuilder> tracks(2);
+			tracks[0].addTempo(0, 600000);
+
+			Random random(1);
+			tracks[1].addProgramChange(0, 0, 0);
+			for (uint32_t tick = 0; tick < s_bar * 32; tick += s_beat)
+			{
+				int degree = random.range(0, 13);
+				tracks[1].addNote(0, tick, s_beat - s_beat / 8, getScaleKey(5, degree), random.range(60, 100));
+			}
+			return tracks;
+		}
+
+		std::vector<TrackBuilder> generateDenseOrchestral()
+		{
+			std::vector<TrackBuilder> tracks(13);
+			tracks[0].addTempo(0, 500000);
+
+			static const int s_programs[] = { 40, 40, 41, 42, 43, 48, 56, 57, 60, 68, 71, 73 };
+			Random random(2);
+			for (int channel = 0; channel < 12; channel++)
+			{
+				// Channel 9 is drums; give it a melodic instrument like the rest
+				int midiChannel = channel < 9 ? channel : channel + 1;
+				TrackBuilder& track = tracks[channel + 1];
+				track.addProgramChange(midiChannel, 0, s_programs[channel]);
+
+				int octave = 3 + channel % 4;
+				for (uint32_t bar = 0; bar < 32; bar++)
+				{
+					int root = random.range(0, 6);
+					if (channel % 3 == 0)
+					{
+						// Sixteenth note runs
+						for (uint32_t tick = 0; tick < s_bar; tick += s_beat / 4)
+						{
+							track.addNote(midiChannel, bar * s_bar + tick, s_beat / 4, getScaleKey(octave, root + random.range(0, 7)), random.range(70, 110));
+						}
+					}
+					else
+					{
+						// Chords on each beat
+						for (uint32_t tick = 0; tick < s_bar; tick += s_beat)
+						{
+							for (int third = 0; third < 3; third++)
+							{
+								track.addNote(midiChannel, bar * s_bar + tick, s_beat, getScaleKey(octave, root + third * 2), random.range(60, 100));
+							}
+						}
+					}
+				}
+			}
+			return tracks;
+		}
+
+		std::vector<TrackBuilder> generateSustainedPads()
+		{
+			std::vector<TrackBuilder> tracks(4);
+			tracks[0].addTempo(0, 750000);
+
+			Random random(3);
+			for (int channel = 0; channel < 3; channel++)
+			{
+				TrackBuilder& track = tracks[channel + 1];
+				track.addProgramChange(channel, 0, 88 + channel * 2);
+				for (uint32_t bar = 0; bar < 32; bar += 4)
+				{
+					uint32_t tick = bar * s_bar;
+					track.addControlChange(channel, tick, 64, 127);
+					int root = random.range(0, 6);
+					for (int third = 0; third < 4; third++)
+					{
+						track.addNote(channel, tick, s_bar, getScaleKey(3 + channel, root + third * 2), random.range(50, 90));
+					}
+					// The pedal holds the chord until just before the next one
+					track.addControlChange(channel, tick + s_bar * 4 - s_beat / 4, 64, 0);
+				}
+			}
+			return tracks;
+		}
+
+		std::vector<TrackBuilder> generateTempoChanges()
+		{
+			std::vector<TrackBuilder> tracks(3);
+
+			Random random(4);
+			for (uint32_t tick = 0; tick < s_bar * 32; tick += s_beat)
+			{
+				// 60 to 200 BPM
+				tracks[0].addTempo(tick, random.range(300000, 1000000));
+			}
+
+			tracks[1].addProgramChange(0, 0, 0);
+			tracks[2].addProgramChange(1, 0, 32);
+			for (uint32_t tick = 0; tick < s_bar * 32; tick += s_beat / 2)
+			{
+				tracks[1].addNote(0, tick, s_beat / 2, getScaleKey(5, random.range(0, 13)), random.range(60, 100));
+				if (tick % s_beat == 0)
+				{
+					tracks[2].addNote(1, tick, s_beat, getScaleKey(2, random.range(0, 6)), 90);
+				}
+			}
+			return tracks;
+		}
+
+		std::vector<TrackBuilder> generateLooped()
+		{
+			std::vector<TrackBuilder> tracks(3);
+			tracks[0].addTempo(0, 500000);
+			tracks[0].addControlChange(0, s_bar * 4, 111, 0);
+
+			Random random(5);
+			tracks[1].addProgramChange(0, 0, 0);
+			tracks[2].addProgramChange(1, 0, 48);
+			for (uint32_t bar = 0; bar < 36; bar++)
+			{
+				int root = random.range(0, 6);
+				for (int third = 0; third < 3; third++)
+				{
+					tracks[2].addNote(1, bar * s_bar, s_bar, getScaleKey(4, root + third * 2), 70);
+				}
+				for (uint32_t tick = 0; tick < s_bar; tick += s_beat / 2)
+				{
+					tracks[1].addNote(0, bar * s_bar + tick, s_beat / 2, getScaleKey(5, root + random.range(0, 7)), random.range(70, 100));
+				}
+			}
+			return tracks;
+		}
+	}
+
+	const std::vector<std::string>& getScenarioNames()
+	{
+		static const std::vector<std::string> s_names = { "sparse-piano", "dense-orchestral", "sustained-pads", "tempo-changes", "looped" };
+		return s_names;
+	}
+
+	std::vector<unsigned char> generateScenario(const std::string& name)
+	{
+		std::vector<TrackBuilder> tracks;
+		if (name == "sparse-piano") { tracks = generateSparsePiano(); }
+		else if (name == "dense-orchestral") { tracks = generateDenseOrchestral(); }
+		else if (name == "sustained-pads") { tracks = generateSustainedPads(); }
+		else if (name == "tempo-changes") { tracks = generateTempoChanges(); }
+		else if (name == "looped") { tracks = generateLooped(); }
+		else
+		{
+			throw std::invalid_argument("Unknown scenario " + name);
+		}
+
+		std::vector<unsigned char> output = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1 };
+		TrackBuilder::writeBigEndian(output, static_cast<uint32_t>(tracks.size()), 2);
+		TrackBuilder::writeBigEndian(output, s_division, 2);
+		for (TrackBuilder& track : tracks)
+		{
+			track.write(output);
+		}
+		return output;
+	}
+}
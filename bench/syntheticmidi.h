@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace midirenderer::bench
+{
+	// The names of the generated songs, each of which stresses a different part of the renderer:
+	//   sparse-piano: a single piano line with at most a few voices playing
+	//   dense-orchestral: twelve channels of chords and runs with high polyphony
+	//   sustained-pads: long pad chords held by the sustain pedal, with long releases
+	//   tempo-changes: a tempo change on every beat
+	//   looped: a CC111 loop point a few bars in, for the loop modes to work with
+	const std::vector<std::string>& getScenarioNames();
+
+	// Generates the standard MIDI file for a scenario. The same name always gives the same bytes.
+	std::vector<unsigned char> generateScenario(const std::string& name);
+}
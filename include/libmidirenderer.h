@@ -0,0 +1,138 @@
+#pragma once
+
+/*
+ * A C interface to the renderer for embedding it in other programs. A renderer keeps its soundfont
+ * loaded between renders and takes MIDI files from memory, passing the rendered file back through a
+ * callback. Renders on the same renderer may run on several threads at once.
+ *
+ * Every struct passed in starts with struct_size, which must be set to the size of the struct the
+ * caller was built against (the init functions do this), so that fields added to the end later on
+ * keep their defaults for older callers.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(MIDIRENDERER_SHARED) && defined(_WIN32)
+#ifdef MIDIRENDERER_BUILDING
+#define MIDIRENDERER_API __declspec(dllexport)
+#else
+#define MIDIRENDERER_API __declspec(dllimport)
+#endif
+#elif defined(MIDIRENDERER_SHARED) && defined(__GNUC__)
+#define MIDIRENDERER_API __attribute__((visibility("default")))
+#else
+#define MIDIRENDERER_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct midirenderer_renderer midirenderer_renderer;
+typedef struct midirenderer_cancel_token midirenderer_cancel_token;
+
+typedef enum midirenderer_status
+{
+	MIDIRENDERER_OK = 0,
+	MIDIRENDERER_ERROR_INVALID_ARGUMENT = 1,
+	MIDIRENDERER_ERROR_CANCELLED = 2,
+	/* The write callback asked for the render to stop */
+	MIDIRENDERER_ERROR_WRITE_FAILED = 3,
+	MIDIRENDERER_ERROR_RENDER_FAILED = 4
+} midirenderer_status;
+
+typedef enum midirenderer_output_format
+{
+	MIDIRENDERER_FORMAT_VORBIS = 0,
+	/* 32-bit float WAV, with the loop in a smpl chunk */
+	MIDIRENDERER_FORMAT_WAV = 1,
+	/* Headerless interleaved 32-bit float frames; the loop start is only in the render result */
+	MIDIRENDERER_FORMAT_RAW = 2
+} midirenderer_output_format;
+
+typedef enum midirenderer_loop_mode
+{
+	MIDIRENDERER_LOOP_NONE = 0,
+	MIDIRENDERER_LOOP_DOUBLE = 1,
+	MIDIRENDERER_LOOP_SHORT = 2
+} midirenderer_loop_mode;
+
+typedef struct midirenderer_config
+{
+	size_t struct_size;
+	/* UTF-8 path to the soundfont, which is loaded when the renderer is created */
+	const char* soundfont_path;
+	/* One of midirenderer_output_format; Vorbis by default */
+	int32_t output_format;
+	/* Threads to encode each Vorbis render on; 1 by default */
+	uint32_t encoder_thread_count;
+	/* Nonzero to run synthesis and encoding on separate threads; off by default */
+	int32_t is_pipelined;
+	/* Nonzero to scale each render to target_loudness in LUFS (EBU R128), or as close as it gets without
+	 * its true peak going over true_peak_ceiling in dBTP; off by default. Normalized renders are held in
+	 * memory until they're finished. */
+	int32_t is_normalizing;
+	double target_loudness;
+	/* -1 by default */
+	double true_peak_ceiling;
+} midirenderer_config;
+
+typedef struct midirenderer_render_options
+{
+	size_t struct_size;
+	/* One of midirenderer_loop_mode; no loop by default */
+	int32_t loop_mode;
+	/* Ends the song on the next beat of this division, a power of two from 1 (whole note) to 64,
+	 * or -1 (the default) to end it as soon as it finishes */
+	int32_t ending_beat_division;
+	/* The Vorbis quality from -0.1 to 1; 0.4 by default */
+	float vorbis_quality;
+} midirenderer_render_options;
+
+typedef struct midirenderer_render_result
+{
+	size_t struct_size;
+	/* How many frames the output plays for */
+	uint64_t frame_count;
+	/* The frame the output loops back to, or 0 if it doesn't loop */
+	uint64_t loop_start_frame;
+	/* For normalized renders, the integrated loudness before normalization in LUFS, or -INFINITY if
+	 * the render was silent, and the gain applied to it in dB */
+	double measured_loudness;
+	double normalization_gain;
+} midirenderer_render_result;
+
+/* Called with each piece of the output in order; returning nonzero stops the render */
+typedef int (*midirenderer_write_func)(void* user_data, const unsigned char* data, size_t size);
+/* Called from the rendering thread with the fraction of the render that's done so far */
+typedef void (*midirenderer_progress_func)(void* user_data, double progress);
+
+MIDIRENDERER_API void midirenderer_config_init(midirenderer_config* config);
+MIDIRENDERER_API void midirenderer_render_options_init(midirenderer_render_options* options);
+MIDIRENDERER_API void midirenderer_render_result_init(midirenderer_render_result* result);
+
+MIDIRENDERER_API midirenderer_status midirenderer_create(const midirenderer_config* config, midirenderer_renderer** renderer);
+/* Every render on the renderer must have finished */
+MIDIRENDERER_API void midirenderer_destroy(midirenderer_renderer* renderer);
+
+/* A token can be cancelled from any thread, and stops every render it's passed to soon after */
+MIDIRENDERER_API midirenderer_cancel_token* midirenderer_cancel_token_create(void);
+MIDIRENDERER_API void midirenderer_cancel_token_cancel(midirenderer_cancel_token* token);
+MIDIRENDERER_API void midirenderer_cancel_token_destroy(midirenderer_cancel_token* token);
+
+/*
+ * Renders a MIDI file's contents, passing the whole output to write once the render is done.
+ * options, progress, cancel_token and result may all be NULL.
+ */
+MIDIRENDERER_API midirenderer_status midirenderer_render(midirenderer_renderer* renderer, const void* midi_data, size_t midi_size,
+	const midirenderer_render_options* options, midirenderer_write_func write, midirenderer_progress_func progress,
+	midirenderer_cancel_token* cancel_token, void* user_data, midirenderer_render_result* result);
+
+/* A description of the last call on this thread that failed, valid until the next failed call */
+MIDIRENDERER_API const char* midirenderer_get_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
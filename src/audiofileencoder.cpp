@@ -0,0 +1,220 @@
+#include "audiofileencoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "mixutils.h"
+
+AudioFileEncoder::AudioFileEncoder() : m_stats(nullptr), m_isComplete(false), m_acquiredBuffers({ nullptr, nullptr }), m_acquiredFrameCount(0),
+	m_isAcquiredForOverlap(false), m_isWritingOverlapRegion(false), m_overlapPosition(0), m_targetLoudness(0), m_truePeakCeiling(0),
+	m_measuredLoudness(-std::numeric_limits<double>::infinity()), m_normalizationGain(0), m_spoolFrameCount(0)
+{
+}
+
+bool AudioFileEncoder::getIsComplete() { return m_isComplete; }
+
+void AudioFileEncoder::writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	if (frameCount == 0) { return; }
+
+	float* acquiredLeftBuffer = nullptr;
+	float* acquiredRightBuffer = nullptr;
+	acquireBuffers(frameCount, acquiredLeftBuffer, acquiredRightBuffer);
+	std::copy(leftBuffer, &leftBuffer[frameCount], acquiredLeftBuffer);
+	std::copy(rightBuffer, &rightBuffer[frameCount], acquiredRightBuffer);
+	commitBuffers(frameCount);
+}
+
+size_t AudioFileEncoder::acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	throwIfComplete();
+
+	m_isAcquiredForOverlap = m_isWritingOverlapRegion;
+	if (m_isAcquiredForOverlap)
+	{
+		m_overlap.extend(frameCount, m_acquiredBuffers[0], m_acquiredBuffers[1]);
+	}
+	else
+	{
+		acquireOutputBuffers(frameCount, m_acquiredBuffers[0], m_acquiredBuffers[1]);
+	}
+
+	m_acquiredFrameCount = frameCount;
+	leftBuffer = m_acquiredBuffers[0];
+	rightBuffer = m_acquiredBuffers[1];
+	return frameCount;
+}
+
+void AudioFileEncoder::commitBuffers(size_t frameCount)
+{
+	if (m_isAcquiredForOverlap)
+	{
+		m_overlap.truncate(m_overlap.getFrameCount() - (m_acquiredFrameCount - frameCount));
+		return;
+	}
+
+	size_t mixedFrameCount = std::min(frameCount, m_overlap.getFrameCount() - m_overlapPosition);
+	if (mixedFrameCount > 0)
+	{
+		for (size_t channel = 0; channel < m_acquiredBuffers.size(); channel++)
+		{
+			midirenderer::utils::addFrames(m_acquiredBuffers[channel], &m_overlap.getChannel(channel)[m_overlapPosition], mixedFrameCount);
+		}
+
+		m_overlapPosition += mixedFrameCount;
+		if (m_overlapPosition == m_overlap.getFrameCount())
+		{
+			// Exhausted the buffer overlap
+			m_overlap.clear();
+			m_overlapPosition = 0;
+		}
+	}
+
+	commitOutputBuffers(frameCount);
+}
+
+void AudioFileEncoder::startOverlapRegion()
+{
+	m_isWritingOverlapRegion = true;
+}
+
+void AudioFileEncoder::endOverlapRegion()
+{
+	m_isWritingOverlapRegion = false;
+}
+
+void AudioFileEncoder::completeStream()
+{
+	throwIfComplete();
+	m_isComplete = true;
+	m_isWritingOverlapRegion = false;
+
+	// Whatever's left of the overlap goes at the end as it is
+	size_t remainingOverlap = m_overlap.getFrameCount() - m_overlapPosition;
+	if (remainingOverlap > 0)
+	{
+		float* leftBuffer = nullptr;
+		float* rightBuffer = nullptr;
+		acquireOutputBuffers(remainingOverlap, leftBuffer, rightBuffer);
+		const float* leftOverlap = &m_overlap.getChannel(0)[m_overlapPosition];
+		const float* rightOverlap = &m_overlap.getChannel(1)[m_overlapPosition];
+		std::copy(leftOverlap, leftOverlap + remainingOverlap, leftBuffer);
+		std::copy(rightOverlap, rightOverlap + remainingOverlap, rightBuffer);
+		commitOutputBuffers(remainingOverlap);
+	}
+
+	m_overlap.clear();
+	m_overlapPosition = 0;
+
+	if (m_loudnessMeter != nullptr)
+	{
+		encodeSpool();
+	}
+
+	finishStream();
+}
+
+std::string AudioFileEncoder::getSidecarContents()
+{
+	return "";
+}
+
+void AudioFileEncoder::setStats(midirenderer::RenderStats* stats)
+{
+	m_stats = stats;
+}
+
+void AudioFileEncoder::setNormalization(long sampleRate, double targetLoudness, double truePeakCeiling)
+{
+	m_loudnessMeter = std::make_unique<LoudnessMeter>(static_cast<double>(sampleRate));
+	m_targetLoudness = targetLoudness;
+	m_truePeakCeiling = truePeakCeiling;
+}
+
+double AudioFileEncoder::getMeasuredLoudness() const
+{
+	return m_measuredLoudness;
+}
+
+double AudioFileEncoder::getNormalizationGain() const
+{
+	return m_normalizationGain;
+}
+
+void AudioFileEncoder::throwIfComplete()
+{
+	if (m_isComplete) { throw std::runtime_error("Attempted to use a completed audio encoder"); }
+}
+
+void AudioFileEncoder::acquireOutputBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	if (m_loudnessMeter == nullptr)
+	{
+		acquireEncoderBuffers(frameCount, leftBuffer, rightBuffer);
+		return;
+	}
+
+	for (std::vector<float>& channel : m_spool)
+	{
+		channel.resize(m_spoolFrameCount + frameCount);
+	}
+	leftBuffer = &m_spool[0][m_spoolFrameCount];
+	rightBuffer = &m_spool[1][m_spoolFrameCount];
+}
+
+void AudioFileEncoder::commitOutputBuffers(size_t frameCount)
+{
+	if (m_loudnessMeter == nullptr)
+	{
+		encodeAcquiredBuffers(frameCount);
+		return;
+	}
+
+	{
+		midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Loudness);
+		m_loudnessMeter->addFrames(&m_spool[0][m_spoolFrameCount], &m_spool[1][m_spoolFrameCount], frameCount);
+	}
+	m_spoolFrameCount += frameCount;
+	for (std::vector<float>& channel : m_spool)
+	{
+		channel.resize(m_spoolFrameCount);
+	}
+}
+
+void AudioFileEncoder::encodeSpool()
+{
+	// Silence has no loudness to normalize, so it's left alone
+	m_measuredLoudness = m_loudnessMeter->getIntegratedLoudness();
+	m_normalizationGain = 0;
+	if (std::isfinite(m_measuredLoudness))
+	{
+		m_normalizationGain = m_targetLoudness - m_measuredLoudness;
+		double truePeak = m_loudnessMeter->getTruePeak();
+		if (std::isfinite(truePeak))
+		{
+			m_normalizationGain = std::min(m_normalizationGain, m_truePeakCeiling - truePeak);
+		}
+	}
+
+	float gain = static_cast<float>(std::pow(10.0, m_normalizationGain / 20.0));
+	for (size_t position = 0; position < m_spoolFrameCount; position += s_spoolEncodeFrameCount)
+	{
+		size_t frameCount = std::min(s_spoolEncodeFrameCount, m_spoolFrameCount - position);
+		std::array<float*, 2> buffers = { nullptr, nullptr };
+		acquireEncoderBuffers(frameCount, buffers[0], buffers[1]);
+		for (size_t channel = 0; channel < buffers.size(); channel++)
+		{
+			const float* spooled = &m_spool[channel][position];
+			std::transform(spooled, spooled + frameCount, buffers[channel], [gain](float sample) { return sample * gain; });
+		}
+		encodeAcquiredBuffers(frameCount);
+	}
+
+	for (std::vector<float>& channel : m_spool)
+	{
+		std::vector<float>().swap(channel);
+	}
+	m_spoolFrameCount = 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audiosink.h"
+#include "loudnessmeter.h"
+#include "overlapbuffer.h"
+#include "renderstats.h"
+
+// An audio sink that encodes everything written to it into a file. Frames written while an overlap
+// region is open are mixed into the frames written after it before they're encoded. Acquired buffers
+// come straight from the encoder where it can take frames in place, and the overlap is mixed into
+// them when they're committed.
+//
+// A file is either built in memory and read out once completeStream has been called, with readHeader
+// followed by readEncodedData, or streamed as it's encoded after startStreaming. Streamed files start
+// with a placeholder header, and once the stream is complete, readHeader gives a final header of the
+// same size to write over it.
+//
+// When normalizing, frames are measured and held in memory instead of being encoded, and the whole
+// song is encoded with the normalization gain applied once the stream is complete.
+class AudioFileEncoder : public AudioSink
+{
+public:
+	typedef std::function<void(const unsigned char*, size_t)> OutputCallbackFunc;
+
+	AudioFileEncoder();
+
+	bool getIsComplete();
+
+	void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount) override;
+	size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void commitBuffers(size_t frameCount) override;
+	void startOverlapRegion() override;
+	void endOverlapRegion() override;
+
+	// Stores the loop in the file, in frames from the start. Has to be set before the final header is read.
+	virtual void setLoopPoints(uint64_t loopStart, uint64_t loopLength) = 0;
+
+	// Outputs a placeholder header right away, then everything else as soon as it's encoded
+	virtual void startStreaming(const OutputCallbackFunc& output) = 0;
+	// Encodes anything held back. When streaming, the rest of the file goes to the streaming output.
+	void completeStream();
+
+	virtual void readHeader(const OutputCallbackFunc& output) = 0;
+	// Outputs everything after the header that's been encoded but not output yet
+	virtual void readEncodedData(const OutputCallbackFunc& output) = 0;
+
+	// Metadata that goes in a file next to the output for formats that can't hold it themselves,
+	// or an empty string if there's none. Only complete once the final header can be read.
+	virtual std::string getSidecarContents();
+
+	// Times encoding into the stats, which must outlive the encoder
+	virtual void setStats(midirenderer::RenderStats* stats);
+
+	// Scales the output to the target integrated loudness in LUFS, or less if its true peak would go
+	// over the ceiling in dBTP. Has to be set before anything's written.
+	void setNormalization(long sampleRate, double targetLoudness, double truePeakCeiling);
+	// The integrated loudness before normalization, in LUFS, or -infinity if it's silent. Only
+	// measured when normalizing, once the stream is complete.
+	double getMeasuredLoudness() const;
+	// The gain applied by normalization, in dB
+	double getNormalizationGain() const;
+
+protected:
+	// Points the buffers at room for exactly frameCount frames to be encoded by encodeAcquiredBuffers
+	virtual void acquireEncoderBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) = 0;
+	// Encodes the first frameCount frames of the buffers from the last call to acquireEncoderBuffers
+	virtual void encodeAcquiredBuffers(size_t frameCount) = 0;
+	// Called once everything has been passed to encodeAcquiredBuffers
+	virtual void finishStream() = 0;
+
+	void throwIfComplete();
+
+	midirenderer::RenderStats* m_stats;
+
+private:
+	// Room for frames that go to the encoder, or into the spool when normalizing
+	void acquireOutputBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer);
+	void commitOutputBuffers(size_t frameCount);
+	void encodeSpool();
+
+	bool m_isComplete;
+
+	std::array<float*, 2> m_acquiredBuffers;
+	size_t m_acquiredFrameCount;
+	bool m_isAcquiredForOverlap;
+
+	OverlapBuffer m_overlap;
+	bool m_isWritingOverlapRegion;
+	// How much of the overlap has been mixed into frames written after it
+	size_t m_overlapPosition;
+
+	std::unique_ptr<LoudnessMeter> m_loudnessMeter;
+	double m_targetLoudness;
+	double m_truePeakCeiling;
+	double m_measuredLoudness;
+	double m_normalizationGain;
+	// Everything written so far while normalizing, which can't be encoded until the gain is known
+	std::array<std::vector<float>, 2> m_spool;
+	size_t m_spoolFrameCount;
+
+	constexpr static size_t s_spoolEncodeFrameCount = 4096;
+};
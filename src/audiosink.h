@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+
+// Receives rendered stereo audio. Frames written while an overlap region is open are
+// held back and mixed into the frames written after the region ends.
+//
+// Instead of writing buffers it already has, a producer can acquire buffers from the sink,
+// render straight into them and commit them, which saves copying every frame on the way
+// through. Only one pair of buffers can be acquired at a time, and nothing else may be
+// done with the sink until they're committed.
+class AudioSink
+{
+public:
+	virtual ~AudioSink() = default;
+
+	virtual void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount) = 0;
+	// Points the buffers at room for at least one and at most frameCount frames and returns
+	// how many frames they hold
+	virtual size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) = 0;
+	// Writes the first frameCount frames of the acquired buffers, which may be none of them
+	virtual void commitBuffers(size_t frameCount) = 0;
+	virtual void startOverlapRegion() = 0;
+	virtual void endOverlapRegion() = 0;
+};
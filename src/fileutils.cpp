@@ -0,0 +1,99 @@
+#include "fileutils.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "platformsupport.h"
+
+#if _WIN32
+#include <fcntl.h>
+#include <io.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+namespace midirenderer::utils
+{
+	std::vector<unsigned char> readFileContents(const std::string& path)
+	{
+		std::ifstream file(stringutils::getPlatformString(path), std::ios_base::in | std::ios_base::binary);
+		if (!file.is_open())
+		{
+			throw std::invalid_argument("Failed to open " + path);
+		}
+
+		return std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	}
+
+	std::vector<unsigned char> readStandardInput()
+	{
+#if _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		std::vector<unsigned char> contents;
+		unsigned char buffer[65536];
+		size_t readSize = 0;
+		while ((readSize = std::fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+		{
+			contents.insert(contents.end(), buffer, buffer + readSize);
+		}
+
+		if (std::ferror(stdin))
+		{
+			throw std::runtime_error("Failed to read from stdin");
+		}
+		return contents;
+	}
+
+	void setStandardOutputBinary()
+	{
+#if _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+
+	void cloneOrCopyFile(const std::filesystem::path& source, const std::filesystem::path& destination)
+	{
+		// Cloning fails if the destination exists
+		std::filesystem::remove(destination);
+
+		bool isCloned = false;
+#if defined(__linux__) && defined(FICLONE)
+		int sourceFile = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+		if (sourceFile >= 0)
+		{
+			int destinationFile = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+			if (destinationFile >= 0)
+			{
+				isCloned = ioctl(destinationFile, FICLONE, sourceFile) == 0;
+				close(destinationFile);
+			}
+			close(sourceFile);
+		}
+#elif defined(__APPLE__)
+		isCloned = clonefile(source.c_str(), destination.c_str(), 0) == 0;
+#endif
+
+		if (!isCloned)
+		{
+			std::filesystem::copy_file(source, destination, std::filesystem::copy_options::overwrite_existing);
+		}
+	}
+
+	std::string getFileIdentity(const std::string& path)
+	{
+		std::filesystem::path filePath = std::filesystem::u8path(path);
+		std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filePath);
+		auto modifiedTime = std::filesystem::last_write_time(filePath).time_since_epoch().count();
+
+		return canonicalPath.u8string() + "|" + std::to_string(std::filesystem::file_size(filePath)) +
+			"|" + std::to_string(modifiedTime);
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace midirenderer::utils
+{
+	std::vector<unsigned char> readFileContents(const std::string& path);
+	// Reads stdin to its end, as binary on every platform
+	std::vector<unsigned char> readStandardInput();
+	// Stops Windows from translating line endings in binary files written to stdout
+	void setStandardOutputBinary();
+
+	// Copies the source to the destination, replacing the destination if it exists. On file systems
+	// that support it, the copy shares the source's data until either of them is written to.
+	void cloneOrCopyFile(const std::filesystem::path& source, const std::filesystem::path& destination);
+
+	// A string that changes whenever the file is replaced or modified
+	std::string getFileIdentity(const std::string& path);
+}
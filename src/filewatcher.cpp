@@ -0,0 +1,121 @@
+#include "filewatcher.h"
+
+#if __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace midirenderer::utils
+{
+	FileWatcher::FileWatcher() : m_inotify(inotify_init1(IN_CLOEXEC))
+	{
+		if (m_inotify < 0)
+		{
+			throw std::runtime_error(std::string("Failed to start watching for changes: ") + std::strerror(errno));
+		}
+	}
+
+	FileWatcher::~FileWatcher()
+	{
+		close(m_inotify);
+	}
+
+	void FileWatcher::watchFolder(const std::string& path)
+	{
+		// inotify hands back the same descriptor for a folder that's already watched, and adding to its
+		// mask keeps it watching for new subfolders if it's in a watched tree
+		int watch = inotify_add_watch(m_inotify, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MASK_ADD);
+		if (watch < 0)
+		{
+			throw std::runtime_error("Failed to watch " + path + " for changes: " + std::strerror(errno));
+		}
+		m_folders[watch] = path;
+	}
+
+	void FileWatcher::watchFolderTree(const std::string& path)
+	{
+		watchTree(path, nullptr);
+	}
+
+	void FileWatcher::watchTree(const std::string& path, std::vector<std::string>* existingFiles)
+	{
+		int watch = inotify_add_watch(m_inotify, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MASK_ADD);
+		if (watch < 0)
+		{
+			// A folder that's removed again before it can be watched has nothing left to watch
+			if (errno == ENOENT) { return; }
+			throw std::runtime_error("Failed to watch " + path + " for changes: " + std::strerror(errno));
+		}
+		m_folders[watch] = path;
+		m_treeFolders.insert(watch);
+
+		std::error_code error;
+		for (std::filesystem::directory_iterator entry(std::filesystem::u8path(path), error), end; !error && entry != end; entry.increment(error))
+		{
+			std::error_code statusError;
+			if (entry->is_directory(statusError) && !entry->is_symlink(statusError))
+			{
+				watchTree(entry->path().lexically_normal().u8string(), existingFiles);
+			}
+			else if (existingFiles != nullptr)
+			{
+				existingFiles->push_back(entry->path().lexically_normal().u8string());
+			}
+		}
+	}
+
+	std::vector<std::string> FileWatcher::waitForChanges(std::chrono::milliseconds timeout)
+	{
+		std::vector<std::string> changedPaths;
+
+		pollfd pollEntry = { m_inotify, POLLIN, 0 };
+		int pollResult = poll(&pollEntry, 1, timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+		if (pollResult < 0 && errno != EINTR)
+		{
+			throw std::runtime_error(std::string("Failed to wait for changes: ") + std::strerror(errno));
+		}
+		if (pollResult <= 0) { return changedPaths; }
+
+		alignas(inotify_event) char buffer[16 * 1024];
+		ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+		if (length < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN) { return changedPaths; }
+			throw std::runtime_error(std::string("Failed to read changes: ") + std::strerror(errno));
+		}
+
+		ssize_t offset = 0;
+		while (offset < length)
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(&buffer[offset]);
+			offset += sizeof(inotify_event) + event->len;
+
+			auto folder = m_folders.find(event->wd);
+			if (folder == m_folders.end() || event->len == 0) { continue; }
+
+			std::filesystem::path changedPath = std::filesystem::u8path(folder->second) / std::filesystem::u8path(event->name);
+			if ((event->mask & IN_ISDIR) != 0)
+			{
+				if (m_treeFolders.count(event->wd) > 0)
+				{
+					watchTree(changedPath.lexically_normal().u8string(), &changedPaths);
+				}
+			}
+			// New files are only reported once they've been written and closed
+			else if ((event->mask & IN_CREATE) == 0)
+			{
+				changedPaths.push_back(changedPath.lexically_normal().u8string());
+			}
+		}
+
+		return changedPaths;
+	}
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace midirenderer::utils
+{
+	// Reports files that are written to or moved into a set of watched folders, which covers both
+	// editors that save in place and ones that save to a temporary file and rename it.
+	// Only available on Linux.
+	class FileWatcher
+	{
+	public:
+		FileWatcher();
+		~FileWatcher();
+
+		FileWatcher(const FileWatcher& other) = delete;
+		FileWatcher& operator=(const FileWatcher& other) = delete;
+
+		// Watching a folder that's already watched does nothing
+		void watchFolder(const std::string& path);
+		// Watches the folder and every folder under it, along with folders made or moved into them later.
+		// Files already in a folder that turns up later are reported as changed, since they may have been
+		// written before it could be watched.
+		void watchFolderTree(const std::string& path);
+
+		// Waits until something changes or the timeout passes and returns the paths of the files that
+		// changed, normalized the same way as the folders they're in. A negative timeout waits forever.
+		std::vector<std::string> waitForChanges(std::chrono::milliseconds timeout);
+
+	private:
+		void watchTree(const std::string& path, std::vector<std::string>* existingFiles);
+
+		int m_inotify;
+		// Watch descriptors to the folders they watch
+		std::map<int, std::string> m_folders;
+		// The watch descriptors of folders whose new subfolders are watched too
+		std::set<int> m_treeFolders;
+	};
+}
@@ -0,0 +1,48 @@
+#include "hashutils.h"
+
+#include <cstdio>
+
+namespace midirenderer::utils
+{
+	FNV1aHash::FNV1aHash() : m_hash(14695981039346656037ull)
+	{
+	}
+
+	void FNV1aHash::addBytes(const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			m_hash ^= bytes[i];
+			m_hash *= 1099511628211ull;
+		}
+	}
+
+	void FNV1aHash::addString(const std::string& value)
+	{
+		// The length keeps consecutive strings from running into each other
+		addValue(value.size());
+		addBytes(value.data(), value.size());
+	}
+
+	void FNV1aHash::addValue(uint64_t value)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			m_hash ^= (value >> (i * 8)) & 0xff;
+			m_hash *= 1099511628211ull;
+		}
+	}
+
+	uint64_t FNV1aHash::getValue() const
+	{
+		return m_hash;
+	}
+
+	std::string FNV1aHash::getHexString() const
+	{
+		char hexString[17];
+		std::snprintf(hexString, sizeof(hexString), "%016llx", static_cast<unsigned long long>(m_hash));
+		return hexString;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace midirenderer::utils
+{
+	// 64-bit FNV-1a, for hashes that need to be the same on every run and platform but
+	// don't need to be secure
+	class FNV1aHash
+	{
+	public:
+		FNV1aHash();
+
+		void addBytes(const void* data, size_t size);
+		void addString(const std::string& value);
+		// Adds the value as 8 little-endian bytes
+		void addValue(uint64_t value);
+
+		uint64_t getValue() const;
+		std::string getHexString() const;
+
+	private:
+		uint64_t m_hash;
+	};
+}
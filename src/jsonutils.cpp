@@ -0,0 +1,53 @@
+#include "jsonutils.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace midirenderer::utils
+{
+	std::string toJSONString(const std::string& value)
+	{
+		std::string result;
+		result.reserve(value.size() + 2);
+		result += '"';
+
+		for (char character : value)
+		{
+			switch (character)
+			{
+			case '"': result += "\\\""; break;
+			case '\\': result += "\\\\"; break;
+			case '\b': result += "\\b"; break;
+			case '\f': result += "\\f"; break;
+			case '\n': result += "\\n"; break;
+			case '\r': result += "\\r"; break;
+			case '\t': result += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(character) < 0x20)
+				{
+					char escaped[7];
+					std::snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+					result += escaped;
+				}
+				else
+				{
+					// UTF-8 passes through unchanged
+					result += character;
+				}
+				break;
+			}
+		}
+
+		result += '"';
+		return result;
+	}
+
+	std::string toJSONNumber(double value, int decimalPlaces)
+	{
+		if (!std::isfinite(value)) { return "null"; }
+
+		char text[384];
+		std::snprintf(text, sizeof(text), "%.*f", decimalPlaces, value);
+		return text;
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+namespace midirenderer::utils
+{
+	// Returns the value as a quoted JSON string literal
+	std::string toJSONString(const std::string& value);
+	// Returns the value as a JSON number with the given number of decimal places, or null if it's
+	// infinite or NaN, which JSON numbers can't represent
+	std::string toJSONNumber(double value, int decimalPlaces = 2);
+	// Enough for a progress fraction to move between events on a long render
+	constexpr int s_progressDecimalPlaces = 4;
+}
@@ -0,0 +1,268 @@
+#include "libmidirenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "midivorbisrenderer.h"
+
+struct midirenderer_renderer
+{
+	std::unique_ptr<midirenderer::MIDIVorbisRenderer> m_renderer;
+};
+
+struct midirenderer_cancel_token
+{
+	std::atomic<bool> m_isCancelled;
+};
+
+namespace
+{
+	using midirenderer::MIDIVorbisRenderer;
+
+	thread_local std::string s_lastError;
+
+	// Thrown out of the output callback to stop a render when the caller's write fails
+	struct WriteFailedException : std::runtime_error
+	{
+		WriteFailedException() : std::runtime_error("The write callback failed") { }
+	};
+
+	midirenderer_status fail(midirenderer_status status, const std::string& error)
+	{
+		s_lastError = error;
+		return status;
+	}
+
+	// Copies as much of a struct as the caller knows about over the defaults in output
+	template<typename T>
+	bool readVersionedStruct(const T* input, T& output)
+	{
+		if (input == nullptr) { return true; }
+		if (input->struct_size < sizeof(input->struct_size)) { return false; }
+
+		size_t outputSize = output.struct_size;
+		std::memcpy(&output, input, std::min(input->struct_size, sizeof(T)));
+		output.struct_size = outputSize;
+		return true;
+	}
+
+	template<typename T>
+	void writeVersionedStruct(const T& input, T* output)
+	{
+		if (output == nullptr || output->struct_size < sizeof(output->struct_size)) { return; }
+
+		size_t outputSize = output->struct_size;
+		std::memcpy(output, &input, std::min(outputSize, sizeof(T)));
+		output->struct_size = outputSize;
+	}
+}
+
+extern "C"
+{
+	void midirenderer_config_init(midirenderer_config* config)
+	{
+		*config = {};
+		config->struct_size = sizeof(midirenderer_config);
+		config->output_format = MIDIRENDERER_FORMAT_VORBIS;
+		config->encoder_thread_count = 1;
+		config->true_peak_ceiling = MIDIVorbisRenderer::s_defaultTruePeakCeiling;
+	}
+
+	void midirenderer_render_options_init(midirenderer_render_options* options)
+	{
+		*options = {};
+		options->struct_size = sizeof(midirenderer_render_options);
+		options->loop_mode = MIDIRENDERER_LOOP_NONE;
+		options->ending_beat_division = -1;
+		options->vorbis_quality = MIDIVorbisRenderer::s_defaultVorbisQuality;
+	}
+
+	void midirenderer_render_result_init(midirenderer_render_result* result)
+	{
+		*result = {};
+		result->struct_size = sizeof(midirenderer_render_result);
+	}
+
+	midirenderer_status midirenderer_create(const midirenderer_config* config, midirenderer_renderer** renderer)
+	{
+		if (renderer == nullptr) { return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "No renderer to create was given"); }
+		*renderer = nullptr;
+
+		midirenderer_config settings;
+		midirenderer_config_init(&settings);
+		if (config == nullptr || !readVersionedStruct(config, settings) || settings.soundfont_path == nullptr)
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "A renderer needs a soundfont");
+		}
+
+		MIDIVorbisRenderer::OutputFormat outputFormat;
+		switch (settings.output_format)
+		{
+		case MIDIRENDERER_FORMAT_VORBIS:
+			outputFormat = MIDIVorbisRenderer::OutputFormat::Vorbis;
+			break;
+		case MIDIRENDERER_FORMAT_WAV:
+			outputFormat = MIDIVorbisRenderer::OutputFormat::Wav;
+			break;
+		case MIDIRENDERER_FORMAT_RAW:
+			outputFormat = MIDIVorbisRenderer::OutputFormat::Raw;
+			break;
+		default:
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "Unknown output format " + std::to_string(settings.output_format));
+		}
+
+		if (settings.is_normalizing != 0 && (!(settings.target_loudness <= 0 && settings.target_loudness >= -70) || !(settings.true_peak_ceiling <= 0)))
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "Normalization needs a loudness from -70 LUFS up to 0 LUFS and a true peak ceiling of 0 dBTP or below");
+		}
+
+		try
+		{
+			auto newRenderer = std::make_unique<midirenderer_renderer>();
+			newRenderer->m_renderer = std::make_unique<MIDIVorbisRenderer>();
+			newRenderer->m_renderer->loadSoundfont(settings.soundfont_path);
+			newRenderer->m_renderer->setOutputFormat(outputFormat);
+			newRenderer->m_renderer->setEncoderThreadCount(std::max<uint32_t>(settings.encoder_thread_count, 1));
+			newRenderer->m_renderer->setPipelined(settings.is_pipelined != 0);
+			if (settings.is_normalizing != 0)
+			{
+				newRenderer->m_renderer->setNormalization(settings.target_loudness, settings.true_peak_ceiling);
+			}
+			*renderer = newRenderer.release();
+			return MIDIRENDERER_OK;
+		}
+		catch (std::invalid_argument& e)
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, e.what());
+		}
+		catch (std::exception& e)
+		{
+			return fail(MIDIRENDERER_ERROR_RENDER_FAILED, e.what());
+		}
+	}
+
+	void midirenderer_destroy(midirenderer_renderer* renderer)
+	{
+		delete renderer;
+	}
+
+	midirenderer_cancel_token* midirenderer_cancel_token_create(void)
+	{
+		midirenderer_cancel_token* token = new midirenderer_cancel_token();
+		token->m_isCancelled = false;
+		return token;
+	}
+
+	void midirenderer_cancel_token_cancel(midirenderer_cancel_token* token)
+	{
+		token->m_isCancelled = true;
+	}
+
+	void midirenderer_cancel_token_destroy(midirenderer_cancel_token* token)
+	{
+		delete token;
+	}
+
+	midirenderer_status midirenderer_render(midirenderer_renderer* renderer, const void* midi_data, size_t midi_size,
+		const midirenderer_render_options* options, midirenderer_write_func write, midirenderer_progress_func progress,
+		midirenderer_cancel_token* cancel_token, void* user_data, midirenderer_render_result* result)
+	{
+		if (renderer == nullptr || write == nullptr || (midi_data == nullptr && midi_size > 0))
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "A render needs a renderer, MIDI data and a write callback");
+		}
+
+		midirenderer_render_options renderOptions;
+		midirenderer_render_options_init(&renderOptions);
+		if (!readVersionedStruct(options, renderOptions))
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "The render options have no size");
+		}
+
+		MIDIVorbisRenderer::RenderSettings settings = { MIDIVorbisRenderer::LoopMode::None, renderOptions.ending_beat_division, renderOptions.vorbis_quality };
+		switch (renderOptions.loop_mode)
+		{
+		case MIDIRENDERER_LOOP_NONE:
+			break;
+		case MIDIRENDERER_LOOP_DOUBLE:
+			settings.m_loopMode = MIDIVorbisRenderer::LoopMode::Double;
+			break;
+		case MIDIRENDERER_LOOP_SHORT:
+			settings.m_loopMode = MIDIVorbisRenderer::LoopMode::Short;
+			break;
+		default:
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "Unknown loop mode " + std::to_string(renderOptions.loop_mode));
+		}
+
+		int beatDivision = settings.m_endingBeatDivision;
+		if (beatDivision != -1 && (beatDivision <= 0 || beatDivision > 64 || (beatDivision & (beatDivision - 1)) != 0))
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "Invalid beat division " + std::to_string(beatDivision) +
+				" - use a power of two from 1 (whole note) to 64");
+		}
+
+		if (!(settings.m_vorbisQuality >= -0.1f && settings.m_vorbisQuality <= 1.0f))
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, "Invalid quality " + std::to_string(settings.m_vorbisQuality) + " - use a number from -0.1 to 1");
+		}
+
+		const unsigned char* midiBytes = static_cast<const unsigned char*>(midi_data);
+		std::vector<unsigned char> midiData(midiBytes, midiBytes + midi_size);
+
+		MIDIVorbisRenderer::ProgressCallback progressCallback;
+		if (progress != nullptr)
+		{
+			progressCallback = [&](double fraction) { progress(user_data, fraction); };
+		}
+		auto outputCallback = [&](const unsigned char* data, size_t size)
+		{
+			if (write(user_data, data, size) != 0)
+			{
+				throw WriteFailedException();
+			}
+		};
+		const std::atomic<bool>* isCancelled = cancel_token != nullptr ? &cancel_token->m_isCancelled : nullptr;
+
+		try
+		{
+			midirenderer::RenderResult renderResult = renderer->m_renderer->renderMemory(midiData, outputCallback, settings,
+				progressCallback, isCancelled);
+
+			midirenderer_render_result output;
+			midirenderer_render_result_init(&output);
+			output.frame_count = renderResult.m_outputFrames;
+			output.loop_start_frame = renderResult.m_loopStartFrame;
+			output.measured_loudness = renderResult.m_measuredLoudness;
+			output.normalization_gain = renderResult.m_normalizationGain;
+			writeVersionedStruct(output, result);
+			return MIDIRENDERER_OK;
+		}
+		catch (WriteFailedException& e)
+		{
+			return fail(MIDIRENDERER_ERROR_WRITE_FAILED, e.what());
+		}
+		catch (std::invalid_argument& e)
+		{
+			return fail(MIDIRENDERER_ERROR_INVALID_ARGUMENT, e.what());
+		}
+		catch (std::exception& e)
+		{
+			if (isCancelled != nullptr && *isCancelled)
+			{
+				return fail(MIDIRENDERER_ERROR_CANCELLED, e.what());
+			}
+			return fail(MIDIRENDERER_ERROR_RENDER_FAILED, e.what());
+		}
+	}
+
+	const char* midirenderer_get_last_error(void)
+	{
+		return s_lastError.c_str();
+	}
+}
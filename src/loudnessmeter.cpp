@@ -0,0 +1,182 @@
+#include "loudnessmeter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	constexpr double s_pi = 3.14159265358979323846;
+	constexpr int s_oversamplingFactor = 4;
+	constexpr size_t s_subBlocksPerBlock = 4;
+	constexpr double s_absoluteGate = -70.0;
+	constexpr double s_relativeGate = -10.0;
+
+	double getLoudness(double meanSquare)
+	{
+		return -0.691 + 10.0 * std::log10(meanSquare);
+	}
+
+	double getMeanSquare(double loudness)
+	{
+		return std::pow(10.0, (loudness + 0.691) / 10.0);
+	}
+}
+
+LoudnessMeter::LoudnessMeter(double sampleRate) : m_truePeak(0), m_subBlockPosition(0), m_subBlockSquareSum(0)
+{
+	// The filters are specified at 48kHz, so they're designed again at the sample rate from
+	// their analog prototypes, the same way libebur128 does
+	double shelfGain = std::pow(10.0, 3.999843853973347 / 20.0);
+	double shelfBandGain = std::pow(shelfGain, 0.4996667741545416);
+	double shelfQ = 0.7071752369554196;
+	double shelfK = std::tan(s_pi * 1681.974450955533 / sampleRate);
+	double shelfNorm = 1.0 + shelfK / shelfQ + shelfK * shelfK;
+	Biquad shelf = { (shelfGain + shelfBandGain * shelfK / shelfQ + shelfK * shelfK) / shelfNorm,
+		2.0 * (shelfK * shelfK - shelfGain) / shelfNorm,
+		(shelfGain - shelfBandGain * shelfK / shelfQ + shelfK * shelfK) / shelfNorm,
+		2.0 * (shelfK * shelfK - 1.0) / shelfNorm,
+		(1.0 - shelfK / shelfQ + shelfK * shelfK) / shelfNorm,
+		0, 0 };
+
+	double highPassQ = 0.5003270373238773;
+	double highPassK = std::tan(s_pi * 38.13547087602444 / sampleRate);
+	double highPassNorm = 1.0 + highPassK / highPassQ + highPassK * highPassK;
+	Biquad highPass = { 1.0, -2.0, 1.0,
+		2.0 * (highPassK * highPassK - 1.0) / highPassNorm,
+		(1.0 - highPassK / highPassQ + highPassK * highPassK) / highPassNorm,
+		0, 0 };
+
+	for (Channel& channel : m_channels)
+	{
+		channel.m_shelf = shelf;
+		channel.m_highPass = highPass;
+		channel.m_history.fill(0.0f);
+	}
+
+	// A Hann windowed sinc with its cutoff at the original Nyquist frequency, with each phase
+	// scaled to unity gain so that steady levels come through unchanged
+	size_t tapsPerPhase = m_oversamplingTaps.size() / s_oversamplingFactor;
+	double center = (m_oversamplingTaps.size() - 1) / 2.0;
+	for (size_t phase = 0; phase < s_oversamplingFactor; phase++)
+	{
+		double phaseSum = 0;
+		for (size_t i = 0; i < tapsPerPhase; i++)
+		{
+			size_t tap = i * s_oversamplingFactor + phase;
+			double x = (tap - center) / s_oversamplingFactor;
+			double sinc = x == 0 ? 1.0 : std::sin(s_pi * x) / (s_pi * x);
+			double window = 0.5 - 0.5 * std::cos(2.0 * s_pi * (tap + 0.5) / m_oversamplingTaps.size());
+			m_oversamplingTaps[phase * tapsPerPhase + i] = static_cast<float>(sinc * window);
+			phaseSum += sinc * window;
+		}
+		for (size_t i = 0; i < tapsPerPhase; i++)
+		{
+			m_oversamplingTaps[phase * tapsPerPhase + i] = static_cast<float>(m_oversamplingTaps[phase * tapsPerPhase + i] / phaseSum);
+		}
+	}
+
+	m_subBlockSize = static_cast<size_t>(sampleRate / 10.0 + 0.5);
+}
+
+void LoudnessMeter::addFrames(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	for (size_t i = 0; i < frameCount; i++)
+	{
+		addSample(m_channels[0], leftBuffer[i], m_subBlockSquareSum);
+		addSample(m_channels[1], rightBuffer[i], m_subBlockSquareSum);
+
+		m_subBlockPosition++;
+		if (m_subBlockPosition == m_subBlockSize)
+		{
+			m_subBlockSquareSums.push_back(m_subBlockSquareSum);
+			m_subBlockSquareSum = 0;
+			m_subBlockPosition = 0;
+		}
+	}
+}
+
+double LoudnessMeter::getIntegratedLoudness() const
+{
+	if (m_subBlockSquareSums.size() < s_subBlocksPerBlock) { return -std::numeric_limits<double>::infinity(); }
+
+	// Both channels are weighted 1, so a block's loudness comes from the sum of their mean squares
+	std::vector<double> blockMeanSquares;
+	blockMeanSquares.reserve(m_subBlockSquareSums.size());
+	double squareSum = 0;
+	for (size_t i = 0; i < m_subBlockSquareSums.size(); i++)
+	{
+		squareSum += m_subBlockSquareSums[i];
+		if (i >= s_subBlocksPerBlock)
+		{
+			squareSum -= m_subBlockSquareSums[i - s_subBlocksPerBlock];
+		}
+		if (i + 1 >= s_subBlocksPerBlock)
+		{
+			blockMeanSquares.push_back(std::max(squareSum, 0.0) / (m_subBlockSize * s_subBlocksPerBlock));
+		}
+	}
+
+	auto getGatedMean = [&](double gateMeanSquare, double& mean)
+	{
+		double sum = 0;
+		size_t count = 0;
+		for (double meanSquare : blockMeanSquares)
+		{
+			if (meanSquare > gateMeanSquare)
+			{
+				sum += meanSquare;
+				count++;
+			}
+		}
+		mean = count > 0 ? sum / count : 0;
+		return count > 0;
+	};
+
+	double absoluteMean = 0;
+	if (!getGatedMean(getMeanSquare(s_absoluteGate), absoluteMean)) { return -std::numeric_limits<double>::infinity(); }
+
+	double relativeMean = 0;
+	if (!getGatedMean(std::max(getMeanSquare(getLoudness(absoluteMean) + s_relativeGate), getMeanSquare(s_absoluteGate)), relativeMean))
+	{
+		return -std::numeric_limits<double>::infinity();
+	}
+	return getLoudness(relativeMean);
+}
+
+double LoudnessMeter::getTruePeak() const
+{
+	return m_truePeak > 0 ? 20.0 * std::log10(m_truePeak) : -std::numeric_limits<double>::infinity();
+}
+
+void LoudnessMeter::addSample(Channel& channel, float sample, double& squareSum)
+{
+	double weighted = channel.m_highPass.process(channel.m_shelf.process(sample));
+	squareSum += weighted * weighted;
+
+	std::array<float, 12>& history = channel.m_history;
+	std::copy(history.begin() + 1, history.end(), history.begin());
+	history.back() = sample;
+
+	float peak = std::fabs(sample);
+	size_t tapsPerPhase = history.size();
+	for (size_t phase = 0; phase < s_oversamplingFactor; phase++)
+	{
+		const float* taps = &m_oversamplingTaps[phase * tapsPerPhase];
+		float interpolated = 0;
+		for (size_t i = 0; i < tapsPerPhase; i++)
+		{
+			interpolated += taps[i] * history[tapsPerPhase - 1 - i];
+		}
+		peak = std::max(peak, std::fabs(interpolated));
+	}
+	m_truePeak = std::max(m_truePeak, peak);
+}
+
+double LoudnessMeter::Biquad::process(double sample)
+{
+	double output = m_b0 * sample + m_z1;
+	m_z1 = m_b1 * sample - m_a1 * output + m_z2;
+	m_z2 = m_b2 * sample - m_a2 * output;
+	return output;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Measures the integrated loudness and true peak of stereo audio as it's written, following
+// ITU-R BS.1770 and EBU R128: K-weighted 400ms blocks every 100ms, gated at -70 LUFS and then
+// at 10 LU below the loudness of the blocks left. True peaks are found by 4x oversampling.
+class LoudnessMeter
+{
+public:
+	LoudnessMeter(double sampleRate);
+
+	void addFrames(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
+
+	// In LUFS, or -infinity when there's less than a block or every block is gated out
+	double getIntegratedLoudness() const;
+	// In dBTP, or -infinity for silence
+	double getTruePeak() const;
+
+private:
+	struct Biquad
+	{
+		double m_b0, m_b1, m_b2, m_a1, m_a2;
+		double m_z1, m_z2;
+
+		double process(double sample);
+	};
+
+	struct Channel
+	{
+		// The K-weighting curve: a high shelf for the head, then a high pass
+		Biquad m_shelf;
+		Biquad m_highPass;
+		// The last few samples, oldest first, for the oversampling filter
+		std::array<float, 12> m_history;
+	};
+
+	void addSample(Channel& channel, float sample, double& squareSum);
+
+	std::array<Channel, 2> m_channels;
+	// The polyphase filter for oversampling, one phase after another
+	std::array<float, 48> m_oversamplingTaps;
+	float m_truePeak;
+
+	size_t m_subBlockSize;
+	size_t m_subBlockPosition;
+	double m_subBlockSquareSum;
+	// Each 100ms of audio's sum of squares across both channels, which blocks are built from
+	std::vector<double> m_subBlockSquareSums;
+};
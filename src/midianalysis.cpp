@@ -0,0 +1,638 @@
+#include "midianalysis.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include "jsonutils.h"
+#include "platformsupport.h"
+#include "songrendercontainer.h"
+
+namespace midirenderer
+{
+	namespace
+	{
+		constexpr uint64_t s_synthBufferSize = MIDIAnalysis::s_synthBufferSize;
+		// The tempo the player starts with, before any tempo events
+		constexpr int s_defaultTempo = 500000;
+
+		enum class EventType
+		{
+			NoteOn,
+			NoteOff,
+			ControlChange,
+			Tempo,
+			EndOfTrack,
+			// System exclusive and aftertouch, which change synth state that can't be read back
+			Opaque,
+			Other
+		};
+
+		struct TrackEvent
+		{
+			uint32_t m_tick;
+			EventType m_type;
+			int m_channel;
+			int m_data1;
+			int m_data2;
+		};
+
+		class ByteReader
+		{
+		public:
+			ByteReader(const unsigned char* data, size_t size) : m_data(data), m_size(size), m_position(0) { }
+
+			bool getIsAtEnd() const { return m_position >= m_size; }
+			size_t getPosition() const { return m_position; }
+
+			uint8_t readByte()
+			{
+				if (m_position >= m_size) { throw std::runtime_error("Unexpected end of MIDI data"); }
+				return m_data[m_position++];
+			}
+
+			uint32_t readBigEndian(int byteCount)
+			{
+				uint32_t value = 0;
+				for (int i = 0; i < byteCount; i++)
+				{
+					value = (value << 8) | readByte();
+				}
+				return value;
+			}
+
+			uint32_t readVariableLength()
+			{
+				uint32_t value = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					uint8_t byte = readByte();
+					value = (value << 7) | (byte & 0x7f);
+					if ((byte & 0x80) == 0) { return value; }
+				}
+				throw std::runtime_error("Invalid variable-length value in MIDI data");
+			}
+
+			std::string readString(size_t length)
+			{
+				skip(length);
+				return std::string(reinterpret_cast<const char*>(&m_data[m_position - length]), length);
+			}
+
+			void skip(size_t byteCount)
+			{
+				if (byteCount > m_size - m_position) { throw std::runtime_error("Unexpected end of MIDI data"); }
+				m_position += byteCount;
+			}
+
+		private:
+			const unsigned char* m_data;
+			size_t m_size;
+			size_t m_position;
+		};
+
+		std::vector<TrackEvent> readTrack(ByteReader& reader, size_t trackEnd)
+		{
+			std::vector<TrackEvent> events;
+			uint32_t tick = 0;
+			uint8_t runningStatus = 0;
+
+			while (reader.getPosition() < trackEnd)
+			{
+				tick += reader.readVariableLength();
+
+				uint8_t status = reader.readByte();
+				int firstDataByte = -1;
+				if (status < 0x80)
+				{
+					if (runningStatus == 0) { throw std::runtime_error("MIDI data byte without a status"); }
+					firstDataByte = status;
+					status = runningStatus;
+				}
+
+				TrackEvent event = { tick, EventType::Other, status & 0x0f, 0, 0 };
+
+				// Meta and system exclusive events are supposed to cancel running status, but
+				// files that keep using it afterwards are common enough to tolerate
+				if (status == 0xff)
+				{
+					uint8_t metaType = reader.readByte();
+					uint32_t length = reader.readVariableLength();
+					if (metaType == 0x51 && length == 3)
+					{
+						event.m_type = EventType::Tempo;
+						event.m_data1 = static_cast<int>(reader.readBigEndian(3));
+					}
+					else
+					{
+						reader.skip(length);
+						if (metaType == 0x2f)
+						{
+							event.m_type = EventType::EndOfTrack;
+						}
+					}
+				}
+				else if (status == 0xf0 || status == 0xf7)
+				{
+					event.m_type = EventType::Opaque;
+					reader.skip(reader.readVariableLength());
+				}
+				else if (status >= 0xf0)
+				{
+					throw std::runtime_error("Unsupported system message in MIDI track");
+				}
+				else
+				{
+					runningStatus = status;
+					int dataByteCount = (status & 0xf0) == 0xc0 || (status & 0xf0) == 0xd0 ? 1 : 2;
+					event.m_data1 = firstDataByte >= 0 ? firstDataByte : reader.readByte();
+					if (dataByteCount == 2)
+					{
+						event.m_data2 = reader.readByte();
+					}
+
+					switch (status & 0xf0)
+					{
+					case 0x80:
+						event.m_type = EventType::NoteOff;
+						break;
+					case 0x90:
+						event.m_type = event.m_data2 > 0 ? EventType::NoteOn : EventType::NoteOff;
+						break;
+					case 0xa0:
+					case 0xd0:
+						event.m_type = EventType::Opaque;
+						break;
+					case 0xb0:
+						event.m_type = EventType::ControlChange;
+						break;
+					}
+				}
+
+				events.push_back(event);
+				if (event.m_type == EventType::EndOfTrack) { break; }
+			}
+
+			// FluidSynth treats the end of the chunk as the end of the track if it has no end of track event
+			if (events.empty() || events.back().m_type != EventType::EndOfTrack)
+			{
+				events.push_back({ tick, EventType::EndOfTrack, 0, 0, 0 });
+			}
+
+			return events;
+		}
+
+		std::vector<std::vector<TrackEvent>> readTracks(const unsigned char* data, size_t size, int& division)
+		{
+			ByteReader reader(data, size);
+			if (reader.readString(4) != "MThd")
+			{
+				throw std::invalid_argument("Not a standard MIDI file");
+			}
+
+			uint32_t headerLength = reader.readBigEndian(4);
+			if (headerLength < 6) { throw std::runtime_error("Invalid MIDI file header"); }
+			reader.readBigEndian(2);
+			uint32_t trackCount = reader.readBigEndian(2);
+			division = static_cast<int16_t>(reader.readBigEndian(2));
+			reader.skip(headerLength - 6);
+
+			if (division <= 0)
+			{
+				throw std::runtime_error("SMPTE-timed MIDI files are not supported");
+			}
+
+			std::vector<std::vector<TrackEvent>> tracks;
+			while (tracks.size() < trackCount && !reader.getIsAtEnd())
+			{
+				std::string chunkType = reader.readString(4);
+				uint32_t chunkLength = reader.readBigEndian(4);
+				size_t chunkEnd = reader.getPosition() + chunkLength;
+				if (chunkEnd > size) { throw std::runtime_error("Unexpected end of MIDI data"); }
+
+				if (chunkType == "MTrk")
+				{
+					tracks.push_back(readTrack(reader, chunkEnd));
+				}
+				// Chunks are always skipped by their length, even if the track ended early
+				reader.skip(chunkEnd - reader.getPosition());
+			}
+
+			if (tracks.empty())
+			{
+				throw std::runtime_error("The MIDI file has no tracks");
+			}
+
+			return tracks;
+		}
+
+		// Follows FluidSynth's player with "player.timing-source" set to "sample": it's called at
+		// the start of every synth block with the milliseconds since playback started, truncated,
+		// and it dispatches every event whose tick has been reached, rounding the current tick.
+		// Callback 0 happens while SongRenderContainer::startPlayback flushes the synth, and
+		// callback n afterwards happens on frame (n - 1) * 64 of the render.
+		void followPlayer(const std::vector<std::vector<TrackEvent>>& tracks, MIDIAnalysis& analysis)
+		{
+			std::vector<size_t> nextEvents(tracks.size(), 0);
+			double millisecondsPerTick = s_defaultTempo / 1000.0 / analysis.m_division;
+			long startMillisecond = 0;
+			int startTick = 0;
+			int tempo = s_defaultTempo;
+
+			auto getCallbackMillisecond = [](uint64_t callbackIndex)
+			{
+				return static_cast<long>(1000.0 * static_cast<double>(callbackIndex * s_synthBufferSize) / SongRenderContainer::s_sampleRate);
+			};
+			auto getCallbackSample = [](uint64_t callbackIndex)
+			{
+				return callbackIndex > 0 ? (callbackIndex - 1) * s_synthBufferSize : 0;
+			};
+
+			analysis.m_lastTempo = s_defaultTempo;
+			analysis.m_lastTempoSample = 0;
+
+			for (uint64_t callbackIndex = 0; ; callbackIndex++)
+			{
+				long millisecond = getCallbackMillisecond(callbackIndex);
+				int currentTick = startTick + static_cast<int>((millisecond - startMillisecond) / millisecondsPerTick + 0.5);
+				uint64_t sample = getCallbackSample(callbackIndex);
+
+				bool isPlaying = false;
+				uint32_t nextEventTick = UINT32_MAX;
+				for (size_t track = 0; track < tracks.size(); track++)
+				{
+					const std::vector<TrackEvent>& events = tracks[track];
+					size_t& nextEvent = nextEvents[track];
+					if (nextEvent >= events.size()) { continue; }
+
+					isPlaying = true;
+					while (nextEvent < events.size() && events[nextEvent].m_tick <= static_cast<uint32_t>(std::max(currentTick, 0)))
+					{
+						const TrackEvent& event = events[nextEvent];
+						if (event.m_type == EventType::Tempo)
+						{
+							tempo = event.m_data1;
+							millisecondsPerTick = tempo / 1000.0 / analysis.m_division;
+							startMillisecond = millisecond;
+							startTick = currentTick;
+							analysis.m_tempoMap.push_back({ event.m_tick, sample, tempo });
+						}
+						else if (event.m_type == EventType::ControlChange && event.m_data1 == 111 && analysis.m_loopTick < 0)
+						{
+							analysis.m_loopTick = static_cast<int>(event.m_tick);
+							analysis.m_loopPlayerTick = currentTick;
+							// The renderer places the loop point one synth buffer before the frame that sees it
+							analysis.m_loopSample = sample >= s_synthBufferSize ? sample - s_synthBufferSize : 0;
+						}
+						nextEvent++;
+					}
+
+					if (nextEvent < events.size())
+					{
+						nextEventTick = std::min(nextEventTick, events[nextEvent].m_tick);
+					}
+				}
+
+				// The renderer only notices tempo changes after its first block
+				if (callbackIndex == 0)
+				{
+					analysis.m_lastTempo = tempo;
+				}
+				else if (tempo != analysis.m_lastTempo)
+				{
+					analysis.m_lastTempo = tempo;
+					analysis.m_lastTempoSample = sample;
+				}
+
+				if (!isPlaying)
+				{
+					// The renderer counts the frame on which it sees that the player has stopped
+					analysis.m_endSample = sample + 1;
+					return;
+				}
+
+				// Skip the callbacks that can't reach the next event. Aiming a couple of blocks early
+				// leaves room for the truncated clock and the rounding of the current tick.
+				if (nextEventTick != UINT32_MAX)
+				{
+					double targetMillisecond = startMillisecond + (nextEventTick - startTick - 0.5) * millisecondsPerTick;
+					double targetCallback = std::floor(targetMillisecond * SongRenderContainer::s_sampleRate / 1000.0 / s_synthBufferSize) - 2;
+					if (targetCallback > callbackIndex + 1)
+					{
+						callbackIndex = static_cast<uint64_t>(targetCallback) - 1;
+					}
+				}
+			}
+		}
+
+		void collectNotes(const std::vector<std::vector<TrackEvent>>& tracks, MIDIAnalysis& analysis)
+		{
+			struct OrderedEvent
+			{
+				const TrackEvent* m_event;
+				size_t m_track;
+				size_t m_index;
+			};
+
+			std::vector<OrderedEvent> orderedEvents;
+			for (size_t track = 0; track < tracks.size(); track++)
+			{
+				for (size_t i = 0; i < tracks[track].size(); i++)
+				{
+					orderedEvents.push_back({ &tracks[track][i], track, i });
+				}
+			}
+			std::stable_sort(orderedEvents.begin(), orderedEvents.end(), [](const OrderedEvent& a, const OrderedEvent& b)
+			{
+				return a.m_event->m_tick < b.m_event->m_tick;
+			});
+
+			for (const auto& orderedEvent : orderedEvents)
+			{
+				if (analysis.m_eventTicks.empty() || analysis.m_eventTicks.back() != orderedEvent.m_event->m_tick)
+				{
+					analysis.m_eventTicks.push_back(orderedEvent.m_event->m_tick);
+				}
+			}
+
+			// Notes that are on (or held by a pedal) for each channel and key. A note off releases
+			// every note on its key, like it does in FluidSynth.
+			std::array<std::array<std::vector<size_t>, 128>, 16> activeNotes;
+			std::array<std::vector<size_t>, 16> heldNotes;
+			std::array<bool, 16> isSustained = {};
+			std::array<bool, 16> isHold2 = {};
+			std::array<std::vector<size_t>, 16> sostenutoNotes;
+
+			auto releaseNote = [&](size_t noteIndex, uint32_t tick)
+			{
+				MIDINote& note = analysis.m_notes[noteIndex];
+				note.m_releaseTick = std::max(note.m_releaseTick, tick);
+			};
+			auto isHeldBySostenuto = [&](int channel, size_t noteIndex)
+			{
+				const auto& notes = sostenutoNotes[channel];
+				return std::find(notes.begin(), notes.end(), noteIndex) != notes.end();
+			};
+			auto releaseHeldNotes = [&](int channel, uint32_t tick)
+			{
+				std::vector<size_t> stillHeld;
+				for (size_t noteIndex : heldNotes[channel])
+				{
+					if (isSustained[channel] || isHold2[channel] || isHeldBySostenuto(channel, noteIndex))
+					{
+						stillHeld.push_back(noteIndex);
+					}
+					else
+					{
+						releaseNote(noteIndex, tick);
+					}
+				}
+				heldNotes[channel] = std::move(stillHeld);
+			};
+
+			for (const auto& orderedEvent : orderedEvents)
+			{
+				const TrackEvent& event = *orderedEvent.m_event;
+				int channel = event.m_channel;
+
+				switch (event.m_type)
+				{
+				case EventType::NoteOn:
+					activeNotes[channel][event.m_data1].push_back(analysis.m_notes.size());
+					analysis.m_notes.push_back({ channel, event.m_data1, event.m_data2, event.m_tick, UINT32_MAX, 0 });
+					break;
+				case EventType::NoteOff:
+					for (size_t noteIndex : activeNotes[channel][event.m_data1])
+					{
+						analysis.m_notes[noteIndex].m_endTick = event.m_tick;
+						heldNotes[channel].push_back(noteIndex);
+					}
+					activeNotes[channel][event.m_data1].clear();
+					releaseHeldNotes(channel, event.m_tick);
+					break;
+				case EventType::ControlChange:
+					// Portamento control and time, legato, and mono and poly mode
+					if (event.m_data1 == 5 || event.m_data1 == 65 || event.m_data1 == 68 || event.m_data1 == 84 ||
+						event.m_data1 == 126 || event.m_data1 == 127)
+					{
+						analysis.m_channelsWithLinkedNotes |= 1 << channel;
+					}
+
+					if (event.m_data1 == 64)
+					{
+						isSustained[channel] = event.m_data2 >= 64;
+					}
+					else if (event.m_data1 == 69)
+					{
+						isHold2[channel] = event.m_data2 >= 64;
+					}
+					else if (event.m_data1 == 66)
+					{
+						sostenutoNotes[channel].clear();
+						if (event.m_data2 >= 64)
+						{
+							for (const auto& keyNotes : activeNotes[channel])
+							{
+								sostenutoNotes[channel].insert(sostenutoNotes[channel].end(), keyNotes.begin(), keyNotes.end());
+							}
+						}
+					}
+					else if (event.m_data1 == 120 || event.m_data1 == 123)
+					{
+						// All sound off and all notes off
+						for (auto& keyNotes : activeNotes[channel])
+						{
+							for (size_t noteIndex : keyNotes)
+							{
+								analysis.m_notes[noteIndex].m_endTick = event.m_tick;
+								heldNotes[channel].push_back(noteIndex);
+							}
+							keyNotes.clear();
+						}
+					}
+					releaseHeldNotes(channel, event.m_tick);
+					break;
+				default:
+					break;
+				}
+			}
+
+			// Anything still on is cut off by the end of the song
+			for (MIDINote& note : analysis.m_notes)
+			{
+				if (note.m_endTick == UINT32_MAX) { note.m_endTick = analysis.m_endTick; }
+				note.m_releaseTick = std::max(note.m_releaseTick, note.m_endTick);
+			}
+			for (auto& channelNotes : heldNotes)
+			{
+				for (size_t noteIndex : channelNotes)
+				{
+					releaseNote(noteIndex, analysis.m_endTick);
+				}
+			}
+
+			std::vector<std::pair<uint32_t, int>> polyphonyChanges;
+			for (const MIDINote& note : analysis.m_notes)
+			{
+				polyphonyChanges.push_back({ note.m_startTick, 1 });
+				polyphonyChanges.push_back({ note.m_releaseTick, -1 });
+			}
+			std::sort(polyphonyChanges.begin(), polyphonyChanges.end());
+
+			int polyphony = 0;
+			for (const auto& change : polyphonyChanges)
+			{
+				polyphony += change.second;
+				analysis.m_peakPolyphony = std::max(analysis.m_peakPolyphony, polyphony);
+			}
+		}
+	}
+
+	bool MIDIAnalysis::getHasLoopPoint() const
+	{
+		return m_loopTick >= 0;
+	}
+
+	uint64_t MIDIAnalysis::getEndOnDivisionSample(int beatDivision) const
+	{
+		if (beatDivision == -1) { return m_endSample; }
+		return getBeatDivisionEndSample(m_endSample, m_lastTempoSample, m_lastTempo, beatDivision);
+	}
+
+	int MIDIAnalysis::getNextEventTick(int tick) const
+	{
+		auto nextTick = std::upper_bound(m_eventTicks.begin(), m_eventTicks.end(), static_cast<uint32_t>(std::max(tick, 0)));
+		if (tick < 0 && !m_eventTicks.empty() && m_eventTicks.front() == 0)
+		{
+			return 0;
+		}
+		return nextTick == m_eventTicks.end() ? -1 : static_cast<int>(*nextTick);
+	}
+
+	uint64_t MIDIAnalysis::getSampleAtTick(uint32_t tick) const
+	{
+		double sample = 0;
+		uint32_t lastTick = 0;
+		int tempo = s_defaultTempo;
+		for (const TempoChange& change : m_tempoMap)
+		{
+			if (change.m_tick >= tick) { break; }
+			sample += (change.m_tick - lastTick) * (tempo / 1000000.0) / m_division * SongRenderContainer::s_sampleRate;
+			lastTick = change.m_tick;
+			tempo = change.m_tempo;
+		}
+		sample += (tick - lastTick) * (tempo / 1000000.0) / m_division * SongRenderContainer::s_sampleRate;
+		return static_cast<uint64_t>(sample);
+	}
+
+	std::vector<uint64_t> MIDIAnalysis::getSamplesAtTicks(const std::vector<uint32_t>& ticks) const
+	{
+		std::vector<uint64_t> samples;
+		samples.reserve(ticks.size());
+
+		// The tempo changes before each tick are added up where the last tick left off, in the same order
+		// getSampleAtTick adds them, so the results are identical
+		double sample = 0;
+		uint32_t lastTick = 0;
+		int tempo = s_defaultTempo;
+		size_t changeIndex = 0;
+		for (uint32_t tick : ticks)
+		{
+			while (changeIndex < m_tempoMap.size() && m_tempoMap[changeIndex].m_tick < tick)
+			{
+				const TempoChange& change = m_tempoMap[changeIndex++];
+				sample += (change.m_tick - lastTick) * (tempo / 1000000.0) / m_division * SongRenderContainer::s_sampleRate;
+				lastTick = change.m_tick;
+				tempo = change.m_tempo;
+			}
+			samples.push_back(static_cast<uint64_t>(sample + (tick - lastTick) * (tempo / 1000000.0) / m_division * SongRenderContainer::s_sampleRate));
+		}
+		return samples;
+	}
+
+	std::string MIDIAnalysis::toJSON(int beatDivision) const
+	{
+		std::ostringstream json;
+		json << "{\"division\":" << m_division << ",\"loopPoint\":";
+		if (getHasLoopPoint())
+		{
+			json << "{\"tick\":" << m_loopTick << ",\"playerTick\":" << m_loopPlayerTick <<
+				",\"sample\":" << m_loopSample << "}";
+		}
+		else
+		{
+			json << "null";
+		}
+
+		json << ",\"tempoMap\":[";
+		for (size_t i = 0; i < m_tempoMap.size(); i++)
+		{
+			const TempoChange& change = m_tempoMap[i];
+			json << (i > 0 ? "," : "") << "{\"tick\":" << change.m_tick << ",\"sample\":" << change.m_sample <<
+				",\"tempo\":" << change.m_tempo << ",\"bpm\":" << 60000000.0 / change.m_tempo << "}";
+		}
+		json << "],\"endTick\":" << m_endTick << ",\"endSample\":" << m_endSample <<
+			",\"endSeconds\":" << m_endSample / SongRenderContainer::s_sampleRate;
+
+		json << ",\"endOnDivisionSample\":";
+		if (beatDivision > 0)
+		{
+			json << getEndOnDivisionSample(beatDivision);
+		}
+		else
+		{
+			json << "null";
+		}
+
+		json << ",\"noteCount\":" << m_notes.size() << ",\"peakPolyphony\":" << m_peakPolyphony << "}";
+		return json.str();
+	}
+
+	MIDIAnalysis analyzeMIDIFile(const std::string& path)
+	{
+		std::ifstream file(stringutils::getPlatformString(path), std::ios_base::in | std::ios_base::binary);
+		if (!file.is_open())
+		{
+			throw std::invalid_argument("Failed to open MIDI file at " + path);
+		}
+
+		std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return analyzeMIDIData(contents.data(), contents.size());
+	}
+
+	MIDIAnalysis analyzeMIDIData(const unsigned char* data, size_t size)
+	{
+		MIDIAnalysis analysis = {};
+		analysis.m_loopTick = -1;
+		analysis.m_loopPlayerTick = -1;
+
+		std::vector<std::vector<TrackEvent>> tracks = readTracks(data, size, analysis.m_division);
+		for (const auto& track : tracks)
+		{
+			analysis.m_endTick = std::max(analysis.m_endTick, track.back().m_tick);
+			for (const TrackEvent& event : track)
+			{
+				analysis.m_hasOpaqueEvents |= event.m_type == EventType::Opaque;
+			}
+		}
+
+		collectNotes(tracks, analysis);
+		followPlayer(tracks, analysis);
+		return analysis;
+	}
+
+	uint64_t getBeatDivisionEndSample(uint64_t songLength, uint64_t lastTempoSample, int lastTempo, int beatDivision)
+	{
+		uint64_t samplesSinceTempoChange = songLength - lastTempoSample;
+		double alignmentTempo = 4.0 / beatDivision * (lastTempo / 1000000.0);
+		double samplesPerAlignedBeat = SongRenderContainer::s_sampleRate * alignmentTempo;
+		double beatsElapsed = samplesSinceTempoChange / samplesPerAlignedBeat;
+		uint64_t lastAlignedBeat = static_cast<uint64_t>(beatsElapsed) + 1.0;
+		uint64_t lastSample = static_cast<uint64_t>(lastAlignedBeat * samplesPerAlignedBeat);
+		return std::max(lastSample, songLength);
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace midirenderer
+{
+	struct TempoChange
+	{
+		uint32_t m_tick;
+		// The first frame rendered after the player switches to this tempo
+		uint64_t m_sample;
+		// Microseconds per quarter note
+		int m_tempo;
+	};
+
+	struct MIDINote
+	{
+		int m_channel;
+		int m_key;
+		int m_velocity;
+		uint32_t m_startTick;
+		// When the note off (or equivalent) arrives
+		uint32_t m_endTick;
+		// When the note is actually released, which is later than the note off if a pedal holds it
+		uint32_t m_releaseTick;
+	};
+
+	// The results of running a standard MIDI file through a model of FluidSynth's sample-timed
+	// player without synthesizing anything. Sample positions are those the renderer sees when it
+	// renders the file from the start: events are only dispatched when the synth starts a new
+	// block, so every position is on a synth block boundary.
+	struct MIDIAnalysis
+	{
+		// The synth block size the model dispatches events on. FluidSynth's internal buffer size is fixed
+		// when it's compiled, so a render checks its synth uses the same size before trusting the analysis.
+		constexpr static uint64_t s_synthBufferSize = 64;
+
+		int m_division;
+
+		// The tick of the first CC111 event or -1 if there is none
+		int m_loopTick;
+		// The player's tick when the event is dispatched, which can be past the event's own tick
+		int m_loopPlayerTick;
+		uint64_t m_loopSample;
+
+		std::vector<TempoChange> m_tempoMap;
+
+		uint32_t m_endTick;
+		// The number of frames rendered before the player stops, not counting beat division padding
+		uint64_t m_endSample;
+
+		// The tempo the renderer uses to align the end of the song to a beat division
+		int m_lastTempo;
+		uint64_t m_lastTempoSample;
+
+		// Every tick that has at least one event on it, in order
+		std::vector<uint32_t> m_eventTicks;
+		std::vector<MIDINote> m_notes;
+		// Bit n is set if channel n uses portamento, legato or mono mode, where the notes played
+		// before a note change how it sounds
+		uint16_t m_channelsWithLinkedNotes;
+		// Whether there are system exclusive or aftertouch events, whose effects on the synth
+		// can't be read back from it
+		bool m_hasOpaqueEvents;
+		int m_peakPolyphony;
+
+		bool getHasLoopPoint() const;
+		uint64_t getEndOnDivisionSample(int beatDivision) const;
+		// The first tick after the given tick that has an event on it, or -1 if there are none left
+		int getNextEventTick(int tick) const;
+		// Converts a tick to a sample position using the tempo map, ignoring block boundaries
+		uint64_t getSampleAtTick(uint32_t tick) const;
+		// Converts ticks, which must be in ascending order, the same way in one pass over the tempo map
+		std::vector<uint64_t> getSamplesAtTicks(const std::vector<uint32_t>& ticks) const;
+
+		std::string toJSON(int beatDivision = -1) const;
+	};
+
+	MIDIAnalysis analyzeMIDIFile(const std::string& path);
+	MIDIAnalysis analyzeMIDIData(const unsigned char* data, size_t size);
+
+	// Where a song that plays for songLength frames ends when padded out to the next beat of
+	// the given division, following the tempo the song ended with
+	uint64_t getBeatDivisionEndSample(uint64_t songLength, uint64_t lastTempoSample, int lastTempo, int beatDivision);
+}
@@ -1,14 +1,33 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <exception>
 #include <filesystem>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "platformsupport.h"
 
 #include "cxxopts.hpp"
+#include "fileutils.h"
+#include "jsonutils.h"
+#include "midianalysis.h"
 #include "pathresolution.h"
 #include "platformargswrapper.h"
+#include "progressevents.h"
 #include "midivorbisrenderer.h"
+#include "orderedoutput.h"
+#include "rendercache.h"
+#include "rendercost.h"
+#include "rendermanifest.h"
+#include "renderdaemon.h"
+#include "watchsession.h"
+#include "workerpool.h"
 
 #ifndef WINDOWS_UTF16_WORKAROUND
 #include "fluidsynth.h"
@@ -16,6 +35,33 @@
 
 using namespace midirenderer;
 
+// Renders a file given on the command line, where - is stdin as the file and stdout as the output
+RenderResult renderCommandLineFile(MIDIVorbisRenderer& renderer, const std::string& midiFile, const std::string& outputFile,
+	const MIDIVorbisRenderer::RenderSettings& settings, const MIDIVorbisRenderer::ProgressCallback& progressCallback,
+	const MIDIVorbisRenderer::PhaseCallback& phaseCallback)
+{
+	if (midiFile != "-" && outputFile != "-")
+	{
+		return renderer.renderFile(midiFile, outputFile, settings, progressCallback, nullptr, phaseCallback);
+	}
+
+	std::vector<unsigned char> midiData = midiFile == "-" ? utils::readStandardInput() : utils::readFileContents(midiFile);
+	if (outputFile != "-")
+	{
+		return renderer.renderData(midiFile, midiData, outputFile, settings, progressCallback, nullptr, phaseCallback);
+	}
+
+	utils::setStandardOutputBinary();
+	return renderer.renderMemory(midiData, [](const unsigned char* data, size_t size)
+	{
+		// Flushed as it goes so whatever reads the pipe can start on each page as soon as it's encoded
+		if (std::fwrite(data, 1, size, stdout) != size || std::fflush(stdout) != 0)
+		{
+			throw std::runtime_error("Failed to write to stdout");
+		}
+	}, settings, progressCallback, nullptr, phaseCallback);
+}
+
 int MAIN(int argc, argv_t** argv)
 {
 	PlatformArgsWrapper wrapper(argc, argv);
@@ -28,12 +74,56 @@ int MAIN(int argc, argv_t** argv)
 		("files", "The midi file(s) to convert", cxxopts::value<std::vector<std::string>>())
 		("f,soundfont", "(Required) The path to the soundfont to use", cxxopts::value<std::string>(), "soundfont.sf2")
 		("d,destination", "The folder to place the rendered files in", cxxopts::value<std::string>(), "output")
+		("o,output", "The file to write the render to when rendering a single file, or - for stdout (the default when the file is -, which reads it from stdin)",
+			cxxopts::value<std::string>(), "file")
 		("loop", "Render the audio looped to help make the loop more seamless at the cost of filesize")
 		("loop-mode", "The mode to use when rendering the audio looped (implies --loop)\n"
 			"  short: (default) render again from the start of the loop until all voices from the end have terminated (minimal filesize impact)\n"
 			"  double: loop the whole song again (cleanest loop)", cxxopts::value<std::string>(), "short|double")
+		("format", "The format to render to\n"
+			"  ogg: (default) Ogg Vorbis, with the loop in LOOPSTART/LOOPLENGTH comments\n"
+			"  wav: 32-bit float WAV (RF64 past 4GB), with the loop in a smpl chunk\n"
+			"  raw: headerless interleaved 32-bit float frames, with the layout and loop in a .json sidecar", cxxopts::value<std::string>(), "ogg|wav|raw")
 		("end-on-division", "Align the end of the song to a note division up to a 64th note",
-			cxxopts::value<int>(), "4");
+			cxxopts::value<int>(), "4")
+		("quality", "The Vorbis quality to encode at, from -0.1 to 1 (default: 0.4)",
+			cxxopts::value<double>(), "q")
+		("runoff-floor", "End the voices ringing out after the song once they've stayed this many decibels below full scale for half a second, and leave out what's below it at the very end (default: -96)",
+			cxxopts::value<double>(), "dB")
+		("max-runoff", "End the voices ringing out after the song after this many seconds even if they're still audible, or 0 for no limit (default: 30)",
+			cxxopts::value<double>(), "seconds")
+		("normalize", "Scale each render to this integrated loudness in LUFS (EBU R128), measured as it's rendered (holds each render in memory until it's finished, so it can't be used with --stream)",
+			cxxopts::value<double>(), "LUFS")
+		("true-peak", "The highest true peak a normalized render may reach, in dBTP (default: -1)",
+			cxxopts::value<double>(), "dBTP")
+		("j,jobs", "The number of files to render at once (default: the number of processor cores)",
+			cxxopts::value<int>(), "N")
+		("loop-memory", "The memory double loops may use to copy their first pass instead of synthesizing it again, shared between all jobs (default: about 505, 25 minutes of audio)",
+			cxxopts::value<int>(), "MB")
+		("pipeline", "Synthesize and encode each file on separate threads (faster for long files when there are few files to render)")
+		("stream", "Write each file as it's encoded instead of all at once at the end (constant memory use; the file is only complete when its render finishes)")
+		("encode-threads", "Encode each file on this many threads by cutting it into segments (faster for long files when there are few files to render)",
+			cxxopts::value<int>(), "N")
+		("progress", "How to report each file's progress\n"
+			"  plain: (default) print a line as each file starts and finishes\n"
+			"  jsonl: print a JSON event per line as each file is queued, starts, progresses, changes phase and finishes or fails, with everything else on stderr",
+			cxxopts::value<std::string>(), "plain|jsonl")
+		("stats", "Print how long each stage of each render took, and totals for all files")
+		("cache-dir", "Reuse renders stored in this folder when the file and settings haven't changed, and store new renders there",
+			cxxopts::value<std::string>(), "DIR")
+		("manifest", "Render the jobs listed in this JSON or CSV file instead of files given on the command line, each with its own input, output, soundfont, loop mode, end division and quality",
+			cxxopts::value<std::string>(), "jobs.json")
+		("reference-render", "Render one frame at a time instead of whole synth blocks (much slower; only useful for comparing output)")
+		("analyze", "Print the loop point, tempo map and length of each file as JSON without rendering anything (no soundfont needed)");
+#if __linux__
+	options.add_options()
+		("watch", "Keep running after rendering and render files again whenever they're saved, including new files matching the given paths");
+#endif
+#if !_WIN32
+	options.add_options()
+		("daemon", "Keep the soundfont loaded and render jobs sent to a Unix socket at this path instead of rendering files (the other options set the defaults for each job)",
+			cxxopts::value<std::string>(), "SOCKET");
+#endif
 	options.parse_positional({ "files" });
 
 	std::unique_ptr<cxxopts::ParseResult> parsedArgsPtr;
@@ -81,6 +171,26 @@ int MAIN(int argc, argv_t** argv)
 		loopMode = MIDIVorbisRenderer::LoopMode::Short;
 	}
 	
+	MIDIVorbisRenderer::OutputFormat outputFormat = MIDIVorbisRenderer::OutputFormat::Vorbis;
+	if (parsedArgs.count("format") > 0)
+	{
+		std::string formatString = parsedArgs["format"].as<std::string>();
+
+		if (formatString == "wav")
+		{
+			outputFormat = MIDIVorbisRenderer::OutputFormat::Wav;
+		}
+		else if (formatString == "raw")
+		{
+			outputFormat = MIDIVorbisRenderer::OutputFormat::Raw;
+		}
+		else if (formatString != "ogg")
+		{
+			std::cout << "Invalid output format " << formatString << std::endl << options.help() << std::endl;
+			return 1;
+		}
+	}
+	
 	int beatDivision = -1;
 	if (parsedArgs.count("end-on-division") == 1)
 	{
@@ -103,6 +213,180 @@ int MAIN(int argc, argv_t** argv)
 		return 1;
 	}
 
+	float vorbisQuality = MIDIVorbisRenderer::s_defaultVorbisQuality;
+	if (parsedArgs.count("quality") > 0)
+	{
+		double quality = parsedArgs["quality"].as<double>();
+		if (!(quality >= -0.1 && quality <= 1.0))
+		{
+			std::cout << "Invalid quality " << quality << " given - please use a number from -0.1 to 1" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+		vorbisQuality = static_cast<float>(quality);
+	}
+
+	double runoffFloor = MIDIVorbisRenderer::s_defaultRunoffFloorDecibels;
+	if (parsedArgs.count("runoff-floor") > 0)
+	{
+		runoffFloor = parsedArgs["runoff-floor"].as<double>();
+		if (!(runoffFloor < 0))
+		{
+			std::cout << "Invalid runoff floor " << runoffFloor << " given - please use a level below 0 dB" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+	}
+
+	double maxRunoff = MIDIVorbisRenderer::s_defaultMaxRunoffSeconds;
+	if (parsedArgs.count("max-runoff") > 0)
+	{
+		maxRunoff = parsedArgs["max-runoff"].as<double>();
+		if (!(maxRunoff >= 0))
+		{
+			std::cout << "Invalid maximum runoff " << maxRunoff << " given - please use 0 seconds or more" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+	}
+
+	bool isNormalizing = parsedArgs.count("normalize") > 0;
+	double targetLoudness = 0;
+	if (isNormalizing)
+	{
+		targetLoudness = parsedArgs["normalize"].as<double>();
+		if (!(targetLoudness <= 0 && targetLoudness >= -70))
+		{
+			std::cout << "Invalid loudness " << targetLoudness << " given - please use a level from -70 LUFS up to 0 LUFS" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+	}
+
+	double truePeakCeiling = MIDIVorbisRenderer::s_defaultTruePeakCeiling;
+	if (parsedArgs.count("true-peak") > 0)
+	{
+		truePeakCeiling = parsedArgs["true-peak"].as<double>();
+		if (!isNormalizing)
+		{
+			std::cout << "A true peak ceiling only applies to normalized renders - give a loudness with --normalize" << std::endl;
+			return 1;
+		}
+		if (!(truePeakCeiling <= 0))
+		{
+			std::cout << "Invalid true peak ceiling " << truePeakCeiling << " given - please use a level of 0 dBTP or below" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+	}
+
+	if (isNormalizing && parsedArgs.count("stream") > 0)
+	{
+		std::cout << "A normalized render can't be written until it's been measured, so --normalize can't be combined with --stream" << std::endl;
+		return 1;
+	}
+
+	unsigned int jobCount = utils::WorkerPool::getDefaultWorkerCount();
+	if (parsedArgs.count("jobs") > 0)
+	{
+		int jobsArg = parsedArgs["jobs"].as<int>();
+		if (jobsArg <= 0)
+		{
+			std::cout << "Invalid job count " << jobsArg << " given - please use at least 1 job" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+		jobCount = static_cast<unsigned int>(jobsArg);
+	}
+
+	unsigned int encoderThreadCount = 1;
+	if (parsedArgs.count("encode-threads") > 0)
+	{
+		int encodeThreadsArg = parsedArgs["encode-threads"].as<int>();
+		if (encodeThreadsArg <= 0)
+		{
+			std::cout << "Invalid encoder thread count " << encodeThreadsArg << " given - please use at least 1 thread" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+		encoderThreadCount = static_cast<unsigned int>(encodeThreadsArg);
+	}
+
+	size_t loopCopyMemory = MIDIVorbisRenderer::s_defaultLoopCopyMemory;
+	if (parsedArgs.count("loop-memory") > 0)
+	{
+		int loopMemoryArg = parsedArgs["loop-memory"].as<int>();
+		if (loopMemoryArg < 0)
+		{
+			std::cout << "Invalid loop memory " << loopMemoryArg << " given - please use 0 MB or more" << std::endl <<
+				options.help() << std::endl;
+			return 1;
+		}
+		loopCopyMemory = static_cast<size_t>(loopMemoryArg) * 1024 * 1024;
+	}
+
+	bool isReportingEvents = false;
+	if (parsedArgs.count("progress") > 0)
+	{
+		std::string progressString = parsedArgs["progress"].as<std::string>();
+
+		if (progressString == "jsonl")
+		{
+			isReportingEvents = true;
+		}
+		else if (progressString != "plain")
+		{
+			std::cout << "Invalid progress format " << progressString << std::endl << options.help() << std::endl;
+			return 1;
+		}
+	}
+
+	bool isAnalyzing = parsedArgs.count("analyze") > 0;
+	bool isUsingManifest = parsedArgs.count("manifest") > 0;
+#if !_WIN32
+	bool isDaemon = parsedArgs.count("daemon") > 0;
+#else
+	bool isDaemon = false;
+#endif
+	std::string outputArg;
+	if (parsedArgs.count("o") > 0)
+	{
+		outputArg = parsedArgs["o"].as<std::string>();
+	}
+
+	size_t stdinFileCount = 0;
+	if (parsedArgs.count("files") > 0)
+	{
+		const std::vector<std::string>& fileArgs = parsedArgs["files"].as<std::vector<std::string>>();
+		stdinFileCount = std::count(fileArgs.begin(), fileArgs.end(), "-");
+	}
+	bool isWritingToStdout = !isAnalyzing && (outputArg == "-" || (stdinFileCount > 0 && outputArg.empty()));
+
+	// Analysis results and progress events are printed as JSON and renders can be written to stdout,
+	// so everything else goes to stderr to keep stdout usable
+	std::ostream& messageOutput = isAnalyzing || isReportingEvents || isWritingToStdout ? std::cerr : std::cout;
+	std::ostream& eventOutput = isWritingToStdout ? std::cerr : std::cout;
+	if (isWritingToStdout)
+	{
+		MIDIVorbisRenderer::setSynthLogToStandardError();
+	}
+
+	if (stdinFileCount > 1)
+	{
+		messageOutput << "stdin can only be read once - give - as a file only once" << std::endl;
+		return 1;
+	}
+
+	bool isWatching = false;
+#if __linux__
+	isWatching = parsedArgs.count("watch") > 0;
+#endif
+	if (isUsingManifest && (parsedArgs.count("files") > 0 || !outputArg.empty() || isAnalyzing || isWatching || isDaemon))
+	{
+		messageOutput << "A manifest lists its own files and outputs, so it can't be combined with files, -o, --analyze, --watch or --daemon" << std::endl;
+		return 1;
+	}
+
 	std::string soundfontPath;
 	if (parsedArgs.count("f") > 0)
 	{
@@ -110,14 +394,14 @@ int MAIN(int argc, argv_t** argv)
 #ifndef WINDOWS_UTF16_WORKAROUND
 		if (!fluid_is_soundfont(soundfontPath.c_str()))
 		{
-			std::cout << "The soundfont at " << soundfontPath.c_str() << " is missing or invalid" << std::endl;
+			messageOutput << "The soundfont at " << soundfontPath.c_str() << " is missing or invalid" << std::endl;
 			return 1;
 		}
 #endif
 	}
-	else
+	else if (!isAnalyzing && !isUsingManifest)
 	{
-		std::cout << "No soundfont specified - use -f <path> or --soundfont <path>" << std::endl <<
+		messageOutput << "No soundfont specified - use -f <path> or --soundfont <path>" << std::endl <<
 			options.help() << std::endl;
 		return 1;
 	}
@@ -133,73 +417,409 @@ int MAIN(int argc, argv_t** argv)
 		}
 	}
 
-	std::vector<std::string> midiFiles;
-	std::vector<std::string> outputFiles;
-	if (parsedArgs.count("files") > 0)
+	auto getOutputPath = [&](const std::string& midiFile)
+	{
+		std::filesystem::path outputPath = std::filesystem::u8path(midiFile);
+		outputPath.replace_extension(MIDIVorbisRenderer::getOutputExtension(outputFormat));
+		if (!outputFolder.empty())
+		{
+			outputPath = outputFolder / outputPath.filename();
+		}
+		return outputPath.u8string();
+	};
+
+	// Watch mode resolves the paths again as files are added, so this can run more than once
+	auto resolveFiles = [&](std::vector<std::string>& midiFiles, std::vector<std::string>& outputFiles, bool isReportingMissing)
 	{
+		if (parsedArgs.count("files") == 0) { return; }
+
 		const std::vector<std::string>& midiPaths = parsedArgs["files"].as<std::vector<std::string>>();
+		std::vector<std::string> wildcardedPaths;
+		std::copy_if(midiPaths.begin(), midiPaths.end(), std::back_inserter(wildcardedPaths), [](const std::string& path) { return path != "-"; });
+
+		// Big folders are listed and their files checked for MIDI headers on several threads at once
+		utils::PathFilter isMIDIFile;
+#ifndef WINDOWS_UTF16_WORKAROUND
+		isMIDIFile = [](const std::string& path) { return fluid_is_midifile(path.c_str()) != 0; };
+#endif
+		std::vector<std::vector<std::string>> resolvedPaths = utils::resolveWildcardedPaths(wildcardedPaths, isMIDIFile, jobCount);
+
+		size_t resolvedIndex = 0;
 		for (const auto& path : midiPaths)
 		{
-			int midiFileCount = midiFiles.size();
-			utils::resolveWildcardedPath(path, [&](std::string path)
+			if (path == "-")
 			{
-				const char* filename = path.c_str();
-#ifndef WINDOWS_UTF16_WORKAROUND
-				if (!fluid_is_midifile(filename))
-				{
-					return;
-				}
-#endif
 				midiFiles.push_back(path);
+				outputFiles.push_back(outputArg.empty() ? "-" : outputArg);
+				continue;
+			}
+
+			const std::vector<std::string>& foundFiles = resolvedPaths[resolvedIndex++];
+			if (foundFiles.empty() && isReportingMissing)
+			{
+				messageOutput << "No midi file(s) found at " << path << "; skipping" << std::endl;
+			}
 
-				std::filesystem::path oggPath = std::filesystem::u8path(path);
-				oggPath.replace_extension(".ogg");
-				if (!outputFolder.empty())
+			for (const std::string& midiFile : foundFiles)
+			{
+				midiFiles.push_back(midiFile);
+
+				outputFiles.push_back(outputArg.empty() ? getOutputPath(midiFile) : outputArg);
+			}
+		}
+	};
+
+	std::vector<std::string> midiFiles;
+	std::vector<std::string> outputFiles;
+	// Manifest jobs each have their own soundfont and settings, while files on the command line all use the same ones
+	std::vector<std::string> fileSoundfontPaths;
+	std::vector<MIDIVorbisRenderer::RenderSettings> fileSettings;
+	MIDIVorbisRenderer::RenderSettings defaultSettings = { loopMode, beatDivision, vorbisQuality };
+	if (isUsingManifest)
+	{
+		std::string manifestPath = parsedArgs["manifest"].as<std::string>();
+		try
+		{
+			for (const ManifestJob& job : readManifest(manifestPath, defaultSettings))
+			{
+				if (job.m_soundfontPath.empty() && soundfontPath.empty())
 				{
-					oggPath = outputFolder / oggPath.filename();
+					throw std::invalid_argument("The job for " + job.m_inputPath + " has no soundfont, and none was given with -f");
 				}
-				outputFiles.push_back(oggPath.u8string());
-			});
 
-			if (midiFiles.size() == midiFileCount)
-			{
-				std::cout << "No midi file(s) found at " << path << "; skipping" << std::endl;
+				midiFiles.push_back(job.m_inputPath);
+				outputFiles.push_back(job.m_outputPath.empty() ? getOutputPath(job.m_inputPath) : job.m_outputPath);
+				fileSoundfontPaths.push_back(job.m_soundfontPath.empty() ? soundfontPath : job.m_soundfontPath);
+				fileSettings.push_back(job.m_settings);
 			}
 		}
+		catch (std::exception& e)
+		{
+			messageOutput << "Failed to read the manifest: " << e.what() << std::endl;
+			return 1;
+		}
 	}
-	
-	if (midiFiles.size() == 0)
+	else
 	{
-		std::cout << "No valid midi files specified." << std::endl <<
+		resolveFiles(midiFiles, outputFiles, true);
+		fileSoundfontPaths.assign(midiFiles.size(), soundfontPath);
+		fileSettings.assign(midiFiles.size(), defaultSettings);
+	}
+
+	if (midiFiles.size() == 0 && !isDaemon)
+	{
+		messageOutput << "No valid midi files specified." << std::endl <<
 			options.help() << std::endl;
 		return 1;
 	}
 
-	MIDIVorbisRenderer renderer(loopMode, beatDivision);
+	if (!outputArg.empty() && !isAnalyzing && midiFiles.size() > 1)
+	{
+		messageOutput << "An output file can only be given when rendering a single file, but " << midiFiles.size() << " files were found" << std::endl;
+		return 1;
+	}
+
+	if (isAnalyzing)
+	{
+		utils::OrderedOutput output(std::cout, midiFiles.size());
+		output.write(0, "[\n");
+		{
+			utils::WorkerPool workers(std::min<unsigned int>(jobCount, static_cast<unsigned int>(midiFiles.size())));
+			for (size_t i = 0; i < midiFiles.size(); i++)
+			{
+				workers.submit([&, i]()
+				{
+					std::string fileJSON = "{\"file\":" + utils::toJSONString(midiFiles[i]) + ",";
+					try
+					{
+						MIDIAnalysis analysis;
+						if (midiFiles[i] == "-")
+						{
+							std::vector<unsigned char> midiData = utils::readStandardInput();
+							analysis = analyzeMIDIData(midiData.data(), midiData.size());
+						}
+						else
+						{
+							analysis = analyzeMIDIFile(midiFiles[i]);
+						}
+						std::string analysisJSON = analysis.toJSON(beatDivision);
+						// Splice the analysis object's fields in after the file name
+						fileJSON += analysisJSON.substr(1);
+					}
+					catch (std::exception& e)
+					{
+						fileJSON += "\"error\":" + utils::toJSONString(e.what()) + "}";
+					}
+					output.write(i, (i > 0 ? ",\n" : "") + fileJSON);
+					if (i == midiFiles.size() - 1)
+					{
+						output.write(i, "\n]\n");
+					}
+					output.finish(i);
+				});
+			}
+			workers.wait();
+		}
+
+		return 0;
+	}
+
+	MIDIVorbisRenderer::RenderMode renderMode = parsedArgs.count("reference-render") > 0 ?
+		MIDIVorbisRenderer::RenderMode::PerFrame : MIDIVorbisRenderer::RenderMode::Block;
+
+	std::unique_ptr<RenderCache> renderCache;
+	if (parsedArgs.count("cache-dir") > 0)
+	{
+		std::string cacheDirArg = parsedArgs["cache-dir"].as<std::string>();
+		try
+		{
+			renderCache = std::make_unique<RenderCache>(cacheDirArg);
+		}
+		catch (std::exception& e)
+		{
+			messageOutput << "Failed to open the render cache at " << cacheDirArg << ": " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	bool isCollectingStats = parsedArgs.count("stats") > 0;
+	auto createRenderer = [&]()
+	{
+		std::unique_ptr<MIDIVorbisRenderer> renderer = std::make_unique<MIDIVorbisRenderer>(loopMode, beatDivision, renderMode);
+		renderer->setOutputFormat(outputFormat);
+		renderer->setPipelined(parsedArgs.count("pipeline") > 0);
+		renderer->setStreaming(parsedArgs.count("stream") > 0);
+		renderer->setEncoderThreadCount(encoderThreadCount);
+		renderer->setVorbisQuality(vorbisQuality);
+		renderer->setRunoffLimits(runoffFloor, maxRunoff);
+		// Every job can be rendering a double loop at once, so each gets its share of the budget. A batch
+		// never runs more jobs than it has files; the daemon and watch mode can be given any number.
+		unsigned int concurrentRenderCount = isDaemon || isWatching ? jobCount :
+			std::max(1u, std::min<unsigned int>(jobCount, static_cast<unsigned int>(midiFiles.size())));
+		renderer->setLoopCopyMemory(loopCopyMemory / concurrentRenderCount);
+		if (isNormalizing)
+		{
+			renderer->setNormalization(targetLoudness, truePeakCeiling);
+		}
+		renderer->setRenderCache(renderCache.get());
+		renderer->setCollectingStats(isCollectingStats);
+		return renderer;
+	};
+
+	std::unique_ptr<MIDIVorbisRenderer> renderer = createRenderer();
 	try
 	{
-		renderer.loadSoundfont(soundfontPath);
+		// Loading a large soundfont can take longer than the renders themselves, so it's put off
+		// until a file actually needs rendering when every file might be in the cache, or when
+		// a manifest's jobs might not use it at all
+		if ((renderCache || isUsingManifest) && !isDaemon)
+		{
+			renderer->deferSoundfontLoad(soundfontPath);
+		}
+		else
+		{
+			renderer->loadSoundfont(soundfontPath);
+		}
 	}
 	catch (std::exception& e)
 	{
-		std::cout << "Failed to load soundfont at " << soundfontPath << ": " <<
+		messageOutput << "Failed to load soundfont at " << soundfontPath << ": " <<
 			e.what() << std::endl;
 		return 1;
 	}
 
-	for (int i = 0; i < midiFiles.size(); i++)
+#if !_WIN32
+	if (isDaemon)
 	{
+		std::string socketPath = parsedArgs["daemon"].as<std::string>();
 		try
 		{
-			std::cout << "Rendering " << midiFiles[i] << std::endl;
-			renderer.renderFile(midiFiles[i], outputFiles[i]);
-			std::cout << "Output: " << outputFiles[i] << std::endl;
+			RenderDaemon daemon(socketPath, soundfontPath, std::move(renderer), [&](const std::string& requestedSoundfontPath)
+			{
+				std::unique_ptr<MIDIVorbisRenderer> requestedRenderer = createRenderer();
+				requestedRenderer->deferSoundfontLoad(requestedSoundfontPath);
+				return requestedRenderer;
+			}, defaultSettings, jobCount);
+
+			std::cout << "Listening for render jobs at " << socketPath << std::endl;
+			daemon.run();
 		}
 		catch (std::exception& e)
 		{
-			std::cout << "Failed to create render for file " << midiFiles[i] << ": " <<
-				e.what() << std::endl;
+			messageOutput << "Failed to run the render daemon: " << e.what() << std::endl;
+			return 1;
 		}
+		return 0;
+	}
+#endif
+
+#if __linux__
+	if (isWatching)
+	{
+		if (stdinFileCount > 0 || !outputArg.empty())
+		{
+			std::cout << "Watching for changes needs files to read and write, not stdin or an output file" << std::endl;
+			return 1;
+		}
+
+		try
+		{
+			std::vector<utils::WildcardRoot> watchedRoots;
+			if (parsedArgs.count("files") > 0)
+			{
+				for (const std::string& path : parsedArgs["files"].as<std::vector<std::string>>())
+				{
+					watchedRoots.push_back(utils::getWildcardRoot(path));
+				}
+			}
+
+			WatchSession session(*renderer, [&](std::vector<std::string>& watchedFiles, std::vector<std::string>& watchedOutputFiles)
+			{
+				resolveFiles(watchedFiles, watchedOutputFiles, false);
+			}, watchedRoots, jobCount, std::cout);
+			session.run();
+		}
+		catch (std::exception& e)
+		{
+			std::cout << "Failed to watch for changes: " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+	// Each soundfont is loaded by one renderer, the first time a file needs it, and shared by every
+	// file that uses it. Each worker renders with its own synth and encoder.
+	// Output is kept in file order regardless of the order renders finish in.
+	std::map<std::string, MIDIVorbisRenderer*> soundfontRenderers = { { soundfontPath, renderer.get() } };
+	std::vector<std::unique_ptr<MIDIVorbisRenderer>> manifestRenderers;
+	std::vector<MIDIVorbisRenderer*> fileRenderers;
+	for (const std::string& fileSoundfontPath : fileSoundfontPaths)
+	{
+		MIDIVorbisRenderer*& soundfontRenderer = soundfontRenderers[fileSoundfontPath];
+		if (soundfontRenderer == nullptr)
+		{
+			manifestRenderers.push_back(createRenderer());
+			manifestRenderers.back()->deferSoundfontLoad(fileSoundfontPath);
+			soundfontRenderer = manifestRenderers.back().get();
+		}
+		fileRenderers.push_back(soundfontRenderer);
+	}
+
+	// Scanning every file first lets the most expensive renders start first, so that a long song
+	// picked up near the end of the batch doesn't keep one worker busy after the rest are done.
+	// Files that can't be scanned (or come from standard input) are predicted to cost nothing and
+	// go last; most of them fail quickly anyway.
+	std::vector<RenderCostEstimate> costEstimates(midiFiles.size());
+	bool isPredictingCosts = midiFiles.size() > 1 || isCollectingStats || isReportingEvents;
+	if (isPredictingCosts)
+	{
+		utils::WorkerPool scanners(std::min<unsigned int>(jobCount, static_cast<unsigned int>(midiFiles.size())));
+		for (size_t i = 0; i < midiFiles.size(); i++)
+		{
+			if (midiFiles[i] == "-") { continue; }
+			scanners.submit([&, i]()
+			{
+				try
+				{
+					costEstimates[i] = estimateRenderCost(analyzeMIDIFile(midiFiles[i]), fileSettings[i]);
+				}
+				catch (std::exception&)
+				{
+				}
+			});
+		}
+		scanners.wait();
+	}
+	std::vector<size_t> renderOrder = getLongestFirstOrder(costEstimates);
+
+	utils::OrderedOutput output(messageOutput, midiFiles.size());
+	std::unique_ptr<ProgressEventWriter> events;
+	if (isReportingEvents)
+	{
+		events = std::make_unique<ProgressEventWriter>(eventOutput);
+		for (size_t i = 0; i < midiFiles.size(); i++)
+		{
+			events->writeQueued(i, midiFiles[i], outputFiles[i], costEstimates[i].m_cost);
+		}
+	}
+
+	std::mutex batchStatsMutex;
+	RenderStats batchStats = {};
+	RenderCostCalibration costCalibration;
+	auto batchStart = std::chrono::steady_clock::now();
+	{
+		utils::WorkerPool workers(std::min<unsigned int>(jobCount, static_cast<unsigned int>(midiFiles.size())));
+		for (size_t i : renderOrder)
+		{
+			workers.submit([&, i]()
+			{
+				auto renderStart = std::chrono::steady_clock::now();
+				auto getElapsedSeconds = [&]()
+				{
+					return std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+				};
+
+				MIDIVorbisRenderer::ProgressCallback progressCallback;
+				MIDIVorbisRenderer::PhaseCallback phaseCallback;
+				if (events)
+				{
+					progressCallback = [&](double progress) { events->writeProgress(i, progress, getElapsedSeconds()); };
+					phaseCallback = [&](MIDIVorbisRenderer::RenderPhase phase) { events->writePhase(i, phase); };
+					events->writeStarted(i);
+				}
+
+				try
+				{
+					output.write(i, "Rendering " + midiFiles[i] + "\n");
+					RenderResult result = renderCommandLineFile(*fileRenderers[i], midiFiles[i], outputFiles[i], fileSettings[i], progressCallback, phaseCallback);
+					output.write(i, "Output: " + outputFiles[i] + result.getOutputNote() + "\n");
+					if (events)
+					{
+						events->writeFinished(i, result, getElapsedSeconds());
+					}
+
+					if (isCollectingStats && !result.m_isCached)
+					{
+						double seconds = std::chrono::duration<double>(result.m_stats.m_totalTime).count();
+						std::ostringstream prediction;
+						prediction << std::fixed << std::setprecision(1) << "  predicted cost: " << costEstimates[i].m_cost << " voice-seconds (" <<
+							costEstimates[i].m_noteDensity << " notes/s, peak polyphony " << costEstimates[i].m_peakPolyphony << ")\n";
+						output.write(i, result.m_stats.getSummary("  ", result.m_stats.m_totalTime) + prediction.str());
+
+						std::lock_guard<std::mutex> lock(batchStatsMutex);
+						batchStats.add(result.m_stats);
+						if (costEstimates[i].m_cost > 0)
+						{
+							costCalibration.add(costEstimates[i].m_cost, seconds);
+						}
+					}
+				}
+				catch (std::exception& e)
+				{
+					output.write(i, "Failed to create render for file " + midiFiles[i] + ": " + e.what() + "\n");
+					if (events)
+					{
+						events->writeFailed(i, e.what());
+					}
+				}
+				output.finish(i);
+			});
+		}
+		workers.wait();
+	}
+
+	if (isCollectingStats)
+	{
+		// Stage times add up across workers, so with several jobs they can exceed the batch's wall time
+		messageOutput << "Batch stats:" << std::endl << batchStats.getSummary("  ", std::chrono::steady_clock::now() - batchStart) <<
+			costCalibration.getSummary("  ");
+	}
+
+	if (renderCache)
+	{
+		messageOutput << "Render cache: " << renderCache->getHitCount() << " hits, " <<
+			renderCache->getMissCount() << " misses" << std::endl;
 	}
 
     return 0;
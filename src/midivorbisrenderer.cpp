@@ -1,38 +1,165 @@
 #include "midivorbisrenderer.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <exception>
+#include <filesystem>
 #include <fstream>
-#include <random>
-#include <ctime>
+#include <limits>
+#include <optional>
+#include <vector>
 
 #include <fluidsynth.h>
+#include <vorbis/codec.h>
 
 #include "platformsupport.h"
+#include "fileutils.h"
+#include "hashutils.h"
+#include "midianalysis.h"
+#include "mixutils.h"
 #include "oggvorbisencoder.h"
+#include "pipelinedaudiosink.h"
+#include "progressaudiosink.h"
+#include "rawaudioencoder.h"
+#include "rendercache.h"
+#include "retainingaudiosink.h"
 #include "songrendercontainer.h"
+#include "wavencoder.h"
 
 namespace midirenderer
 {
 	struct PlayerCallbackData
 	{
-		int m_loopTick;
-		int m_queuedSeek;
 		bool m_hasHitLoopPoint;
+		bool m_areNoteOnsMuted;
 
-		PlayerCallbackData() : m_loopTick(-1), m_queuedSeek(-1), m_hasHitLoopPoint(false) { }
+		// How many note ons the player has dispatched, and how many of the first ones are dropped
+		size_t m_noteOnCount;
+		size_t m_mutedNoteOnCount;
+
+		PlayerCallbackData() : m_hasHitLoopPoint(false), m_areNoteOnsMuted(false),
+			m_noteOnCount(0), m_mutedNoteOnCount(0) { }
+	};
+
+	// A frame of the first pass where no voices are playing, after every note on dispatched
+	// up to it has finished
+	struct QuietPoint
+	{
+		uint64_t m_frame;
+		size_t m_noteOnCount;
+	};
+
+	// What the second pass of a double loop needs from the first pass to tell when the two have
+	// converged, after which the rest of the first pass can be copied instead of synthesized again
+	struct LoopRecording
+	{
+		struct Candidate
+		{
+			uint64_t m_frame;
+			int m_voiceCount;
+		};
+
+		bool m_isRecording;
+		bool m_hasCapturedLoopState;
+		// The frame the second pass starts from
+		uint64_t m_loopFrame;
+		uint64_t m_channelStateHash;
+		int m_peakVoiceCount;
+		// Frames where few enough voices are playing that the second pass can take over from them
+		std::vector<Candidate> m_candidates;
+
+		uint64_t m_songEnd;
+		int m_lastTempo;
+		uint64_t m_lastTempoSample;
+		// Everything from m_loopFrame up to the end of the beat division padding
+		const std::vector<float>* m_leftFrames;
+		const std::vector<float>* m_rightFrames;
+
+		LoopRecording() : m_isRecording(false), m_hasCapturedLoopState(false), m_loopFrame(0), m_channelStateHash(0),
+			m_peakVoiceCount(0), m_songEnd(0), m_lastTempo(0), m_lastTempoSample(0),
+			m_leftFrames(nullptr), m_rightFrames(nullptr) { }
+	};
+
+	// Frames read from the synth are rendered straight into buffers acquired from the sink, which
+	// are committed once they're full or whenever the sink needs to be used for anything else
+	struct RenderBuffer
+	{
+		float* m_leftBuffer;
+		float* m_rightBuffer;
+		// How many frames the acquired buffers hold, or 0 when none are acquired
+		size_t m_capacity;
+		size_t m_frameCount;
+
+		RenderBuffer() : m_leftBuffer(nullptr), m_rightBuffer(nullptr), m_capacity(0), m_frameCount(0) { }
 	};
 
-	MIDIVorbisRenderer::MIDIVorbisRenderer(LoopMode loopMode, int endingBeatDivision) :
-		m_loopMode(loopMode), m_endingBeatDivision(endingBeatDivision),
+	// Compares what the second pass of a double loop renders with the first pass' frames
+	struct FrameComparison
+	{
+		const float* m_leftFrames;
+		const float* m_rightFrames;
+		size_t m_frameCount;
+		// Where the next rendered frame is in the first pass' frames
+		size_t m_position;
+		// How many frames in a row up to the last one rendered are identical
+		size_t m_matchingFrames;
+
+		void compare(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+		{
+			bool isMatching = m_position + frameCount <= m_frameCount &&
+				std::memcmp(leftBuffer, &m_leftFrames[m_position], frameCount * sizeof(float)) == 0 &&
+				std::memcmp(rightBuffer, &m_rightFrames[m_position], frameCount * sizeof(float)) == 0;
+			m_matchingFrames = isMatching ? m_matchingFrames + frameCount : 0;
+			m_position += frameCount;
+		}
+	};
+
+	std::string RenderResult::getOutputNote() const
+	{
+		if (m_isCached) { return " (cached)"; }
+
+		std::string note;
+		if (m_trimmedRunoffFrames > 0)
+		{
+			char trimmedNote[64];
+			std::snprintf(trimmedNote, sizeof(trimmedNote), "%.2f s of quiet runoff trimmed", m_trimmedRunoffFrames / SongRenderContainer::s_sampleRate);
+			note = trimmedNote;
+		}
+		if (m_isNormalized)
+		{
+			char normalizedNote[64];
+			if (std::isfinite(m_measuredLoudness))
+			{
+				std::snprintf(normalizedNote, sizeof(normalizedNote), "%.1f LUFS, normalized by %+.1f dB", m_measuredLoudness, m_normalizationGain);
+			}
+			else
+			{
+				std::snprintf(normalizedNote, sizeof(normalizedNote), "silent, not normalized");
+			}
+			note += (note.empty() ? "" : ", ") + std::string(normalizedNote);
+		}
+		return note.empty() ? "" : " (" + note + ")";
+	}
+
+	MIDIVorbisRenderer::MIDIVorbisRenderer(LoopMode loopMode, int endingBeatDivision, RenderMode renderMode) :
+		m_settings({ loopMode, endingBeatDivision }), m_renderMode(renderMode), m_outputFormat(OutputFormat::Vorbis), m_isPipelined(false), m_isStreaming(false), m_encoderThreadCount(1), m_isCollectingStats(false),
+		m_renderCache(nullptr), m_runoffFloor(0), m_maxRunoffFrames(0), m_maxRetainedLoopFrames(0), m_isNormalizing(false), m_targetLoudness(0), m_truePeakCeiling(0),
 		m_fluidSettings(nullptr, nullptr),
 		m_synth(nullptr, nullptr)
 	{
+		setRunoffLimits(s_defaultRunoffFloorDecibels, s_defaultMaxRunoffSeconds);
+		setLoopCopyMemory(s_defaultLoopCopyMemory);
+
 		m_fluidSettings = deleter_unique_ptr<fluid_settings_t>(new_fluid_settings(), delete_fluid_settings);
 
-		fluid_settings_setnum(m_fluidSettings.get(), "synth.sample-rate", 44100.0);
+		fluid_settings_setnum(m_fluidSettings.get(), "synth.sample-rate", SongRenderContainer::s_sampleRate);
 		fluid_settings_setint(m_fluidSettings.get(), "synth.chorus.active", 0);
 		fluid_settings_setint(m_fluidSettings.get(), "synth.reverb.active", 0);
-		fluid_settings_setnum(m_fluidSettings.get(), "synth.gain", 0.5);
+		fluid_settings_setnum(m_fluidSettings.get(), "synth.gain", SongRenderContainer::s_gain);
 		fluid_settings_setstr(m_fluidSettings.get(), "player.timing-source", "sample");
 		// Don't reset just in case stopping and starting resets it - we want playback to be seamless
 		fluid_settings_setint(m_fluidSettings.get(), "player.reset-synth", 0);
@@ -43,6 +170,19 @@ namespace midirenderer
 	}
 
 	void MIDIVorbisRenderer::loadSoundfont(std::string soundfontPath)
+	{
+		loadSoundfontFile(soundfontPath);
+		m_pendingSoundfontPath.clear();
+		m_soundfontIdentity = getSoundfontIdentity(soundfontPath);
+	}
+
+	void MIDIVorbisRenderer::deferSoundfontLoad(std::string soundfontPath)
+	{
+		m_pendingSoundfontPath = soundfontPath;
+		m_soundfontIdentity = getSoundfontIdentity(soundfontPath);
+	}
+
+	void MIDIVorbisRenderer::loadSoundfontFile(const std::string& soundfontPath)
 	{
 		if (getHasSoundfont())
 		{
@@ -56,42 +196,166 @@ namespace midirenderer
 		}
 	}
 
-	void MIDIVorbisRenderer::renderFile(std::string sourcePath, std::string outputPath)
+	RenderResult MIDIVorbisRenderer::renderFile(std::string sourcePath, std::string outputPath)
 	{
-		if (!getHasSoundfont())
+		return renderFile(sourcePath, outputPath, m_settings);
+	}
+
+	RenderResult MIDIVorbisRenderer::renderFile(std::string sourcePath, std::string outputPath, const RenderSettings& settings,
+		const ProgressCallback& progressCallback, const std::atomic<bool>* isCancelled, const PhaseCallback& phaseCallback)
+	{
+		return renderData(sourcePath, utils::readFileContents(sourcePath), outputPath, settings, progressCallback, isCancelled, phaseCallback);
+	}
+
+	RenderResult MIDIVorbisRenderer::renderData(const std::string& sourceName, const std::vector<unsigned char>& midiData, std::string outputPath,
+		const RenderSettings& settings, const ProgressCallback& progressCallback, const std::atomic<bool>* isCancelled, const PhaseCallback& phaseCallback)
+	{
+		// Everything that affects the output goes into this hash. It names the render in the cache
+		// and seeds the stream serial, so rendering the same thing twice gives the same file.
+		utils::FNV1aHash renderHash = getRenderHash(midiData, settings, m_isStreaming);
+		// Raw files can't hold the loop points themselves, so they go in a sidecar file next to the output
+		std::vector<std::string> outputPaths = { outputPath };
+		if (m_outputFormat == OutputFormat::Raw)
 		{
-			throw std::runtime_error("Cannot render with no soundfont loaded");
+			outputPaths.push_back(outputPath + ".json");
 		}
 
-		std::default_random_engine rng;
-		rng.seed(time(NULL));
-		OggVorbisEncoder encoder = OggVorbisEncoder(static_cast<int>(rng()), 44100, 0.4);
+		if (m_renderCache != nullptr && m_renderCache->fetch(renderHash.getHexString(), outputPaths))
+		{
+			RenderResult cachedResult;
+			cachedResult.m_isCached = true;
+			return cachedResult;
+		}
 
-		PlayerCallbackData callbackData;
-		uint64_t songLength = 0;
-		uint64_t loopStart = 0;
+		requireSoundfont();
+
+		auto renderStart = std::chrono::steady_clock::now();
+		RenderResult result;
+		RenderStats* stats = m_isCollectingStats ? &result.m_stats : nullptr;
+
+		std::unique_ptr<AudioFileEncoder> encoder = createEncoder(renderHash, settings);
+		encoder->setStats(stats);
 
-		renderSong(callbackData, sourcePath, encoder, loopStart, songLength);
+		std::ofstream fileOutput;
+		auto openOutput = [&]()
+		{
+			fileOutput.open(stringutils::getPlatformString(outputPath), std::ios_base::out | std::ios_base::binary);
+			if (!fileOutput.is_open())
+			{
+				throw std::runtime_error("Failed to open " + outputPath + " for writing");
+			}
+		};
+		auto outputCallback = [&](const unsigned char* data, size_t size)
+		{
+			StageTimer timer(stats, RenderStage::PageWrites);
+			fileOutput.write(reinterpret_cast<const char*>(data), size);
+		};
 
-		encoder.addComment("ENCODER", "libvorbis (midirenderer)");
-		if (m_loopMode != LoopMode::None)
+		if (m_isStreaming)
 		{
-			encoder.addComment("LOOPSTART", std::to_string(loopStart));
-			encoder.addComment("LOOPLENGTH", std::to_string(songLength - loopStart));
+			openOutput();
+			encoder->startStreaming(outputCallback);
 		}
 
-		std::ofstream fileOutput;
-		fileOutput.open(stringutils::getPlatformString(outputPath), std::ios_base::out | std::ios_base::binary);
-		auto pageCallback = [&](const unsigned char* header, long headerLength, const unsigned char* body, long bodyLength)
+		encodeSong(sourceName, midiData, settings, progressCallback, phaseCallback, isCancelled, stats, *encoder, result);
+
+		if (m_isStreaming)
+		{
+			// The loop points are only known now, so the placeholder header at the start
+			// of the file is replaced with the final one
+			fileOutput.seekp(0);
+			encoder->readHeader(outputCallback);
+		}
+		else
+		{
+			openOutput();
+			encoder->readHeader(outputCallback);
+			encoder->readEncodedData(outputCallback);
+		}
+
+		if (!fileOutput)
+		{
+			throw std::runtime_error("Failed to write to " + outputPath);
+		}
+		fileOutput.close();
+
+		std::string sidecarContents = encoder->getSidecarContents();
+		if (outputPaths.size() > 1)
+		{
+			const std::string& sidecarPath = outputPaths[1];
+			std::error_code removeError;
+			std::filesystem::remove(std::filesystem::u8path(sidecarPath), removeError);
+
+			std::ofstream sidecarOutput(stringutils::getPlatformString(sidecarPath), std::ios_base::out | std::ios_base::binary);
+			sidecarOutput << sidecarContents;
+			if (!sidecarOutput)
+			{
+				throw std::runtime_error("Failed to write to " + sidecarPath);
+			}
+		}
+
+		if (m_renderCache != nullptr)
+		{
+			m_renderCache->store(renderHash.getHexString(), outputPaths);
+		}
+
+		if (stats != nullptr)
+		{
+			stats->m_totalTime = std::chrono::steady_clock::now() - renderStart;
+		}
+
+		if (progressCallback)
 		{
-			fileOutput.write(reinterpret_cast<const char*>(header), headerLength);
-			fileOutput.write(reinterpret_cast<const char*>(body), bodyLength);
+			progressCallback(1.0);
+		}
+		return result;
+	}
+
+	RenderResult MIDIVorbisRenderer::renderMemory(const std::vector<unsigned char>& midiData, const OutputCallback& outputCallback,
+		const RenderSettings& settings, const ProgressCallback& progressCallback, const std::atomic<bool>* isCancelled,
+		const PhaseCallback& phaseCallback)
+	{
+		requireSoundfont();
+
+		auto renderStart = std::chrono::steady_clock::now();
+		RenderResult result;
+		RenderStats* stats = m_isCollectingStats ? &result.m_stats : nullptr;
+
+		// The output can't be rewritten once it's passed on, so only renders whose streamed header is already
+		// final can be streamed. WAV headers hold the length, and Vorbis headers hold the loop points.
+		bool isStreaming = m_isStreaming && settings.m_loopMode == LoopMode::None && m_outputFormat != OutputFormat::Wav;
+		std::unique_ptr<AudioFileEncoder> encoder = createEncoder(getRenderHash(midiData, settings, isStreaming), settings);
+		encoder->setStats(stats);
+
+		auto timedOutputCallback = [&](const unsigned char* data, size_t size)
+		{
+			StageTimer timer(stats, RenderStage::PageWrites);
+			outputCallback(data, size);
 		};
 
-		encoder.readHeader(pageCallback);
-		encoder.completeStream(pageCallback);
+		if (isStreaming)
+		{
+			encoder->startStreaming(timedOutputCallback);
+		}
+
+		encodeSong("(in memory)", midiData, settings, progressCallback, phaseCallback, isCancelled, stats, *encoder, result);
+
+		if (!isStreaming)
+		{
+			encoder->readHeader(timedOutputCallback);
+			encoder->readEncodedData(timedOutputCallback);
+		}
+
+		if (stats != nullptr)
+		{
+			stats->m_totalTime = std::chrono::steady_clock::now() - renderStart;
+		}
 
-		return;
+		if (progressCallback)
+		{
+			progressCallback(1.0);
+		}
+		return result;
 	}
 
 	bool MIDIVorbisRenderer::getHasSoundfont()
@@ -99,41 +363,358 @@ namespace midirenderer
 		return fluid_synth_sfcount(m_synth.get()) > 0;
 	}
 
-	void MIDIVorbisRenderer::renderSong(PlayerCallbackData& callbackData, std::string fileName, OggVorbisEncoder& encoder, uint64_t& loopStart, uint64_t& songLength)
+	const MIDIVorbisRenderer::RenderSettings& MIDIVorbisRenderer::getSettings() const
+	{
+		return m_settings;
+	}
+
+	void MIDIVorbisRenderer::setVorbisQuality(float quality)
+	{
+		m_settings.m_vorbisQuality = quality;
+	}
+
+	void MIDIVorbisRenderer::setOutputFormat(OutputFormat outputFormat)
+	{
+		m_outputFormat = outputFormat;
+	}
+
+	void MIDIVorbisRenderer::setSynthLogToStandardError()
+	{
+		static const char* const levelNames[] = { "panic", "error", "warning", "info" };
+		for (int level = FLUID_PANIC; level <= FLUID_INFO; level++)
+		{
+			fluid_set_log_function(level, [](int level, const char* message, void*)
+			{
+				std::fprintf(stderr, "fluidsynth: %s: %s\n", levelNames[level], message);
+			}, nullptr);
+		}
+		// Debug messages are only written by debug builds of FluidSynth, and are left off here too
+		fluid_set_log_function(FLUID_DBG, nullptr, nullptr);
+	}
+
+	std::string MIDIVorbisRenderer::getOutputExtension(OutputFormat outputFormat)
+	{
+		switch (outputFormat)
+		{
+		case OutputFormat::Wav:
+			return ".wav";
+		case OutputFormat::Raw:
+			return ".raw";
+		default:
+			return ".ogg";
+		}
+	}
+
+	void MIDIVorbisRenderer::setPipelined(bool isPipelined)
+	{
+		m_isPipelined = isPipelined;
+	}
+
+	void MIDIVorbisRenderer::setStreaming(bool isStreaming)
+	{
+		m_isStreaming = isStreaming;
+	}
+
+	void MIDIVorbisRenderer::setEncoderThreadCount(unsigned int threadCount)
+	{
+		m_encoderThreadCount = threadCount;
+	}
+
+	void MIDIVorbisRenderer::setRunoffLimits(double floorDecibels, double maxSeconds)
+	{
+		m_runoffFloor = static_cast<float>(std::pow(10.0, floorDecibels / 20.0));
+		m_maxRunoffFrames = static_cast<uint64_t>(std::max(maxSeconds, 0.0) * SongRenderContainer::s_sampleRate);
+	}
+
+	void MIDIVorbisRenderer::setLoopCopyMemory(size_t bytesPerRender)
+	{
+		m_maxRetainedLoopFrames = bytesPerRender / (2 * sizeof(float));
+	}
+
+	void MIDIVorbisRenderer::setNormalization(double targetLoudness, double truePeakCeiling)
+	{
+		m_isNormalizing = true;
+		m_targetLoudness = targetLoudness;
+		m_truePeakCeiling = truePeakCeiling;
+	}
+
+	void MIDIVorbisRenderer::setCollectingStats(bool isCollectingStats)
+	{
+		m_isCollectingStats = isCollectingStats;
+	}
+
+	void MIDIVorbisRenderer::setRenderCache(RenderCache* renderCache)
+	{
+		m_renderCache = renderCache;
+	}
+
+	utils::FNV1aHash MIDIVorbisRenderer::getRenderHash(const std::vector<unsigned char>& midiData, const RenderSettings& settings, bool isStreaming)
+	{
+		utils::FNV1aHash hash;
+		hash.addValue(s_renderFormatVersion);
+
+		hash.addValue(midiData.size());
+		hash.addBytes(midiData.data(), midiData.size());
+
+		hash.addString(m_soundfontIdentity);
+		// Synthesis and encoding can change between library versions
+		hash.addString(fluid_version_str());
+		hash.addString(vorbis_version_string());
+
+		hash.addValue(static_cast<uint64_t>(settings.m_loopMode));
+		hash.addValue(static_cast<uint64_t>(settings.m_endingBeatDivision));
+		hash.addValue(static_cast<uint64_t>(m_renderMode));
+		hash.addValue(static_cast<uint64_t>(m_outputFormat));
+		// Streamed files have padding in their comment header
+		hash.addValue(isStreaming);
+		// Segmented encodes choose their blocks a little differently, though the thread count doesn't matter
+		hash.addValue(m_encoderThreadCount > 1);
+		hash.addValue(m_maxRunoffFrames);
+		hash.addValue(m_isNormalizing);
+
+		auto addFloat = [&hash](double value)
+		{
+			uint64_t bits = 0;
+			std::memcpy(&bits, &value, sizeof(bits));
+			hash.addValue(bits);
+		};
+		addFloat(SongRenderContainer::s_sampleRate);
+		addFloat(SongRenderContainer::s_gain);
+		addFloat(settings.m_vorbisQuality);
+		addFloat(m_runoffFloor);
+		if (m_isNormalizing)
+		{
+			addFloat(m_targetLoudness);
+			addFloat(m_truePeakCeiling);
+		}
+
+		return hash;
+	}
+
+	std::unique_ptr<AudioFileEncoder> MIDIVorbisRenderer::createEncoder(const utils::FNV1aHash& renderHash, const RenderSettings& settings)
+	{
+		long sampleRate = static_cast<long>(SongRenderContainer::s_sampleRate);
+		std::unique_ptr<AudioFileEncoder> encoder;
+		switch (m_outputFormat)
+		{
+		case OutputFormat::Wav:
+			encoder = std::make_unique<WavEncoder>(sampleRate);
+			break;
+		case OutputFormat::Raw:
+			encoder = std::make_unique<RawAudioEncoder>(sampleRate);
+			break;
+		default:
+		{
+			uint64_t serial = renderHash.getValue();
+			auto vorbisEncoder = std::make_unique<OggVorbisEncoder>(static_cast<int>(serial ^ (serial >> 32)), sampleRate, settings.m_vorbisQuality);
+			vorbisEncoder->addComment("ENCODER", "libvorbis (midirenderer)");
+			vorbisEncoder->setEncoderThreadCount(m_encoderThreadCount);
+			encoder = std::move(vorbisEncoder);
+			break;
+		}
+		}
+
+		if (m_isNormalizing)
+		{
+			encoder->setNormalization(sampleRate, m_targetLoudness, m_truePeakCeiling);
+		}
+		return encoder;
+	}
+
+	void MIDIVorbisRenderer::loadPendingSoundfont()
+	{
+		// The identity was set when the load was deferred, and other workers read it for their render
+		// hashes without the lock, so only the synth is touched here
+		std::lock_guard<std::mutex> lock(m_soundfontMutex);
+		if (!m_pendingSoundfontPath.empty())
+		{
+			loadSoundfontFile(m_pendingSoundfontPath);
+			m_pendingSoundfontPath.clear();
+		}
+	}
+
+	void MIDIVorbisRenderer::requireSoundfont()
+	{
+		loadPendingSoundfont();
+		if (!getHasSoundfont())
+		{
+			throw std::runtime_error("Cannot render with no soundfont loaded");
+		}
+	}
+
+	void MIDIVorbisRenderer::encodeSong(const std::string& sourceName, const std::vector<unsigned char>& midiData, const RenderSettings& settings,
+		const ProgressCallback& progressCallback, const PhaseCallback& phaseCallback, const std::atomic<bool>* isCancelled, RenderStats* stats,
+		AudioFileEncoder& encoder, RenderResult& result)
+	{
+		PlayerCallbackData callbackData;
+		uint64_t songLength = 0;
+		uint64_t loopStart = 0;
+		uint64_t trimmedRunoffFrames = 0;
+
+		if (m_isPipelined)
+		{
+			PipelinedAudioSink pipeline(encoder);
+			renderSong(callbackData, sourceName, midiData, settings, progressCallback, phaseCallback, isCancelled, stats, pipeline, loopStart, songLength, trimmedRunoffFrames);
+			pipeline.finish();
+		}
+		else
+		{
+			renderSong(callbackData, sourceName, midiData, settings, progressCallback, phaseCallback, isCancelled, stats, encoder, loopStart, songLength, trimmedRunoffFrames);
+		}
+
+		if (settings.m_loopMode != LoopMode::None)
+		{
+			encoder.setLoopPoints(loopStart, songLength - loopStart);
+			result.m_loopStartFrame = loopStart;
+		}
+
+		encoder.completeStream();
+		result.m_outputFrames = songLength;
+		result.m_trimmedRunoffFrames = trimmedRunoffFrames;
+		if (m_isNormalizing)
+		{
+			result.m_isNormalized = true;
+			result.m_measuredLoudness = encoder.getMeasuredLoudness();
+			result.m_normalizationGain = encoder.getNormalizationGain();
+		}
+	}
+
+	std::string MIDIVorbisRenderer::getSoundfontIdentity(const std::string& soundfontPath)
+	{
+		try
+		{
+			return utils::getFileIdentity(soundfontPath);
+		}
+		catch (std::filesystem::filesystem_error&)
+		{
+			return soundfontPath;
+		}
+	}
+
+	void MIDIVorbisRenderer::renderSong(PlayerCallbackData& callbackData, const std::string& sourceName, const std::vector<unsigned char>& midiData, const RenderSettings& settings, const ProgressCallback& progressCallback,
+		const PhaseCallback& phaseCallback, const std::atomic<bool>* isCancelled, RenderStats* stats, AudioSink& outputSink, uint64_t& loopStart, uint64_t& songLength,
+		uint64_t& trimmedRunoffFrames)
 	{
 		loopStart = 0;
 		songLength = 0;
-		SongRenderContainer songRenderer = SongRenderContainer(fileName, fluid_synth_get_sfont(m_synth.get(), 0));
+		trimmedRunoffFrames = 0;
+		SongRenderContainer songRenderer = SongRenderContainer(midiData, fluid_synth_get_sfont(m_synth.get(), 0));
+		songRenderer.setStats(stats);
+
+		// The analysis only lets the render skip ahead between events, so if it fails the
+		// render carries on one block at a time and reports its own errors
+		std::unique_ptr<MIDIAnalysis> analysis;
+		if (m_renderMode == RenderMode::Block)
+		{
+			try
+			{
+				analysis = std::make_unique<MIDIAnalysis>(analyzeMIDIData(midiData.data(), midiData.size()));
+			}
+			catch (std::exception&) { }
+		}
+
+		if (analysis != nullptr && static_cast<uint64_t>(songRenderer.getSynthBufferSize()) != MIDIAnalysis::s_synthBufferSize)
+		{
+			// Events would be dispatched on other frames than the analysis expects, so render a block at a time
+			analysis = nullptr;
+		}
+
+		// A double loop's second pass can only take over from the first pass if the state of the synth
+		// and the player can be compared between them, and streaming renders keep their memory use bounded
+		ProgressAudioSink progressSink(outputSink, progressCallback, isCancelled);
+		if (analysis != nullptr)
+		{
+			uint64_t expectedFrameCount = analysis->m_endSample;
+			if (settings.m_loopMode == LoopMode::Double && analysis->getHasLoopPoint())
+			{
+				expectedFrameCount += analysis->m_endSample - analysis->m_loopSample;
+			}
+			progressSink.setExpectedFrameCount(expectedFrameCount);
+		}
+
+		RetainingAudioSink encoder(progressSink);
+		LoopRecording loopRecording;
+		loopRecording.m_isRecording = settings.m_loopMode == LoopMode::Double && !m_isStreaming && m_maxRetainedLoopFrames > 0 &&
+			analysis != nullptr && !analysis->m_hasOpaqueEvents && analysis->m_channelsWithLinkedNotes == 0 &&
+			analysis->getEndOnDivisionSample(settings.m_endingBeatDivision) - std::min(analysis->m_loopSample, analysis->m_endSample) <= m_maxRetainedLoopFrames;
+		if (loopRecording.m_isRecording)
+		{
+			loopRecording.m_loopFrame = analysis->m_loopSample;
+			encoder.retainFrom(loopRecording.m_loopFrame, m_maxRetainedLoopFrames);
+		}
 
 		songRenderer.setMIDICallback(playerEventCallback, &callbackData);
 		songRenderer.startPlayback();
 
-		float leftBuffer[s_audioBufferSize];
-		float rightBuffer[s_audioBufferSize];
-		size_t bufferIndex = 0;
+		RenderBuffer buffer;
 
 		int lastTempo = songRenderer.getTempo();
 		uint64_t lastTempoSample = songLength;
 		uint64_t loopStartSample = 0;
+		// The short loop's pre-roll goes through the same blocks as the first pass, so once nothing is
+		// playing the notes before then can't change anything it renders after. The synth has no effects
+		// to ring out, but notes on channels that use portamento or legato change the notes after them.
+		bool isFindingQuietPoints = settings.m_loopMode == LoopMode::Short && analysis != nullptr &&
+			!analysis->m_hasOpaqueEvents && analysis->m_channelsWithLinkedNotes == 0;
+		// The last two, since the pre-roll might stop before it's finished the last one's block
+		std::array<QuietPoint, 2> quietPoints = {};
+		size_t loopQuietNoteOnCount = 0;
 
 		if (!songRenderer.getIsPlaying())
 		{
-			throw std::runtime_error("Failed to play MIDI file " + fileName);
+			throw std::runtime_error("Failed to play MIDI file " + sourceName);
 		}
 
 		bool hasHitLoopPoint = false;
 
+		auto startPhase = [&phaseCallback](RenderPhase phase)
+		{
+			if (phaseCallback)
+			{
+				phaseCallback(phase);
+			}
+		};
+
+		// Each phase of the render is timed until the next one starts
+		std::optional<StageTimer> phaseTimer;
+		phaseTimer.emplace(stats, RenderStage::SongBody);
+		startPhase(RenderPhase::SongBody);
+
 		while (songRenderer.getIsPlaying())
 		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
+			if (loopRecording.m_isRecording && songLength == loopRecording.m_loopFrame)
+			{
+				loopRecording.m_channelStateHash = songRenderer.getChannelStateHash();
+				loopRecording.m_hasCapturedLoopState = true;
+			}
+
+			size_t frameCount = getRenderStepSize(songRenderer, analysis.get());
+			if (loopRecording.m_isRecording && songLength < loopRecording.m_loopFrame && songLength + frameCount > loopRecording.m_loopFrame)
+			{
+				// Stop just before the block the second pass starts on to capture the state there
+				frameCount = static_cast<size_t>(loopRecording.m_loopFrame - songLength);
+			}
+			readStepFromSynth(songRenderer, analysis.get(), stats, frameCount, buffer, encoder);
+
+			// Everything below can only change on the last frame of the step, so songLength
+			// is moved up to that frame before checking
+			songLength += frameCount - 1;
 
 			if (!hasHitLoopPoint && callbackData.m_hasHitLoopPoint)
 			{
 				hasHitLoopPoint = true;
-				loopStart = songLength;
 				// The loop point actually happened one buffer ago so we need to move the loop point backward
-				loopStart -= songRenderer.getSynthBufferSize();
+				int bufferSize = songRenderer.getSynthBufferSize();
+				loopStart = songLength >= static_cast<uint64_t>(bufferSize) ? songLength - bufferSize : 0;
 				loopStartSample = songLength;
+				// The pre-roll stops a block before the loop point, and has to have finished the quiet point's block
+				const QuietPoint& quietPoint = quietPoints[1].m_frame + 2 * bufferSize <= loopStartSample ? quietPoints[1] : quietPoints[0];
+				loopQuietNoteOnCount = quietPoint.m_noteOnCount;
+
+				if (loopStart != loopRecording.m_loopFrame)
+				{
+					loopRecording.m_isRecording = false;
+				}
 			}
 
 			int tempo = songRenderer.getTempo();
@@ -142,17 +723,41 @@ namespace midirenderer
 				lastTempo = tempo;
 				lastTempoSample = songLength;
 			}
+
+			if (loopRecording.m_isRecording && loopRecording.m_hasCapturedLoopState)
+			{
+				recordLoopStep(songRenderer, loopRecording, songLength);
+			}
+			if (isFindingQuietPoints && !hasHitLoopPoint && songRenderer.getActiveVoiceCount() == 0)
+			{
+				quietPoints[0] = quietPoints[1];
+				quietPoints[1] = { songLength, callbackData.m_noteOnCount };
+			}
 			songLength++;
 		}
 
+		if (loopRecording.m_isRecording)
+		{
+			loopRecording.m_isRecording = loopRecording.m_hasCapturedLoopState && hasHitLoopPoint == analysis->getHasLoopPoint();
+			loopRecording.m_songEnd = songLength;
+			loopRecording.m_lastTempo = lastTempo;
+			loopRecording.m_lastTempoSample = lastTempoSample;
+		}
+
 		songRenderer.join();
 
-		renderToBeatDivision(songRenderer, songLength, lastTempoSample, lastTempo, leftBuffer, rightBuffer, bufferIndex, encoder);
+		renderToBeatDivision(songRenderer, settings.m_endingBeatDivision, songLength, lastTempoSample, lastTempo, buffer, encoder);
 
 		// To ensure no non-runoff samples are written to the encoder as overlap samples,
 		// all buffered samples need to be written to the encoder before playing voice runoff
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+		flushBuffersToEncoder(buffer, encoder);
 		songRenderer.silence();
+		if (stats != nullptr)
+		{
+			stats->m_bodyFrames = songLength;
+		}
+		phaseTimer.emplace(stats, RenderStage::Runoff);
+		startPhase(RenderPhase::Runoff);
 
 		// Play the voice runoff of the end, which may or may not end up part of the loop
 
@@ -160,49 +765,142 @@ namespace midirenderer
 		// and the runoff is not meant to delay the loop point at the end of the song.
 		encoder.startOverlapRegion();
 
-		size_t overlapSamples = 0;
-		while (songRenderer.getActiveVoiceCount() > 0)
+		// Starting the overlap region ends retention, so the whole first pass has been kept by now
+		if (loopRecording.m_isRecording && encoder.getHasRetainedAll())
 		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
-			overlapSamples++;
+			loopRecording.m_leftFrames = &encoder.getLeftBuffer();
+			loopRecording.m_rightFrames = &encoder.getRightBuffer();
 		}
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+
+		size_t overlapSamples = renderRunoff(songRenderer, stats, encoder, trimmedRunoffFrames);
 
 		encoder.endOverlapRegion();
+		phaseTimer.reset();
 
 		// When looping in-file, the runoff period is used to transition to a partial second
 		// playthrough of the song, which is the same length of the runoff period. In theory,
 		// this means that the loop is made seamless since the sound from the end of the loop
 		// carry into the sound at the beginning of the loop.
-		if (m_loopMode != LoopMode::None)
+		if (settings.m_loopMode != LoopMode::None)
 		{
+			startPhase(RenderPhase::Loop);
 			songRenderer.resetPlayer();
 
-			switch (m_loopMode)
+			switch (settings.m_loopMode)
 			{
 			case LoopMode::Short:
 			{
-				renderShortLoop(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder,
-					loopStartSample, overlapSamples, songLength, loopStart);
+				renderShortLoop(songRenderer, callbackData, stats, buffer, encoder,
+					loopStartSample, loopQuietNoteOnCount, overlapSamples, songLength, loopStart);
 				break;
 			}
 			case LoopMode::Double:
 			{
-				renderDoubleLoop(songRenderer, callbackData,
-					leftBuffer, rightBuffer, bufferIndex, encoder,
+				renderDoubleLoop(songRenderer, callbackData, analysis.get(), stats, loopRecording, settings.m_endingBeatDivision,
+					buffer, encoder,
 					loopStart, songLength, lastTempo, lastTempoSample);
 				break;
 			}
 			default:
-				throw std::runtime_error("Attempted to loop with invalid loop mode " + std::to_string(static_cast<int>(m_loopMode)));
+				throw std::runtime_error("Attempted to loop with invalid loop mode " + std::to_string(static_cast<int>(settings.m_loopMode)));
+			}
+
+			if (stats != nullptr)
+			{
+				stats->m_loopFrames = songLength - stats->m_bodyFrames;
 			}
 		}
 	}
 
-	void MIDIVorbisRenderer::renderShortLoop(SongRenderContainer& songRenderer, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder, uint64_t loopStartSample, size_t overlapSamples, uint64_t& samplePosition, uint64_t& loopPoint)
+	size_t MIDIVorbisRenderer::renderRunoff(SongRenderContainer& songRenderer, RenderStats* stats, AudioSink& encoder, uint64_t& trimmedFrameCount)
 	{
+		// Runoff below the floor is held back until something louder comes after it, so whatever's
+		// left of it once the runoff ends is dropped instead of being mixed into the loop
+		std::array<std::vector<float>, 2> quietFrames;
+		size_t keptFrameCount = 0;
+		uint64_t renderedFrameCount = 0;
+		auto renderStep = [&](size_t maxFrameCount)
+		{
+			size_t frameCount = std::min(getRenderStepSize(songRenderer), maxFrameCount);
+			size_t quietStart = quietFrames[0].size();
+			quietFrames[0].resize(quietStart + frameCount);
+			quietFrames[1].resize(quietStart + frameCount);
+			songRenderer.renderFrames(static_cast<int>(frameCount), &quietFrames[0][quietStart], &quietFrames[1][quietStart]);
+			renderedFrameCount += frameCount;
+			return std::max(utils::getPeak(&quietFrames[0][quietStart], frameCount), utils::getPeak(&quietFrames[1][quietStart], frameCount));
+		};
+		auto writeFrames = [&]()
+		{
+			for (size_t i = 0; i < quietFrames[0].size(); i += s_audioBufferSize)
+			{
+				size_t writeCount = std::min(s_audioBufferSize, quietFrames[0].size() - i);
+				encoder.writeBuffers(&quietFrames[0][i], &quietFrames[1][i], writeCount);
+			}
+			keptFrameCount += quietFrames[0].size();
+			quietFrames[0].clear();
+			quietFrames[1].clear();
+		};
+
+		while (songRenderer.getActiveVoiceCount() > 0)
+		{
+			if (quietFrames[0].size() >= s_runoffQuietWindow)
+			{
+				// Voices left playing now would carry on into whatever the synth renders next
+				songRenderer.stopAllVoices();
+				break;
+			}
+
+			if (m_maxRunoffFrames > 0 && renderedFrameCount >= m_maxRunoffFrames)
+			{
+				// The runoff is still above the floor, so stopping the voices outright would leave a step at
+				// the end of the file, or in the middle of the start of the loop. It's faded out instead.
+				size_t fadeStart = quietFrames[0].size();
+				while (quietFrames[0].size() < fadeStart + s_runoffFadeFrames)
+				{
+					renderStep(fadeStart + s_runoffFadeFrames - quietFrames[0].size());
+				}
+				for (size_t i = 0; i < s_runoffFadeFrames; i++)
+				{
+					float gain = 1.0f - static_cast<float>(i + 1) / s_runoffFadeFrames;
+					quietFrames[0][fadeStart + i] *= gain;
+					quietFrames[1][fadeStart + i] *= gain;
+				}
+				writeFrames();
+				songRenderer.stopAllVoices();
+				break;
+			}
+
+			// The floor is compared with each step's peak rather than its RMS level. The peak is never
+			// below the RMS, so no step whose RMS is above the floor is ever dropped, and a decaying
+			// tail with a few loud samples keeps going until they're gone too.
+			if (renderStep(std::numeric_limits<size_t>::max()) >= m_runoffFloor)
+			{
+				writeFrames();
+			}
+		}
+
+		trimmedFrameCount = renderedFrameCount - keptFrameCount;
+		if (stats != nullptr)
+		{
+			stats->m_runoffFrames = keptFrameCount;
+			stats->m_trimmedRunoffFrames = trimmedFrameCount;
+		}
+		return keptFrameCount;
+	}
+
+	void MIDIVorbisRenderer::renderShortLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData, RenderStats* stats, RenderBuffer& buffer, AudioSink& encoder,
+		uint64_t loopStartSample, size_t quietNoteOnCount, size_t overlapSamples, uint64_t& samplePosition, uint64_t& loopPoint)
+	{
+		// Starting from the channels the first pass started with keeps the pre-roll block for block the same
+		// as the first pass, so the note ons that had all finished by its last quiet point before the loop
+		// point can be left out. Blocks with no voices cost next to nothing to render, so songs with long
+		// intros get to the loop point quickly, and the synth is in exactly the state a full replay leaves it in.
+		songRenderer.resetChannels();
+		callbackData.m_noteOnCount = 0;
+		callbackData.m_mutedNoteOnCount = quietNoteOnCount;
+
 		songRenderer.startPlayback();
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+		flushBuffersToEncoder(buffer, encoder);
 
 		// Just jumping to the loop point seems to create an unavoidable pop when the rendered file's loop point is reached
 		// (the short loop mode end, not the song loop point) but synthesizing up to the song loop point and throwing
@@ -215,20 +913,24 @@ namespace midirenderer
 		{
 			uint64_t samplesToLoopPoint = loopStartSample - bufferSize;
 			float throwawayBuffer = 0;
+			StageTimer timer(stats, RenderStage::LoopPreRoll);
 			songRenderer.renderFrames(samplesToLoopPoint, &throwawayBuffer, &throwawayBuffer, 0);
+			if (stats != nullptr)
+			{
+				stats->m_preRollFrames = samplesToLoopPoint;
+			}
 		}
+		callbackData.m_mutedNoteOnCount = 0;
+		StageTimer loopTimer(stats, RenderStage::Loop);
 		songRenderer.silence();
 		songRenderer.flushSynthBuffer();
 
-		for (int i = 0; i < overlapSamples; i++)
-		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
-		}
+		readFramesFromSynth(songRenderer, overlapSamples, buffer, encoder);
 
 		samplePosition += overlapSamples;
 		loopPoint += overlapSamples;
 
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+		flushBuffersToEncoder(buffer, encoder);
 
 		// Synthesizing a little bit extra helps prevent a small pop, click or other
 		// looping artifact caused by Vorbis' lossy encoding. See the Vorbis documentation
@@ -244,25 +946,78 @@ namespace midirenderer
 
 		encoder.startOverlapRegion();
 
-		for (int i = 0; i < 64; i++)
-		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
-		}
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+		readFramesFromSynth(songRenderer, 64, buffer, encoder);
+		flushBuffersToEncoder(buffer, encoder);
 
 		encoder.endOverlapRegion();
 
 		songRenderer.stopPlayback();
 	}
 
-	void MIDIVorbisRenderer::renderDoubleLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder, uint64_t& loopPoint, uint64_t& samplePosition, int& lastTempo, uint64_t& lastTempoSample)
+	void MIDIVorbisRenderer::renderDoubleLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData, const MIDIAnalysis* analysis, RenderStats* stats, const LoopRecording& loopRecording,
+		int endingBeatDivision, RenderBuffer& buffer, AudioSink& encoder, uint64_t& loopPoint, uint64_t& samplePosition, int& lastTempo, uint64_t& lastTempoSample)
 	{
-		callbackData.m_queuedSeek = callbackData.m_loopTick;
+		uint64_t loopFrame = loopPoint;
 		loopPoint = samplePosition;
+
+		// The second pass replays the song from the start with its note ons muted up to the first pass'
+		// loop point. Like seeking, this leaves the player and channels as they were at the loop point,
+		// but it also keeps every event on the same synth block as in the first pass. Every double loop
+		// is started this way, so whether the first pass gets copied never changes the output.
+		// Finishing the block the runoff ended in starts playback on the same block grid as well.
+		if (songRenderer.getFramesToNextBlock() != 1)
+		{
+			songRenderer.flushSynthBuffer();
+		}
+		callbackData.m_areNoteOnsMuted = loopFrame > 0;
 		songRenderer.startPlayback();
+		if (loopFrame > 0)
+		{
+			StageTimer timer(stats, RenderStage::LoopPreRoll);
+			songRenderer.advanceFrames(static_cast<int>(loopFrame));
+			if (stats != nullptr)
+			{
+				stats->m_preRollFrames = loopFrame;
+			}
+		}
+		callbackData.m_areNoteOnsMuted = false;
+		StageTimer loopTimer(stats, RenderStage::Loop);
+
+		// From here on both passes get the same events on the same blocks. Once the voices carried over
+		// into the first pass have finished, the synth is in the same state in both if its channels
+		// started out the same, so the rest of the first pass can be copied.
+		bool canConverge = loopRecording.m_isRecording && loopRecording.m_leftFrames != nullptr &&
+			loopRecording.m_peakVoiceCount < songRenderer.getPolyphony() &&
+			songRenderer.getChannelStateHash() == loopRecording.m_channelStateHash;
+
+		FrameComparison comparison = {};
+		if (canConverge)
+		{
+			comparison = { loopRecording.m_leftFrames->data(), loopRecording.m_rightFrames->data(), loopRecording.m_leftFrames->size(), 0, 0 };
+		}
+
+		const std::vector<LoopRecording::Candidate>& candidates = loopRecording.m_candidates;
+		size_t candidateIndex = 0;
+		uint64_t frame = loopFrame;
 		while (songRenderer.getIsPlaying())
 		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
+			size_t frameCount = getRenderStepSize(songRenderer, analysis);
+			if (canConverge)
+			{
+				// Stop on the next frame the first pass could be taken over from
+				while (candidateIndex < candidates.size() && candidates[candidateIndex].m_frame < frame)
+				{
+					candidateIndex++;
+				}
+				if (candidateIndex < candidates.size() && candidates[candidateIndex].m_frame < frame + frameCount)
+				{
+					frameCount = static_cast<size_t>(candidates[candidateIndex].m_frame - frame) + 1;
+				}
+			}
+
+			readStepFromSynth(songRenderer, analysis, stats, frameCount, buffer, encoder, canConverge ? &comparison : nullptr);
+			samplePosition += frameCount - 1;
+			frame += frameCount - 1;
 
 			int tempo = songRenderer.getTempo();
 			if (tempo != lastTempo)
@@ -270,97 +1025,243 @@ namespace midirenderer
 				lastTempo = tempo;
 				lastTempoSample = samplePosition;
 			}
+
+			if (canConverge && candidateIndex < candidates.size() && candidates[candidateIndex].m_frame == frame)
+			{
+				const LoopRecording::Candidate& candidate = candidates[candidateIndex];
+				bool hasConverged = songRenderer.getActiveVoiceCount() == candidate.m_voiceCount &&
+					comparison.m_matchingFrames >= std::min<uint64_t>(s_convergenceCheckFrames, frame - loopFrame + 1);
+				if (hasConverged && copyConvergedLoop(loopRecording, endingBeatDivision, frame, buffer, encoder, samplePosition, lastTempo, lastTempoSample))
+				{
+					songRenderer.stopPlayback();
+					return;
+				}
+				candidateIndex++;
+			}
+
 			samplePosition++;
+			frame++;
 		}
 
 		songRenderer.join();
 
-		renderToBeatDivision(songRenderer, samplePosition, lastTempoSample, lastTempo, leftBuffer, rightBuffer, bufferIndex, encoder);
+		renderToBeatDivision(songRenderer, endingBeatDivision, samplePosition, lastTempoSample, lastTempo, buffer, encoder);
 
-		flushBuffersToEncoder(leftBuffer, rightBuffer, bufferIndex, encoder);
+		flushBuffersToEncoder(buffer, encoder);
 	}
 
-	void MIDIVorbisRenderer::renderToBeatDivision(SongRenderContainer& songRenderer, uint64_t& samplePosition, uint64_t lastTempoSample, int lastTempo, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder)
+	void MIDIVorbisRenderer::recordLoopStep(SongRenderContainer& songRenderer, LoopRecording& loopRecording, uint64_t frame)
 	{
-		if (m_endingBeatDivision == -1) { return; }
+		int voiceCount = songRenderer.getActiveVoiceCount();
+		loopRecording.m_peakVoiceCount = std::max(loopRecording.m_peakVoiceCount, voiceCount);
 
-		uint64_t samplesSinceTempoChange = samplePosition - lastTempoSample;
-		double alignmentTempo = 4.0 / m_endingBeatDivision * (lastTempo / 1000000.0);
-		double samplesPerAlignedBeat = 44100.0 * (alignmentTempo);
-		double beatsElapsed = samplesSinceTempoChange / samplesPerAlignedBeat;
-		uint64_t lastAlignedBeat = static_cast<uint64_t>(beatsElapsed) + 1.0;
-		uint64_t lastSample = static_cast<uint64_t>(lastAlignedBeat * samplesPerAlignedBeat);
-		for (int i = samplePosition; i < lastSample; i++)
+		// The synth mixes voices in an order that depends on when earlier voices finished, which
+		// differs between the passes while voices carried over into the first pass are playing.
+		// Floating point addition isn't associative, so the passes only mix to the same bits from
+		// a point where at most two voices are playing, since the order of two doesn't matter.
+		if (voiceCount > s_maxConvergenceVoiceCount) { return; }
+
+		std::vector<LoopRecording::Candidate>& candidates = loopRecording.m_candidates;
+		if (candidates.empty() || frame >= candidates.back().m_frame + s_audioBufferSize)
 		{
-			readSampleFromSynth(songRenderer, leftBuffer, rightBuffer, bufferIndex, encoder);
-			samplePosition++;
+			candidates.push_back({ frame, voiceCount });
+		}
+	}
+
+	bool MIDIVorbisRenderer::copyConvergedLoop(const LoopRecording& loopRecording, int endingBeatDivision, uint64_t frame, RenderBuffer& buffer, AudioSink& encoder,
+		uint64_t& samplePosition, int& lastTempo, uint64_t& lastTempoSample)
+	{
+		// Work out where the second pass would have ended, following the first pass' tempo changes
+		uint64_t endPosition = samplePosition + (loopRecording.m_songEnd - frame);
+		int endTempo = lastTempo;
+		uint64_t endTempoSample = lastTempoSample;
+		if (loopRecording.m_lastTempoSample > frame)
+		{
+			endTempo = loopRecording.m_lastTempo;
+			endTempoSample = samplePosition + (loopRecording.m_lastTempoSample - frame);
+		}
+
+		uint64_t lastSample = endPosition;
+		if (endingBeatDivision != -1)
+		{
+			lastSample = getBeatDivisionEndSample(endPosition, endTempoSample, endTempo, endingBeatDivision);
 		}
+
+		// The first pass only has as much padding after the end of the song as it needed itself
+		size_t copyStart = static_cast<size_t>(frame + 1 - loopRecording.m_loopFrame);
+		size_t copyEnd = static_cast<size_t>(loopRecording.m_songEnd - loopRecording.m_loopFrame + (lastSample - endPosition));
+		if (copyEnd > loopRecording.m_leftFrames->size()) { return false; }
+
+		flushBuffersToEncoder(buffer, encoder);
+		for (size_t i = copyStart; i < copyEnd; i += s_audioBufferSize)
+		{
+			size_t frameCount = std::min(s_audioBufferSize, copyEnd - i);
+			encoder.writeBuffers(&(*loopRecording.m_leftFrames)[i], &(*loopRecording.m_rightFrames)[i], frameCount);
+		}
+
+		samplePosition = lastSample;
+		lastTempo = endTempo;
+		lastTempoSample = endTempoSample;
+		return true;
 	}
 
-	void MIDIVorbisRenderer::readSampleFromSynth(SongRenderContainer& songRenderer, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder)
+	void MIDIVorbisRenderer::renderToBeatDivision(SongRenderContainer& songRenderer, int endingBeatDivision, uint64_t& samplePosition, uint64_t lastTempoSample, int lastTempo,
+		RenderBuffer& buffer, AudioSink& encoder)
 	{
-		songRenderer.renderFrames(1, &leftBuffer[bufferIndex], &rightBuffer[bufferIndex]);
+		if (endingBeatDivision == -1) { return; }
 
-		bufferIndex++;
-		if (bufferIndex >= s_audioBufferSize)
+		uint64_t lastSample = getBeatDivisionEndSample(samplePosition, lastTempoSample, lastTempo, endingBeatDivision);
+		if (lastSample > samplePosition)
 		{
-			bufferIndex -= s_audioBufferSize;
-			encoder.writeBuffers(leftBuffer, rightBuffer, s_audioBufferSize);
+			readFramesFromSynth(songRenderer, lastSample - samplePosition, buffer, encoder);
+			samplePosition = lastSample;
 		}
 	}
 
-	void MIDIVorbisRenderer::flushBuffersToEncoder(float* leftBuffer, float* rightBuffer, size_t& bufferLength, OggVorbisEncoder& encoder)
+	size_t MIDIVorbisRenderer::getRenderStepSize(SongRenderContainer& songRenderer, const MIDIAnalysis* analysis)
 	{
-		if (bufferLength > 0)
+		if (m_renderMode == RenderMode::PerFrame) { return 1; }
+
+		// Tempo changes, MIDI events, the end of the song and voices finishing all happen when the synth
+		// starts a new block, so stopping on that frame keeps all of those checks sample-accurate
+		size_t frameCount = songRenderer.getFramesToNextBlock();
+		if (analysis == nullptr) { return frameCount; }
+
+		// While the song is playing, nothing the checks look at can change until the player dispatches
+		// its next event, so every block before that can be rendered in the same step. The margin
+		// covers the player rounding its tick and only updating its clock once per block.
+		int currentTick = songRenderer.getCurrentTick();
+		int nextEventTick = analysis->getNextEventTick(currentTick);
+		if (nextEventTick < 0) { return frameCount; }
+
+		double millisecondsPerTick = songRenderer.getTempo() / 1000.0 / analysis->m_division;
+		double safeMilliseconds = (nextEventTick - currentTick - 2) * millisecondsPerTick - 1.0;
+		if (safeMilliseconds > 0)
 		{
-			encoder.writeBuffers(leftBuffer, rightBuffer, bufferLength);
-			bufferLength = 0;
+			size_t bufferSize = songRenderer.getSynthBufferSize();
+			frameCount += static_cast<size_t>(safeMilliseconds * SongRenderContainer::s_sampleRate / 1000.0 / bufferSize) * bufferSize;
 		}
+		return frameCount;
 	}
 
-	void MIDIVorbisRenderer::loadMIDIFile(std::string& fileName, fluid_player_t* player)
+	void MIDIVorbisRenderer::readFramesFromSynth(SongRenderContainer& songRenderer, size_t frameCount, RenderBuffer& buffer, AudioSink& encoder,
+		FrameComparison* comparison)
 	{
-#ifndef WINDOWS_UTF16_WORKAROUND
-		fluid_player_add(player, fileName.c_str());
-#else
-		size_t filenameSize = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, fileName.c_str(), -1, NULL, 0);
-		auto filenameString = std::make_unique<wchar_t[]>(filenameSize);
-		MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, fileName.c_str(), -1, filenameString.get(), filenameSize);
+		size_t maxChunkSize = m_renderMode == RenderMode::PerFrame ? 1 : s_audioBufferSize;
 
-		std::ifstream file(filenameString.get(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-		if (!file.is_open())
+		while (frameCount > 0)
 		{
-			throw std::invalid_argument("Failed to open MIDI file at " + fileName);
+			if (buffer.m_capacity == 0)
+			{
+				buffer.m_capacity = encoder.acquireBuffers(s_audioBufferSize, buffer.m_leftBuffer, buffer.m_rightBuffer);
+			}
+
+			size_t chunkSize = std::min({ frameCount, buffer.m_capacity - buffer.m_frameCount, maxChunkSize });
+			songRenderer.renderFrames(static_cast<int>(chunkSize), &buffer.m_leftBuffer[buffer.m_frameCount], &buffer.m_rightBuffer[buffer.m_frameCount]);
+			if (comparison != nullptr)
+			{
+				comparison->compare(&buffer.m_leftBuffer[buffer.m_frameCount], &buffer.m_rightBuffer[buffer.m_frameCount], chunkSize);
+			}
+
+			frameCount -= chunkSize;
+			buffer.m_frameCount += chunkSize;
+			if (buffer.m_frameCount >= buffer.m_capacity)
+			{
+				flushBuffersToEncoder(buffer, encoder);
+			}
 		}
+	}
 
-		std::streampos fileLength = file.tellg();
-		file.seekg(0, std::ios_base::beg);
-		auto fileContents = std::make_unique<char[]>(fileLength);
-		file.read(fileContents.get(), fileLength);
+	void MIDIVorbisRenderer::readStepFromSynth(SongRenderContainer& songRenderer, const MIDIAnalysis* analysis, RenderStats* stats, size_t frameCount,
+		RenderBuffer& buffer, AudioSink& encoder, FrameComparison* comparison)
+	{
+		// A step spans the rest of the current block, whole blocks that start before the player's next
+		// event, and the first frame of the block after them. The current block may still hold the tail
+		// of a voice that's just finished and events may be dispatched on the last frame, but with nothing
+		// playing and nothing to start a voice, the synth only mixes exact zeros into the blocks between.
+		size_t leadingFrameCount = frameCount;
+		size_t silentFrameCount = 0;
+		if (analysis != nullptr && m_renderMode == RenderMode::Block && songRenderer.getActiveVoiceCount() == 0)
+		{
+			size_t blockSize = songRenderer.getSynthBufferSize();
+			size_t currentBlockFrames = songRenderer.getFramesToNextBlock() - 1;
+			if (frameCount > currentBlockFrames + 1)
+			{
+				leadingFrameCount = currentBlockFrames;
+				silentFrameCount = (frameCount - currentBlockFrames - 1) / blockSize * blockSize;
+			}
+		}
 
-		fluid_player_add_mem(player, fileContents.get(), fileLength);
-#endif
+		readFramesFromSynth(songRenderer, leadingFrameCount, buffer, encoder, comparison);
+		if (silentFrameCount > 0)
+		{
+			// The player only moves when the synth runs, but nothing has to be copied out of it
+			songRenderer.advanceFrames(static_cast<int>(silentFrameCount));
+			writeSilence(silentFrameCount, buffer, encoder, comparison);
+			if (stats != nullptr)
+			{
+				stats->m_silentFrames += silentFrameCount;
+			}
+		}
+		readFramesFromSynth(songRenderer, frameCount - leadingFrameCount - silentFrameCount, buffer, encoder, comparison);
 	}
 
-	int MIDIVorbisRenderer::playerEventCallback(fluid_player_t* player, fluid_synth_t* synth,
+	void MIDIVorbisRenderer::writeSilence(size_t frameCount, RenderBuffer& buffer, AudioSink& encoder, FrameComparison* comparison)
+	{
+		while (frameCount > 0)
+		{
+			if (buffer.m_capacity == 0)
+			{
+				buffer.m_capacity = encoder.acquireBuffers(s_audioBufferSize, buffer.m_leftBuffer, buffer.m_rightBuffer);
+			}
+
+			size_t chunkSize = std::min(frameCount, buffer.m_capacity - buffer.m_frameCount);
+			std::fill_n(&buffer.m_leftBuffer[buffer.m_frameCount], chunkSize, 0.0f);
+			std::fill_n(&buffer.m_rightBuffer[buffer.m_frameCount], chunkSize, 0.0f);
+			if (comparison != nullptr)
+			{
+				comparison->compare(&buffer.m_leftBuffer[buffer.m_frameCount], &buffer.m_rightBuffer[buffer.m_frameCount], chunkSize);
+			}
+
+			frameCount -= chunkSize;
+			buffer.m_frameCount += chunkSize;
+			if (buffer.m_frameCount >= buffer.m_capacity)
+			{
+				flushBuffersToEncoder(buffer, encoder);
+			}
+		}
+	}
+
+	void MIDIVorbisRenderer::flushBuffersToEncoder(RenderBuffer& buffer, AudioSink& encoder)
+	{
+		if (buffer.m_capacity > 0)
+		{
+			encoder.commitBuffers(buffer.m_frameCount);
+			buffer = RenderBuffer();
+		}
+	}
+
+	int MIDIVorbisRenderer::playerEventCallback(fluid_player_t*, fluid_synth_t* synth,
 		void* data, fluid_midi_event_t* event)
 	{
 		PlayerCallbackData* callbackData = static_cast<PlayerCallbackData*>(data);
 
-		if (callbackData->m_queuedSeek != -1)
+		int eventCode = fluid_midi_event_get_type(event);
+		int eventControl = fluid_midi_event_get_control(event);
+
+		if (callbackData->m_areNoteOnsMuted && eventCode == 0x90 && fluid_midi_event_get_velocity(event) > 0)
 		{
-			fluid_player_seek(player, callbackData->m_queuedSeek);
-			callbackData->m_queuedSeek = -1;
 			return FLUID_OK;
 		}
 
-		int eventCode = fluid_midi_event_get_type(event);
-		int eventControl = fluid_midi_event_get_control(event);
+		if (eventCode == 0x90 && fluid_midi_event_get_velocity(event) > 0 && callbackData->m_noteOnCount++ < callbackData->m_mutedNoteOnCount)
+		{
+			return FLUID_OK;
+		}
 
 		if (eventCode == 0xb0 && eventControl == 111)
 		{
 			callbackData->m_hasHitLoopPoint = true;
-			callbackData->m_loopTick = fluid_player_get_current_tick(player);
 		}
 
 		return fluid_synth_handle_midi_event(synth, event);
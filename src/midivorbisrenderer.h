@@ -1,18 +1,57 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <fluidsynth/types.h>
 
 #include "deleteruniqueptr.h"
+#include "renderstats.h"
+#include "songrendercontainer.h"
 
-class OggVorbisEncoder;
+class AudioSink;
+class AudioFileEncoder;
 
 namespace midirenderer
 {
 	struct PlayerCallbackData;
-	class SongRenderContainer;
+	struct MIDIAnalysis;
+	struct LoopRecording;
+	struct FrameComparison;
+	struct RenderBuffer;
+	class RenderCache;
+
+	namespace utils
+	{
+		class FNV1aHash;
+	}
+
+	struct RenderResult
+	{
+		// Whether the output was copied from the render cache instead of being rendered
+		bool m_isCached = false;
+		// Only filled in for renders that weren't cached when the renderer is collecting stats
+		RenderStats m_stats = {};
+		// How many frames the output plays for, or 0 if it was cached
+		uint64_t m_outputFrames = 0;
+		// The frame the output loops back to, or 0 if it doesn't loop or was cached
+		uint64_t m_loopStartFrame = 0;
+		// Runoff frames below the runoff floor that were left out of the output, or 0 if it was cached
+		uint64_t m_trimmedRunoffFrames = 0;
+		// Whether the render was normalized, which is only known for renders that weren't cached
+		bool m_isNormalized = false;
+		// The integrated loudness before normalization in LUFS (-infinity for silence) and the gain applied to it in dB
+		double m_measuredLoudness = 0.0;
+		double m_normalizationGain = 0.0;
+
+		// Whether the output was cached, how much runoff was trimmed and how it was normalized, to print
+		// after its path, or an empty string
+		std::string getOutputNote() const;
+	};
 
 	class MIDIVorbisRenderer
 	{
@@ -24,35 +63,197 @@ namespace midirenderer
 			Short
 		};
 
-		MIDIVorbisRenderer(LoopMode loopMode = LoopMode::None, int endingBeatDivision = -1);
+		enum class RenderMode
+		{
+			// Render whole synth blocks at a time
+			Block,
+			// Render one frame at a time; slow, but useful as a reference to compare against
+			PerFrame
+		};
+
+		enum class OutputFormat
+		{
+			Vorbis,
+			// 32-bit float WAV, with the loop in a smpl chunk
+			Wav,
+			// Headerless 32-bit float frames, with a JSON sidecar describing them
+			Raw
+		};
+
+		constexpr static float s_defaultVorbisQuality = 0.4f;
+
+		// The settings that can differ between renders sharing the same soundfont
+		struct RenderSettings
+		{
+			LoopMode m_loopMode;
+			int m_endingBeatDivision;
+			// From -0.1 to 1; only used for Vorbis output
+			float m_vorbisQuality = s_defaultVorbisQuality;
+		};
+
+		// The parts of a render, in the order they happen
+		enum class RenderPhase
+		{
+			SongBody,
+			// Voices ringing out after the end of the song
+			Runoff,
+			// Everything after the runoff that makes the loop seamless
+			Loop
+		};
+
+		// Called from the rendering thread with the fraction of the render that's done so far
+		using ProgressCallback = std::function<void(double)>;
+		// Called from the rendering thread as each phase of a render starts
+		using PhaseCallback = std::function<void(RenderPhase)>;
+		// Called with each piece of a render's output in order
+		using OutputCallback = std::function<void(const unsigned char*, size_t)>;
+
+		MIDIVorbisRenderer(LoopMode loopMode = LoopMode::None, int endingBeatDivision = -1, RenderMode renderMode = RenderMode::Block);
 
 		void loadSoundfont(std::string soundfontPath);
+		// Loads the soundfont the first time a render needs it, so renders that all come from
+		// the render cache never load it at all
+		void deferSoundfontLoad(std::string soundfontPath);
 
-		void renderFile(std::string sourcePath, std::string outputPath);
+		RenderResult renderFile(std::string sourcePath, std::string outputPath);
+		// The render stops with an exception soon after isCancelled is set
+		RenderResult renderFile(std::string sourcePath, std::string outputPath, const RenderSettings& settings,
+			const ProgressCallback& progressCallback = nullptr, const std::atomic<bool>* isCancelled = nullptr,
+			const PhaseCallback& phaseCallback = nullptr);
+		// Renders the contents of a MIDI file that's already been read, naming it sourceName in errors
+		RenderResult renderData(const std::string& sourceName, const std::vector<unsigned char>& midiData, std::string outputPath,
+			const RenderSettings& settings, const ProgressCallback& progressCallback = nullptr, const std::atomic<bool>* isCancelled = nullptr,
+			const PhaseCallback& phaseCallback = nullptr);
+		// Renders the contents of a MIDI file, passing the output to outputCallback in order. These renders are
+		// never cached. Streaming renders pass the output on as it's encoded when the start of the file doesn't
+		// depend on the rest of it (unlooped Vorbis or raw renders), and once the render is done otherwise.
+		RenderResult renderMemory(const std::vector<unsigned char>& midiData, const OutputCallback& outputCallback, const RenderSettings& settings,
+			const ProgressCallback& progressCallback = nullptr, const std::atomic<bool>* isCancelled = nullptr,
+			const PhaseCallback& phaseCallback = nullptr);
 
 		bool getHasSoundfont();
+		const RenderSettings& getSettings() const;
+		// Sets the quality in the settings renders use when they aren't given their own
+		void setVorbisQuality(float quality);
+
+		void setOutputFormat(OutputFormat outputFormat);
+		// The extension, with its leading dot, that files in the format are usually given
+		static std::string getOutputExtension(OutputFormat outputFormat);
+
+		// Sends FluidSynth's log messages to stderr, which its default handler doesn't do on every platform,
+		// so that renders written to stdout don't have warnings mixed into them
+		static void setSynthLogToStandardError();
+
+		// Runs synthesis and encoding on separate threads for each file
+		void setPipelined(bool isPipelined);
+
+		// Writes pages to the output file as they're encoded instead of all at once at the end,
+		// so memory use doesn't grow with the length of the song
+		void setStreaming(bool isStreaming);
+
+		// Encodes each file on this many threads by cutting it into segments and joining them back
+		// together, which speeds up long songs. Songs shorter than a segment use just one thread.
+		void setEncoderThreadCount(unsigned int threadCount);
+
+		// Ends the voice runoff after the song once it's stayed below floorDecibels (relative to full scale)
+		// for a while, or once it's run for maxSeconds, or 0 for no limit, even if voices are still playing.
+		// Runoff below the floor at the very end is left out of the output.
+		void setRunoffLimits(double floorDecibels, double maxSeconds);
+		// Below 16-bit resolution, so the runoff that's cut can't be heard in any format
+		constexpr static double s_defaultRunoffFloorDecibels = -96.0;
+		constexpr static double s_defaultMaxRunoffSeconds = 30.0;
+
+		// Double loops keep up to this many bytes of the first pass for each render, to copy into the second
+		// pass once the passes converge. Longer loops have their second pass synthesized, and 0 always does.
+		void setLoopCopyMemory(size_t bytesPerRender);
+		// Twenty-five minutes of stereo float audio, about 505 MB. The command line tool shares this between
+		// the renders it runs at once.
+		constexpr static size_t s_defaultLoopCopyMemory = static_cast<size_t>(SongRenderContainer::s_sampleRate * 60 * 25) * 2 * sizeof(float);
+
+		// Measures each render's integrated loudness as it's synthesized and scales it to targetLoudness in LUFS,
+		// or as close as it can get without its true peak going over truePeakCeiling in dBTP. The whole render
+		// is held in memory until it's been measured, even when streaming.
+		void setNormalization(double targetLoudness, double truePeakCeiling = s_defaultTruePeakCeiling);
+		// EBU R128's maximum true peak, which leaves room for lossy encoding to overshoot
+		constexpr static double s_defaultTruePeakCeiling = -1.0;
+
+		// Times each stage of every render and returns the timings with the render's result
+		void setCollectingStats(bool isCollectingStats);
+
+		// Copies renders from the cache when nothing that affects them has changed and adds
+		// new renders to it. The cache must outlive every render.
+		void setRenderCache(RenderCache* renderCache);
 	private:
-		void renderSong(PlayerCallbackData& callbackData, std::string fileName, OggVorbisEncoder& encoder, uint64_t& loopStart, uint64_t& songLength);
+		utils::FNV1aHash getRenderHash(const std::vector<unsigned char>& midiData, const RenderSettings& settings, bool isStreaming);
+		void loadSoundfontFile(const std::string& soundfontPath);
+		void loadPendingSoundfont();
+		void requireSoundfont();
+		std::unique_ptr<AudioFileEncoder> createEncoder(const utils::FNV1aHash& renderHash, const RenderSettings& settings);
+		static std::string getSoundfontIdentity(const std::string& soundfontPath);
+
+		// Renders the song into the encoder and completes its stream, filling in the result's frame counts
+		void encodeSong(const std::string& sourceName, const std::vector<unsigned char>& midiData, const RenderSettings& settings,
+			const ProgressCallback& progressCallback, const PhaseCallback& phaseCallback, const std::atomic<bool>* isCancelled, RenderStats* stats,
+			AudioFileEncoder& encoder, RenderResult& result);
+		void renderSong(PlayerCallbackData& callbackData, const std::string& sourceName, const std::vector<unsigned char>& midiData, const RenderSettings& settings, const ProgressCallback& progressCallback,
+			const PhaseCallback& phaseCallback, const std::atomic<bool>* isCancelled, RenderStats* stats, AudioSink& outputSink, uint64_t& loopStart, uint64_t& songLength,
+			uint64_t& trimmedRunoffFrames);
 
-		void renderShortLoop(SongRenderContainer& songRenderer, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder,
-			uint64_t loopStartSample, size_t overlapSamples, uint64_t& samplePosition, uint64_t& loopPoint);
+		// Plays out the voices left at the end of the song into the sink's overlap region, returning how many frames were kept
+		// and setting trimmedFrameCount to how many were dropped for being below the floor at the end
+		size_t renderRunoff(SongRenderContainer& songRenderer, RenderStats* stats, AudioSink& encoder, uint64_t& trimmedFrameCount);
 
-		void renderDoubleLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData,
-			float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder,
+		// Leaves out the first quietNoteOnCount note ons on the way back to the loop point
+		void renderShortLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData, RenderStats* stats, RenderBuffer& buffer, AudioSink& encoder,
+			uint64_t loopStartSample, size_t quietNoteOnCount, size_t overlapSamples, uint64_t& samplePosition, uint64_t& loopPoint);
+
+		void renderDoubleLoop(SongRenderContainer& songRenderer, PlayerCallbackData& callbackData, const MIDIAnalysis* analysis, RenderStats* stats, const LoopRecording& loopRecording,
+			int endingBeatDivision, RenderBuffer& buffer, AudioSink& encoder,
 			uint64_t& loopPoint, uint64_t& samplePosition, int& lastTempo, uint64_t& lastTempoSample);
 
-		void renderToBeatDivision(SongRenderContainer& songRenderer, uint64_t& samplePosition, uint64_t lastTempoSample, int lastTempo, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder);
+		void recordLoopStep(SongRenderContainer& songRenderer, LoopRecording& loopRecording, uint64_t frame);
+		// Writes the rest of the first pass in place of the second pass from the frame after the given one,
+		// or returns false if the first pass doesn't have enough padding at the end to do so
+		bool copyConvergedLoop(const LoopRecording& loopRecording, int endingBeatDivision, uint64_t frame, RenderBuffer& buffer, AudioSink& encoder,
+			uint64_t& samplePosition, int& lastTempo, uint64_t& lastTempoSample);
+
+		void renderToBeatDivision(SongRenderContainer& songRenderer, int endingBeatDivision, uint64_t& samplePosition, uint64_t lastTempoSample, int lastTempo,
+			RenderBuffer& buffer, AudioSink& encoder);
 
-		void readSampleFromSynth(SongRenderContainer& songRenderer, float* leftBuffer, float* rightBuffer, size_t& bufferIndex, OggVorbisEncoder& encoder);
+		// Without an analysis of the song, steps never go past the start of the next synth block
+		size_t getRenderStepSize(SongRenderContainer& songRenderer, const MIDIAnalysis* analysis = nullptr);
 
-		void flushBuffersToEncoder(float* leftBuffer, float* rightBuffer, size_t& bufferLength, OggVorbisEncoder& encoder);
+		void readFramesFromSynth(SongRenderContainer& songRenderer, size_t frameCount, RenderBuffer& buffer, AudioSink& encoder,
+			FrameComparison* comparison = nullptr);
+		// Reads a step from getRenderStepSize. While no voices are playing, every whole synth block in the
+		// step is silent, so the synth is only advanced over them and zeros are written instead.
+		void readStepFromSynth(SongRenderContainer& songRenderer, const MIDIAnalysis* analysis, RenderStats* stats, size_t frameCount,
+			RenderBuffer& buffer, AudioSink& encoder, FrameComparison* comparison = nullptr);
+		void writeSilence(size_t frameCount, RenderBuffer& buffer, AudioSink& encoder, FrameComparison* comparison);
+
+		void flushBuffersToEncoder(RenderBuffer& buffer, AudioSink& encoder);
 
-		static void loadMIDIFile(std::string &fileName, fluid_player_t* loopPlayer);
 		static int playerEventCallback(fluid_player_t* player, fluid_synth_t* synth,
 			void* data, fluid_midi_event_t* event);
 
-		LoopMode m_loopMode;
-		int m_endingBeatDivision;
+		RenderSettings m_settings;
+		RenderMode m_renderMode;
+		OutputFormat m_outputFormat;
+		bool m_isPipelined;
+		bool m_isStreaming;
+		unsigned int m_encoderThreadCount;
+		bool m_isCollectingStats;
+		RenderCache* m_renderCache;
+		float m_runoffFloor;
+		uint64_t m_maxRunoffFrames;
+		size_t m_maxRetainedLoopFrames;
+		bool m_isNormalizing;
+		double m_targetLoudness;
+		double m_truePeakCeiling;
+
+		std::mutex m_soundfontMutex;
+		std::string m_pendingSoundfontPath;
+		std::string m_soundfontIdentity;
 
 		// While this synth isn't used to do any synthesis, this is the only way I see to
 		// create a soundfont to share between synth instances
@@ -60,6 +261,17 @@ namespace midirenderer
 		deleter_unique_ptr<fluid_synth_t> m_synth;
 
 		constexpr static size_t s_audioBufferSize = 1024;
+		// Bump this whenever a change to the renderer changes what it outputs, so that renders
+		// cached by older versions aren't used
+		constexpr static uint64_t s_renderFormatVersion = 5;
 		constexpr static size_t s_loopClickBufferSize = 128;
+		// How long the runoff has to stay below the floor before it's ended, so voices that dip in volume
+		// before coming back up, like tremolos and looped samples, aren't cut short
+		constexpr static size_t s_runoffQuietWindow = static_cast<size_t>(SongRenderContainer::s_sampleRate / 2);
+		// How long the runoff takes to fade out when it's cut off by the time limit
+		constexpr static size_t s_runoffFadeFrames = static_cast<size_t>(SongRenderContainer::s_sampleRate / 50);
+		constexpr static int s_maxConvergenceVoiceCount = 2;
+		// How many frames before a convergence point must be identical in both passes
+		constexpr static size_t s_convergenceCheckFrames = 1024;
 	};
 }
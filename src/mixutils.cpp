@@ -0,0 +1,148 @@
+#include "mixutils.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MIXUTILS_X64 1
+#include <immintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MIXUTILS_AVX_FUNCTION __attribute__((target("avx")))
+#else
+#define MIXUTILS_AVX_FUNCTION
+#endif
+
+namespace midirenderer::utils
+{
+	namespace
+	{
+		typedef void (*AddFramesFunc)(float* destination, const float* source, size_t frameCount);
+		typedef float (*GetPeakFunc)(const float* frames, size_t frameCount);
+
+		void addFramesScalar(float* destination, const float* source, size_t frameCount)
+		{
+			for (size_t i = 0; i < frameCount; i++)
+			{
+				destination[i] = source[i] + destination[i];
+			}
+		}
+
+		float getPeakScalar(const float* frames, size_t frameCount)
+		{
+			float peak = 0.0f;
+			for (size_t i = 0; i < frameCount; i++)
+			{
+				peak = std::max(peak, std::fabs(frames[i]));
+			}
+			return peak;
+		}
+
+#if MIXUTILS_X64
+		// SSE2 is part of x86-64, so this is the fallback on every x86-64 processor
+		void addFramesSSE(float* destination, const float* source, size_t frameCount)
+		{
+			size_t i = 0;
+			for (; i + 4 <= frameCount; i += 4)
+			{
+				__m128 sum = _mm_add_ps(_mm_loadu_ps(&source[i]), _mm_loadu_ps(&destination[i]));
+				_mm_storeu_ps(&destination[i], sum);
+			}
+			addFramesScalar(&destination[i], &source[i], frameCount - i);
+		}
+
+		MIXUTILS_AVX_FUNCTION void addFramesAVX(float* destination, const float* source, size_t frameCount)
+		{
+			size_t i = 0;
+			for (; i + 8 <= frameCount; i += 8)
+			{
+				__m256 sum = _mm256_add_ps(_mm256_loadu_ps(&source[i]), _mm256_loadu_ps(&destination[i]));
+				_mm256_storeu_ps(&destination[i], sum);
+			}
+			addFramesScalar(&destination[i], &source[i], frameCount - i);
+		}
+
+		float getPeakSSE(const float* frames, size_t frameCount)
+		{
+			// Clearing the sign bit gives the absolute value
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			__m128 peaks = _mm_setzero_ps();
+			size_t i = 0;
+			for (; i + 4 <= frameCount; i += 4)
+			{
+				peaks = _mm_max_ps(peaks, _mm_and_ps(_mm_loadu_ps(&frames[i]), absMask));
+			}
+
+			float lanes[4];
+			_mm_storeu_ps(lanes, peaks);
+			float peak = std::max({ lanes[0], lanes[1], lanes[2], lanes[3] });
+			return std::max(peak, getPeakScalar(&frames[i], frameCount - i));
+		}
+
+		MIXUTILS_AVX_FUNCTION float getPeakAVX(const float* frames, size_t frameCount)
+		{
+			const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			__m256 peaks = _mm256_setzero_ps();
+			size_t i = 0;
+			for (; i + 8 <= frameCount; i += 8)
+			{
+				peaks = _mm256_max_ps(peaks, _mm256_and_ps(_mm256_loadu_ps(&frames[i]), absMask));
+			}
+
+			float lanes[8];
+			_mm256_storeu_ps(lanes, peaks);
+			float peak = *std::max_element(lanes, lanes + 8);
+			return std::max(peak, getPeakScalar(&frames[i], frameCount - i));
+		}
+
+		bool getHasAVX()
+		{
+#if _MSC_VER
+			// The processor has to support AVX and the OS has to save the AVX registers
+			int cpuInfo[4];
+			__cpuid(cpuInfo, 1);
+			bool hasAVX = (cpuInfo[2] & (1 << 28)) != 0;
+			bool hasOSXSave = (cpuInfo[2] & (1 << 27)) != 0;
+			return hasAVX && hasOSXSave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+			return __builtin_cpu_supports("avx");
+#endif
+		}
+#endif
+
+		AddFramesFunc chooseAddFrames()
+		{
+#if MIXUTILS_X64
+			return getHasAVX() ? addFramesAVX : addFramesSSE;
+#else
+			// Left to the compiler to vectorize
+			return addFramesScalar;
+#endif
+		}
+
+		GetPeakFunc chooseGetPeak()
+		{
+#if MIXUTILS_X64
+			return getHasAVX() ? getPeakAVX : getPeakSSE;
+#else
+			return getPeakScalar;
+#endif
+		}
+	}
+
+	void addFrames(float* destination, const float* source, size_t frameCount)
+	{
+		static const AddFramesFunc s_addFrames = chooseAddFrames();
+		s_addFrames(destination, source, frameCount);
+	}
+
+	float getPeak(const float* frames, size_t frameCount)
+	{
+		static const GetPeakFunc s_getPeak = chooseGetPeak();
+		return s_getPeak(frames, frameCount);
+	}
+}
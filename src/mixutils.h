@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+namespace midirenderer::utils
+{
+	// Adds each source frame to the destination frame at the same position, using the widest
+	// vector instructions the processor supports. Sums are identical to adding one frame at a time.
+	void addFrames(float* destination, const float* source, size_t frameCount);
+
+	// The largest absolute value of any of the frames, or 0 if there are none
+	float getPeak(const float* frames, size_t frameCount);
+}
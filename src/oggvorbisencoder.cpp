@@ -8,8 +8,10 @@
 
 #include <vorbis/vorbisenc.h>
 
-OggVorbisEncoder::OggVorbisEncoder(int streamID, long sampleRate, float quality) : m_isComplete(false),
-	m_streamID(streamID), m_isWritingOverlapRegion(false), m_overlapOffset(0)
+#include "segmentedvorbisencoder.h"
+
+OggVorbisEncoder::OggVorbisEncoder(int streamID, long sampleRate, float quality) :
+	m_streamID(streamID), m_sampleRate(sampleRate), m_quality(quality), m_isStreaming(false), m_reservedCommentSize(0)
 {
 	vorbis_info_init(&m_info);
 	int status = vorbis_encode_init_vbr(&m_info, 2, sampleRate, quality);
@@ -27,6 +29,8 @@ OggVorbisEncoder::OggVorbisEncoder(int streamID, long sampleRate, float quality)
 
 OggVorbisEncoder::~OggVorbisEncoder()
 {
+	// Stopped first, since it writes into the stream
+	m_segmentedEncoder.reset();
 	ogg_stream_clear(&m_stream);
 	vorbis_block_clear(&m_block);
 	vorbis_dsp_clear(&m_dspState);
@@ -34,62 +38,38 @@ OggVorbisEncoder::~OggVorbisEncoder()
 	vorbis_info_clear(&m_info);
 }
 
-bool OggVorbisEncoder::getIsComplete() { return m_isComplete; }
-
 void OggVorbisEncoder::addComment(std::string tag, std::string contents)
 {
 	vorbis_comment_add_tag(&m_comment, tag.c_str(), contents.c_str());
 }
 
-void OggVorbisEncoder::writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+void OggVorbisEncoder::setLoopPoints(uint64_t loopStart, uint64_t loopLength)
 {
-	throwIfComplete();
+	addComment("LOOPSTART", std::to_string(loopStart));
+	addComment("LOOPLENGTH", std::to_string(loopLength));
+}
 
-	if (m_isWritingOverlapRegion)
+void OggVorbisEncoder::startStreaming(const OutputCallbackFunc& output)
+{
+	throwIfComplete();
+	if (m_isStreaming)
 	{
-		m_overlapBuffers[0].insert(m_overlapBuffers[0].end(), &leftBuffer[0], &leftBuffer[frameCount]);
-		m_overlapBuffers[1].insert(m_overlapBuffers[1].end(), &rightBuffer[0], &rightBuffer[frameCount]);
-		m_overlapOffset += frameCount;
+		throw std::runtime_error("Attempted to start streaming a Vorbis encoder twice");
 	}
-	else
-	{
-		size_t sourceFrameOffset = 0;
-		const size_t overlapBufferSize = m_overlapBuffers[0].size();
 
-		while (m_overlapOffset > 0 && sourceFrameOffset < frameCount)
-		{
-			m_overlapBuffers[0][overlapBufferSize - m_overlapOffset] += leftBuffer[sourceFrameOffset];
-			m_overlapBuffers[1][overlapBufferSize - m_overlapOffset] += rightBuffer[sourceFrameOffset];
-			m_overlapOffset--;
-			sourceFrameOffset++;
-		}
-
-		if (m_overlapOffset == 0 && sourceFrameOffset > 0)
-		{
-			// Exhausted the buffer overlap - it can be written now
-			encodeBuffers(m_overlapBuffers[0].data(), m_overlapBuffers[1].data(), overlapBufferSize);
-			m_overlapBuffers[0].clear();
-			m_overlapBuffers[1].clear();
-		}
-
-		if (sourceFrameOffset < frameCount)
-		{
-			encodeBuffers(&leftBuffer[sourceFrameOffset], &rightBuffer[sourceFrameOffset], frameCount - sourceFrameOffset);
-		}
-	}
-}
+	ogg_packet header;
+	ogg_packet commentsHeader;
+	ogg_packet codebookHeader;
+	vorbis_analysis_headerout(&m_dspState, &m_comment, &header, &commentsHeader, &codebookHeader);
 
-void OggVorbisEncoder::startOverlapRegion()
-{
-	m_isWritingOverlapRegion = true;
-}
+	m_reservedCommentSize = commentsHeader.bytes + s_streamingCommentReserve;
+	readHeader(output);
 
-void OggVorbisEncoder::endOverlapRegion()
-{
-	m_isWritingOverlapRegion = false;
+	m_isStreaming = true;
+	m_streamOutput = output;
 }
 
-void OggVorbisEncoder::readHeader(const PageCallbackFunc& pageCallback)
+void OggVorbisEncoder::readHeader(const OutputCallbackFunc& output)
 {
 	ogg_stream_state headerStream;
 	ogg_stream_init(&headerStream, m_streamID);
@@ -99,6 +79,25 @@ void OggVorbisEncoder::readHeader(const PageCallbackFunc& pageCallback)
 	ogg_packet codebookHeader;
 
 	vorbis_analysis_headerout(&m_dspState, &m_comment, &header, &commentsHeader, &codebookHeader);
+
+	// Decoders stop reading the comment header after its framing bit, so padding it with
+	// zeroes to a fixed size doesn't change its contents but keeps the header's page layout
+	// the same no matter which comments it holds
+	std::vector<unsigned char> paddedComments;
+	if (m_reservedCommentSize > 0)
+	{
+		if (commentsHeader.bytes > m_reservedCommentSize)
+		{
+			ogg_stream_clear(&headerStream);
+			throw std::runtime_error("The stream's comments don't fit in the space reserved for them");
+		}
+
+		paddedComments.assign(commentsHeader.packet, commentsHeader.packet + commentsHeader.bytes);
+		paddedComments.resize(m_reservedCommentSize, 0);
+		commentsHeader.packet = paddedComments.data();
+		commentsHeader.bytes = m_reservedCommentSize;
+	}
+
 	ogg_stream_packetin(&headerStream, &header);
 	ogg_stream_packetin(&headerStream, &commentsHeader);
 	ogg_stream_packetin(&headerStream, &codebookHeader);
@@ -106,92 +105,152 @@ void OggVorbisEncoder::readHeader(const PageCallbackFunc& pageCallback)
 	ogg_page page;
 	while (ogg_stream_flush(&headerStream, &page) != 0)
 	{
-		executePageCallback(pageCallback, page);
+		writePage(output, page);
 	}
 
 	ogg_stream_clear(&headerStream);
 }
 
-void OggVorbisEncoder::readStreamPages(const PageCallbackFunc& pageCallback)
+void OggVorbisEncoder::readStreamPages(const OutputCallbackFunc& output)
 {
 	ogg_page page;
 	while (ogg_stream_pageout(&m_stream, &page) != 0)
 	{
-		executePageCallback(pageCallback, page);
+		writePage(output, page);
 	}
 }
 
-void OggVorbisEncoder::completeStream(const PageCallbackFunc& pageCallback)
+void OggVorbisEncoder::readEncodedData(const OutputCallbackFunc& output)
 {
-	throwIfComplete();
-	m_isComplete = true;
-	m_isWritingOverlapRegion = false;
+	readStreamPages(output);
+}
 
-	if (m_overlapOffset > 0)
+void OggVorbisEncoder::finishStream()
+{
+	if (m_segmentedEncoder)
 	{
-		encodeBuffers(m_overlapBuffers[0].data(), m_overlapBuffers[1].data(), m_overlapBuffers[0].size());
-		m_overlapBuffers[0].clear();
-		m_overlapBuffers[1].clear();
-		m_overlapOffset = 0;
+		midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Encoding);
+		m_segmentedEncoder->finish();
+	}
+	else
+	{
+		vorbis_analysis_wrote(&m_dspState, 0);
+		flushBufferToStream();
 	}
 
-	vorbis_analysis_wrote(&m_dspState, 0);
-
-	flushBufferToStream();
+	if (m_isStreaming)
+	{
+		readStreamPages(m_streamOutput);
+	}
+}
 
-	readStreamPages(pageCallback);
+void OggVorbisEncoder::writePage(const OutputCallbackFunc& output, const ogg_page& page)
+{
+	output(page.header, static_cast<size_t>(page.header_len));
+	output(page.body, static_cast<size_t>(page.body_len));
 }
 
-void OggVorbisEncoder::executePageCallback(const PageCallbackFunc& pageCallback, const ogg_page& page)
+void OggVorbisEncoder::acquireEncoderBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
 {
-	pageCallback(page.header, page.header_len, page.body, page.body_len);
+	if (m_segmentedEncoder)
+	{
+		m_segmentedEncoder->acquireBuffers(frameCount, leftBuffer, rightBuffer);
+		return;
+	}
+
+	float** buffer = vorbis_analysis_buffer(&m_dspState, static_cast<int>(frameCount));
+	leftBuffer = buffer[0];
+	rightBuffer = buffer[1];
 }
 
-void OggVorbisEncoder::encodeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+void OggVorbisEncoder::encodeAcquiredBuffers(size_t frameCount)
 {
-	float** buffer = vorbis_analysis_buffer(&m_dspState, frameCount);
+	if (m_segmentedEncoder)
+	{
+		{
+			// Waiting for segments to finish counts as encoding; their analysis is added to the stats as they're joined
+			midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Encoding);
+			m_segmentedEncoder->commitBuffers(frameCount);
+		}
 
-	std::copy(leftBuffer, &leftBuffer[frameCount], buffer[0]);
-	std::copy(rightBuffer, &rightBuffer[frameCount], buffer[1]);
+		if (m_isStreaming)
+		{
+			readStreamPages(m_streamOutput);
+		}
+		return;
+	}
 
-	vorbis_analysis_wrote(&m_dspState, frameCount);
+	if (frameCount == 0) { return; }
+
+	{
+		midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Encoding);
+		vorbis_analysis_wrote(&m_dspState, static_cast<int>(frameCount));
+	}
 
 	flushBufferToStream();
 }
 
 void OggVorbisEncoder::flushBufferToStream()
 {
-	while (true)
 	{
-		int blockStatus = vorbis_analysis_blockout(&m_dspState, &m_block);
-		if (blockStatus == 0) { break; }
-		else if (blockStatus < 0)
-		{
-			throw std::runtime_error("Failed to read an audio block while encoding");
-		}
-
-		// This is only used when using bitrate management but it's
-		// considered good practice even when not using bitrate management
-		// https://xiph.org/vorbis/doc/libvorbis/vorbis_analysis.html
-		vorbis_analysis(&m_block, nullptr);
-		vorbis_bitrate_addblock(&m_block);
-
+		// Pages written while streaming are timed separately by whatever writes them
+		midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Analysis);
 		while (true)
 		{
-			ogg_packet packet;
-			int packetStatus = vorbis_bitrate_flushpacket(&m_dspState, &packet);
-			if (packetStatus == 0) { break; }
-			else if (packetStatus < 0)
+			int blockStatus = vorbis_analysis_blockout(&m_dspState, &m_block);
+			if (blockStatus == 0) { break; }
+			else if (blockStatus < 0)
 			{
-				throw std::runtime_error("Failed to read a packet audio block while encoding");
+				throw std::runtime_error("Failed to read an audio block while encoding");
 			}
 
-			ogg_stream_packetin(&m_stream, &packet);
+			// This is only used when using bitrate management but it's
+			// considered good practice even when not using bitrate management
+			// https://xiph.org/vorbis/doc/libvorbis/vorbis_analysis.html
+			vorbis_analysis(&m_block, nullptr);
+			vorbis_bitrate_addblock(&m_block);
+
+			while (true)
+			{
+				ogg_packet packet;
+				int packetStatus = vorbis_bitrate_flushpacket(&m_dspState, &packet);
+				if (packetStatus == 0) { break; }
+				else if (packetStatus < 0)
+				{
+					throw std::runtime_error("Failed to read a packet audio block while encoding");
+				}
+
+				ogg_stream_packetin(&m_stream, &packet);
+			}
 		}
 	}
+
+	if (m_isStreaming)
+	{
+		readStreamPages(m_streamOutput);
+	}
 }
 
-void OggVorbisEncoder::throwIfComplete()
+void OggVorbisEncoder::setStats(midirenderer::RenderStats* stats)
 {
-	if (m_isComplete) { throw std::runtime_error("Attempted to use a completed Vorbis encoder"); }
-}
\ No newline at end of file
+	AudioFileEncoder::setStats(stats);
+	if (m_segmentedEncoder)
+	{
+		m_segmentedEncoder->setStats(stats);
+	}
+}
+
+void OggVorbisEncoder::setEncoderThreadCount(unsigned int threadCount)
+{
+	if (threadCount <= 1)
+	{
+		m_segmentedEncoder.reset();
+		return;
+	}
+
+	// The segmented encoder's packets go into the same stream the headers come from, since
+	// every encoder set up with the same quality writes the same headers
+	m_segmentedEncoder = std::make_unique<SegmentedVorbisEncoder>(m_sampleRate, m_quality, threadCount,
+		[this](ogg_packet& packet) { ogg_stream_packetin(&m_stream, &packet); });
+	m_segmentedEncoder->setStats(m_stats);
+}
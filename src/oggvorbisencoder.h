@@ -1,47 +1,66 @@
 #pragma once
 #include <memory>
-#include <array>
-#include <functional>
+#include <string>
 
 #include <vorbis/codec.h>
 
-class OggVorbisEncoder
+#include "audiofileencoder.h"
+#include "renderstats.h"
+
+class SegmentedVorbisEncoder;
+
+class OggVorbisEncoder : public AudioFileEncoder
 {
 public:
-	typedef std::function<void(const unsigned char*, long, const unsigned char*, long)> PageCallbackFunc;
-
 	OggVorbisEncoder(int streamID, long sampleRate, float quality);
 	~OggVorbisEncoder();
 
-	bool getIsComplete();
-
 	void addComment(std::string tag, std::string contents);
+	// Stored as the LOOPSTART and LOOPLENGTH comments
+	void setLoopPoints(uint64_t loopStart, uint64_t loopLength) override;
 
-	void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
-	void startOverlapRegion();
-	void endOverlapRegion();
+	// Writes a placeholder header right away and passes every page to the callback as soon
+	// as it's complete instead of keeping the stream in memory. Comments added afterwards are
+	// written by a final readHeader call whose pages have the same layout and size as the
+	// placeholder's, so they can be written over it.
+	void startStreaming(const OutputCallbackFunc& output) override;
 
-	void readHeader(const PageCallbackFunc& pageCallback);
-	void readStreamPages(const PageCallbackFunc& pageCallback);
-	void completeStream(const PageCallbackFunc& pageCallback);
+	// Times encoding and analysis into the stats, which must outlive the encoder
+	void setStats(midirenderer::RenderStats* stats) override;
 
-private:
-	static void executePageCallback(const PageCallbackFunc& pageCallback, const ogg_page& page);
-	void encodeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
-	void flushBufferToStream();
+	// Encodes on this many threads by cutting the stream into segments (see SegmentedVorbisEncoder).
+	// Only worth it for long streams, and has to be set before anything is written.
+	void setEncoderThreadCount(unsigned int threadCount);
 
-	void throwIfComplete();
+	void readHeader(const OutputCallbackFunc& output) override;
+	void readEncodedData(const OutputCallbackFunc& output) override;
 
-	bool m_isComplete;
+protected:
+	// Frames are rendered straight into libvorbis' analysis buffer, or the segmented encoder's
+	void acquireEncoderBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void encodeAcquiredBuffers(size_t frameCount) override;
+	void finishStream() override;
+
+private:
+	static void writePage(const OutputCallbackFunc& output, const ogg_page& page);
+	void readStreamPages(const OutputCallbackFunc& output);
+	void flushBufferToStream();
 
 	int m_streamID;
+	long m_sampleRate;
+	float m_quality;
 	vorbis_info m_info;
 	vorbis_comment m_comment;
 	vorbis_dsp_state m_dspState;
 	vorbis_block m_block;
 	ogg_stream_state m_stream;
 
-	std::array<std::vector<float>, 2> m_overlapBuffers;
-	bool m_isWritingOverlapRegion;
-	size_t m_overlapOffset;
+	std::unique_ptr<SegmentedVorbisEncoder> m_segmentedEncoder;
+
+	bool m_isStreaming;
+	OutputCallbackFunc m_streamOutput;
+	long m_reservedCommentSize;
+
+	// Room left in the placeholder comment header for comments added while streaming
+	constexpr static long s_streamingCommentReserve = 256;
 };
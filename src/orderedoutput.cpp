@@ -0,0 +1,39 @@
+#include "orderedoutput.h"
+
+namespace midirenderer::utils
+{
+	OrderedOutput::OrderedOutput(std::ostream& output, size_t entryCount) :
+		m_output(output), m_entries(entryCount, { std::string(), false }), m_nextIndex(0) { }
+
+	void OrderedOutput::write(size_t index, const std::string& text)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (index == m_nextIndex)
+		{
+			m_output << text << std::flush;
+		}
+		else
+		{
+			m_entries.at(index).m_text += text;
+		}
+	}
+
+	void OrderedOutput::finish(size_t index)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.at(index).m_isFinished = true;
+
+		while (m_nextIndex < m_entries.size() && m_entries[m_nextIndex].m_isFinished)
+		{
+			m_nextIndex++;
+			if (m_nextIndex < m_entries.size())
+			{
+				// The next entry becomes the live one, so anything it already wrote goes out now
+				Entry& entry = m_entries[m_nextIndex];
+				m_output << entry.m_text;
+				entry.m_text.clear();
+			}
+		}
+		m_output << std::flush;
+	}
+}
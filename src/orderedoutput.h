@@ -0,0 +1,33 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace midirenderer::utils
+{
+	// Collects text from entries that finish in any order and writes it to the output
+	// in entry order. The earliest unfinished entry's text is written as it arrives so
+	// that progress is still visible while it runs.
+	class OrderedOutput
+	{
+	public:
+		OrderedOutput(std::ostream& output, size_t entryCount);
+
+		void write(size_t index, const std::string& text);
+		void finish(size_t index);
+
+	private:
+		struct Entry
+		{
+			std::string m_text;
+			bool m_isFinished;
+		};
+
+		std::ostream& m_output;
+		std::vector<Entry> m_entries;
+		size_t m_nextIndex;
+		std::mutex m_mutex;
+	};
+}
@@ -0,0 +1,99 @@
+#include "overlapbuffer.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	struct PooledStorage
+	{
+		std::unique_ptr<float[]> m_storage;
+		size_t m_capacity;
+	};
+
+	// Enough for every render running at once on most machines; anything beyond it is freed
+	constexpr size_t s_maxPooledStorage = 16;
+
+	std::mutex s_poolMutex;
+	std::vector<PooledStorage> s_pool;
+}
+
+OverlapBuffer::OverlapBuffer() : m_capacity(0), m_frameCount(0)
+{
+}
+
+OverlapBuffer::~OverlapBuffer()
+{
+	clear();
+}
+
+size_t OverlapBuffer::getFrameCount() const
+{
+	return m_frameCount;
+}
+
+float* OverlapBuffer::getChannel(size_t channel)
+{
+	return &m_storage[channel * m_capacity];
+}
+
+void OverlapBuffer::extend(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	reserve(m_frameCount + frameCount);
+	leftBuffer = &getChannel(0)[m_frameCount];
+	rightBuffer = &getChannel(1)[m_frameCount];
+	m_frameCount += frameCount;
+}
+
+void OverlapBuffer::truncate(size_t frameCount)
+{
+	m_frameCount = std::min(m_frameCount, frameCount);
+}
+
+void OverlapBuffer::clear()
+{
+	m_frameCount = 0;
+	if (!m_storage) { return; }
+
+	std::lock_guard<std::mutex> lock(s_poolMutex);
+	if (s_pool.size() < s_maxPooledStorage)
+	{
+		s_pool.push_back({ std::move(m_storage), m_capacity });
+	}
+	m_storage.reset();
+	m_capacity = 0;
+}
+
+void OverlapBuffer::reserve(size_t frameCount)
+{
+	if (frameCount <= m_capacity) { return; }
+
+	if (!m_storage)
+	{
+		// The largest pooled storage is the most likely to be big enough for the whole region
+		std::lock_guard<std::mutex> lock(s_poolMutex);
+		auto largest = std::max_element(s_pool.begin(), s_pool.end(), [](const PooledStorage& a, const PooledStorage& b)
+			{
+				return a.m_capacity < b.m_capacity;
+			});
+		if (largest != s_pool.end())
+		{
+			m_storage = std::move(largest->m_storage);
+			m_capacity = largest->m_capacity;
+			s_pool.erase(largest);
+		}
+		if (frameCount <= m_capacity) { return; }
+	}
+
+	size_t capacity = std::max({ frameCount, m_capacity * 2, s_minimumCapacity });
+	std::unique_ptr<float[]> storage(new float[capacity * 2]);
+	if (m_frameCount > 0)
+	{
+		std::copy(getChannel(0), getChannel(0) + m_frameCount, &storage[0]);
+		std::copy(getChannel(1), getChannel(1) + m_frameCount, &storage[capacity]);
+	}
+
+	m_storage = std::move(storage);
+	m_capacity = capacity;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+// Stereo frames held back while an overlap region is open. Its storage comes from a pool shared by
+// every overlap buffer and goes back to the pool once the buffer is cleared, so renders after the
+// first seldom allocate at all, even with long runoffs. Growing it never fills the new frames in.
+class OverlapBuffer
+{
+public:
+	OverlapBuffer();
+	~OverlapBuffer();
+
+	OverlapBuffer(const OverlapBuffer& other) = delete;
+	OverlapBuffer& operator=(const OverlapBuffer& other) = delete;
+
+	size_t getFrameCount() const;
+	float* getChannel(size_t channel);
+
+	// Adds room for frameCount frames at the end and points the buffers at it. Pointers from
+	// earlier calls may no longer be valid afterwards.
+	void extend(size_t frameCount, float*& leftBuffer, float*& rightBuffer);
+	// Drops frames from the end until there are frameCount left
+	void truncate(size_t frameCount);
+	// Drops every frame and returns the storage to the pool
+	void clear();
+
+private:
+	void reserve(size_t frameCount);
+
+	// The left channel, then the right channel, each with room for m_capacity frames
+	std::unique_ptr<float[]> m_storage;
+	size_t m_capacity;
+	size_t m_frameCount;
+
+	// About a second and a half of audio
+	constexpr static size_t s_minimumCapacity = 1 << 16;
+};
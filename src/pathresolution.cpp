@@ -1,121 +1,440 @@
 #include "pathresolution.h"
-#include <vector>
-#include <sstream>
+#include <algorithm>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+
+#include "workerpool.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
 namespace midirenderer::utils
 {
-	void enumerateWildcardPath(const fs::path& parentFolder, size_t pathIndex, const vector<string>& pathList,
-		function<void(string)> pathCallback);
-
-	void resolveWildcardedPath(const std::string& path, std::function<void(std::string)> pathCallback)
+	namespace
 	{
-		fs::path fsPath = fs::u8path(path).lexically_normal();
-
-		vector<string> pathComponents;
-
-		fs::path root = fsPath.root_path();
-		if (root.empty()) { root = fs::u8path("."); }
-
-		for (const auto& pathComponent : fsPath.relative_path())
+		// Invalid UTF-8 is read a byte at a time, so names that aren't UTF-8 can still match literally
+		u32string decodeUTF8(const string& text)
 		{
-			pathComponents.push_back(pathComponent.u8string());
-		}
+			u32string decoded;
+			decoded.reserve(text.size());
+			for (size_t i = 0; i < text.size();)
+			{
+				unsigned char lead = static_cast<unsigned char>(text[i]);
+				size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+				char32_t character = length == 1 ? lead : length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+				bool isValid = length > 0 && i + length <= text.size();
+				for (size_t j = 1; isValid && j < length; j++)
+				{
+					unsigned char continuation = static_cast<unsigned char>(text[i + j]);
+					isValid = (continuation >> 6) == 0x2;
+					character = (character << 6) | (continuation & 0x3F);
+				}
 
-#if _WINDOWS
-		// UNC paths for SMB shares need the hostname and share name together
-		// in order to be considered a valid path
-		if (root.lexically_normal().string().at(0) == '\\')
-		{
-			root /= fs::u8path(pathComponents[1]);
-			pathComponents.erase(pathComponents.begin());
+				if (!isValid)
+				{
+					character = lead;
+					length = 1;
+				}
+				decoded.push_back(character);
+				i += length;
+			}
+			return decoded;
 		}
-#endif
-		error_code ec;
-		if (fs::is_directory(root, ec))
+
+		// Walks the folders that could hold matches for one wildcarded path. Each folder is listed at most
+		// once, with the set of components that entries in it could match, so a ** followed by more
+		// wildcards doesn't list the same folders over and over.
+		class PathTraversal
 		{
-			enumerateWildcardPath(root, 0, pathComponents, pathCallback);
-		}
-	}
+		public:
+			PathTraversal(vector<GlobPattern> components, bool isMatchingFolders, const PathFilter& filter, WorkerPool& workers) :
+				m_components(std::move(components)), m_isMatchingFolders(isMatchingFolders), m_filter(filter), m_workers(workers)
+			{
+			}
 
-	void enumerateWildcardPath(const fs::path& parentFolder, size_t pathIndex, const vector<string>& pathList, function<void(string)> pathCallback)
-	{
-		string pathName = pathList.at(pathIndex);
+			void start(const fs::path& root)
+			{
+				vector<size_t> states = getClosure({ 0 });
+				if (binary_search(states.begin(), states.end(), m_components.size()))
+				{
+					addMatch(root);
+				}
+				states.erase(remove(states.begin(), states.end(), m_components.size()), states.end());
+				if (!states.empty())
+				{
+					m_workers.submit([this, root, states]() { visit(root, states); });
+				}
+			}
 
-		// Stop if the final path's name is empty - the folder _is_ the match
-		// This happens when the original search string ends with a directory separator
-		if (pathName.empty())
-		{
-			pathCallback(parentFolder.string());
-		}
+			vector<string> getMatches()
+			{
+				lock_guard<mutex> lock(m_mutex);
+				sort(m_matches.begin(), m_matches.end());
 
-		bool isFinalPath = pathIndex == pathList.size() - 1;
+				vector<string> matches;
+				matches.reserve(m_matches.size());
+				for (const fs::path& match : m_matches)
+				{
+					matches.push_back(match.u8string());
+				}
+				return matches;
+			}
 
-		if (pathName.find('*') == string::npos)
-		{
-			// No wildcards
-			fs::path nextPath = parentFolder / fs::u8path(pathName);
-			if (fs::exists(nextPath))
+		private:
+			// The states are the indices of the components that entries in the folder could match
+			void visit(const fs::path& folder, const vector<size_t>& states)
 			{
-				if (isFinalPath)
+				// A component whose text names an entry as it is matches just that entry, so names with
+				// brackets or question marks in them still find their files
+				vector<size_t> literalStates;
+				bool isListing = false;
+				for (size_t state : states)
 				{
-					pathCallback(nextPath.u8string());
+					const GlobPattern& component = m_components[state];
+					error_code ec;
+					if (!component.getIsRecursive() && (!component.getHasWildcards() || fs::exists(folder / fs::u8path(component.getText()), ec)))
+					{
+						literalStates.push_back(state);
+					}
+					else
+					{
+						isListing = true;
+					}
 				}
-				else if (fs::is_directory(nextPath))
+
+				if (!isListing)
 				{
-					enumerateWildcardPath(nextPath, pathIndex + 1, pathList, pathCallback);
+					// Components taken literally name their entry, which saves listing big folders
+					for (size_t state : literalStates)
+					{
+						fs::path entryPath = folder / fs::u8path(m_components[state].getText());
+						error_code ec;
+						fs::file_status status = fs::status(entryPath, ec);
+						if (fs::exists(status))
+						{
+							visitEntry(entryPath, status, false, { state + 1 });
+						}
+					}
+					return;
 				}
-			}
-			return;
-		}
 
-		// Resolve wildcards
-		stringstream pathNameStream = std::stringstream(pathName);
-		string nameFragment;
-		vector<string> nameFragments;
-		while (getline(pathNameStream, nameFragment, '*'))
-		{
-			nameFragments.push_back(nameFragment);
-		}
+				// Folders that can't be read are skipped like they're empty
+				error_code ec;
+				for (fs::directory_iterator entry(folder, ec), end; !ec && entry != end; entry.increment(ec))
+				{
+					string filename = entry->path().filename().u8string();
+					vector<size_t> nextStates;
+					for (size_t state : states)
+					{
+						const GlobPattern& component = m_components[state];
+						if (component.getIsRecursive())
+						{
+							nextStates.push_back(state);
+						}
+						else if (binary_search(literalStates.begin(), literalStates.end(), state) ? filename == component.getText() : component.matches(filename))
+						{
+							nextStates.push_back(state + 1);
+						}
+					}
+					if (nextStates.empty()) { continue; }
 
-		for (const auto& entry : fs::directory_iterator(parentFolder))
-		{
-			// Skip files when still following directories
-			// and all other non-file non-directory entries
-			if (entry.is_regular_file())
+					error_code statusError;
+					fs::file_status status = entry->status(statusError);
+					visitEntry(entry->path(), status, entry->is_symlink(statusError), nextStates);
+				}
+			}
+
+			void visitEntry(const fs::path& path, fs::file_status status, bool isSymlink, vector<size_t> states)
 			{
-				if (!isFinalPath) { continue; }
+				bool isDirectory = fs::is_directory(status);
+				if (!isDirectory && !fs::is_regular_file(status)) { return; }
+
+				states = getClosure(std::move(states));
+				auto matchedState = find(states.begin(), states.end(), m_components.size());
+				if (matchedState != states.end())
+				{
+					states.erase(matchedState);
+					if (isDirectory || !m_isMatchingFolders)
+					{
+						addMatch(path);
+					}
+				}
+
+				if (!isDirectory) { return; }
+
+				// ** doesn't follow links, which could lead back into the folders it's already walking
+				if (isSymlink)
+				{
+					states.erase(remove_if(states.begin(), states.end(), [this](size_t state) { return m_components[state].getIsRecursive(); }), states.end());
+				}
+				if (!states.empty())
+				{
+					m_workers.submit([this, path, states]() { visit(path, states); });
+				}
 			}
-			else if (!entry.is_directory()) { continue; }
 
-			string filename = entry.path().filename().u8string();
+			// Adds the components after each **, since it can match no folders at all
+			vector<size_t> getClosure(vector<size_t> states) const
+			{
+				for (size_t i = 0; i < states.size(); i++)
+				{
+					size_t state = states[i];
+					if (state < m_components.size() && m_components[state].getIsRecursive() &&
+						find(states.begin(), states.end(), state + 1) == states.end())
+					{
+						states.push_back(state + 1);
+					}
+				}
+				sort(states.begin(), states.end());
+				states.erase(unique(states.begin(), states.end()), states.end());
+				return states;
+			}
 
-			size_t searchIndex = 0;
-			for (const auto& fragment : nameFragments)
+			void addMatch(const fs::path& path)
 			{
-				searchIndex = filename.find(fragment, searchIndex);
-				if (searchIndex == string::npos)
+				if (!m_filter)
 				{
-					break;
+					lock_guard<mutex> lock(m_mutex);
+					m_matches.push_back(path);
+					return;
 				}
-				searchIndex += fragment.length();
+
+				// Filters usually read the file, so each one runs as its own job rather than holding up the listing
+				m_workers.submit([this, path]()
+				{
+					if (m_filter(path.u8string()))
+					{
+						lock_guard<mutex> lock(m_mutex);
+						m_matches.push_back(path);
+					}
+				});
 			}
-			if (searchIndex == filename.length() ||
-				(searchIndex != -1 && pathName.back() == '*'))
+
+			vector<GlobPattern> m_components;
+			bool m_isMatchingFolders;
+			const PathFilter& m_filter;
+			WorkerPool& m_workers;
+
+			mutex m_mutex;
+			vector<fs::path> m_matches;
+		};
+	}
+
+	GlobPattern::GlobPattern(const string& pattern) : m_text(pattern), m_hasWildcards(false), m_isRecursive(pattern == "**")
+	{
+		u32string characters = decodeUTF8(pattern);
+		for (size_t i = 0; i < characters.size(); i++)
+		{
+			char32_t character = characters[i];
+			if (character == U'*')
 			{
-				fs::path foundPath = parentFolder / fs::u8path(filename);
-				if (isFinalPath)
+				// Runs of stars match the same as one
+				if (m_tokens.empty() || m_tokens.back().m_type != TokenType::AnyRun)
 				{
-					pathCallback(foundPath.u8string());
+					m_tokens.push_back({ TokenType::AnyRun, 0 });
 				}
-				else
+				continue;
+			}
+			if (character == U'?')
+			{
+				m_tokens.push_back({ TokenType::AnyCharacter, 0 });
+				continue;
+			}
+
+			if (character == U'[')
+			{
+				// A ] straight after the opening bracket (and its negation) is part of the set
+				size_t setStart = i + 1;
+				bool isNegated = setStart < characters.size() && (characters[setStart] == U'!' || characters[setStart] == U'^');
+				if (isNegated) { setStart++; }
+				size_t setEnd = characters.find(U']', setStart + 1);
+
+				// Brackets that aren't closed are matched as they are
+				if (setStart < characters.size() && setEnd != u32string::npos)
 				{
-					enumerateWildcardPath(foundPath, pathIndex + 1, pathList, pathCallback);
+					CharacterSet set = { {}, isNegated };
+					for (size_t j = setStart; j < setEnd; j++)
+					{
+						if (j + 2 < setEnd && characters[j + 1] == U'-')
+						{
+							set.m_ranges.push_back({ characters[j], characters[j + 2] });
+							j += 2;
+						}
+						else
+						{
+							set.m_ranges.push_back({ characters[j], characters[j] });
+						}
+					}
+
+					m_tokens.push_back({ TokenType::Set, static_cast<char32_t>(m_sets.size()) });
+					m_sets.push_back(std::move(set));
+					i = setEnd;
+					continue;
 				}
 			}
+
+			m_tokens.push_back({ TokenType::Character, character });
+		}
+
+		m_hasWildcards = m_isRecursive || any_of(m_tokens.begin(), m_tokens.end(), [](const Token& token) { return token.m_type != TokenType::Character; });
+	}
+
+	bool GlobPattern::matches(const string& name) const
+	{
+		if (!m_hasWildcards) { return name == m_text; }
+
+		u32string characters = decodeUTF8(name);
+
+		// Matches greedily, and when that fails, goes back to the last star and has it take one more character
+		size_t tokenIndex = 0;
+		size_t characterIndex = 0;
+		size_t starTokenIndex = string::npos;
+		size_t starCharacterIndex = 0;
+		while (characterIndex < characters.size())
+		{
+			if (tokenIndex < m_tokens.size() && m_tokens[tokenIndex].m_type == TokenType::AnyRun)
+			{
+				tokenIndex++;
+				starTokenIndex = tokenIndex;
+				starCharacterIndex = characterIndex;
+			}
+			else if (tokenIndex < m_tokens.size() && matchesToken(m_tokens[tokenIndex], characters[characterIndex]))
+			{
+				tokenIndex++;
+				characterIndex++;
+			}
+			else if (starTokenIndex != string::npos)
+			{
+				tokenIndex = starTokenIndex;
+				starCharacterIndex++;
+				characterIndex = starCharacterIndex;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		while (tokenIndex < m_tokens.size() && m_tokens[tokenIndex].m_type == TokenType::AnyRun)
+		{
+			tokenIndex++;
 		}
+		return tokenIndex == m_tokens.size();
+	}
+
+	bool GlobPattern::getHasWildcards() const { return m_hasWildcards; }
+
+	bool GlobPattern::getIsRecursive() const { return m_isRecursive; }
+
+	const string& GlobPattern::getText() const { return m_text; }
+
+	bool GlobPattern::CharacterSet::contains(char32_t character) const
+	{
+		bool isInRange = any_of(m_ranges.begin(), m_ranges.end(), [character](const pair<char32_t, char32_t>& range)
+		{
+			return character >= range.first && character <= range.second;
+		});
+		return isInRange != m_isNegated;
+	}
+
+	bool GlobPattern::matchesToken(const Token& token, char32_t character) const
+	{
+		switch (token.m_type)
+		{
+		case TokenType::Character:
+			return character == token.m_value;
+		case TokenType::Set:
+			return m_sets[token.m_value].contains(character);
+		default:
+			return true;
+		}
+	}
+
+	vector<vector<string>> resolveWildcardedPaths(const vector<string>& paths, const PathFilter& filter, unsigned int threadCount)
+	{
+		WorkerPool workers(threadCount);
+		vector<unique_ptr<PathTraversal>> traversals;
+		for (const string& path : paths)
+		{
+			fs::path fsPath = fs::u8path(path).lexically_normal();
+
+			vector<string> pathComponents;
+
+			fs::path root = fsPath.root_path();
+			if (root.empty()) { root = fs::u8path("."); }
+
+			for (const auto& pathComponent : fsPath.relative_path())
+			{
+				pathComponents.push_back(pathComponent.u8string());
+			}
+
+#if _WINDOWS
+			// UNC paths for SMB shares need the hostname and share name together
+			// in order to be considered a valid path
+			if (root.lexically_normal().string().at(0) == '\\' && pathComponents.size() > 1)
+			{
+				root /= fs::u8path(pathComponents[1]);
+				pathComponents.erase(pathComponents.begin());
+			}
+#endif
+
+			// A trailing separator leaves an empty name at the end, and means the path is a folder
+			bool isMatchingFolders = !pathComponents.empty() && pathComponents.back().empty();
+			if (isMatchingFolders)
+			{
+				pathComponents.pop_back();
+			}
+			// A ** at the end matches every file under it, rather than just folders
+			if (!pathComponents.empty() && pathComponents.back() == "**")
+			{
+				pathComponents.push_back("*");
+			}
+
+			vector<GlobPattern> components(pathComponents.begin(), pathComponents.end());
+			traversals.push_back(make_unique<PathTraversal>(std::move(components), isMatchingFolders, filter, workers));
+
+			error_code ec;
+			if (fs::is_directory(root, ec))
+			{
+				traversals.back()->start(root);
+			}
+		}
+
+		workers.wait();
+
+		vector<vector<string>> resolvedPaths;
+		resolvedPaths.reserve(traversals.size());
+		for (const auto& traversal : traversals)
+		{
+			resolvedPaths.push_back(traversal->getMatches());
+		}
+		return resolvedPaths;
+	}
+
+	WildcardRoot getWildcardRoot(const string& path)
+	{
+		fs::path fsPath = fs::u8path(path).lexically_normal();
+		vector<string> pathComponents;
+		for (const auto& pathComponent : fsPath.relative_path())
+		{
+			pathComponents.push_back(pathComponent.u8string());
+		}
+		if (!pathComponents.empty() && pathComponents.back().empty())
+		{
+			pathComponents.pop_back();
+		}
+
+		// Matches are only in other folders if there are wildcards before the last component, or it's a **
+		fs::path folder = fsPath.root_path();
+		size_t literalCount = 0;
+		while (literalCount + 1 < pathComponents.size() && !GlobPattern(pathComponents[literalCount]).getHasWildcards())
+		{
+			folder /= fs::u8path(pathComponents[literalCount++]);
+		}
+		bool isRecursive = literalCount + 1 < pathComponents.size() ||
+			(!pathComponents.empty() && GlobPattern(pathComponents.back()).getIsRecursive());
+
+		return { folder.empty() ? "." : folder.u8string(), isRecursive };
 	}
 }
@@ -2,8 +2,77 @@
 
 #include <string>
 #include <functional>
+#include <utility>
+#include <vector>
 
 namespace midirenderer::utils
 {
-	void resolveWildcardedPath(const std::string& path, std::function<void(std::string)> pathCallback);
+	// One component of a wildcarded path, compiled once to be matched against many names. * matches
+	// any run of characters, ? matches one character, and [abc], [a-z] and [!abc] match one character
+	// in or out of a set. A component that's only ** matches any number of folders, including none.
+	// Wildcard characters can be matched literally by putting them in a set of their own, as in [[] or [?].
+	class GlobPattern
+	{
+	public:
+		explicit GlobPattern(const std::string& pattern);
+
+		bool matches(const std::string& name) const;
+
+		// Whether the pattern matches anything besides its own text, so folders have to be listed to find matches
+		bool getHasWildcards() const;
+		bool getIsRecursive() const;
+		const std::string& getText() const;
+
+	private:
+		enum class TokenType
+		{
+			Character,
+			AnyCharacter,
+			AnyRun,
+			Set
+		};
+
+		struct Token
+		{
+			TokenType m_type;
+			// The character for Character tokens, or the index of the set for Set tokens
+			char32_t m_value;
+		};
+
+		struct CharacterSet
+		{
+			std::vector<std::pair<char32_t, char32_t>> m_ranges;
+			bool m_isNegated;
+
+			bool contains(char32_t character) const;
+		};
+
+		bool matchesToken(const Token& token, char32_t character) const;
+
+		std::string m_text;
+		std::vector<Token> m_tokens;
+		std::vector<CharacterSet> m_sets;
+		bool m_hasWildcards;
+		bool m_isRecursive;
+	};
+
+	// Decides whether a path that matched is kept. Called from several threads at once.
+	using PathFilter = std::function<bool(const std::string&)>;
+
+	// Finds the files and folders matching each wildcarded path, listing folders and running the filter (if any)
+	// on threadCount threads at once. Each path's matches are sorted, so they come out in the same order however
+	// the work was split up. A path ending in a separator matches only folders. A component that names an
+	// existing entry exactly is taken as it is rather than as a pattern.
+	std::vector<std::vector<std::string>> resolveWildcardedPaths(const std::vector<std::string>& paths, const PathFilter& filter,
+		unsigned int threadCount);
+
+	// Where new matches for a wildcarded path can turn up: the folder before its first component with
+	// wildcards, and whether they can be in the folders under it as well as in the folder itself
+	struct WildcardRoot
+	{
+		std::string m_folder;
+		bool m_isRecursive;
+	};
+
+	WildcardRoot getWildcardRoot(const std::string& path);
 }
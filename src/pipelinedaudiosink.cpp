@@ -0,0 +1,184 @@
+#include "pipelinedaudiosink.h"
+
+#include <algorithm>
+
+PipelinedAudioSink::PipelinedAudioSink(AudioSink& target, size_t blockCapacity) : m_target(target),
+	m_blockCapacity(std::max<size_t>(blockCapacity, 2)), m_blocks(std::make_unique<Block[]>(m_blockCapacity)),
+	m_acquiredBlock(nullptr), m_readIndex(0), m_writeIndex(0), m_isProducerWaiting(false), m_isConsumerWaiting(false), m_hasFailed(false)
+{
+	m_consumer = std::thread(&PipelinedAudioSink::runConsumer, this);
+}
+
+PipelinedAudioSink::~PipelinedAudioSink()
+{
+	if (m_consumer.joinable())
+	{
+		acquireBlock(BlockType::Finish);
+		publishBlock();
+		m_consumer.join();
+	}
+}
+
+void PipelinedAudioSink::writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	throwIfFailed();
+
+	size_t frameOffset = 0;
+	while (frameOffset < frameCount)
+	{
+		Block& block = acquireBlock(BlockType::Samples);
+		block.m_frameCount = std::min(frameCount - frameOffset, s_blockFrameCount);
+		std::copy(&leftBuffer[frameOffset], &leftBuffer[frameOffset + block.m_frameCount], block.m_leftBuffer);
+		std::copy(&rightBuffer[frameOffset], &rightBuffer[frameOffset + block.m_frameCount], block.m_rightBuffer);
+		frameOffset += block.m_frameCount;
+		publishBlock();
+	}
+}
+
+size_t PipelinedAudioSink::acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	throwIfFailed();
+
+	m_acquiredBlock = &acquireBlock(BlockType::Samples);
+	leftBuffer = m_acquiredBlock->m_leftBuffer;
+	rightBuffer = m_acquiredBlock->m_rightBuffer;
+	return std::min(frameCount, s_blockFrameCount);
+}
+
+void PipelinedAudioSink::commitBuffers(size_t frameCount)
+{
+	m_acquiredBlock->m_frameCount = frameCount;
+	m_acquiredBlock = nullptr;
+	if (frameCount > 0)
+	{
+		publishBlock();
+	}
+}
+
+void PipelinedAudioSink::startOverlapRegion()
+{
+	throwIfFailed();
+	acquireBlock(BlockType::StartOverlapRegion);
+	publishBlock();
+}
+
+void PipelinedAudioSink::endOverlapRegion()
+{
+	throwIfFailed();
+	acquireBlock(BlockType::EndOverlapRegion);
+	publishBlock();
+}
+
+void PipelinedAudioSink::finish()
+{
+	if (m_consumer.joinable())
+	{
+		acquireBlock(BlockType::Finish);
+		publishBlock();
+		m_consumer.join();
+	}
+
+	throwIfFailed();
+}
+
+PipelinedAudioSink::Block& PipelinedAudioSink::acquireBlock(BlockType type)
+{
+	size_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+	waitUntil([&]() { return writeIndex - m_readIndex.load() < m_blockCapacity; }, m_isProducerWaiting, m_spaceAvailable);
+
+	Block& block = m_blocks[writeIndex % m_blockCapacity];
+	block.m_type = type;
+	block.m_frameCount = 0;
+	return block;
+}
+
+void PipelinedAudioSink::publishBlock()
+{
+	m_writeIndex.store(m_writeIndex.load(std::memory_order_relaxed) + 1);
+	wake(m_isConsumerWaiting, m_blockAvailable);
+}
+
+void PipelinedAudioSink::advanceReadIndex(size_t readIndex)
+{
+	m_readIndex.store(readIndex);
+	wake(m_isProducerWaiting, m_spaceAvailable);
+}
+
+template<typename Predicate>
+void PipelinedAudioSink::waitUntil(Predicate isReady, std::atomic<bool>& isWaiting, std::condition_variable& condition)
+{
+	for (int i = 0; i < s_spinCount; i++)
+	{
+		if (isReady()) { return; }
+		std::this_thread::yield();
+	}
+
+	// The flag is raised before the last check, and the other side moves its index before it looks
+	// at the flag, so either this check sees the move or the other side sees the flag and wakes it
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	isWaiting.store(true);
+	condition.wait(lock, isReady);
+	isWaiting.store(false);
+}
+
+void PipelinedAudioSink::wake(std::atomic<bool>& isWaiting, std::condition_variable& condition)
+{
+	if (isWaiting.load())
+	{
+		// Taking the lock makes sure the waiting side is either still before its last check or already asleep
+		std::lock_guard<std::mutex> lock(m_waitMutex);
+		condition.notify_one();
+	}
+}
+
+void PipelinedAudioSink::runConsumer()
+{
+	size_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+	while (true)
+	{
+		waitUntil([&]() { return readIndex != m_writeIndex.load(); }, m_isConsumerWaiting, m_blockAvailable);
+
+		Block& block = m_blocks[readIndex % m_blockCapacity];
+		BlockType type = block.m_type;
+
+		// After a failure, blocks are still consumed so that the producer never waits on a full ring
+		if (!m_hasFailed.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				switch (type)
+				{
+				case BlockType::Samples:
+					m_target.writeBuffers(block.m_leftBuffer, block.m_rightBuffer, block.m_frameCount);
+					break;
+				case BlockType::StartOverlapRegion:
+					m_target.startOverlapRegion();
+					break;
+				case BlockType::EndOverlapRegion:
+					m_target.endOverlapRegion();
+					break;
+				case BlockType::Finish:
+					break;
+				}
+			}
+			catch (...)
+			{
+				m_error = std::current_exception();
+				m_hasFailed.store(true, std::memory_order_release);
+			}
+		}
+
+		readIndex++;
+		advanceReadIndex(readIndex);
+
+		if (type == BlockType::Finish) { return; }
+	}
+}
+
+void PipelinedAudioSink::throwIfFailed()
+{
+	if (m_hasFailed.load(std::memory_order_acquire))
+	{
+		std::rethrow_exception(m_error);
+	}
+}
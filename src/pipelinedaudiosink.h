@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "audiosink.h"
+
+// Passes everything written to it on to another sink on a separate thread, so that
+// whatever produces the audio and whatever consumes it can run at the same time.
+// Blocks are handed over through a bounded single-producer/single-consumer ring;
+// the producer waits when the ring is full and the consumer waits when it's empty.
+// Either side spins briefly before it sleeps, so a stage that's much faster than the
+// other doesn't keep a core busy for the whole render.
+class PipelinedAudioSink : public AudioSink
+{
+public:
+	PipelinedAudioSink(AudioSink& target, size_t blockCapacity = 16);
+	~PipelinedAudioSink();
+
+	PipelinedAudioSink(const PipelinedAudioSink& other) = delete;
+	PipelinedAudioSink& operator=(const PipelinedAudioSink& other) = delete;
+
+	void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount) override;
+	// Hands out the next block in the ring, so the producer renders straight into it
+	size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void commitBuffers(size_t frameCount) override;
+	void startOverlapRegion() override;
+	void endOverlapRegion() override;
+
+	// Waits until the target has received everything written so far and stops the consumer
+	// thread. Anything the target threw is rethrown here.
+	void finish();
+
+private:
+	enum class BlockType
+	{
+		Samples,
+		StartOverlapRegion,
+		EndOverlapRegion,
+		Finish
+	};
+
+	constexpr static size_t s_blockFrameCount = 1024;
+	// How many times a side checks the ring again before it sleeps
+	constexpr static int s_spinCount = 64;
+
+	struct Block
+	{
+		BlockType m_type;
+		size_t m_frameCount;
+		float m_leftBuffer[s_blockFrameCount];
+		float m_rightBuffer[s_blockFrameCount];
+	};
+
+	Block& acquireBlock(BlockType type);
+	void publishBlock();
+	void advanceReadIndex(size_t readIndex);
+	template<typename Predicate>
+	void waitUntil(Predicate isReady, std::atomic<bool>& isWaiting, std::condition_variable& condition);
+	void wake(std::atomic<bool>& isWaiting, std::condition_variable& condition);
+	void runConsumer();
+	void throwIfFailed();
+
+	AudioSink& m_target;
+	size_t m_blockCapacity;
+	std::unique_ptr<Block[]> m_blocks;
+	Block* m_acquiredBlock;
+
+	// Both indices only ever increase; a block's slot is its index modulo the capacity
+	std::atomic<size_t> m_readIndex;
+	std::atomic<size_t> m_writeIndex;
+
+	std::mutex m_waitMutex;
+	std::condition_variable m_spaceAvailable;
+	std::condition_variable m_blockAvailable;
+	std::atomic<bool> m_isProducerWaiting;
+	std::atomic<bool> m_isConsumerWaiting;
+
+	std::atomic<bool> m_hasFailed;
+	std::exception_ptr m_error;
+
+	std::thread m_consumer;
+};
@@ -0,0 +1,65 @@
+#include "progressaudiosink.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+ProgressAudioSink::ProgressAudioSink(AudioSink& target, std::function<void(double)> callback, const std::atomic<bool>* isCancelled) :
+	m_target(target), m_callback(std::move(callback)), m_isCancelled(isCancelled), m_framePosition(0), m_expectedFrameCount(0), m_lastReportedProgress(0)
+{
+}
+
+void ProgressAudioSink::writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	throwIfCancelled();
+	m_target.writeBuffers(leftBuffer, rightBuffer, frameCount);
+	reportProgress(frameCount);
+}
+
+size_t ProgressAudioSink::acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	return m_target.acquireBuffers(frameCount, leftBuffer, rightBuffer);
+}
+
+void ProgressAudioSink::commitBuffers(size_t frameCount)
+{
+	throwIfCancelled();
+	m_target.commitBuffers(frameCount);
+	reportProgress(frameCount);
+}
+
+void ProgressAudioSink::startOverlapRegion()
+{
+	m_target.startOverlapRegion();
+}
+
+void ProgressAudioSink::endOverlapRegion()
+{
+	m_target.endOverlapRegion();
+}
+
+void ProgressAudioSink::setExpectedFrameCount(uint64_t expectedFrameCount)
+{
+	m_expectedFrameCount = expectedFrameCount;
+}
+
+void ProgressAudioSink::throwIfCancelled()
+{
+	if (m_isCancelled != nullptr && *m_isCancelled)
+	{
+		throw std::runtime_error("The render was cancelled");
+	}
+}
+
+void ProgressAudioSink::reportProgress(size_t frameCount)
+{
+	m_framePosition += frameCount;
+
+	if (!m_callback || m_expectedFrameCount == 0) { return; }
+
+	double progress = std::min(static_cast<double>(m_framePosition) / m_expectedFrameCount, s_maxReportedProgress);
+	if (progress >= m_lastReportedProgress + s_reportInterval)
+	{
+		m_lastReportedProgress = progress;
+		m_callback(progress);
+	}
+}
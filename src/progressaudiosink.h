@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "audiosink.h"
+
+// Passes everything written to it on to another sink and reports how far along the render
+// is, going by how many frames it's expected to write in total. Nothing is reported until
+// the expected frame count is known, and the report never reaches 1 since the length of
+// the runoff at the end can't be known in advance. Writes throw once the render is cancelled,
+// which stops the render at its next step.
+class ProgressAudioSink : public AudioSink
+{
+public:
+	ProgressAudioSink(AudioSink& target, std::function<void(double)> callback, const std::atomic<bool>* isCancelled = nullptr);
+
+	ProgressAudioSink(const ProgressAudioSink& other) = delete;
+	ProgressAudioSink& operator=(const ProgressAudioSink& other) = delete;
+
+	void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount) override;
+	size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void commitBuffers(size_t frameCount) override;
+	void startOverlapRegion() override;
+	void endOverlapRegion() override;
+
+	void setExpectedFrameCount(uint64_t expectedFrameCount);
+
+private:
+	void throwIfCancelled();
+	void reportProgress(size_t frameCount);
+
+	AudioSink& m_target;
+	std::function<void(double)> m_callback;
+	const std::atomic<bool>* m_isCancelled;
+
+	uint64_t m_framePosition;
+	uint64_t m_expectedFrameCount;
+	double m_lastReportedProgress;
+
+	constexpr static double s_reportInterval = 0.01;
+	constexpr static double s_maxReportedProgress = 0.99;
+};
@@ -0,0 +1,92 @@
+#include "progressevents.h"
+
+#include "jsonutils.h"
+#include "songrendercontainer.h"
+
+namespace midirenderer
+{
+	namespace
+	{
+		const char* getPhaseName(MIDIVorbisRenderer::RenderPhase phase)
+		{
+			switch (phase)
+			{
+			case MIDIVorbisRenderer::RenderPhase::SongBody:
+				return "body";
+			case MIDIVorbisRenderer::RenderPhase::Runoff:
+				return "runoff";
+			default:
+				return "loop";
+			}
+		}
+	}
+
+	ProgressEventWriter::ProgressEventWriter(std::ostream& output) : m_output(output)
+	{
+	}
+
+	void ProgressEventWriter::writeQueued(size_t index, const std::string& inputPath, const std::string& outputPath, double predictedCost)
+	{
+		writeLine(getEventJSON(index, "queued") + ",\"input\":" + utils::toJSONString(inputPath) +
+			",\"output\":" + utils::toJSONString(outputPath) + ",\"predictedCost\":" + utils::toJSONNumber(predictedCost) + "}");
+	}
+
+	void ProgressEventWriter::writeStarted(size_t index)
+	{
+		writeLine(getEventJSON(index, "started") + "}");
+	}
+
+	void ProgressEventWriter::writeProgress(size_t index, double progress, double elapsedSeconds)
+	{
+		std::string line = getEventJSON(index, "progress") + ",\"progress\":" + utils::toJSONNumber(progress, utils::s_progressDecimalPlaces);
+		if (progress > 0)
+		{
+			line += ",\"eta\":" + utils::toJSONNumber(elapsedSeconds * (1.0 - progress) / progress);
+		}
+		writeLine(line + "}");
+	}
+
+	void ProgressEventWriter::writePhase(size_t index, MIDIVorbisRenderer::RenderPhase phase)
+	{
+		writeLine(getEventJSON(index, "phase") + ",\"phase\":" + utils::toJSONString(getPhaseName(phase)) + "}");
+	}
+
+	void ProgressEventWriter::writeFinished(size_t index, const RenderResult& result, double seconds)
+	{
+		std::string line = getEventJSON(index, "finished") + ",\"cached\":" + (result.m_isCached ? "true" : "false") +
+			",\"seconds\":" + utils::toJSONNumber(seconds);
+		if (!result.m_isCached)
+		{
+			double audioSeconds = result.m_outputFrames / SongRenderContainer::s_sampleRate;
+			line += ",\"audioSeconds\":" + utils::toJSONNumber(audioSeconds);
+			line += ",\"trimmedRunoffFrames\":" + std::to_string(result.m_trimmedRunoffFrames);
+			if (seconds > 0)
+			{
+				line += ",\"realtimeFactor\":" + utils::toJSONNumber(audioSeconds / seconds);
+			}
+			if (result.m_isNormalized)
+			{
+				// Silence has no loudness, so it comes out as null
+				line += ",\"loudness\":" + utils::toJSONNumber(result.m_measuredLoudness) +
+					",\"gain\":" + utils::toJSONNumber(result.m_normalizationGain);
+			}
+		}
+		writeLine(line + "}");
+	}
+
+	void ProgressEventWriter::writeFailed(size_t index, const std::string& message)
+	{
+		writeLine(getEventJSON(index, "failed") + ",\"message\":" + utils::toJSONString(message) + "}");
+	}
+
+	std::string ProgressEventWriter::getEventJSON(size_t index, const std::string& event)
+	{
+		return "{\"index\":" + std::to_string(index) + ",\"event\":" + utils::toJSONString(event);
+	}
+
+	void ProgressEventWriter::writeLine(const std::string& line)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_output << line << '\n' << std::flush;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "midivorbisrenderer.h"
+
+namespace midirenderer
+{
+	// Writes a JSON object per line for each step of each file's render, so that other programs can
+	// follow a batch as it runs. Files are identified by their index in the batch. Events from files
+	// rendering at the same time are interleaved, but every line is written and flushed whole.
+	class ProgressEventWriter
+	{
+	public:
+		ProgressEventWriter(std::ostream& output);
+
+		ProgressEventWriter(const ProgressEventWriter& other) = delete;
+		ProgressEventWriter& operator=(const ProgressEventWriter& other) = delete;
+
+		// The predicted cost is in the voice-seconds of estimateRenderCost, or 0 if the file couldn't be scanned
+		void writeQueued(size_t index, const std::string& inputPath, const std::string& outputPath, double predictedCost);
+		void writeStarted(size_t index);
+		// The ETA assumes the rest of the render goes as fast as it has so far
+		void writeProgress(size_t index, double progress, double elapsedSeconds);
+		void writePhase(size_t index, MIDIVorbisRenderer::RenderPhase phase);
+		void writeFinished(size_t index, const RenderResult& result, double seconds);
+		void writeFailed(size_t index, const std::string& message);
+
+	private:
+		static std::string getEventJSON(size_t index, const std::string& event);
+		void writeLine(const std::string& line);
+
+		std::ostream& m_output;
+		std::mutex m_mutex;
+	};
+}
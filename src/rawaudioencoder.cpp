@@ -0,0 +1,121 @@
+#include "rawaudioencoder.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+	void appendSample(std::vector<unsigned char>& output, float sample)
+	{
+		uint32_t bits = 0;
+		std::memcpy(&bits, &sample, sizeof(bits));
+		for (int i = 0; i < 4; i++)
+		{
+			output.push_back(static_cast<unsigned char>(bits >> (i * 8)));
+		}
+	}
+}
+
+RawAudioEncoder::RawAudioEncoder(long sampleRate) : m_sampleRate(sampleRate), m_frameCount(0),
+	m_hasLoopPoints(false), m_loopStart(0), m_loopLength(0), m_isStreaming(false)
+{
+}
+
+void RawAudioEncoder::setLoopPoints(uint64_t loopStart, uint64_t loopLength)
+{
+	m_hasLoopPoints = true;
+	m_loopStart = loopStart;
+	m_loopLength = loopLength;
+}
+
+void RawAudioEncoder::startStreaming(const OutputCallbackFunc& output)
+{
+	throwIfComplete();
+	if (m_isStreaming)
+	{
+		throw std::runtime_error("Attempted to start streaming an audio encoder twice");
+	}
+
+	readHeader(output);
+	readFrames(output);
+
+	m_isStreaming = true;
+	m_streamOutput = output;
+}
+
+void RawAudioEncoder::readHeader(const OutputCallbackFunc&)
+{
+}
+
+void RawAudioEncoder::readEncodedData(const OutputCallbackFunc& output)
+{
+	readFrames(output);
+	if (getIsComplete())
+	{
+		readTrailer(output);
+	}
+}
+
+std::string RawAudioEncoder::getSidecarContents()
+{
+	std::ostringstream contents;
+	contents << "{\"format\":\"f32le\",\"channels\":" << s_channelCount << ",\"sampleRate\":" << m_sampleRate <<
+		",\"frames\":" << m_frameCount;
+	if (m_hasLoopPoints)
+	{
+		contents << ",\"loopStart\":" << m_loopStart << ",\"loopLength\":" << m_loopLength;
+	}
+	contents << "}\n";
+	return contents.str();
+}
+
+void RawAudioEncoder::acquireEncoderBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	m_planarBuffers[0].resize(frameCount);
+	m_planarBuffers[1].resize(frameCount);
+	leftBuffer = m_planarBuffers[0].data();
+	rightBuffer = m_planarBuffers[1].data();
+}
+
+void RawAudioEncoder::encodeAcquiredBuffers(size_t frameCount)
+{
+	const float* leftBuffer = m_planarBuffers[0].data();
+	const float* rightBuffer = m_planarBuffers[1].data();
+	{
+		midirenderer::StageTimer timer(m_stats, midirenderer::RenderStage::Encoding);
+		m_encodedFrames.reserve(m_encodedFrames.size() + frameCount * s_channelCount * s_bytesPerSample);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			appendSample(m_encodedFrames, leftBuffer[i]);
+			appendSample(m_encodedFrames, rightBuffer[i]);
+		}
+		m_frameCount += frameCount;
+	}
+
+	if (m_isStreaming)
+	{
+		readFrames(m_streamOutput);
+	}
+}
+
+void RawAudioEncoder::finishStream()
+{
+	if (m_isStreaming)
+	{
+		readFrames(m_streamOutput);
+		readTrailer(m_streamOutput);
+	}
+}
+
+void RawAudioEncoder::readTrailer(const OutputCallbackFunc&)
+{
+}
+
+void RawAudioEncoder::readFrames(const OutputCallbackFunc& output)
+{
+	if (m_encodedFrames.empty()) { return; }
+
+	output(m_encodedFrames.data(), m_encodedFrames.size());
+	m_encodedFrames.clear();
+}
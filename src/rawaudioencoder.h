@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "audiofileencoder.h"
+
+// Writes interleaved stereo 32-bit little-endian float frames with no header. The loop points,
+// along with the sample rate and frame layout, go in a JSON sidecar instead.
+class RawAudioEncoder : public AudioFileEncoder
+{
+public:
+	RawAudioEncoder(long sampleRate);
+
+	void setLoopPoints(uint64_t loopStart, uint64_t loopLength) override;
+
+	void startStreaming(const OutputCallbackFunc& output) override;
+	void readHeader(const OutputCallbackFunc& output) override;
+	void readEncodedData(const OutputCallbackFunc& output) override;
+
+	std::string getSidecarContents() override;
+
+protected:
+	// Frames are interleaved as they're encoded, so they're rendered into planar buffers first
+	void acquireEncoderBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void encodeAcquiredBuffers(size_t frameCount) override;
+	void finishStream() override;
+
+	// Outputs anything that goes after the frames
+	virtual void readTrailer(const OutputCallbackFunc& output);
+
+	constexpr static int s_channelCount = 2;
+	constexpr static int s_bytesPerSample = 4;
+
+	long m_sampleRate;
+	uint64_t m_frameCount;
+
+	bool m_hasLoopPoints;
+	uint64_t m_loopStart;
+	uint64_t m_loopLength;
+
+private:
+	void readFrames(const OutputCallbackFunc& output);
+
+	std::array<std::vector<float>, 2> m_planarBuffers;
+	std::vector<unsigned char> m_encodedFrames;
+
+	bool m_isStreaming;
+	OutputCallbackFunc m_streamOutput;
+};
@@ -0,0 +1,123 @@
+#include "rendercache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "fileutils.h"
+
+namespace midirenderer
+{
+	RenderCache::RenderCache(const std::string& directory) : m_directory(std::filesystem::u8path(directory)),
+		m_hitCount(0), m_missCount(0), m_temporaryEntryCount(0)
+	{
+		// Builds running at the same time can share a cache folder, and their thread ids and counters
+		// can be the same, so each cache gets a random name for its temporary entries. The clock is
+		// mixed in for platforms whose random_device isn't random.
+		std::random_device randomDevice;
+		uint64_t nonce = (static_cast<uint64_t>(randomDevice()) << 32) ^ randomDevice() ^
+			static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		std::ostringstream prefix;
+		prefix << std::hex << nonce;
+		m_temporaryPrefix = prefix.str();
+
+		std::error_code error;
+		std::filesystem::create_directories(m_directory, error);
+		if (!std::filesystem::is_directory(m_directory))
+		{
+			throw std::runtime_error("Failed to create the render cache folder at " + directory);
+		}
+	}
+
+	bool RenderCache::fetch(const std::string& key, const std::vector<std::string>& outputPaths)
+	{
+		bool hasEntries = std::all_of(outputPaths.begin(), outputPaths.end(), [&](const std::string& outputPath)
+			{
+				return std::filesystem::exists(getEntryPath(key, outputPath));
+			});
+
+		if (hasEntries)
+		{
+			// Every entry is copied next to its output before any of them are renamed into place, so
+			// a failure part way through never leaves a render's outputs from different renders
+			std::vector<std::filesystem::path> stagedPaths;
+			size_t placedCount = 0;
+			try
+			{
+				for (const std::string& outputPath : outputPaths)
+				{
+					stagedPaths.push_back(getTemporaryPath(std::filesystem::u8path(outputPath)));
+					utils::cloneOrCopyFile(getEntryPath(key, outputPath), stagedPaths.back());
+				}
+				for (; placedCount < outputPaths.size(); placedCount++)
+				{
+					std::filesystem::rename(stagedPaths[placedCount], std::filesystem::u8path(outputPaths[placedCount]));
+				}
+				m_hitCount++;
+				return true;
+			}
+			catch (std::filesystem::filesystem_error&)
+			{
+				// Fall back to rendering, which reports its own errors if the output can't be written
+				std::error_code error;
+				for (size_t i = 0; i < placedCount; i++)
+				{
+					std::filesystem::remove(std::filesystem::u8path(outputPaths[i]), error);
+				}
+				for (size_t i = placedCount; i < stagedPaths.size(); i++)
+				{
+					std::filesystem::remove(stagedPaths[i], error);
+				}
+			}
+		}
+
+		m_missCount++;
+		return false;
+	}
+
+	void RenderCache::store(const std::string& key, const std::vector<std::string>& outputPaths)
+	{
+		// Entries are written under a temporary name and renamed into place, so other threads and
+		// processes never see a partial entry
+		for (const std::string& outputPath : outputPaths)
+		{
+			std::filesystem::path temporaryPath = getTemporaryPath(m_directory / key);
+
+			std::error_code error;
+			try
+			{
+				utils::cloneOrCopyFile(std::filesystem::u8path(outputPath), temporaryPath);
+				std::filesystem::rename(temporaryPath, getEntryPath(key, outputPath));
+			}
+			catch (std::filesystem::filesystem_error&)
+			{
+				std::filesystem::remove(temporaryPath, error);
+			}
+		}
+	}
+
+	size_t RenderCache::getHitCount() const
+	{
+		return m_hitCount;
+	}
+
+	size_t RenderCache::getMissCount() const
+	{
+		return m_missCount;
+	}
+
+	std::filesystem::path RenderCache::getEntryPath(const std::string& key, const std::string& outputPath) const
+	{
+		return m_directory / (key + std::filesystem::u8path(outputPath).extension().u8string());
+	}
+
+	std::filesystem::path RenderCache::getTemporaryPath(const std::filesystem::path& path)
+	{
+		std::filesystem::path temporaryPath = path;
+		temporaryPath += "." + m_temporaryPrefix + "." + std::to_string(m_temporaryEntryCount++) + ".tmp";
+		return temporaryPath;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace midirenderer
+{
+	// A directory of finished renders named after a hash of everything that went into them.
+	// Outputs get their own copies of entries, so nothing done to an output changes the cache.
+	class RenderCache
+	{
+	public:
+		RenderCache(const std::string& directory);
+
+		RenderCache(const RenderCache& other) = delete;
+		RenderCache& operator=(const RenderCache& other) = delete;
+
+		// Puts the render cached under the key at the output paths, or returns false if any of its
+		// files are missing or can't be copied, leaving none of them in place. A render's files are
+		// told apart by their extensions.
+		bool fetch(const std::string& key, const std::vector<std::string>& outputPaths);
+		// Adds a finished render to the cache. The render is already in place, so any failure
+		// to cache it is ignored.
+		void store(const std::string& key, const std::vector<std::string>& outputPaths);
+
+		size_t getHitCount() const;
+		size_t getMissCount() const;
+
+	private:
+		std::filesystem::path getEntryPath(const std::string& key, const std::string& outputPath) const;
+		// A unique name in the same folder to write the file under before it's renamed to the path
+		std::filesystem::path getTemporaryPath(const std::filesystem::path& path);
+
+		std::filesystem::path m_directory;
+
+		std::atomic<size_t> m_hitCount;
+		std::atomic<size_t> m_missCount;
+		// Keeps temporary entry names unique between processes sharing the folder
+		std::string m_temporaryPrefix;
+		// Keeps temporary entry names unique between threads
+		std::atomic<size_t> m_temporaryEntryCount;
+	};
+}
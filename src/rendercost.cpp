@@ -0,0 +1,132 @@
+#include "rendercost.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+#include "songrendercontainer.h"
+
+namespace midirenderer
+{
+	namespace
+	{
+		// Roughly how long a released note keeps its voice while its envelope fades out
+		constexpr double s_releaseSeconds = 0.5;
+		// Roughly how long voices ring out after the end of the song
+		constexpr double s_runoffSeconds = 2.0;
+		// Mixing, effects and encoding cost about as much per second as this many voices, however
+		// many are playing
+		constexpr double s_fixedCostVoices = 8.0;
+		// Starting a voice looks up its samples and sets up its envelopes and filters
+		constexpr double s_noteOnCost = 0.01;
+	}
+
+	RenderCostEstimate estimateRenderCost(const MIDIAnalysis& analysis, const MIDIVorbisRenderer::RenderSettings& settings)
+	{
+		RenderCostEstimate estimate;
+		double songSeconds = analysis.m_endSample / SongRenderContainer::s_sampleRate;
+		if (songSeconds <= 0) { return estimate; }
+
+		// The notes' lengths add up to the sum of their releases less the sum of their starts, and sorting
+		// the ticks lets both be converted in one pass over the tempo map, which can be thousands of
+		// changes long for songs with tempo ramps
+		std::vector<uint32_t> startTicks;
+		std::vector<uint32_t> releaseTicks;
+		startTicks.reserve(analysis.m_notes.size());
+		releaseTicks.reserve(analysis.m_notes.size());
+		for (const MIDINote& note : analysis.m_notes)
+		{
+			startTicks.push_back(note.m_startTick);
+			releaseTicks.push_back(note.m_releaseTick);
+		}
+		std::sort(startTicks.begin(), startTicks.end());
+		std::sort(releaseTicks.begin(), releaseTicks.end());
+		std::vector<uint64_t> startSamples = analysis.getSamplesAtTicks(startTicks);
+		std::vector<uint64_t> releaseSamples = analysis.getSamplesAtTicks(releaseTicks);
+		uint64_t noteSamples = std::accumulate(releaseSamples.begin(), releaseSamples.end(), uint64_t(0)) -
+			std::accumulate(startSamples.begin(), startSamples.end(), uint64_t(0));
+		double noteSeconds = noteSamples / SongRenderContainer::s_sampleRate + analysis.m_notes.size() * s_releaseSeconds;
+		// Voices can't overlap more than the notes ever do, even with their releases counted
+		double averageVoices = std::min(noteSeconds / songSeconds, static_cast<double>(analysis.m_peakPolyphony));
+
+		uint64_t loopSample = analysis.getHasLoopPoint() ? analysis.m_loopSample : 0;
+		double loopSeconds = (analysis.m_endSample - std::min(loopSample, analysis.m_endSample)) / SongRenderContainer::s_sampleRate;
+		double audioSeconds = songSeconds + s_runoffSeconds;
+		double noteOnCount = static_cast<double>(analysis.m_notes.size());
+		// Seconds the synth is run for without any voices to play or audio to keep
+		double preRollSeconds = 0;
+		switch (settings.m_loopMode)
+		{
+		case MIDIVorbisRenderer::LoopMode::Double:
+			// The second pass replays the song from the start with its note ons muted up to the loop point,
+			// so only the loop is heard again, but the synth still runs over everything before it
+			audioSeconds += loopSeconds;
+			noteOnCount *= 1.0 + loopSeconds / songSeconds;
+			preRollSeconds = songSeconds - loopSeconds;
+			break;
+		case MIDIVorbisRenderer::LoopMode::Short:
+			// The start of the loop is rendered again for the runoff to be mixed into
+			audioSeconds += std::min(loopSeconds, s_runoffSeconds);
+			break;
+		default:
+			break;
+		}
+
+		estimate.m_audioSeconds = audioSeconds;
+		estimate.m_noteDensity = analysis.m_notes.size() / songSeconds;
+		estimate.m_peakPolyphony = analysis.m_peakPolyphony;
+		estimate.m_cost = audioSeconds * (s_fixedCostVoices + averageVoices) + preRollSeconds * s_fixedCostVoices + noteOnCount * s_noteOnCost;
+		return estimate;
+	}
+
+	std::vector<size_t> getLongestFirstOrder(const std::vector<RenderCostEstimate>& estimates)
+	{
+		std::vector<size_t> order(estimates.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return estimates[a].m_cost > estimates[b].m_cost; });
+		return order;
+	}
+
+	RenderCostCalibration::RenderCostCalibration() : m_count(0), m_costSum(0), m_secondsSum(0), m_costSquareSum(0),
+		m_secondsSquareSum(0), m_productSum(0)
+	{
+	}
+
+	void RenderCostCalibration::add(double predictedCost, double seconds)
+	{
+		m_count++;
+		m_costSum += predictedCost;
+		m_secondsSum += seconds;
+		m_costSquareSum += predictedCost * predictedCost;
+		m_secondsSquareSum += seconds * seconds;
+		m_productSum += predictedCost * seconds;
+	}
+
+	std::string RenderCostCalibration::getSummary(const std::string& indent) const
+	{
+		std::ostringstream summary;
+		summary << indent << "predicted cost: ";
+		if (m_count == 0 || m_costSquareSum <= 0)
+		{
+			summary << "no renders to compare\n";
+			return summary.str();
+		}
+
+		// The fit goes through zero, since a render that costs nothing should take no time
+		double secondsPerCost = m_productSum / m_costSquareSum;
+		summary << std::setprecision(3) << secondsPerCost * 1000.0 << "ms per voice-second over " << m_count << " renders";
+
+		// The correlation says how well the estimates would have ordered the batch, whatever the scale
+		double costVariance = m_count * m_costSquareSum - m_costSum * m_costSum;
+		double secondsVariance = m_count * m_secondsSquareSum - m_secondsSum * m_secondsSum;
+		if (m_count > 1 && costVariance > 0 && secondsVariance > 0)
+		{
+			double correlation = (m_count * m_productSum - m_costSum * m_secondsSum) / std::sqrt(costVariance * secondsVariance);
+			summary << std::fixed << std::setprecision(2) << ", correlation " << correlation;
+		}
+		summary << "\n";
+		return summary.str();
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "midianalysis.h"
+#include "midivorbisrenderer.h"
+
+namespace midirenderer
+{
+	// How long a render is expected to take, judged from a scan of its MIDI file before it's rendered.
+	// The cost is in voice-seconds: seconds of audio rendered times the voices expected to be playing,
+	// plus a fixed share for mixing and encoding. It's only meant to rank renders against each other,
+	// and the calibration below relates it to real seconds on a given machine and soundfont.
+	struct RenderCostEstimate
+	{
+		double m_cost = 0;
+		// The seconds of audio the render synthesizes, counting a second pass over the loop for
+		// double loops and the loop's overlap for short loops
+		double m_audioSeconds = 0;
+		// Note ons per second of the song
+		double m_noteDensity = 0;
+		int m_peakPolyphony = 0;
+	};
+
+	RenderCostEstimate estimateRenderCost(const MIDIAnalysis& analysis, const MIDIVorbisRenderer::RenderSettings& settings);
+
+	// The indices of the estimates from most to least expensive, so that a batch can start its longest
+	// renders first instead of leaving one to run on its own at the end. Ties keep their order.
+	std::vector<size_t> getLongestFirstOrder(const std::vector<RenderCostEstimate>& estimates);
+
+	// Fits the seconds renders actually took to their predicted costs, for checking how well the
+	// estimates rank a batch and what a voice-second costs on this machine
+	class RenderCostCalibration
+	{
+	public:
+		RenderCostCalibration();
+
+		void add(double predictedCost, double seconds);
+		std::string getSummary(const std::string& indent) const;
+
+	private:
+		size_t m_count;
+		double m_costSum;
+		double m_secondsSum;
+		double m_costSquareSum;
+		double m_secondsSquareSum;
+		double m_productSum;
+	};
+}
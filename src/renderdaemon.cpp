@@ -0,0 +1,479 @@
+#include "renderdaemon.h"
+
+#if !_WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "jsonutils.h"
+#include "rendermanifest.h"
+
+namespace midirenderer
+{
+	// One client's socket. Requests are read from it on the connection's own thread while any number
+	// of jobs send responses from the worker threads, so sending is serialized. The socket stays open
+	// until the client has gone and every job it submitted has finished.
+	class RenderDaemon::Connection
+	{
+	public:
+		Connection(int socket) : m_socket(socket), m_bufferStart(0), m_isBroken(false) { }
+
+		~Connection()
+		{
+			close(m_socket);
+		}
+
+		Connection(const Connection& other) = delete;
+		Connection& operator=(const Connection& other) = delete;
+
+		// Ends any read the connection's thread is waiting on and makes later sends fail
+		void disconnect()
+		{
+			shutdown(m_socket, SHUT_RDWR);
+		}
+
+		bool readLine(std::string& line, size_t maxLength)
+		{
+			while (true)
+			{
+				auto bufferBegin = m_buffer.begin() + m_bufferStart;
+				auto lineEnd = std::find(bufferBegin, m_buffer.end(), '\n');
+				if (lineEnd != m_buffer.end())
+				{
+					line.assign(bufferBegin, lineEnd);
+					if (!line.empty() && line.back() == '\r')
+					{
+						line.pop_back();
+					}
+					m_bufferStart = lineEnd + 1 - m_buffer.begin();
+					return true;
+				}
+
+				if (m_buffer.size() - m_bufferStart > maxLength || !receive())
+				{
+					return false;
+				}
+			}
+		}
+
+		bool readBytes(size_t count, std::vector<unsigned char>& bytes)
+		{
+			while (m_buffer.size() - m_bufferStart < count)
+			{
+				if (!receive()) { return false; }
+			}
+
+			bytes.assign(m_buffer.begin() + m_bufferStart, m_buffer.begin() + m_bufferStart + count);
+			m_bufferStart += count;
+			return true;
+		}
+
+		void send(const std::string& message)
+		{
+			std::lock_guard<std::mutex> lock(m_sendMutex);
+			// A client that stops reading doesn't stop its jobs; their results are just dropped
+			if (m_isBroken) { return; }
+
+			std::string line = message + "\n";
+			size_t sentLength = 0;
+			while (sentLength < line.size())
+			{
+				ssize_t result = ::send(m_socket, line.data() + sentLength, line.size() - sentLength, 0);
+				if (result < 0)
+				{
+					if (errno == EINTR) { continue; }
+					m_isBroken = true;
+					return;
+				}
+				sentLength += static_cast<size_t>(result);
+			}
+		}
+
+	private:
+		bool receive()
+		{
+			// Drop what's already been read before the buffer grows
+			m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_bufferStart);
+			m_bufferStart = 0;
+
+			char chunk[4096];
+			while (true)
+			{
+				ssize_t result = recv(m_socket, chunk, sizeof(chunk), 0);
+				if (result < 0 && errno == EINTR) { continue; }
+				if (result <= 0) { return false; }
+
+				m_buffer.insert(m_buffer.end(), chunk, chunk + result);
+				return true;
+			}
+		}
+
+		int m_socket;
+		std::vector<char> m_buffer;
+		size_t m_bufferStart;
+
+		std::mutex m_sendMutex;
+		bool m_isBroken;
+	};
+
+	struct RenderDaemon::RenderRequest
+	{
+		std::string m_id;
+		std::string m_inputPath;
+		// Whether the input was sent over the socket, in which case it's rendered straight from m_inputData
+		bool m_hasInputData;
+		std::vector<unsigned char> m_inputData;
+		std::string m_outputPath;
+		std::string m_soundfontPath;
+		MIDIVorbisRenderer::RenderSettings m_settings;
+	};
+
+	namespace
+	{
+		std::string getEventJSON(const std::string& id, const std::string& event)
+		{
+			return "{\"id\":" + utils::toJSONString(id) + ",\"event\":" + utils::toJSONString(event);
+		}
+
+		std::string getErrorJSON(const std::string& id, const std::string& message)
+		{
+			return getEventJSON(id, "error") + ",\"message\":" + utils::toJSONString(message) + "}";
+		}
+
+		// Signal handlers can't do much, so they wake the accept loop through this pipe
+		int s_signalPipe[2] = { -1, -1 };
+
+		void onStopSignal(int)
+		{
+			int savedErrno = errno;
+			char byte = 0;
+			ssize_t result = write(s_signalPipe[1], &byte, 1);
+			(void)result;
+			errno = savedErrno;
+		}
+	}
+
+	RenderDaemon::RenderDaemon(const std::string& socketPath, const std::string& defaultSoundfontPath, std::unique_ptr<MIDIVorbisRenderer> defaultRenderer,
+		RendererFactory rendererFactory, MIDIVorbisRenderer::RenderSettings defaultSettings, unsigned int jobCount) :
+		m_socketPath(socketPath), m_listenSocket(-1), m_defaultSoundfontPath(defaultSoundfontPath), m_rendererFactory(std::move(rendererFactory)),
+		m_defaultSettings(defaultSettings), m_isStopping(false), m_workers(jobCount)
+	{
+		m_renderers[defaultSoundfontPath] = std::move(defaultRenderer);
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+		{
+			throw std::invalid_argument("The socket path " + socketPath + " is too long");
+		}
+		std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+		m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_listenSocket < 0)
+		{
+			throw std::runtime_error(std::string("Failed to create a socket: ") + std::strerror(errno));
+		}
+
+		// A socket file left behind by a daemon that was killed is replaced, but one that's still
+		// being listened on belongs to another daemon
+		std::error_code statusError;
+		std::filesystem::file_status status = std::filesystem::status(socketPath, statusError);
+		if (std::filesystem::is_socket(status))
+		{
+			int probeSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+			bool isInUse = probeSocket >= 0 && connect(probeSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+			if (probeSocket >= 0) { close(probeSocket); }
+			if (isInUse)
+			{
+				close(m_listenSocket);
+				throw std::runtime_error("Another daemon is already listening at " + socketPath);
+			}
+			unlink(socketPath.c_str());
+		}
+
+		if (bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_listenSocket, SOMAXCONN) != 0)
+		{
+			std::string error = std::strerror(errno);
+			close(m_listenSocket);
+			throw std::runtime_error("Failed to listen at " + socketPath + ": " + error);
+		}
+	}
+
+	RenderDaemon::~RenderDaemon()
+	{
+		// run may have ended with an exception and left clients connected
+		stopConnections();
+		close(m_listenSocket);
+		unlink(m_socketPath.c_str());
+	}
+
+	void RenderDaemon::run()
+	{
+		// Writing to a client that has disconnected should fail that write, not end the daemon
+		std::signal(SIGPIPE, SIG_IGN);
+
+		if (s_signalPipe[0] < 0)
+		{
+			if (pipe(s_signalPipe) != 0)
+			{
+				throw std::runtime_error(std::string("Failed to create the signal pipe: ") + std::strerror(errno));
+			}
+			fcntl(s_signalPipe[1], F_SETFL, O_NONBLOCK);
+		}
+		// A second signal ends the process as usual, in case a job won't stop
+		struct sigaction stopAction = {};
+		stopAction.sa_handler = onStopSignal;
+		stopAction.sa_flags = SA_RESETHAND;
+		sigemptyset(&stopAction.sa_mask);
+		sigaction(SIGTERM, &stopAction, nullptr);
+		sigaction(SIGINT, &stopAction, nullptr);
+
+		while (true)
+		{
+			pollfd pollSockets[2] = { { m_listenSocket, POLLIN, 0 }, { s_signalPipe[0], POLLIN, 0 } };
+			if (poll(pollSockets, 2, -1) < 0)
+			{
+				if (errno == EINTR) { continue; }
+				throw std::runtime_error(std::string("Failed to wait for connections: ") + std::strerror(errno));
+			}
+			if (pollSockets[1].revents != 0) { break; }
+
+			int clientSocket = accept(m_listenSocket, nullptr, nullptr);
+			if (clientSocket < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) { continue; }
+				throw std::runtime_error(std::string("Failed to accept a connection: ") + std::strerror(errno));
+			}
+
+			auto connection = std::make_shared<Connection>(clientSocket);
+			joinFinishedConnections();
+			if (m_connectionThreads.size() >= s_maxConnectionCount)
+			{
+				connection->send(getErrorJSON("", "Too many clients are connected"));
+				continue;
+			}
+
+			auto isFinished = std::make_shared<std::atomic<bool>>(false);
+			m_connectionThreads.push_back({ connection, isFinished, std::thread([this, connection, isFinished]()
+			{
+				handleConnection(connection);
+				isFinished->store(true);
+			}) });
+		}
+
+		stopConnections();
+	}
+
+	void RenderDaemon::joinFinishedConnections()
+	{
+		for (auto connectionThread = m_connectionThreads.begin(); connectionThread != m_connectionThreads.end();)
+		{
+			if (connectionThread->m_isFinished->load())
+			{
+				connectionThread->m_thread.join();
+				connectionThread = m_connectionThreads.erase(connectionThread);
+			}
+			else
+			{
+				++connectionThread;
+			}
+		}
+	}
+
+	void RenderDaemon::stopConnections()
+	{
+		m_isStopping.store(true);
+		for (ConnectionThread& connectionThread : m_connectionThreads)
+		{
+			connectionThread.m_connection->disconnect();
+		}
+		for (ConnectionThread& connectionThread : m_connectionThreads)
+		{
+			connectionThread.m_thread.join();
+		}
+		m_connectionThreads.clear();
+
+		// Queued jobs see that the daemon is stopping and return without rendering
+		m_workers.wait();
+	}
+
+	void RenderDaemon::handleConnection(std::shared_ptr<Connection> connection)
+	{
+		std::string line;
+		while (connection->readLine(line, s_maxRequestLength))
+		{
+			if (line.empty()) { continue; }
+			if (!handleRequest(connection, line)) { return; }
+		}
+	}
+
+	bool RenderDaemon::handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line)
+	{
+		std::vector<std::string> fields;
+		size_t fieldStart = 0;
+		while (fieldStart <= line.size())
+		{
+			size_t fieldEnd = line.find('\t', fieldStart);
+			if (fieldEnd == std::string::npos) { fieldEnd = line.size(); }
+			fields.push_back(line.substr(fieldStart, fieldEnd - fieldStart));
+			fieldStart = fieldEnd + 1;
+		}
+
+		std::map<std::string, std::string> values;
+		for (size_t i = 1; i < fields.size(); i++)
+		{
+			size_t separator = fields[i].find('=');
+			if (separator == std::string::npos)
+			{
+				values[fields[i]] = "";
+			}
+			else
+			{
+				values[fields[i].substr(0, separator)] = fields[i].substr(separator + 1);
+			}
+		}
+
+		RenderRequest request = { values["id"], "", false, {}, values["output"], m_defaultSoundfontPath, m_defaultSettings };
+
+		// MIDI data sent with the request has to be read even if the request is rejected,
+		// or it would be taken for the next request
+		std::vector<unsigned char> inputData;
+		if (values.count("input-size") > 0)
+		{
+			size_t inputSize = 0;
+			try
+			{
+				inputSize = std::stoull(values["input-size"]);
+			}
+			catch (std::exception&)
+			{
+				connection->send(getErrorJSON(request.m_id, "Invalid input size " + values["input-size"]));
+				return false;
+			}
+
+			if (inputSize > s_maxInputSize)
+			{
+				connection->send(getErrorJSON(request.m_id, "The input is larger than the limit of " + std::to_string(s_maxInputSize) + " bytes"));
+				return false;
+			}
+			if (!connection->readBytes(inputSize, inputData)) { return false; }
+		}
+
+		try
+		{
+			if (fields[0] != "render")
+			{
+				throw std::invalid_argument("Unknown request " + fields[0]);
+			}
+
+			if (values.count("input") > 0 && values.count("input-size") > 0)
+			{
+				throw std::invalid_argument("Only one of input and input-size can be given");
+			}
+			if (values.count("input") == 0 && values.count("input-size") == 0)
+			{
+				throw std::invalid_argument("No input given");
+			}
+			if (request.m_outputPath.empty())
+			{
+				throw std::invalid_argument("No output given");
+			}
+
+			// The fields that aren't settings were handled above
+			for (const auto& value : values)
+			{
+				const std::string& name = value.first;
+				if (name != "id" && name != "input" && name != "input-size" && name != "output" && name != "soundfont" &&
+					!setRenderSetting(request.m_settings, name, value.second))
+				{
+					throw std::invalid_argument("Unknown field " + name);
+				}
+			}
+
+			if (values.count("soundfont") > 0)
+			{
+				request.m_soundfontPath = values["soundfont"];
+			}
+
+			if (values.count("input") > 0)
+			{
+				request.m_inputPath = values["input"];
+			}
+			else
+			{
+				request.m_hasInputData = true;
+				request.m_inputData = std::move(inputData);
+			}
+		}
+		catch (std::exception& e)
+		{
+			connection->send(getErrorJSON(request.m_id, e.what()));
+			return true;
+		}
+
+		connection->send(getEventJSON(request.m_id, "queued") + "}");
+		m_workers.submit([this, connection, request = std::move(request)]()
+		{
+			runJob(connection, request);
+		});
+		return true;
+	}
+
+	void RenderDaemon::runJob(const std::shared_ptr<Connection>& connection, const RenderRequest& request)
+	{
+		if (m_isStopping.load())
+		{
+			connection->send(getErrorJSON(request.m_id, "The daemon is stopping"));
+			return;
+		}
+
+		auto startTime = std::chrono::steady_clock::now();
+		try
+		{
+			MIDIVorbisRenderer& renderer = getRenderer(request.m_soundfontPath);
+			auto progressCallback = [&](double progress)
+			{
+				connection->send(getEventJSON(request.m_id, "progress") + ",\"progress\":" + utils::toJSONNumber(progress, utils::s_progressDecimalPlaces) + "}");
+			};
+			RenderResult result = request.m_hasInputData ?
+				renderer.renderData("sent with request " + request.m_id, request.m_inputData, request.m_outputPath, request.m_settings, progressCallback, &m_isStopping) :
+				renderer.renderFile(request.m_inputPath, request.m_outputPath, request.m_settings, progressCallback, &m_isStopping);
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			connection->send(getEventJSON(request.m_id, "done") + ",\"output\":" + utils::toJSONString(request.m_outputPath) +
+				",\"cached\":" + (result.m_isCached ? "true" : "false") + ",\"seconds\":" + utils::toJSONNumber(seconds) + "}");
+		}
+		catch (std::exception& e)
+		{
+			connection->send(getErrorJSON(request.m_id, e.what()));
+		}
+	}
+
+	MIDIVorbisRenderer& RenderDaemon::getRenderer(const std::string& soundfontPath)
+	{
+		// The factory's renderers load their soundfonts when they first render, so a job for
+		// a new soundfont doesn't hold up the others while it loads
+		std::lock_guard<std::mutex> lock(m_rendererMutex);
+		std::unique_ptr<MIDIVorbisRenderer>& renderer = m_renderers[soundfontPath];
+		if (!renderer)
+		{
+			renderer = m_rendererFactory(soundfontPath);
+		}
+		return *renderer;
+	}
+}
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "midivorbisrenderer.h"
+#include "workerpool.h"
+
+namespace midirenderer
+{
+	// Keeps renderers and the soundfonts they've loaded alive between renders, taking render jobs
+	// from clients connected to a Unix socket. Each request is a line of tab-separated fields and
+	// each response is a JSON object on its own line; the README describes the protocol.
+	// Only available on platforms with Unix sockets.
+	class RenderDaemon
+	{
+	public:
+		// Creates the renderer for a soundfont a client asks for, which is kept for later jobs
+		using RendererFactory = std::function<std::unique_ptr<MIDIVorbisRenderer>(const std::string& soundfontPath)>;
+
+		RenderDaemon(const std::string& socketPath, const std::string& defaultSoundfontPath, std::unique_ptr<MIDIVorbisRenderer> defaultRenderer,
+			RendererFactory rendererFactory, MIDIVorbisRenderer::RenderSettings defaultSettings, unsigned int jobCount);
+		~RenderDaemon();
+
+		RenderDaemon(const RenderDaemon& other) = delete;
+		RenderDaemon& operator=(const RenderDaemon& other) = delete;
+
+		// Accepts connections until the process gets SIGTERM or SIGINT, then cancels the jobs that are
+		// running, disconnects every client and returns
+		void run();
+
+	private:
+		class Connection;
+		struct RenderRequest;
+
+		struct ConnectionThread
+		{
+			std::shared_ptr<Connection> m_connection;
+			std::shared_ptr<std::atomic<bool>> m_isFinished;
+			std::thread m_thread;
+		};
+
+		// Joins the threads of connections whose clients have gone
+		void joinFinishedConnections();
+		void stopConnections();
+		void handleConnection(std::shared_ptr<Connection> connection);
+		// Returns false if the connection can't be read from anymore
+		bool handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line);
+		void runJob(const std::shared_ptr<Connection>& connection, const RenderRequest& request);
+		MIDIVorbisRenderer& getRenderer(const std::string& soundfontPath);
+
+		std::string m_socketPath;
+		int m_listenSocket;
+
+		std::string m_defaultSoundfontPath;
+		RendererFactory m_rendererFactory;
+		MIDIVorbisRenderer::RenderSettings m_defaultSettings;
+
+		std::mutex m_rendererMutex;
+		std::map<std::string, std::unique_ptr<MIDIVorbisRenderer>> m_renderers;
+
+		// Only used from the thread that calls run
+		std::list<ConnectionThread> m_connectionThreads;
+		// Cancels running jobs and skips queued ones once the daemon is stopping
+		std::atomic<bool> m_isStopping;
+
+		// Declared last so that queued jobs finish before the renderers they use are destroyed
+		utils::WorkerPool m_workers;
+
+		constexpr static size_t s_maxRequestLength = 64 * 1024;
+		constexpr static size_t s_maxInputSize = 64 * 1024 * 1024;
+		// Each connection has its own thread, so clients past this are turned away
+		constexpr static size_t s_maxConnectionCount = 256;
+	};
+}
@@ -0,0 +1,501 @@
+#include "rendermanifest.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+
+#include "fileutils.h"
+
+namespace midirenderer
+{
+	namespace
+	{
+		// A job's fields as they were written, along with the line it starts on for errors
+		struct ManifestEntry
+		{
+			size_t m_line;
+			std::map<std::string, std::string> m_fields;
+		};
+
+		std::invalid_argument getLineError(const std::string& manifestPath, size_t line, const std::string& message)
+		{
+			return std::invalid_argument(manifestPath + " line " + std::to_string(line) + ": " + message);
+		}
+
+		void appendUTF8(std::string& text, uint32_t codePoint)
+		{
+			if (codePoint < 0x80)
+			{
+				text += static_cast<char>(codePoint);
+			}
+			else if (codePoint < 0x800)
+			{
+				text += static_cast<char>(0xC0 | (codePoint >> 6));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+			else if (codePoint < 0x10000)
+			{
+				text += static_cast<char>(0xE0 | (codePoint >> 12));
+				text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+			else
+			{
+				text += static_cast<char>(0xF0 | (codePoint >> 18));
+				text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+				text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+		}
+
+		// Reads just enough JSON for a manifest: an array of objects whose values are strings, numbers,
+		// booleans or null. Null values are left out as if they weren't given.
+		class ManifestJSONReader
+		{
+		public:
+			ManifestJSONReader(const std::string& text, const std::string& manifestPath) :
+				m_text(text), m_manifestPath(manifestPath), m_position(0), m_line(1)
+			{
+			}
+
+			std::vector<ManifestEntry> read()
+			{
+				std::vector<ManifestEntry> entries;
+				expect('[');
+				if (!consume(']'))
+				{
+					do
+					{
+						entries.push_back(readEntry());
+					} while (consume(','));
+					expect(']');
+				}
+
+				skipWhitespace();
+				if (m_position < m_text.size())
+				{
+					fail("Unexpected text after the list of jobs");
+				}
+				return entries;
+			}
+
+		private:
+			ManifestEntry readEntry()
+			{
+				skipWhitespace();
+				ManifestEntry entry = { m_line, {} };
+				expect('{');
+				if (!consume('}'))
+				{
+					do
+					{
+						skipWhitespace();
+						std::string name = readString();
+						expect(':');
+
+						std::string value;
+						bool isNull = !readValue(value);
+						if (entry.m_fields.count(name) > 0)
+						{
+							fail("The field " + name + " is given twice");
+						}
+						if (!isNull)
+						{
+							entry.m_fields[name] = value;
+						}
+					} while (consume(','));
+					expect('}');
+				}
+				return entry;
+			}
+
+			// Returns false for null
+			bool readValue(std::string& value)
+			{
+				skipWhitespace();
+				if (m_position < m_text.size() && m_text[m_position] == '"')
+				{
+					value = readString();
+					return true;
+				}
+
+				size_t start = m_position;
+				while (m_position < m_text.size() && (std::isalnum(static_cast<unsigned char>(m_text[m_position])) ||
+					m_text[m_position] == '-' || m_text[m_position] == '+' || m_text[m_position] == '.'))
+				{
+					m_position++;
+				}
+				value = m_text.substr(start, m_position - start);
+
+				if (value == "null") { return false; }
+				if (value == "true" || value == "false") { return true; }
+
+				char* numberEnd = nullptr;
+				std::strtod(value.c_str(), &numberEnd);
+				if (value.empty() || numberEnd != value.c_str() + value.size())
+				{
+					fail("Expected a string, number, boolean or null");
+				}
+				return true;
+			}
+
+			std::string readString()
+			{
+				if (m_position >= m_text.size() || m_text[m_position] != '"')
+				{
+					fail("Expected a string");
+				}
+				m_position++;
+
+				std::string value;
+				while (true)
+				{
+					if (m_position >= m_text.size() || m_text[m_position] == '\n')
+					{
+						fail("A string isn't closed");
+					}
+
+					char character = m_text[m_position++];
+					if (character == '"') { break; }
+					if (character != '\\')
+					{
+						value += character;
+						continue;
+					}
+
+					if (m_position >= m_text.size()) { fail("A string isn't closed"); }
+					char escape = m_text[m_position++];
+					switch (escape)
+					{
+					case '"':
+					case '\\':
+					case '/':
+						value += escape;
+						break;
+					case 'b':
+						value += '\b';
+						break;
+					case 'f':
+						value += '\f';
+						break;
+					case 'n':
+						value += '\n';
+						break;
+					case 'r':
+						value += '\r';
+						break;
+					case 't':
+						value += '\t';
+						break;
+					case 'u':
+					{
+						uint32_t codePoint = readHexQuad();
+						// Characters outside the basic plane are written as a pair of surrogates
+						if (codePoint >= 0xD800 && codePoint < 0xDC00 && m_text.compare(m_position, 2, "\\u") == 0)
+						{
+							m_position += 2;
+							uint32_t lowSurrogate = readHexQuad();
+							if (lowSurrogate < 0xDC00 || lowSurrogate >= 0xE000)
+							{
+								fail("Invalid surrogate pair in a string");
+							}
+							codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+						}
+						appendUTF8(value, codePoint);
+						break;
+					}
+					default:
+						fail(std::string("Invalid escape \\") + escape + " in a string");
+					}
+				}
+				return value;
+			}
+
+			uint32_t readHexQuad()
+			{
+				if (m_position + 4 > m_text.size())
+				{
+					fail("A \\u escape needs four hex digits");
+				}
+
+				uint32_t value = 0;
+				for (size_t i = 0; i < 4; i++)
+				{
+					char digit = m_text[m_position++];
+					if (!std::isxdigit(static_cast<unsigned char>(digit)))
+					{
+						fail("A \\u escape needs four hex digits");
+					}
+					value = value * 16 + (std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : std::tolower(digit) - 'a' + 10);
+				}
+				return value;
+			}
+
+			void skipWhitespace()
+			{
+				while (m_position < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_position])))
+				{
+					if (m_text[m_position] == '\n')
+					{
+						m_line++;
+					}
+					m_position++;
+				}
+			}
+
+			bool consume(char expected)
+			{
+				skipWhitespace();
+				if (m_position < m_text.size() && m_text[m_position] == expected)
+				{
+					m_position++;
+					return true;
+				}
+				return false;
+			}
+
+			void expect(char expected)
+			{
+				if (!consume(expected))
+				{
+					fail(std::string("Expected ") + expected);
+				}
+			}
+
+			[[noreturn]] void fail(const std::string& message)
+			{
+				throw getLineError(m_manifestPath, m_line, message);
+			}
+
+			const std::string& m_text;
+			const std::string& m_manifestPath;
+			size_t m_position;
+			size_t m_line;
+		};
+
+		// Reads CSV where the first row names the fields. Quoted fields can hold commas, line breaks
+		// and "" for a quote, and empty fields are left out as if they weren't given.
+		std::vector<ManifestEntry> readManifestCSV(const std::string& text, const std::string& manifestPath)
+		{
+			std::vector<std::pair<size_t, std::vector<std::string>>> rows;
+			size_t line = 1;
+			size_t position = 0;
+			while (position < text.size())
+			{
+				size_t rowLine = line;
+				std::vector<std::string> row;
+				while (true)
+				{
+					std::string field;
+					if (position < text.size() && text[position] == '"')
+					{
+						position++;
+						while (true)
+						{
+							if (position >= text.size())
+							{
+								throw getLineError(manifestPath, rowLine, "A quoted field isn't closed");
+							}
+
+							char character = text[position++];
+							if (character == '"')
+							{
+								if (position >= text.size() || text[position] != '"') { break; }
+								position++;
+							}
+							else if (character == '\n')
+							{
+								line++;
+							}
+							field += character;
+						}
+					}
+					while (position < text.size() && text[position] != ',' && text[position] != '\r' && text[position] != '\n')
+					{
+						field += text[position++];
+					}
+					row.push_back(field);
+
+					if (position < text.size() && text[position] == ',')
+					{
+						position++;
+						continue;
+					}
+					break;
+				}
+
+				if (position < text.size() && text[position] == '\r') { position++; }
+				if (position < text.size() && text[position] == '\n')
+				{
+					position++;
+					line++;
+				}
+
+				if (row.size() > 1 || !row[0].empty())
+				{
+					rows.push_back({ rowLine, std::move(row) });
+				}
+			}
+
+			std::vector<ManifestEntry> entries;
+			if (rows.empty()) { return entries; }
+
+			std::vector<std::string>& header = rows[0].second;
+			for (std::string& name : header)
+			{
+				size_t start = name.find_first_not_of(' ');
+				name = start == std::string::npos ? "" : name.substr(start, name.find_last_not_of(' ') - start + 1);
+			}
+
+			for (size_t i = 1; i < rows.size(); i++)
+			{
+				const std::vector<std::string>& row = rows[i].second;
+				if (row.size() != header.size())
+				{
+					throw getLineError(manifestPath, rows[i].first, "The row has " + std::to_string(row.size()) + " fields, but the header has " +
+						std::to_string(header.size()));
+				}
+
+				ManifestEntry entry = { rows[i].first, {} };
+				for (size_t field = 0; field < row.size(); field++)
+				{
+					if (!row[field].empty())
+					{
+						entry.m_fields[header[field]] = row[field];
+					}
+				}
+				entries.push_back(std::move(entry));
+			}
+			return entries;
+		}
+	}
+
+	std::vector<ManifestJob> readManifest(const std::string& manifestPath, const MIDIVorbisRenderer::RenderSettings& defaultSettings)
+	{
+		std::vector<unsigned char> contents = utils::readFileContents(manifestPath);
+		std::string text(contents.begin(), contents.end());
+		// Spreadsheets tend to start their CSV files with a byte order mark
+		if (text.compare(0, 3, "\xEF\xBB\xBF") == 0)
+		{
+			text.erase(0, 3);
+		}
+
+		std::filesystem::path fsManifestPath = std::filesystem::u8path(manifestPath);
+		std::string extension = fsManifestPath.extension().u8string();
+		for (char& character : extension)
+		{
+			character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+		}
+		std::vector<ManifestEntry> entries = extension == ".csv" ? readManifestCSV(text, manifestPath) :
+			ManifestJSONReader(text, manifestPath).read();
+
+		std::filesystem::path manifestFolder = fsManifestPath.parent_path();
+		auto resolvePath = [&](const std::string& path)
+		{
+			std::filesystem::path fsPath = std::filesystem::u8path(path);
+			return fsPath.is_relative() ? (manifestFolder / fsPath).u8string() : path;
+		};
+
+		std::vector<ManifestJob> jobs;
+		jobs.reserve(entries.size());
+		for (const ManifestEntry& entry : entries)
+		{
+			ManifestJob job = { "", "", "", defaultSettings };
+			for (const auto& field : entry.m_fields)
+			{
+				const std::string& name = field.first;
+				try
+				{
+					if (name == "input")
+					{
+						job.m_inputPath = resolvePath(field.second);
+					}
+					else if (name == "output")
+					{
+						job.m_outputPath = resolvePath(field.second);
+					}
+					else if (name == "soundfont")
+					{
+						job.m_soundfontPath = resolvePath(field.second);
+					}
+					else if (!setRenderSetting(job.m_settings, name, field.second))
+					{
+						throw std::invalid_argument("Unknown field " + name);
+					}
+				}
+				catch (std::invalid_argument& e)
+				{
+					throw getLineError(manifestPath, entry.m_line, e.what());
+				}
+			}
+
+			if (job.m_inputPath.empty())
+			{
+				throw getLineError(manifestPath, entry.m_line, "The job has no input");
+			}
+			jobs.push_back(std::move(job));
+		}
+		return jobs;
+	}
+
+	bool setRenderSetting(MIDIVorbisRenderer::RenderSettings& settings, const std::string& name, const std::string& value)
+	{
+		if (name == "loop-mode")
+		{
+			if (value == "none")
+			{
+				settings.m_loopMode = MIDIVorbisRenderer::LoopMode::None;
+			}
+			else if (value == "short")
+			{
+				settings.m_loopMode = MIDIVorbisRenderer::LoopMode::Short;
+			}
+			else if (value == "double")
+			{
+				settings.m_loopMode = MIDIVorbisRenderer::LoopMode::Double;
+			}
+			else
+			{
+				throw std::invalid_argument("Invalid loop mode " + value);
+			}
+			return true;
+		}
+
+		if (name == "end-on-division")
+		{
+			if (value == "none")
+			{
+				settings.m_endingBeatDivision = -1;
+				return true;
+			}
+
+			// The same powers of two from 1 to 64 the command line accepts, with nothing after the number
+			char* numberEnd = nullptr;
+			long beatDivision = std::strtol(value.c_str(), &numberEnd, 10);
+			if (value.empty() || numberEnd != value.c_str() + value.size() || beatDivision <= 0 || beatDivision > 64 ||
+				(beatDivision & (beatDivision - 1)) != 0)
+			{
+				throw std::invalid_argument("Invalid beat division " + value);
+			}
+			settings.m_endingBeatDivision = static_cast<int>(beatDivision);
+			return true;
+		}
+
+		if (name == "quality")
+		{
+			char* numberEnd = nullptr;
+			double quality = std::strtod(value.c_str(), &numberEnd);
+			if (value.empty() || numberEnd != value.c_str() + value.size() || !(quality >= -0.1 && quality <= 1.0))
+			{
+				throw std::invalid_argument("Invalid quality " + value + " - use a number from -0.1 to 1");
+			}
+			settings.m_vorbisQuality = static_cast<float>(quality);
+			return true;
+		}
+
+		return false;
+	}
+}
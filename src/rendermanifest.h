@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "midivorbisrenderer.h"
+
+namespace midirenderer
+{
+	// One render listed in a manifest, with relative paths made relative to the manifest's folder
+	struct ManifestJob
+	{
+		std::string m_inputPath;
+		// Empty when the manifest leaves it to the usual output path for the input
+		std::string m_outputPath;
+		// Empty when the manifest leaves it to the soundfont given on the command line
+		std::string m_soundfontPath;
+		MIDIVorbisRenderer::RenderSettings m_settings;
+	};
+
+	// Reads the jobs in a manifest: a JSON array of objects, or a CSV file with a header row for files
+	// ending in .csv. Each job's fields have the same names as the render daemon's, and the settings
+	// it doesn't give come from the defaults. Throws std::invalid_argument naming the line of anything
+	// malformed or unknown.
+	std::vector<ManifestJob> readManifest(const std::string& manifestPath, const MIDIVorbisRenderer::RenderSettings& defaultSettings);
+
+	// Sets loop-mode, end-on-division or quality by name, as manifests and the render daemon give them.
+	// Returns false for any other name, and throws std::invalid_argument for invalid values.
+	bool setRenderSetting(MIDIVorbisRenderer::RenderSettings& settings, const std::string& name, const std::string& value);
+}
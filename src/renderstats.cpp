@@ -0,0 +1,93 @@
+#include "renderstats.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include "songrendercontainer.h"
+
+namespace midirenderer
+{
+	namespace
+	{
+		const char* const s_stageNames[] = {
+			"synthesis",
+			"encoding",
+			"analysis",
+			"page writes",
+			"loudness",
+			"song body",
+			"runoff",
+			"loop pre-roll",
+			"loop"
+		};
+
+		double getSeconds(std::chrono::nanoseconds time)
+		{
+			return std::chrono::duration<double>(time).count();
+		}
+	}
+
+	void RenderStats::add(const RenderStats& other)
+	{
+		for (size_t i = 0; i < m_stages.size(); i++)
+		{
+			m_stages[i].m_time += other.m_stages[i].m_time;
+			m_stages[i].m_callCount += other.m_stages[i].m_callCount;
+		}
+		m_totalTime += other.m_totalTime;
+
+		m_bodyFrames += other.m_bodyFrames;
+		m_runoffFrames += other.m_runoffFrames;
+		m_trimmedRunoffFrames += other.m_trimmedRunoffFrames;
+		m_preRollFrames += other.m_preRollFrames;
+		m_loopFrames += other.m_loopFrames;
+		m_silentFrames += other.m_silentFrames;
+	}
+
+	RenderStats::Stage& RenderStats::getStage(RenderStage stage)
+	{
+		return m_stages[static_cast<size_t>(stage)];
+	}
+
+	const RenderStats::Stage& RenderStats::getStage(RenderStage stage) const
+	{
+		return m_stages[static_cast<size_t>(stage)];
+	}
+
+	uint64_t RenderStats::getOutputFrames() const
+	{
+		return m_bodyFrames + m_loopFrames;
+	}
+
+	std::string RenderStats::getSummary(const std::string& indent, std::chrono::nanoseconds wallTime) const
+	{
+		std::ostringstream summary;
+		summary << std::fixed << std::setprecision(3);
+
+		double audioSeconds = getOutputFrames() / SongRenderContainer::s_sampleRate;
+		double wallSeconds = getSeconds(wallTime);
+		summary << indent << wallSeconds << "s for " << audioSeconds << "s of audio (" <<
+			std::setprecision(2) << (wallSeconds > 0 ? audioSeconds / wallSeconds : 0) << "x realtime)\n" << std::setprecision(3);
+
+		auto writeStages = [&](RenderStage first, RenderStage last, bool isCountingCalls)
+		{
+			summary << indent;
+			for (size_t i = static_cast<size_t>(first); i <= static_cast<size_t>(last); i++)
+			{
+				summary << (i > static_cast<size_t>(first) ? ", " : "") << s_stageNames[i] << " " << getSeconds(m_stages[i].m_time) << "s";
+				if (isCountingCalls)
+				{
+					summary << " (" << m_stages[i].m_callCount << " calls)";
+				}
+			}
+			summary << "\n";
+		};
+		writeStages(RenderStage::Synthesis, RenderStage::Loudness, true);
+		// Phases only happen once per render, so their counts aren't worth showing
+		writeStages(RenderStage::SongBody, RenderStage::Loop, false);
+
+		summary << indent << "frames: " << m_bodyFrames << " song body, " << m_runoffFrames << " runoff (" << m_trimmedRunoffFrames << " trimmed), " <<
+			m_preRollFrames << " loop pre-roll, " << m_loopFrames << " loop (" << m_silentFrames << " silent)\n";
+		return summary.str();
+	}
+}
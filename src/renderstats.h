@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace midirenderer
+{
+	enum class RenderStage
+	{
+		// Work done by the synth and encoder, which don't overlap
+		Synthesis,
+		Encoding,
+		Analysis,
+		PageWrites,
+		// Measuring the loudness of renders that are normalized
+		Loudness,
+		// Parts of the song, each including the synthesis (and encoding, unless it's pipelined) done during it
+		SongBody,
+		Runoff,
+		LoopPreRoll,
+		Loop,
+		Count
+	};
+
+	// Wall time and call counts for each stage of a render, and where the rendered frames went.
+	// Each stage is only ever timed from one thread, so a pipelined render can time its synthesis
+	// and encoding stages on separate threads without locking.
+	struct RenderStats
+	{
+		struct Stage
+		{
+			std::chrono::nanoseconds m_time;
+			uint64_t m_callCount;
+		};
+
+		std::array<Stage, static_cast<size_t>(RenderStage::Count)> m_stages;
+		std::chrono::nanoseconds m_totalTime;
+
+		// The song up to its end, including any beat division padding
+		uint64_t m_bodyFrames;
+		// Voices ringing out after the end, which are mixed into the start of the loop
+		uint64_t m_runoffFrames;
+		// Runoff rendered below the runoff floor at the very end, which was dropped
+		uint64_t m_trimmedRunoffFrames;
+		// Frames synthesized and thrown away to bring the synth back to the loop point
+		uint64_t m_preRollFrames;
+		// Frames written after the end of the song to make the loop seamless
+		uint64_t m_loopFrames;
+		// Frames in the song body and loop known to be silent, which were written as zeros
+		// instead of being copied out of the synth
+		uint64_t m_silentFrames;
+
+		void add(const RenderStats& other);
+		Stage& getStage(RenderStage stage);
+		const Stage& getStage(RenderStage stage) const;
+
+		// The frames the output file plays for, not counting runoff mixed into other frames
+		uint64_t getOutputFrames() const;
+
+		// A few lines breaking down where the time went, each starting with the indent
+		std::string getSummary(const std::string& indent, std::chrono::nanoseconds wallTime) const;
+	};
+
+	// Adds the time between its construction and destruction to a stage, if there are stats to add it to
+	class StageTimer
+	{
+	public:
+		StageTimer(RenderStats* stats, RenderStage stage) : m_stats(stats), m_stage(stage)
+		{
+			if (m_stats != nullptr)
+			{
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+
+		~StageTimer()
+		{
+			if (m_stats != nullptr)
+			{
+				RenderStats::Stage& stage = m_stats->getStage(m_stage);
+				stage.m_time += std::chrono::steady_clock::now() - m_start;
+				stage.m_callCount++;
+			}
+		}
+
+		StageTimer(const StageTimer& other) = delete;
+		StageTimer& operator=(const StageTimer& other) = delete;
+
+	private:
+		RenderStats* m_stats;
+		RenderStage m_stage;
+		std::chrono::steady_clock::time_point m_start;
+	};
+}
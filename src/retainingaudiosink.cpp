@@ -0,0 +1,101 @@
+#include "retainingaudiosink.h"
+
+#include <algorithm>
+
+RetainingAudioSink::RetainingAudioSink(AudioSink& target) : m_target(target), m_framePosition(0),
+	m_acquiredLeftBuffer(nullptr), m_acquiredRightBuffer(nullptr), m_isRetaining(false), m_hasRetainedAll(false), m_retainStart(0), m_maxRetainedFrames(0)
+{
+}
+
+void RetainingAudioSink::writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	m_target.writeBuffers(leftBuffer, rightBuffer, frameCount);
+	retainBuffers(leftBuffer, rightBuffer, frameCount);
+}
+
+size_t RetainingAudioSink::acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	size_t acquiredFrameCount = m_target.acquireBuffers(frameCount, leftBuffer, rightBuffer);
+	m_acquiredLeftBuffer = leftBuffer;
+	m_acquiredRightBuffer = rightBuffer;
+	return acquiredFrameCount;
+}
+
+void RetainingAudioSink::commitBuffers(size_t frameCount)
+{
+	// The target may change its buffers as it encodes them, so they're kept before they're committed
+	retainBuffers(m_acquiredLeftBuffer, m_acquiredRightBuffer, frameCount);
+	m_target.commitBuffers(frameCount);
+}
+
+void RetainingAudioSink::startOverlapRegion()
+{
+	if (m_isRetaining)
+	{
+		stopRetaining(m_framePosition >= m_retainStart);
+	}
+	m_target.startOverlapRegion();
+}
+
+void RetainingAudioSink::endOverlapRegion()
+{
+	m_target.endOverlapRegion();
+}
+
+void RetainingAudioSink::retainFrom(uint64_t framePosition, size_t maxFrameCount)
+{
+	m_isRetaining = framePosition >= m_framePosition;
+	m_hasRetainedAll = false;
+	m_retainStart = framePosition;
+	m_maxRetainedFrames = maxFrameCount;
+	m_leftBuffer.clear();
+	m_rightBuffer.clear();
+}
+
+bool RetainingAudioSink::getHasRetainedAll() const
+{
+	return m_hasRetainedAll;
+}
+
+const std::vector<float>& RetainingAudioSink::getLeftBuffer() const
+{
+	return m_leftBuffer;
+}
+
+const std::vector<float>& RetainingAudioSink::getRightBuffer() const
+{
+	return m_rightBuffer;
+}
+
+void RetainingAudioSink::retainBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	if (m_isRetaining && m_framePosition + frameCount > m_retainStart)
+	{
+		size_t skippedFrames = m_framePosition < m_retainStart ? static_cast<size_t>(m_retainStart - m_framePosition) : 0;
+		size_t retainedFrames = frameCount - skippedFrames;
+		if (m_leftBuffer.size() + retainedFrames > m_maxRetainedFrames)
+		{
+			stopRetaining(false);
+		}
+		else
+		{
+			m_leftBuffer.insert(m_leftBuffer.end(), &leftBuffer[skippedFrames], &leftBuffer[frameCount]);
+			m_rightBuffer.insert(m_rightBuffer.end(), &rightBuffer[skippedFrames], &rightBuffer[frameCount]);
+		}
+	}
+
+	m_framePosition += frameCount;
+}
+
+void RetainingAudioSink::stopRetaining(bool isComplete)
+{
+	m_isRetaining = false;
+	m_hasRetainedAll = isComplete;
+	if (!isComplete)
+	{
+		m_leftBuffer.clear();
+		m_leftBuffer.shrink_to_fit();
+		m_rightBuffer.clear();
+		m_rightBuffer.shrink_to_fit();
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "audiosink.h"
+
+// Passes everything written to it on to another sink and keeps a copy of the frames from
+// a given position onward, up to a limit, until an overlap region starts.
+class RetainingAudioSink : public AudioSink
+{
+public:
+	RetainingAudioSink(AudioSink& target);
+
+	RetainingAudioSink(const RetainingAudioSink& other) = delete;
+	RetainingAudioSink& operator=(const RetainingAudioSink& other) = delete;
+
+	void writeBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount) override;
+	size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override;
+	void commitBuffers(size_t frameCount) override;
+	void startOverlapRegion() override;
+	void endOverlapRegion() override;
+
+	// Starts keeping frames once framePosition frames have been written. If more than
+	// maxFrameCount frames would be kept, everything kept so far is dropped instead.
+	void retainFrom(uint64_t framePosition, size_t maxFrameCount);
+
+	// Whether every frame from the position given to retainFrom up to the start of the
+	// overlap region was kept
+	bool getHasRetainedAll() const;
+
+	const std::vector<float>& getLeftBuffer() const;
+	const std::vector<float>& getRightBuffer() const;
+
+private:
+	void retainBuffers(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
+	void stopRetaining(bool isComplete);
+
+	AudioSink& m_target;
+	uint64_t m_framePosition;
+
+	// The target's buffers, kept from when they're acquired until they're committed
+	const float* m_acquiredLeftBuffer;
+	const float* m_acquiredRightBuffer;
+
+	bool m_isRetaining;
+	bool m_hasRetainedAll;
+	uint64_t m_retainStart;
+	size_t m_maxRetainedFrames;
+	std::vector<float> m_leftBuffer;
+	std::vector<float> m_rightBuffer;
+};
@@ -0,0 +1,516 @@
+#include "segmentedvorbisencoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <vorbis/vorbisenc.h>
+
+struct SegmentedVorbisEncoder::EncoderState
+{
+	EncoderState(long sampleRate, float quality)
+	{
+		vorbis_info_init(&m_info);
+		int status = vorbis_encode_init_vbr(&m_info, 2, sampleRate, quality);
+		if (status != 0)
+		{
+			vorbis_info_clear(&m_info);
+			throw std::invalid_argument("Invalid vorbis bitrate or quality");
+		}
+
+		vorbis_analysis_init(&m_dspState, &m_info);
+		vorbis_block_init(&m_dspState, &m_block);
+	}
+
+	~EncoderState()
+	{
+		vorbis_block_clear(&m_block);
+		vorbis_dsp_clear(&m_dspState);
+		vorbis_info_clear(&m_info);
+	}
+
+	EncoderState(const EncoderState& other) = delete;
+	EncoderState& operator=(const EncoderState& other) = delete;
+
+	void write(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+	{
+		float** buffer = vorbis_analysis_buffer(&m_dspState, static_cast<int>(frameCount));
+
+		std::copy(leftBuffer, &leftBuffer[frameCount], buffer[0]);
+		std::copy(rightBuffer, &rightBuffer[frameCount], buffer[1]);
+
+		vorbis_analysis_wrote(&m_dspState, static_cast<int>(frameCount));
+	}
+
+	vorbis_info m_info;
+	vorbis_dsp_state m_dspState;
+	vorbis_block m_block;
+};
+
+SegmentedVorbisEncoder::SegmentedVorbisEncoder(long sampleRate, float quality, unsigned int threadCount, PacketCallbackFunc packetCallback) :
+	m_packetCallback(std::move(packetCallback)), m_sampleRate(sampleRate), m_quality(quality), m_stats(nullptr),
+	m_segmentFrames(getSegmentFrameCount(sampleRate)), m_primingFrames(static_cast<uint64_t>(sampleRate)), m_overrunFrames(static_cast<uint64_t>(sampleRate)),
+	m_gridEncoder(std::make_unique<EncoderState>(sampleRate, quality)), m_framesStart(0), m_frameCount(0), m_nextBoundary(0),
+	m_nextPacketIndex(0), m_nextPacketNumber(3), m_isStopping(false), m_workers(threadCount)
+{
+	m_blockAlignment = static_cast<uint64_t>(vorbis_info_blocksize(&m_gridEncoder->m_info, 0) / 4);
+
+	// Joins are checked by decoding them, which needs the stream's setup read back from its headers
+	vorbis_comment comment;
+	vorbis_comment_init(&comment);
+	ogg_packet header;
+	ogg_packet commentsHeader;
+	ogg_packet codebookHeader;
+	vorbis_analysis_headerout(&m_gridEncoder->m_dspState, &comment, &header, &commentsHeader, &codebookHeader);
+
+	vorbis_info_init(&m_decoderInfo);
+	vorbis_comment decodedComment;
+	vorbis_comment_init(&decodedComment);
+	bool isSetUp = vorbis_synthesis_headerin(&m_decoderInfo, &decodedComment, &header) == 0 &&
+		vorbis_synthesis_headerin(&m_decoderInfo, &decodedComment, &commentsHeader) == 0 &&
+		vorbis_synthesis_headerin(&m_decoderInfo, &decodedComment, &codebookHeader) == 0;
+	vorbis_comment_clear(&decodedComment);
+	vorbis_comment_clear(&comment);
+
+	if (!isSetUp)
+	{
+		vorbis_info_clear(&m_decoderInfo);
+		throw std::runtime_error("Failed to read back the Vorbis headers");
+	}
+}
+
+SegmentedVorbisEncoder::~SegmentedVorbisEncoder()
+{
+	// Segments still being encoded give up at their next chunk instead of finishing
+	m_isStopping = true;
+	vorbis_info_clear(&m_decoderInfo);
+}
+
+void SegmentedVorbisEncoder::write(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	if (frameCount == 0) { return; }
+
+	float* acquiredLeftBuffer = nullptr;
+	float* acquiredRightBuffer = nullptr;
+	acquireBuffers(frameCount, acquiredLeftBuffer, acquiredRightBuffer);
+	std::copy(leftBuffer, &leftBuffer[frameCount], acquiredLeftBuffer);
+	std::copy(rightBuffer, &rightBuffer[frameCount], acquiredRightBuffer);
+	commitBuffers(frameCount);
+}
+
+void SegmentedVorbisEncoder::acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer)
+{
+	size_t frameOffset = static_cast<size_t>(m_frameCount - m_framesStart);
+	m_frames[0].resize(frameOffset + frameCount);
+	m_frames[1].resize(frameOffset + frameCount);
+	leftBuffer = &m_frames[0][frameOffset];
+	rightBuffer = &m_frames[1][frameOffset];
+}
+
+void SegmentedVorbisEncoder::commitBuffers(size_t frameCount)
+{
+	size_t frameOffset = static_cast<size_t>(m_frameCount - m_framesStart);
+	m_frames[0].resize(frameOffset + frameCount);
+	m_frames[1].resize(frameOffset + frameCount);
+	if (frameCount == 0) { return; }
+
+	updateBlockGrid(&m_frames[0][frameOffset], &m_frames[1][frameOffset], frameCount);
+	m_frameCount += frameCount;
+
+	// A segment is cut once its overrun has been written. The last one is cut by finish, so
+	// it takes in whatever's left after the last whole segment.
+	while (m_frameCount >= m_nextBoundary + m_segmentFrames + m_overrunFrames)
+	{
+		submitSegment(m_nextBoundary + m_segmentFrames + m_overrunFrames, false);
+	}
+
+	joinSegments(m_workers.getWorkerCount());
+}
+
+void SegmentedVorbisEncoder::finish()
+{
+	submitSegment(m_frameCount, true);
+	joinSegments(0);
+
+	emitPackets(*m_currentSegment, m_nextPacketIndex, m_currentSegment->m_packets.size());
+	m_currentSegment.reset();
+}
+
+void SegmentedVorbisEncoder::setStats(midirenderer::RenderStats* stats)
+{
+	m_stats = stats;
+}
+
+uint64_t SegmentedVorbisEncoder::getSegmentFrameCount(long sampleRate)
+{
+	return static_cast<uint64_t>(sampleRate) * s_segmentSeconds;
+}
+
+void SegmentedVorbisEncoder::updateBlockGrid(const float* leftBuffer, const float* rightBuffer, size_t frameCount)
+{
+	m_gridEncoder->write(leftBuffer, rightBuffer, frameCount);
+
+	// The block sizes are chosen before a block is analysed, so the analysis that makes up
+	// most of the work of encoding can be skipped
+	while (true)
+	{
+		int blockStatus = vorbis_analysis_blockout(&m_gridEncoder->m_dspState, &m_gridEncoder->m_block);
+		if (blockStatus == 0) { break; }
+		else if (blockStatus < 0)
+		{
+			throw std::runtime_error("Failed to read an audio block while encoding");
+		}
+
+		const vorbis_block& block = m_gridEncoder->m_block;
+		m_gridBlocks.push_back({ static_cast<uint64_t>(block.granulepos), block.W, block.lW });
+	}
+}
+
+uint64_t SegmentedVorbisEncoder::getPlannedSegmentStart(uint64_t boundary)
+{
+	return (boundary - m_primingFrames) / m_blockAlignment * m_blockAlignment;
+}
+
+uint64_t SegmentedVorbisEncoder::chooseSegmentStart(uint64_t boundary)
+{
+	uint64_t plannedStart = getPlannedSegmentStart(boundary);
+	for (int attempt = 0; attempt < s_maxStartAttempts; attempt++)
+	{
+		uint64_t start = plannedStart - attempt * m_blockAlignment;
+		if (getIsInStepWithGrid(start))
+		{
+			return start;
+		}
+	}
+
+	// The segment most likely won't join on and will be encoded again by the previous segment's encoder
+	return plannedStart;
+}
+
+bool SegmentedVorbisEncoder::getIsInStepWithGrid(uint64_t start)
+{
+	// A new encoder hears the start of its input as a sudden change and may pick short blocks
+	// for it, so it's only in step once its blocks land where a single encoder's did and stay there
+	EncoderState encoder(m_sampleRate, m_quality);
+	size_t offset = static_cast<size_t>(start - m_framesStart);
+	size_t frameCount = static_cast<size_t>(std::min(s_stepCheckFrames, m_frameCount - start));
+	encoder.write(&m_frames[0][offset], &m_frames[1][offset], frameCount);
+
+	size_t inStepBlockCount = 0;
+	while (vorbis_analysis_blockout(&encoder.m_dspState, &encoder.m_block) == 1)
+	{
+		uint64_t center = start + static_cast<uint64_t>(encoder.m_block.granulepos);
+		auto gridBlock = std::lower_bound(m_gridBlocks.begin(), m_gridBlocks.end(), center,
+			[](const BlockPosition& block, uint64_t value) { return block.m_center < value; });
+		if (gridBlock == m_gridBlocks.end()) { break; }
+
+		if (gridBlock->m_center == center && gridBlock->m_blockFlag == encoder.m_block.W &&
+			gridBlock->m_previousBlockFlag == encoder.m_block.lW)
+		{
+			inStepBlockCount++;
+		}
+		else if (inStepBlockCount > 0 || center > start + s_stepCheckFrames / 2)
+		{
+			return false;
+		}
+	}
+
+	return inStepBlockCount >= s_minInStepBlockCount;
+}
+
+void SegmentedVorbisEncoder::submitSegment(uint64_t end, bool isFinal)
+{
+	std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+	segment->m_start = m_nextBoundary == 0 ? 0 : chooseSegmentStart(m_nextBoundary);
+	segment->m_end = end;
+	segment->m_isFinal = isFinal;
+	segment->m_stats = {};
+	segment->m_isDone = false;
+	for (size_t channel = 0; channel < m_frames.size(); channel++)
+	{
+		auto first = m_frames[channel].begin() + static_cast<ptrdiff_t>(segment->m_start - m_framesStart);
+		segment->m_frames[channel].assign(first, first + static_cast<ptrdiff_t>(end - segment->m_start));
+	}
+	m_nextBoundary += m_segmentFrames;
+
+	// Nothing before the earliest point the next segment could start from is needed any more
+	uint64_t earliestStart = getPlannedSegmentStart(m_nextBoundary) - (s_maxStartAttempts - 1) * m_blockAlignment;
+	if (!isFinal && earliestStart > m_framesStart)
+	{
+		for (std::vector<float>& channelFrames : m_frames)
+		{
+			channelFrames.erase(channelFrames.begin(), channelFrames.begin() + static_cast<ptrdiff_t>(earliestStart - m_framesStart));
+		}
+		m_framesStart = earliestStart;
+
+		while (!m_gridBlocks.empty() && m_gridBlocks.front().m_center < earliestStart)
+		{
+			m_gridBlocks.pop_front();
+		}
+	}
+
+	m_pendingSegments.push_back(segment);
+	m_workers.submit([this, segment]()
+	{
+		try
+		{
+			segment->m_encoder = std::make_unique<EncoderState>(m_sampleRate, m_quality);
+			encodeFrames(*segment, segment->m_frames[0].data(), segment->m_frames[1].data(), segment->m_frames[0].size(), &segment->m_stats);
+		}
+		catch (...)
+		{
+			segment->m_error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(m_segmentMutex);
+		segment->m_isDone = true;
+		m_segmentDone.notify_all();
+	});
+}
+
+void SegmentedVorbisEncoder::encodeFrames(Segment& segment, const float* leftBuffer, const float* rightBuffer, size_t frameCount, midirenderer::RenderStats* stats)
+{
+	midirenderer::StageTimer timer(stats, midirenderer::RenderStage::Analysis);
+	EncoderState& encoder = *segment.m_encoder;
+
+	auto readPackets = [&]()
+	{
+		while (true)
+		{
+			int blockStatus = vorbis_analysis_blockout(&encoder.m_dspState, &encoder.m_block);
+			if (blockStatus == 0) { break; }
+			else if (blockStatus < 0)
+			{
+				throw std::runtime_error("Failed to read an audio block while encoding");
+			}
+
+			vorbis_analysis(&encoder.m_block, nullptr);
+			vorbis_bitrate_addblock(&encoder.m_block);
+
+			while (true)
+			{
+				ogg_packet packet;
+				int packetStatus = vorbis_bitrate_flushpacket(&encoder.m_dspState, &packet);
+				if (packetStatus == 0) { break; }
+				else if (packetStatus < 0)
+				{
+					throw std::runtime_error("Failed to read a packet audio block while encoding");
+				}
+
+				segment.m_packets.push_back({ std::vector<unsigned char>(packet.packet, packet.packet + packet.bytes),
+					segment.m_start + static_cast<uint64_t>(packet.granulepos), vorbis_packet_blocksize(&encoder.m_info, &packet), packet.e_o_s != 0 });
+			}
+		}
+	};
+
+	for (size_t offset = 0; offset < frameCount; offset += s_encodeChunkFrames)
+	{
+		if (m_isStopping)
+		{
+			throw std::runtime_error("The encoder was stopped");
+		}
+
+		encoder.write(&leftBuffer[offset], &rightBuffer[offset], std::min(s_encodeChunkFrames, frameCount - offset));
+		readPackets();
+	}
+
+	if (segment.m_isFinal)
+	{
+		vorbis_analysis_wrote(&encoder.m_dspState, 0);
+		readPackets();
+	}
+}
+
+void SegmentedVorbisEncoder::joinSegments(size_t maxPendingCount)
+{
+	while (!m_pendingSegments.empty())
+	{
+		std::shared_ptr<Segment> segment = m_pendingSegments.front();
+		{
+			std::unique_lock<std::mutex> lock(m_segmentMutex);
+			if (!segment->m_isDone)
+			{
+				if (m_pendingSegments.size() <= maxPendingCount) { return; }
+				m_segmentDone.wait(lock, [&]() { return segment->m_isDone; });
+			}
+		}
+
+		m_pendingSegments.pop_front();
+		joinSegment(segment);
+	}
+}
+
+void SegmentedVorbisEncoder::joinSegment(const std::shared_ptr<Segment>& segment)
+{
+	if (segment->m_error)
+	{
+		std::rethrow_exception(segment->m_error);
+	}
+
+	if (m_stats != nullptr)
+	{
+		m_stats->add(segment->m_stats);
+	}
+
+	if (!m_currentSegment)
+	{
+		m_currentSegment = segment;
+		m_nextPacketIndex = 0;
+	}
+	else
+	{
+		Segment& previous = *m_currentSegment;
+		size_t previousIndex = 0;
+		size_t nextIndex = 0;
+		if (findJoin(previous, *segment, previousIndex, nextIndex))
+		{
+			emitPackets(previous, m_nextPacketIndex, previousIndex + 1);
+			m_currentSegment = segment;
+			m_nextPacketIndex = nextIndex + 1;
+		}
+		else
+		{
+			size_t offset = static_cast<size_t>(previous.m_end - segment->m_start);
+			previous.m_isFinal = segment->m_isFinal;
+			encodeFrames(previous, &segment->m_frames[0][offset], &segment->m_frames[1][offset], segment->m_frames[0].size() - offset, m_stats);
+			previous.m_end = segment->m_end;
+		}
+	}
+
+	// The current segment's frames were only kept for checking its join and carrying on past it
+	for (std::vector<float>& channelFrames : m_currentSegment->m_frames)
+	{
+		std::vector<float>().swap(channelFrames);
+	}
+}
+
+bool SegmentedVorbisEncoder::findJoin(const Segment& previous, const Segment& next, size_t& previousIndex, size_t& nextIndex)
+{
+	// The next segment's first blocks may still be in step with nothing but its own start
+	uint64_t earliestJoin = next.m_start + m_primingFrames / 2;
+	const std::vector<EncodedPacket>& previousPackets = previous.m_packets;
+	const std::vector<EncodedPacket>& nextPackets = next.m_packets;
+
+	size_t j = 0;
+	for (size_t i = m_nextPacketIndex; i + 1 < previousPackets.size(); i++)
+	{
+		if (previousPackets[i].m_center < earliestJoin) { continue; }
+
+		while (j + 1 < nextPackets.size() && nextPackets[j].m_center < previousPackets[i].m_center)
+		{
+			j++;
+		}
+		if (j + 1 >= nextPackets.size()) { break; }
+
+		// The block after the join overlaps the one before it, so both pairs have to match for
+		// the windows the decoder puts together to be the ones each encoder used
+		if (nextPackets[j].m_center == previousPackets[i].m_center && nextPackets[j].m_blockSize == previousPackets[i].m_blockSize &&
+			nextPackets[j + 1].m_center == previousPackets[i + 1].m_center && nextPackets[j + 1].m_blockSize == previousPackets[i + 1].m_blockSize &&
+			getIsSeamless(previous, i, next, j))
+		{
+			previousIndex = i;
+			nextIndex = j;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SegmentedVorbisEncoder::getIsSeamless(const Segment& previous, size_t previousIndex, const Segment& next, size_t nextIndex)
+{
+	size_t firstIndex = previousIndex - std::min(previousIndex, s_checkedBlockCount);
+
+	std::vector<const EncodedPacket*> joinedPackets;
+	std::vector<const EncodedPacket*> previousPackets;
+	for (size_t i = firstIndex; i <= previousIndex; i++)
+	{
+		joinedPackets.push_back(&previous.m_packets[i]);
+		previousPackets.push_back(&previous.m_packets[i]);
+	}
+	for (size_t i = 1; i <= s_checkedBlockCount; i++)
+	{
+		if (nextIndex + i < next.m_packets.size()) { joinedPackets.push_back(&next.m_packets[nextIndex + i]); }
+		if (previousIndex + i < previous.m_packets.size()) { previousPackets.push_back(&previous.m_packets[previousIndex + i]); }
+	}
+
+	// Both are compared with the source over the same frames, which the next segment has a copy of
+	uint64_t start = previous.m_packets[firstIndex].m_center;
+	uint64_t end = std::min(joinedPackets.back()->m_center, previousPackets.back()->m_center);
+	if (start < next.m_start || end > next.m_end) { return false; }
+
+	double joinedError = getDecodingError(joinedPackets, next, start, end);
+	double previousError = getDecodingError(previousPackets, next, start, end);
+	if (!std::isfinite(joinedError) || !std::isfinite(previousError)) { return false; }
+
+	return joinedError <= previousError * s_maxJoinErrorRatio + s_joinErrorFloor * (end - start);
+}
+
+double SegmentedVorbisEncoder::getDecodingError(const std::vector<const EncodedPacket*>& packets, const Segment& source, uint64_t start, uint64_t end)
+{
+	vorbis_dsp_state decoder;
+	if (vorbis_synthesis_init(&decoder, &m_decoderInfo) != 0)
+	{
+		throw std::runtime_error("Failed to start decoding a segment join");
+	}
+	vorbis_block block;
+	vorbis_block_init(&decoder, &block);
+
+	// The first packet only primes the decoder, so the output starts at the centre of its block
+	uint64_t position = packets.front()->m_center;
+	double error = 0;
+	int64_t packetNumber = 0;
+	for (const EncodedPacket* encodedPacket : packets)
+	{
+		ogg_packet packet = {};
+		packet.packet = const_cast<unsigned char*>(encodedPacket->m_data.data());
+		packet.bytes = static_cast<long>(encodedPacket->m_data.size());
+		// Without a granule position the decoder doesn't trim anything from the end of the packet
+		packet.granulepos = -1;
+		packet.packetno = packetNumber++;
+
+		if (vorbis_synthesis(&block, &packet) != 0 || vorbis_synthesis_blockin(&decoder, &block) != 0)
+		{
+			error = std::numeric_limits<double>::infinity();
+			break;
+		}
+
+		float** pcm;
+		int frameCount;
+		while ((frameCount = vorbis_synthesis_pcmout(&decoder, &pcm)) > 0)
+		{
+			for (int i = 0; i < frameCount; i++, position++)
+			{
+				if (position < start || position >= end) { continue; }
+
+				size_t sourceIndex = static_cast<size_t>(position - source.m_start);
+				for (size_t channel = 0; channel < source.m_frames.size(); channel++)
+				{
+					double difference = pcm[channel][i] - source.m_frames[channel][sourceIndex];
+					error += difference * difference;
+				}
+			}
+			vorbis_synthesis_read(&decoder, frameCount);
+		}
+	}
+
+	vorbis_block_clear(&block);
+	vorbis_dsp_clear(&decoder);
+	return error;
+}
+
+void SegmentedVorbisEncoder::emitPackets(const Segment& segment, size_t firstIndex, size_t endIndex)
+{
+	for (size_t i = firstIndex; i < endIndex; i++)
+	{
+		const EncodedPacket& encodedPacket = segment.m_packets[i];
+
+		ogg_packet packet = {};
+		packet.packet = const_cast<unsigned char*>(encodedPacket.m_data.data());
+		packet.bytes = static_cast<long>(encodedPacket.m_data.size());
+		packet.e_o_s = encodedPacket.m_isEndOfStream ? 1 : 0;
+		packet.granulepos = static_cast<ogg_int64_t>(encodedPacket.m_center);
+		packet.packetno = m_nextPacketNumber++;
+		m_packetCallback(packet);
+	}
+}
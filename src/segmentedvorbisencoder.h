@@ -0,0 +1,161 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vorbis/codec.h>
+
+#include "renderstats.h"
+#include "workerpool.h"
+
+// Encodes a stream on several threads by cutting it into segments, encoding each segment with its
+// own Vorbis encoder and joining their packets back into one continuous stream.
+//
+// Vorbis blocks overlap their neighbours, so packets from two encoders can only be joined where both
+// encoders put a block of the same size in the same place and agree on the size of the block after
+// it. Each segment's encoder starts a little before the segment (the priming) at a point found to
+// fall into step with the blocks a single encoder would have used, and the previous segment's encoder
+// runs on a little past it (the overrun), so the two encode the same blocks for a while. The join is
+// made at the first block they share, after decoding the audio around it to check that it's no worse
+// than the previous segment's own. When no such block is found, the previous segment's encoder simply
+// carries on through the segment, which is slower but can't leave a seam.
+class SegmentedVorbisEncoder
+{
+public:
+	// Called on the thread writing to the encoder with each packet of the joined stream, in order.
+	// Granule positions count frames from the start of the stream, as they do for a single encoder.
+	typedef std::function<void(ogg_packet&)> PacketCallbackFunc;
+
+	SegmentedVorbisEncoder(long sampleRate, float quality, unsigned int threadCount, PacketCallbackFunc packetCallback);
+	~SegmentedVorbisEncoder();
+
+	SegmentedVorbisEncoder(const SegmentedVorbisEncoder& other) = delete;
+	SegmentedVorbisEncoder& operator=(const SegmentedVorbisEncoder& other) = delete;
+
+	void write(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
+	// Points the buffers at room for frameCount frames at the end of the stream, which are
+	// encoded as if they'd been written once committed
+	void acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer);
+	void commitBuffers(size_t frameCount);
+	// Encodes whatever's left and passes on the rest of the packets, ending with the end of the stream
+	void finish();
+
+	// Adds each segment's encoding time to the stats' analysis stage, so it's the time spent on all
+	// threads together. The stats must outlive the encoder.
+	void setStats(midirenderer::RenderStats* stats);
+
+	// How many frames each segment covers, not counting its priming and overrun. Segments are
+	// joined somewhere around each multiple of this.
+	static uint64_t getSegmentFrameCount(long sampleRate);
+
+private:
+	struct EncoderState;
+
+	struct EncodedPacket
+	{
+		std::vector<unsigned char> m_data;
+		// The frame at the centre of the packet's block, which is where decoding it gets up to
+		uint64_t m_center;
+		long m_blockSize;
+		bool m_isEndOfStream;
+	};
+
+	struct BlockPosition
+	{
+		uint64_t m_center;
+		long m_blockFlag;
+		long m_previousBlockFlag;
+	};
+
+	struct Segment
+	{
+		// The frames fed to the segment's encoder, including its priming and overrun
+		uint64_t m_start;
+		uint64_t m_end;
+		bool m_isFinal;
+		std::array<std::vector<float>, 2> m_frames;
+
+		std::unique_ptr<EncoderState> m_encoder;
+		std::vector<EncodedPacket> m_packets;
+		midirenderer::RenderStats m_stats;
+		std::exception_ptr m_error;
+		// Guarded by m_segmentMutex
+		bool m_isDone;
+	};
+
+	void updateBlockGrid(const float* leftBuffer, const float* rightBuffer, size_t frameCount);
+	uint64_t getPlannedSegmentStart(uint64_t boundary);
+	uint64_t chooseSegmentStart(uint64_t boundary);
+	bool getIsInStepWithGrid(uint64_t start);
+
+	void submitSegment(uint64_t end, bool isFinal);
+	void encodeFrames(Segment& segment, const float* leftBuffer, const float* rightBuffer, size_t frameCount, midirenderer::RenderStats* stats);
+
+	// Joins finished segments onto the stream in order, waiting for the oldest one if there
+	// are more than maxPendingCount still to join
+	void joinSegments(size_t maxPendingCount);
+	void joinSegment(const std::shared_ptr<Segment>& segment);
+	bool findJoin(const Segment& previous, const Segment& next, size_t& previousIndex, size_t& nextIndex);
+	bool getIsSeamless(const Segment& previous, size_t previousIndex, const Segment& next, size_t nextIndex);
+	double getDecodingError(const std::vector<const EncodedPacket*>& packets, const Segment& source, uint64_t start, uint64_t end);
+	void emitPackets(const Segment& segment, size_t firstIndex, size_t endIndex);
+
+	PacketCallbackFunc m_packetCallback;
+	long m_sampleRate;
+	float m_quality;
+	midirenderer::RenderStats* m_stats;
+
+	uint64_t m_segmentFrames;
+	// A second either side of each segment, which is long enough for the encoders around a join to fall into step
+	uint64_t m_primingFrames;
+	uint64_t m_overrunFrames;
+
+	// Every block boundary falls on a multiple of this many frames from the start of the encoder's input
+	uint64_t m_blockAlignment;
+	vorbis_info m_decoderInfo;
+
+	// The blocks a single encoder would use, found without encoding them, for lining segments up with
+	std::unique_ptr<EncoderState> m_gridEncoder;
+	std::deque<BlockPosition> m_gridBlocks;
+
+	// Frames that later segments still need, starting at m_framesStart
+	std::array<std::vector<float>, 2> m_frames;
+	uint64_t m_framesStart;
+	uint64_t m_frameCount;
+	uint64_t m_nextBoundary;
+
+	std::deque<std::shared_ptr<Segment>> m_pendingSegments;
+	std::shared_ptr<Segment> m_currentSegment;
+	size_t m_nextPacketIndex;
+	int64_t m_nextPacketNumber;
+
+	std::mutex m_segmentMutex;
+	std::condition_variable m_segmentDone;
+	std::atomic<bool> m_isStopping;
+
+	// Declared last so that segments stop encoding before anything they use is destroyed
+	midirenderer::utils::WorkerPool m_workers;
+
+	// About half a minute, which is long enough for the priming and overrun to cost little
+	constexpr static uint64_t s_segmentSeconds = 30;
+	// How many starting points, each a block alignment earlier than the last, are tried before
+	// giving up on lining a segment up
+	constexpr static int s_maxStartAttempts = 16;
+	// How much of a segment is looked at to see whether its encoder falls into step
+	constexpr static uint64_t s_stepCheckFrames = 16384;
+	constexpr static size_t s_minInStepBlockCount = 3;
+	constexpr static size_t s_encodeChunkFrames = 4096;
+	// How many blocks either side of a join are decoded to check it
+	constexpr static size_t s_checkedBlockCount = 4;
+	// A join is seamless when the audio around it is at most this much further from the source
+	// than the previous segment's own, plus a little leeway for silence
+	constexpr static double s_maxJoinErrorRatio = 2.0;
+	constexpr static double s_joinErrorFloor = 1e-10;
+};
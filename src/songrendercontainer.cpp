@@ -1,26 +1,29 @@
 #include "songrendercontainer.h"
 
-#include <fstream>
+#include <cstring>
 #include <fluidsynth.h>
 #include <iostream>
 
+#include "hashutils.h"
 #include "platformsupport.h"
 
 namespace midirenderer
 {
-	SongRenderContainer::SongRenderContainer(std::string fileName, fluid_sfont_t* soundfont) :
-		m_fileName(fileName),
+	std::mutex SongRenderContainer::s_sharedSoundfontMutex;
+
+	SongRenderContainer::SongRenderContainer(const std::vector<unsigned char>& midiData, fluid_sfont_t* soundfont) :
+		m_midiData(midiData),
 		m_settings(nullptr, &SongRenderContainer::deleteFluidSettings),
 		m_synth(nullptr, &SongRenderContainer::deleteSynth),
 		m_player(nullptr, &SongRenderContainer::deletePlayer),
-		m_synthBufferPosition(0)
+		m_synthBufferPosition(0), m_stats(nullptr)
 	{
 		m_settings.reset(new_fluid_settings());
 
-		fluid_settings_setnum(m_settings.get(), "synth.sample-rate", 44100.0);
+		fluid_settings_setnum(m_settings.get(), "synth.sample-rate", s_sampleRate);
 		fluid_settings_setint(m_settings.get(), "synth.chorus.active", 0);
 		fluid_settings_setint(m_settings.get(), "synth.reverb.active", 0);
-		fluid_settings_setnum(m_settings.get(), "synth.gain", 0.5);
+		fluid_settings_setnum(m_settings.get(), "synth.gain", s_gain);
 		fluid_settings_setstr(m_settings.get(), "player.timing-source", "sample");
 		// Don't reset just in case stopping and starting resets it - we want playback to be seamless
 		fluid_settings_setint(m_settings.get(), "player.reset-synth", 0);
@@ -28,7 +31,10 @@ namespace midirenderer
 		fluid_settings_setint(m_settings.get(), "synth.lock-memory", 0);
 
 		m_synth.reset(new_fluid_synth(m_settings.get()));
-		fluid_synth_add_sfont(m_synth.get(), soundfont);
+		{
+			std::lock_guard<std::mutex> lock(s_sharedSoundfontMutex);
+			fluid_synth_add_sfont(m_synth.get(), soundfont);
+		}
 		m_synthBufferSize = fluid_synth_get_internal_bufsize(m_synth.get());
 
 		m_midiCallbackData = { m_synth.get(), m_player.get(), nullptr, nullptr };
@@ -45,6 +51,20 @@ namespace midirenderer
 		return m_synthBufferSize;
 	}
 
+	int SongRenderContainer::getFramesToNextBlock()
+	{
+		// The synth renders audio one block at a time and only runs the player, processes MIDI
+		// events and retires finished voices when it starts a new block. This is the number of
+		// frames up to and including the first frame of the next block, after which all of that
+		// state is up to date until the end of the block.
+		return (m_synthBufferSize - m_synthBufferPosition) % m_synthBufferSize + 1;
+	}
+
+	int SongRenderContainer::getCurrentTick()
+	{
+		return fluid_player_get_current_tick(m_player.get());
+	}
+
 	void SongRenderContainer::setMIDICallback(FluidsynthMIDIMessageHandler eventCallback, void* callbackData)
 	{
 		m_midiCallbackData.m_userCallback = eventCallback;
@@ -52,6 +72,11 @@ namespace midirenderer
 		refreshMIDICallback();
 	}
 
+	void SongRenderContainer::setStats(RenderStats* stats)
+	{
+		m_stats = stats;
+	}
+
 	void SongRenderContainer::startPlayback()
 	{
 		fluid_player_play(m_player.get());
@@ -83,6 +108,18 @@ namespace midirenderer
 		fluid_synth_all_notes_off(m_synth.get(), -1);
 	}
 
+	void SongRenderContainer::stopAllVoices()
+	{
+		fluid_synth_all_sounds_off(m_synth.get(), -1);
+	}
+
+	void SongRenderContainer::resetChannels()
+	{
+		// This selects every channel's default preset
+		std::lock_guard<std::mutex> lock(s_sharedSoundfontMutex);
+		fluid_synth_system_reset(m_synth.get());
+	}
+
 	void SongRenderContainer::resetPlayer()
 	{
 		if (m_player != nullptr)
@@ -97,6 +134,7 @@ namespace midirenderer
 
 	void SongRenderContainer::renderFrames(int count, float* leftBuffer, float* rightBuffer, int increment)
 	{
+		StageTimer timer(m_stats, RenderStage::Synthesis);
 		if (fluid_synth_write_float(m_synth.get(), count, leftBuffer, 0, increment, rightBuffer, 0, increment))
 		{
 			throw std::runtime_error("Synth encountered an error");
@@ -105,6 +143,28 @@ namespace midirenderer
 		m_synthBufferPosition = (m_synthBufferPosition + count) % m_synthBufferSize;
 	}
 
+	void SongRenderContainer::advanceFrames(int count)
+	{
+		StageTimer timer(m_stats, RenderStage::Synthesis);
+		int result = FLUID_OK;
+		if (getCanProcessWithoutOutput())
+		{
+			result = fluid_synth_process(m_synth.get(), count, 0, nullptr, 0, nullptr);
+		}
+		else
+		{
+			float throwawayBuffer = 0;
+			result = fluid_synth_write_float(m_synth.get(), count, &throwawayBuffer, 0, 0, &throwawayBuffer, 0, 0);
+		}
+
+		if (result != FLUID_OK)
+		{
+			throw std::runtime_error("Synth encountered an error");
+		}
+
+		m_synthBufferPosition = (m_synthBufferPosition + count) % m_synthBufferSize;
+	}
+
 	bool SongRenderContainer::getIsPlaying()
 	{
 		return fluid_player_get_status(m_player.get()) == FLUID_PLAYER_PLAYING;
@@ -115,40 +175,60 @@ namespace midirenderer
 		return fluid_synth_get_active_voice_count(m_synth.get());
 	}
 
-	void SongRenderContainer::loadMIDIFile()
+	int SongRenderContainer::getPolyphony()
+	{
+		return fluid_synth_get_polyphony(m_synth.get());
+	}
+
+	uint64_t SongRenderContainer::getChannelStateHash()
 	{
-#ifndef WINDOWS_UTF16_WORKAROUND
-		fluid_player_add(m_player.get(), m_fileName.c_str());
-#else
-		size_t filenameSize = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, m_fileName.c_str(), -1, NULL, 0);
-		auto filenameString = std::make_unique<wchar_t[]>(filenameSize);
-		MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, m_fileName.c_str(), -1, filenameString.get(), filenameSize);
+		utils::FNV1aHash hash;
 
-		std::ifstream file(filenameString.get(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-		if (!file.is_open())
+		int channelCount = fluid_synth_count_midi_channels(m_synth.get());
+		for (int channel = 0; channel < channelCount; channel++)
 		{
-			throw std::invalid_argument("Failed to open MIDI file at " + m_fileName);
+			int soundfontID = 0, bank = 0, preset = 0;
+			fluid_synth_get_program(m_synth.get(), channel, &soundfontID, &bank, &preset);
+			hash.addValue(soundfontID);
+			hash.addValue(bank);
+			hash.addValue(preset);
+
+			for (int control = 0; control < 128; control++)
+			{
+				int value = 0;
+				fluid_synth_get_cc(m_synth.get(), channel, control, &value);
+				hash.addValue(value);
+			}
+
+			int pitchBend = 0, pitchWheelSensitivity = 0;
+			fluid_synth_get_pitch_bend(m_synth.get(), channel, &pitchBend);
+			fluid_synth_get_pitch_wheel_sens(m_synth.get(), channel, &pitchWheelSensitivity);
+			hash.addValue(pitchBend);
+			hash.addValue(pitchWheelSensitivity);
+
+			// NRPNs set generator offsets
+			for (int generator = 0; generator < GEN_LAST; generator++)
+			{
+				float value = fluid_synth_get_gen(m_synth.get(), channel, generator);
+				uint32_t bits = 0;
+				std::memcpy(&bits, &value, sizeof(bits));
+				hash.addValue(bits);
+			}
 		}
 
-		std::streampos fileLength = file.tellg();
-		file.seekg(0, std::ios_base::beg);
-		auto fileContents = std::make_unique<char[]>(fileLength);
-		file.read(fileContents.get(), fileLength);
+		return hash.getValue();
+	}
 
-		fluid_player_add_mem(m_player.get(), fileContents.get(), fileLength);
-#endif
+	void SongRenderContainer::loadMIDIFile()
+	{
+		// The player copies the data, so the container doesn't have to
+		fluid_player_add_mem(m_player.get(), m_midiData.data(), m_midiData.size());
 	}
 
 	void SongRenderContainer::refreshMIDICallback()
 	{
-		if (m_midiCallbackData.m_userCallback != nullptr)
-		{
-			fluid_player_set_playback_callback(m_player.get(), &SongRenderContainer::onMIDIEvent, &m_midiCallbackData);
-		}
-		else
-		{
-			fluid_player_set_playback_callback(m_player.get(), &fluid_synth_handle_midi_event, NULL);
-		}
+		// Every event goes through onMIDIEvent, which guards the ones that change presets
+		fluid_player_set_playback_callback(m_player.get(), &SongRenderContainer::onMIDIEvent, &m_midiCallbackData);
 	}
 
 	void SongRenderContainer::deleteSynth(fluid_synth_t* synth)
@@ -161,16 +241,25 @@ namespace midirenderer
 		// Before doing that, we need to unset the programs on all of the channels or else
 		// the console will get a warning message for every channel when it tries to reassign
 		// instruments to the channels and fails since there's no fallback synth
-		int channelCount = fluid_synth_count_midi_channels(synth);
-		for (int i = 0; i < channelCount; i++)
-		{
-			fluid_synth_unset_program(synth, i);
-		}
-
-		int soundfontCount = fluid_synth_sfcount(synth);
-		for (int i = soundfontCount - 1; i >= 0; i--)
+		// Unsetting programs updates the shared soundfont's (non-atomic) reference count and
+		// removing it walks its presets, so only one synth may do this at a time, like every other
+		// preset change (see onMIDIEvent and the constructor). The count
+		// itself never decides when the shared soundfont is freed; its owning synth in
+		// MIDIVorbisRenderer outlives every render.
 		{
-			fluid_synth_remove_sfont(synth, fluid_synth_get_sfont(synth, i));
+			std::lock_guard<std::mutex> lock(s_sharedSoundfontMutex);
+
+			int channelCount = fluid_synth_count_midi_channels(synth);
+			for (int i = 0; i < channelCount; i++)
+			{
+				fluid_synth_unset_program(synth, i);
+			}
+
+			int soundfontCount = fluid_synth_sfcount(synth);
+			for (int i = soundfontCount - 1; i >= 0; i--)
+			{
+				fluid_synth_remove_sfont(synth, fluid_synth_get_sfont(synth, i));
+			}
 		}
 
 		delete_fluid_synth(synth);
@@ -199,10 +288,33 @@ namespace midirenderer
 		m_synthBufferPosition = 0;
 	}
 
+	bool SongRenderContainer::getCanProcessWithoutOutput()
+	{
+		static const bool s_canProcessWithoutOutput = []()
+		{
+			int major = 0;
+			int minor = 0;
+			int micro = 0;
+			fluid_version(&major, &minor, &micro);
+			return major > 2 || (major == 2 && minor >= 1);
+		}();
+		return s_canProcessWithoutOutput;
+	}
+
 	int SongRenderContainer::onMIDIEvent(void* data, fluid_midi_event_t* eventData)
 	{
 		CallbackData* callbackData = static_cast<CallbackData*>(data);
 
+		// Selecting a preset updates the (non-atomic) reference count of the soundfont it comes from,
+		// which is shared with the synths on other render threads. Program changes, and the resets
+		// that set every channel's program again, are rare enough to all go through one lock.
+		std::unique_lock<std::mutex> lock(s_sharedSoundfontMutex, std::defer_lock);
+		int type = fluid_midi_event_get_type(eventData);
+		if (type == s_programChangeEvent || type == s_systemExclusiveEvent || type == s_systemResetEvent)
+		{
+			lock.lock();
+		}
+
 		if (callbackData->m_userCallback == nullptr)
 		{
 			return fluid_synth_handle_midi_event(callbackData->m_synth, eventData);
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #include <fluidsynth/types.h>
 
 #include "deleteruniqueptr.h"
+#include "renderstats.h"
 
 namespace midirenderer
 {
@@ -15,26 +19,43 @@ namespace midirenderer
 	class SongRenderContainer
 	{
 	public:
-		SongRenderContainer(std::string fileName, fluid_sfont_t* soundfont);
+		constexpr static double s_sampleRate = 44100.0;
+		constexpr static double s_gain = 0.5;
+
+		// Plays the MIDI file's contents, which must outlive the container
+		SongRenderContainer(const std::vector<unsigned char>& midiData, fluid_sfont_t* soundfont);
 		
 		SongRenderContainer(const SongRenderContainer& other) = delete;
 		SongRenderContainer& operator=(const SongRenderContainer& other) = delete;
 
 		int getTempo();
 		int getSynthBufferSize();
+		int getFramesToNextBlock();
+		int getCurrentTick();
 
 		void setMIDICallback(FluidsynthMIDIMessageHandler eventCallback, void* callbackData);
+		// Times synthesis into the stats, which must outlive the container
+		void setStats(RenderStats* stats);
 
 		void startPlayback();
 		void stopPlayback();
 		void join();
 		void silence();
+		// Cuts off every voice at once, including ones still releasing
+		void stopAllVoices();
+		// Puts every channel back the way a new synth starts out, cutting off any voices
+		void resetChannels();
 		void resetPlayer();
 
 		void renderFrames(int count, float* leftBuffer, float* rightBuffer, int increment = 1);
+		// Moves the synth and player along without copying out any audio, for frames known to be silent
+		void advanceFrames(int count);
 		void flushSynthBuffer();
 		bool getIsPlaying();
 		int getActiveVoiceCount();
+		int getPolyphony();
+		// A hash of every channel setting that MIDI events can change and the synth can report
+		uint64_t getChannelStateHash();
 
 	private:
 		struct CallbackData
@@ -53,8 +74,18 @@ namespace midirenderer
 		static void deleteFluidSettings(fluid_settings_t* settings);
 
 		static int onMIDIEvent(void* data, fluid_midi_event_t* eventData);
-
-		std::string m_fileName;
+		// FluidSynth 2.0 can only process into stereo buffers, while later versions can render with no outputs at all
+		static bool getCanProcessWithoutOutput();
+
+		// Guards adding the shared soundfont to and removing it from synths, and every preset
+		// change, which may happen on several render threads at once
+		static std::mutex s_sharedSoundfontMutex;
+		// The MIDI event types that can select presets
+		constexpr static int s_programChangeEvent = 0xC0;
+		constexpr static int s_systemExclusiveEvent = 0xF0;
+		constexpr static int s_systemResetEvent = 0xFF;
+
+		const std::vector<unsigned char>& m_midiData;
 		deleter_unique_ptr<fluid_settings_t> m_settings;
 		deleter_unique_ptr<fluid_synth_t> m_synth;
 		deleter_unique_ptr<fluid_player_t> m_player;
@@ -63,5 +94,7 @@ namespace midirenderer
 
 		int m_synthBufferSize;
 		int m_synthBufferPosition;
+
+		RenderStats* m_stats;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "watchsession.h"
+
+#if __linux__
+
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+
+namespace midirenderer
+{
+	namespace
+	{
+		std::string getNormalizedPath(const std::string& path)
+		{
+			return std::filesystem::u8path(path).lexically_normal().u8string();
+		}
+	}
+
+	WatchSession::WatchSession(MIDIVorbisRenderer& renderer, FileResolver resolveFiles, std::vector<utils::WildcardRoot> roots, unsigned int jobCount,
+		std::ostream& output) :
+		m_renderer(renderer), m_resolveFiles(std::move(resolveFiles)), m_roots(std::move(roots)), m_output(output), m_workers(jobCount)
+	{
+	}
+
+	void WatchSession::run()
+	{
+		// Matching files can appear in a root before any are there, or in folders made under it later
+		for (const utils::WildcardRoot& root : m_roots)
+		{
+			std::error_code error;
+			if (!std::filesystem::is_directory(std::filesystem::u8path(root.m_folder), error)) { continue; }
+
+			std::string folder = getNormalizedPath(root.m_folder);
+			if (root.m_isRecursive)
+			{
+				m_watcher.watchFolderTree(folder);
+			}
+			else
+			{
+				m_watcher.watchFolder(folder);
+			}
+		}
+		updateFiles();
+
+		// Only files whose renders are missing or older than the file itself are rendered to start
+		// with, so restarting a session doesn't render everything again
+		for (const auto& file : m_outputPaths)
+		{
+			std::error_code error;
+			std::filesystem::file_time_type midiTime = std::filesystem::last_write_time(std::filesystem::u8path(file.first), error);
+			std::filesystem::file_time_type outputTime = std::filesystem::last_write_time(std::filesystem::u8path(file.second), error);
+			if (error || outputTime < midiTime)
+			{
+				m_pendingRenders[file.first] = Clock::now();
+			}
+		}
+
+		print("Watching " + std::to_string(m_outputPaths.size()) + " file(s) for changes\n");
+
+		while (true)
+		{
+			startDueRenders();
+
+			std::vector<std::string> changedPaths = m_watcher.waitForChanges(getWaitTime());
+			Clock::time_point changeTime = Clock::now();
+
+			bool hasCheckedNewFiles = false;
+			for (const std::string& changedPath : changedPaths)
+			{
+				// A file that isn't known yet may be a new match for one of the patterns
+				if (m_outputPaths.count(changedPath) == 0 && !hasCheckedNewFiles)
+				{
+					updateFiles();
+					hasCheckedNewFiles = true;
+				}
+
+				if (m_outputPaths.count(changedPath) > 0)
+				{
+					scheduleRender(changedPath, changeTime);
+				}
+			}
+		}
+	}
+
+	void WatchSession::updateFiles()
+	{
+		std::vector<std::string> midiFiles;
+		std::vector<std::string> outputFiles;
+		m_resolveFiles(midiFiles, outputFiles);
+
+		for (size_t i = 0; i < midiFiles.size(); i++)
+		{
+			std::string midiFile = getNormalizedPath(midiFiles[i]);
+			if (m_outputPaths.count(midiFile) > 0) { continue; }
+
+			std::string folder = std::filesystem::u8path(midiFile).parent_path().u8string();
+			m_watcher.watchFolder(folder.empty() ? "." : folder);
+			m_outputPaths[midiFile] = outputFiles[i];
+		}
+	}
+
+	void WatchSession::scheduleRender(const std::string& midiFile, Clock::time_point time)
+	{
+		m_pendingRenders[midiFile] = time + s_debounceTime;
+
+		// The render in progress is out of date, so stop it rather than let it finish first
+		std::lock_guard<std::mutex> lock(m_activeRenderMutex);
+		auto activeRender = m_activeRenders.find(midiFile);
+		if (activeRender != m_activeRenders.end())
+		{
+			*activeRender->second = true;
+		}
+	}
+
+	void WatchSession::startDueRenders()
+	{
+		Clock::time_point now = Clock::now();
+		for (auto pendingRender = m_pendingRenders.begin(); pendingRender != m_pendingRenders.end();)
+		{
+			const std::string midiFile = pendingRender->first;
+			if (pendingRender->second > now)
+			{
+				++pendingRender;
+				continue;
+			}
+
+			std::shared_ptr<std::atomic<bool>> isCancelled;
+			{
+				std::lock_guard<std::mutex> lock(m_activeRenderMutex);
+				if (m_activeRenders.count(midiFile) > 0)
+				{
+					++pendingRender;
+					continue;
+				}
+
+				isCancelled = std::make_shared<std::atomic<bool>>(false);
+				m_activeRenders[midiFile] = isCancelled;
+			}
+			pendingRender = m_pendingRenders.erase(pendingRender);
+
+			std::string outputFile = m_outputPaths[midiFile];
+			m_workers.submit([this, midiFile, outputFile, isCancelled]()
+			{
+				try
+				{
+					print("Rendering " + midiFile + "\n");
+					RenderResult result = m_renderer.renderFile(midiFile, outputFile, m_renderer.getSettings(), nullptr, isCancelled.get());
+					print("Output: " + outputFile + result.getOutputNote() + "\n");
+				}
+				catch (std::exception& e)
+				{
+					if (*isCancelled)
+					{
+						print("Cancelled the render of " + midiFile + " since it changed again\n");
+					}
+					else
+					{
+						print("Failed to create render for file " + midiFile + ": " + e.what() + "\n");
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(m_activeRenderMutex);
+				m_activeRenders.erase(midiFile);
+			});
+		}
+	}
+
+	std::chrono::milliseconds WatchSession::getWaitTime()
+	{
+		if (m_pendingRenders.empty()) { return std::chrono::milliseconds(-1); }
+
+		Clock::time_point nextRenderTime = Clock::time_point::max();
+		for (const auto& pendingRender : m_pendingRenders)
+		{
+			nextRenderTime = std::min(nextRenderTime, pendingRender.second);
+		}
+
+		// A file that's due but still being cancelled is checked on until its old render stops
+		std::chrono::milliseconds waitTime = std::chrono::duration_cast<std::chrono::milliseconds>(nextRenderTime - Clock::now());
+		return std::max(waitTime, s_cancelPollInterval);
+	}
+
+	void WatchSession::print(const std::string& text)
+	{
+		std::lock_guard<std::mutex> lock(m_outputMutex);
+		m_output << text << std::flush;
+	}
+}
+
+#endif
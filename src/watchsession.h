@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "filewatcher.h"
+#include "midivorbisrenderer.h"
+#include "pathresolution.h"
+#include "workerpool.h"
+
+namespace midirenderer
+{
+	// Renders files again whenever they're saved, keeping the renderer and its soundfont loaded for
+	// the whole session. Saves that come in quick succession are rendered once, and a render is
+	// cancelled if its file is saved again before it finishes. Only available on Linux.
+	class WatchSession
+	{
+	public:
+		// Fills the lists with the MIDI files to watch and the output path of each one's render.
+		// It's run again whenever a file that isn't being watched yet appears in a watched folder.
+		using FileResolver = std::function<void(std::vector<std::string>& midiFiles, std::vector<std::string>& outputFiles)>;
+
+		// New files are looked for in the roots of the wildcarded paths the files were resolved from,
+		// including folders made under recursive roots after the session starts
+		WatchSession(MIDIVorbisRenderer& renderer, FileResolver resolveFiles, std::vector<utils::WildcardRoot> roots, unsigned int jobCount,
+			std::ostream& output);
+
+		WatchSession(const WatchSession& other) = delete;
+		WatchSession& operator=(const WatchSession& other) = delete;
+
+		// Watches for changes until the process is ended
+		void run();
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		void updateFiles();
+		// Waits for the debounce time after the latest save before rendering the file
+		void scheduleRender(const std::string& midiFile, Clock::time_point time);
+		void startDueRenders();
+		std::chrono::milliseconds getWaitTime();
+
+		void print(const std::string& text);
+
+		MIDIVorbisRenderer& m_renderer;
+		FileResolver m_resolveFiles;
+		std::vector<utils::WildcardRoot> m_roots;
+		std::ostream& m_output;
+		utils::FileWatcher m_watcher;
+
+		// Normalized MIDI file paths to their output paths
+		std::map<std::string, std::string> m_outputPaths;
+		// Files waiting out the debounce time, and when they're due to be rendered
+		std::map<std::string, Clock::time_point> m_pendingRenders;
+
+		// Files being rendered and the flags that cancel their renders. A file isn't rendered again
+		// until its last render has stopped so that two renders never write the same output.
+		std::mutex m_activeRenderMutex;
+		std::map<std::string, std::shared_ptr<std::atomic<bool>>> m_activeRenders;
+
+		std::mutex m_outputMutex;
+
+		// Declared last so that renders stop before anything they use is destroyed
+		utils::WorkerPool m_workers;
+
+		constexpr static std::chrono::milliseconds s_debounceTime = std::chrono::milliseconds(300);
+		// How often to check whether a cancelled render has stopped so the file can be rendered again
+		constexpr static std::chrono::milliseconds s_cancelPollInterval = std::chrono::milliseconds(50);
+	};
+}
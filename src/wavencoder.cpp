@@ -0,0 +1,107 @@
+#include "wavencoder.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	constexpr uint16_t s_ieeeFloatFormat = 3;
+	constexpr uint32_t s_fmtChunkSize = 18;
+	constexpr uint32_t s_factChunkSize = 4;
+	constexpr uint64_t s_maxChunkSize = std::numeric_limits<uint32_t>::max();
+}
+
+WavEncoder::WavEncoder(long sampleRate) : RawAudioEncoder(sampleRate)
+{
+}
+
+void WavEncoder::readHeader(const OutputCallbackFunc& output)
+{
+	uint64_t dataSize = m_frameCount * s_channelCount * s_bytesPerSample;
+	uint64_t riffSize = 4 + (8 + s_ds64ChunkSize) + (8 + s_fmtChunkSize) + (8 + s_factChunkSize) + (8 + dataSize) +
+		(getHasLoopChunk() ? 8 + s_smplChunkSize : 0);
+	bool isRF64 = riffSize > s_maxChunkSize;
+
+	std::vector<unsigned char> header;
+	appendChunkHeader(header, isRF64 ? "RF64" : "RIFF", static_cast<uint32_t>(std::min(riffSize, s_maxChunkSize)));
+	header.insert(header.end(), { 'W', 'A', 'V', 'E' });
+
+	// The header is the same size either way, so a streamed file's placeholder can always be written over
+	appendChunkHeader(header, isRF64 ? "ds64" : "JUNK", s_ds64ChunkSize);
+	appendValue(header, isRF64 ? riffSize : 0, 8);
+	appendValue(header, isRF64 ? dataSize : 0, 8);
+	appendValue(header, isRF64 ? m_frameCount : 0, 8);
+	appendValue(header, 0, 4);
+
+	appendChunkHeader(header, "fmt ", s_fmtChunkSize);
+	appendValue(header, s_ieeeFloatFormat, 2);
+	appendValue(header, s_channelCount, 2);
+	appendValue(header, static_cast<uint64_t>(m_sampleRate), 4);
+	appendValue(header, static_cast<uint64_t>(m_sampleRate) * s_channelCount * s_bytesPerSample, 4);
+	appendValue(header, s_channelCount * s_bytesPerSample, 2);
+	appendValue(header, s_bytesPerSample * 8, 2);
+	appendValue(header, 0, 2);
+
+	// Required for anything other than integer PCM
+	appendChunkHeader(header, "fact", s_factChunkSize);
+	appendValue(header, std::min(m_frameCount, s_maxChunkSize), 4);
+
+	appendChunkHeader(header, "data", static_cast<uint32_t>(std::min(dataSize, s_maxChunkSize)));
+
+	output(header.data(), header.size());
+}
+
+std::string WavEncoder::getSidecarContents()
+{
+	return "";
+}
+
+void WavEncoder::readTrailer(const OutputCallbackFunc& output)
+{
+	if (!getHasLoopChunk()) { return; }
+
+	std::vector<unsigned char> trailer;
+	appendChunkHeader(trailer, "smpl", s_smplChunkSize);
+	// Manufacturer and product
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, 0, 4);
+	// Sample period in nanoseconds
+	appendValue(trailer, static_cast<uint64_t>(1000000000.0 / m_sampleRate + 0.5), 4);
+	// MIDI unity note (middle C), pitch fraction, SMPTE format and offset
+	appendValue(trailer, 60, 4);
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, 0, 4);
+	// One loop and no sampler-specific data
+	appendValue(trailer, 1, 4);
+	appendValue(trailer, 0, 4);
+
+	// A forward loop that plays forever, with an inclusive end point
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, std::min(m_loopStart, s_maxChunkSize), 4);
+	appendValue(trailer, std::min(m_loopStart + m_loopLength - 1, s_maxChunkSize), 4);
+	appendValue(trailer, 0, 4);
+	appendValue(trailer, 0, 4);
+
+	output(trailer.data(), trailer.size());
+}
+
+bool WavEncoder::getHasLoopChunk() const
+{
+	return m_hasLoopPoints && m_loopLength > 0;
+}
+
+void WavEncoder::appendChunkHeader(std::vector<unsigned char>& output, const char* id, uint32_t size)
+{
+	output.insert(output.end(), id, id + 4);
+	appendValue(output, size, 4);
+}
+
+void WavEncoder::appendValue(std::vector<unsigned char>& output, uint64_t value, int byteCount)
+{
+	for (int i = 0; i < byteCount; i++)
+	{
+		output.push_back(static_cast<unsigned char>(value >> (i * 8)));
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "rawaudioencoder.h"
+
+// Writes 32-bit float WAV files, with the loop in a smpl chunk after the audio. Files too big
+// for a RIFF header become RF64 files, using the space a JUNK chunk reserves in every header.
+class WavEncoder : public RawAudioEncoder
+{
+public:
+	WavEncoder(long sampleRate);
+
+	void readHeader(const OutputCallbackFunc& output) override;
+
+	// Everything fits in the file itself
+	std::string getSidecarContents() override;
+
+protected:
+	void readTrailer(const OutputCallbackFunc& output) override;
+
+private:
+	bool getHasLoopChunk() const;
+	static void appendChunkHeader(std::vector<unsigned char>& output, const char* id, uint32_t size);
+	static void appendValue(std::vector<unsigned char>& output, uint64_t value, int byteCount);
+
+	constexpr static uint32_t s_ds64ChunkSize = 28;
+	constexpr static uint32_t s_smplChunkSize = 36 + 24;
+};
@@ -0,0 +1,82 @@
+#include "workerpool.h"
+
+namespace midirenderer::utils
+{
+	WorkerPool::WorkerPool(unsigned int workerCount) : m_activeJobCount(0), m_isStopping(false)
+	{
+		if (workerCount == 0) { workerCount = 1; }
+
+		for (unsigned int i = 0; i < workerCount; i++)
+		{
+			m_workers.emplace_back(&WorkerPool::runWorker, this);
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopping = true;
+		}
+		m_jobAvailable.notify_all();
+
+		for (auto& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	unsigned int WorkerPool::getWorkerCount() const
+	{
+		return static_cast<unsigned int>(m_workers.size());
+	}
+
+	void WorkerPool::submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+		}
+		m_jobAvailable.notify_one();
+	}
+
+	void WorkerPool::wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobsFinished.wait(lock, [this]() { return m_jobs.empty() && m_activeJobCount == 0; });
+	}
+
+	unsigned int WorkerPool::getDefaultWorkerCount()
+	{
+		// hardware_concurrency is allowed to return 0 if it can't tell
+		unsigned int coreCount = std::thread::hardware_concurrency();
+		return coreCount > 0 ? coreCount : 1;
+	}
+
+	void WorkerPool::runWorker()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_jobAvailable.wait(lock, [this]() { return m_isStopping || !m_jobs.empty(); });
+			// Queued jobs are always finished before stopping
+			if (m_jobs.empty()) { return; }
+
+			std::function<void()> job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_activeJobCount++;
+
+			lock.unlock();
+			// Jobs are responsible for their own error handling; an exception escaping
+			// here would terminate the whole process
+			job();
+			lock.lock();
+
+			m_activeJobCount--;
+			if (m_jobs.empty() && m_activeJobCount == 0)
+			{
+				m_jobsFinished.notify_all();
+			}
+		}
+	}
+}
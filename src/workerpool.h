@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace midirenderer::utils
+{
+	class WorkerPool
+	{
+	public:
+		WorkerPool(unsigned int workerCount);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool& other) = delete;
+		WorkerPool& operator=(const WorkerPool& other) = delete;
+
+		unsigned int getWorkerCount() const;
+
+		void submit(std::function<void()> job);
+		void wait();
+
+		static unsigned int getDefaultWorkerCount();
+
+	private:
+		void runWorker();
+
+		std::vector<std::thread> m_workers;
+		std::deque<std::function<void()>> m_jobs;
+
+		std::mutex m_mutex;
+		std::condition_variable m_jobAvailable;
+		std::condition_variable m_jobsFinished;
+		size_t m_activeJobCount;
+		bool m_isStopping;
+	};
+}
@@ -0,0 +1,48 @@
+#include <cstdint>
+#include <string>
+
+#include "hashutils.h"
+#include "testframework.h"
+
+using namespace midirenderer::utils;
+
+// Cache keys are these hashes, so they must never change between runs, builds or platforms
+TEST_CASE(hashutils, EmptyHashIsTheFNVOffsetBasis)
+{
+	FNV1aHash hash;
+	CHECK_EQUAL(0xcbf29ce484222325ull, hash.getValue());
+	CHECK_EQUAL(std::string("cbf29ce484222325"), hash.getHexString());
+}
+
+TEST_CASE(hashutils, BytesHashToKnownValues)
+{
+	FNV1aHash hash;
+	hash.addBytes("a", 1);
+	CHECK_EQUAL(0xaf63dc4c8601ec8cull, hash.getValue());
+}
+
+TEST_CASE(hashutils, ValuesAreHashedAsLittleEndianBytes)
+{
+	FNV1aHash hash;
+	hash.addValue(0x0102030405060708ull);
+	CHECK_EQUAL(0x0c6d4496e17859d5ull, hash.getValue());
+	CHECK_EQUAL(std::string("0c6d4496e17859d5"), hash.getHexString());
+
+	FNV1aHash bytesHash;
+	const unsigned char bytes[] = { 8, 7, 6, 5, 4, 3, 2, 1 };
+	bytesHash.addBytes(bytes, sizeof(bytes));
+	CHECK_EQUAL(hash.getValue(), bytesHash.getValue());
+}
+
+TEST_CASE(hashutils, StringsAreHashedWithTheirLengths)
+{
+	FNV1aHash hash;
+	hash.addString("abc");
+	CHECK_EQUAL(0xc11ab6d2519bc2b2ull, hash.getValue());
+
+	// Without the lengths these would hash the same bytes
+	FNV1aHash split;
+	split.addString("ab");
+	split.addString("c");
+	CHECK(split.getValue() != hash.getValue());
+}
@@ -0,0 +1,187 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libmidirenderer.h"
+#include "testframework.h"
+#include "testmidi.h"
+
+using namespace midirenderer::testing;
+
+// These go through the C API the way an embedding program would. Like the rendering tests, they
+// need the soundfont given by the MIDIRENDERER_TEST_SOUNDFONT environment variable.
+namespace
+{
+	struct RenderOutput
+	{
+		std::vector<unsigned char> m_data;
+		size_t m_writeCount = 0;
+		size_t m_progressCount = 0;
+		bool m_isFailingWrites = false;
+		midirenderer_cancel_token* m_cancelToken = nullptr;
+	};
+
+	int writeOutput(void* userData, const unsigned char* data, size_t size)
+	{
+		RenderOutput* output = static_cast<RenderOutput*>(userData);
+		output->m_writeCount++;
+		output->m_data.insert(output->m_data.end(), data, data + size);
+		return output->m_isFailingWrites ? 1 : 0;
+	}
+
+	void reportProgress(void* userData, double)
+	{
+		RenderOutput* output = static_cast<RenderOutput*>(userData);
+		output->m_progressCount++;
+		if (output->m_cancelToken != nullptr)
+		{
+			midirenderer_cancel_token_cancel(output->m_cancelToken);
+		}
+	}
+
+	// Destroys the renderer when the test case ends, however it ends
+	class TestRenderer
+	{
+	public:
+		TestRenderer() : m_renderer(nullptr)
+		{
+			const char* soundfontPath = std::getenv("MIDIRENDERER_TEST_SOUNDFONT");
+			if (soundfontPath == nullptr || *soundfontPath == '\0')
+			{
+				throw TestSkipped("MIDIRENDERER_TEST_SOUNDFONT isn't set");
+			}
+
+			midirenderer_config config;
+			midirenderer_config_init(&config);
+			config.soundfont_path = soundfontPath;
+			config.output_format = MIDIRENDERER_FORMAT_RAW;
+			if (midirenderer_create(&config, &m_renderer) != MIDIRENDERER_OK)
+			{
+				throw std::runtime_error(std::string("Failed to create a renderer: ") + midirenderer_get_last_error());
+			}
+		}
+
+		~TestRenderer()
+		{
+			midirenderer_destroy(m_renderer);
+		}
+
+		TestRenderer(const TestRenderer& other) = delete;
+		TestRenderer& operator=(const TestRenderer& other) = delete;
+
+		midirenderer_status render(const std::vector<unsigned char>& midiData, const midirenderer_render_options* options, RenderOutput& output,
+			midirenderer_render_result* result = nullptr)
+		{
+			return midirenderer_render(m_renderer, midiData.data(), midiData.size(), options, writeOutput, reportProgress,
+				output.m_cancelToken, &output, result);
+		}
+
+	private:
+		midirenderer_renderer* m_renderer;
+	};
+
+	// A bar of notes, then the looped section
+	std::vector<unsigned char> buildLoopedSong()
+	{
+		std::vector<TestMIDIEvent> events = { tempo(0, 500000) };
+		for (uint32_t tick = 0; tick < 3840; tick += 480)
+		{
+			if (tick == 1920)
+			{
+				events.push_back(controlChange(tick, 0, 111, 0));
+			}
+			events.push_back(noteOn(tick, 0, 60 + tick / 480));
+			events.push_back(noteOff(tick + 400, 0, 60 + tick / 480));
+		}
+		return buildMIDIFile(480, { events });
+	}
+}
+
+TEST_CASE(libmidirenderer, CreatingWithoutSoundfontFails)
+{
+	midirenderer_renderer* renderer = nullptr;
+	midirenderer_config config;
+	midirenderer_config_init(&config);
+	CHECK_EQUAL(MIDIRENDERER_ERROR_INVALID_ARGUMENT, midirenderer_create(&config, &renderer));
+	CHECK(renderer == nullptr);
+	CHECK(std::string(midirenderer_get_last_error()) != "");
+}
+
+TEST_CASE(libmidirenderer, OlderOptionsKeepDefaultsForNewerFields)
+{
+	TestRenderer renderer;
+	std::vector<unsigned char> midiData = buildLoopedSong();
+
+	midirenderer_render_options options;
+	midirenderer_render_options_init(&options);
+	options.loop_mode = MIDIRENDERER_LOOP_DOUBLE;
+	RenderOutput expected;
+	CHECK_EQUAL(MIDIRENDERER_OK, renderer.render(midiData, &options, expected));
+
+	// A caller built when the options ended at the loop mode leaves whatever it likes after it,
+	// and the result only has room for the frame count
+	options.struct_size = offsetof(midirenderer_render_options, ending_beat_division);
+	options.ending_beat_division = 3;
+	options.vorbis_quality = 5.0f;
+	midirenderer_render_result result;
+	midirenderer_render_result_init(&result);
+	result.struct_size = offsetof(midirenderer_render_result, loop_start_frame);
+	result.loop_start_frame = 12345;
+	RenderOutput output;
+	CHECK_EQUAL(MIDIRENDERER_OK, renderer.render(midiData, &options, output, &result));
+
+	CHECK(output.m_data == expected.m_data);
+	CHECK_EQUAL(offsetof(midirenderer_render_result, loop_start_frame), result.struct_size);
+	CHECK_EQUAL(static_cast<uint64_t>(output.m_data.size() / 8), result.frame_count);
+	CHECK_EQUAL(static_cast<uint64_t>(12345), result.loop_start_frame);
+}
+
+TEST_CASE(libmidirenderer, InvalidOptionsAreRejected)
+{
+	TestRenderer renderer;
+	std::vector<unsigned char> midiData = buildLoopedSong();
+
+	midirenderer_render_options options;
+	midirenderer_render_options_init(&options);
+	options.loop_mode = 3;
+	RenderOutput output;
+	CHECK_EQUAL(MIDIRENDERER_ERROR_INVALID_ARGUMENT, renderer.render(midiData, &options, output));
+
+	for (int beatDivision : { 0, 3, 128, -2 })
+	{
+		midirenderer_render_options_init(&options);
+		options.ending_beat_division = beatDivision;
+		CHECK_EQUAL(MIDIRENDERER_ERROR_INVALID_ARGUMENT, renderer.render(midiData, &options, output));
+	}
+
+	midirenderer_render_options_init(&options);
+	options.struct_size = 0;
+	CHECK_EQUAL(MIDIRENDERER_ERROR_INVALID_ARGUMENT, renderer.render(midiData, &options, output));
+	CHECK_EQUAL(static_cast<size_t>(0), output.m_writeCount);
+}
+
+TEST_CASE(libmidirenderer, FailedWriteStopsRender)
+{
+	TestRenderer renderer;
+	RenderOutput output;
+	output.m_isFailingWrites = true;
+	CHECK_EQUAL(MIDIRENDERER_ERROR_WRITE_FAILED, renderer.render(buildLoopedSong(), nullptr, output));
+	CHECK_EQUAL(static_cast<size_t>(1), output.m_writeCount);
+}
+
+TEST_CASE(libmidirenderer, CancelTokenStopsRender)
+{
+	TestRenderer renderer;
+	RenderOutput output;
+	// Cancelled from the first progress report, so the render is stopped part of the way through
+	output.m_cancelToken = midirenderer_cancel_token_create();
+	midirenderer_status status = renderer.render(buildLoopedSong(), nullptr, output);
+	midirenderer_cancel_token_destroy(output.m_cancelToken);
+
+	CHECK_EQUAL(MIDIRENDERER_ERROR_CANCELLED, status);
+	CHECK(output.m_progressCount > 0);
+	CHECK_EQUAL(static_cast<size_t>(0), output.m_writeCount);
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "loudnessmeter.h"
+#include "testframework.h"
+
+namespace
+{
+	const double s_pi = std::acos(-1.0);
+
+	// Measures the same frames in both channels, written a block at a time like a render writes them
+	LoudnessMeter measure(const std::vector<float>& frames, double sampleRate)
+	{
+		LoudnessMeter meter(sampleRate);
+		const size_t blockFrames = 1024;
+		for (size_t offset = 0; offset < frames.size(); offset += blockFrames)
+		{
+			size_t frameCount = std::min(blockFrames, frames.size() - offset);
+			meter.addFrames(&frames[offset], &frames[offset], frameCount);
+		}
+		return meter;
+	}
+
+	std::vector<float> buildSine(double sampleRate, double seconds, double frequency, double amplitude, double phase = 0.0)
+	{
+		std::vector<float> frames(static_cast<size_t>(sampleRate * seconds));
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			frames[i] = static_cast<float>(amplitude * std::sin(2.0 * s_pi * frequency * i / sampleRate + phase));
+		}
+		return frames;
+	}
+}
+
+TEST_CASE(loudnessmeter, SineReadsReferenceLoudness)
+{
+	// EBU Tech 3341's first test signal: a sine at -23 dBFS in both channels reads -23 LUFS. The
+	// filters are designed again for each sample rate, so the renderer's rate has to read the same.
+	for (double sampleRate : { 48000.0, 44100.0 })
+	{
+		LoudnessMeter meter = measure(buildSine(sampleRate, 20.0, 997.0, std::pow(10.0, -23.0 / 20.0)), sampleRate);
+		CHECK(std::fabs(meter.getIntegratedLoudness() - -23.0) <= 0.1);
+	}
+}
+
+TEST_CASE(loudnessmeter, GatingLeavesOutQuietStretches)
+{
+	// A quiet stretch 20 LU down is below the relative gate, so it doesn't pull the loudness down
+	double sampleRate = 48000.0;
+	std::vector<float> frames = buildSine(sampleRate, 10.0, 997.0, std::pow(10.0, -23.0 / 20.0));
+	std::vector<float> quietFrames = buildSine(sampleRate, 10.0, 997.0, std::pow(10.0, -43.0 / 20.0));
+	frames.insert(frames.end(), quietFrames.begin(), quietFrames.end());
+	CHECK(std::fabs(measure(frames, sampleRate).getIntegratedLoudness() - -23.0) <= 0.1);
+}
+
+TEST_CASE(loudnessmeter, SilenceHasNoLoudnessOrPeak)
+{
+	LoudnessMeter meter = measure(std::vector<float>(48000 * 5, 0.0f), 48000.0);
+	CHECK_EQUAL(-std::numeric_limits<double>::infinity(), meter.getIntegratedLoudness());
+	CHECK_EQUAL(-std::numeric_limits<double>::infinity(), meter.getTruePeak());
+
+	// Less than a whole 400ms block can't be measured either
+	CHECK_EQUAL(-std::numeric_limits<double>::infinity(), measure(buildSine(48000.0, 0.3, 997.0, 0.5), 48000.0).getIntegratedLoudness());
+}
+
+TEST_CASE(loudnessmeter, TruePeakFindsPeaksBetweenSamples)
+{
+	// A quarter of the sample rate, shifted so every sample lands 45 degrees from a peak: the samples
+	// only reach about 3 dB below the waveform's peak, which falls halfway between them
+	double sampleRate = 48000.0;
+	double amplitude = 0.5;
+	std::vector<float> frames = buildSine(sampleRate, 1.0, sampleRate / 4.0, amplitude, s_pi / 4.0);
+	double samplePeak = 0;
+	for (float frame : frames)
+	{
+		samplePeak = std::max(samplePeak, static_cast<double>(std::fabs(frame)));
+	}
+	double samplePeakDecibels = 20.0 * std::log10(samplePeak);
+	double amplitudeDecibels = 20.0 * std::log10(amplitude);
+
+	double truePeak = measure(frames, sampleRate).getTruePeak();
+	CHECK(truePeak > samplePeakDecibels + 2.0);
+	CHECK(std::fabs(truePeak - amplitudeDecibels) <= 0.5);
+}
@@ -0,0 +1,198 @@
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "midianalysis.h"
+#include "testframework.h"
+#include "testmidi.h"
+
+using namespace midirenderer;
+using namespace midirenderer::testing;
+
+namespace
+{
+	MIDIAnalysis analyze(const std::vector<std::vector<TestMIDIEvent>>& tracks, int division = 480)
+	{
+		std::vector<unsigned char> file = buildMIDIFile(division, tracks);
+		return analyzeMIDIData(file.data(), file.size());
+	}
+}
+
+TEST_CASE(midianalysis, LoopPointIsOneBlockBeforeTheBlockThatDispatchesIt)
+{
+	// At 120 BPM and 480 ticks per quarter, tick 960 is one second in. The player's clock is
+	// truncated to whole milliseconds at the start of each 64 frame block, and it first reaches
+	// tick 960 on the block starting at frame 44096.
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOff(480, 0, 60), controlChange(960, 0, 111, 0), noteOn(960, 0, 62), noteOff(1440, 0, 62) } });
+
+	CHECK(analysis.getHasLoopPoint());
+	CHECK_EQUAL(960, analysis.m_loopTick);
+	CHECK_EQUAL(961, analysis.m_loopPlayerTick);
+	CHECK_EQUAL(44096u - 64u, analysis.m_loopSample);
+	CHECK_EQUAL(0u, analysis.m_loopSample % 64);
+}
+
+TEST_CASE(midianalysis, SongWithoutLoopPointHasNone)
+{
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOff(480, 0, 60) } });
+
+	CHECK(!analysis.getHasLoopPoint());
+	CHECK_EQUAL(-1, analysis.m_loopTick);
+	CHECK(analysis.toJSON().find("\"loopPoint\":null") != std::string::npos);
+}
+
+TEST_CASE(midianalysis, EndSampleCountsTheFrameThatSeesThePlayerStop)
+{
+	// The last event is dispatched on the block at frame 44096, and the player is seen to
+	// have stopped on the first frame of the block after it
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOff(960, 0, 60) } });
+
+	CHECK_EQUAL(960u, analysis.m_endTick);
+	CHECK_EQUAL(44096u + 64u + 1u, analysis.m_endSample);
+}
+
+TEST_CASE(midianalysis, EndTickIsTheLatestTrackEnd)
+{
+	MIDIAnalysis analysis = analyze({ { tempo(0, 500000) }, { noteOn(0, 1, 60), noteOff(1920, 1, 60) }, { noteOn(0, 2, 64), noteOff(480, 2, 64) } });
+
+	CHECK_EQUAL(1920u, analysis.m_endTick);
+}
+
+TEST_CASE(midianalysis, TempoChangesAreMappedToBlocks)
+{
+	MIDIAnalysis analysis = analyze({ { tempo(0, 500000), tempo(480, 250000), noteOn(480, 0, 60), noteOff(960, 0, 60) } });
+
+	CHECK_EQUAL(size_t(2), analysis.m_tempoMap.size());
+	CHECK_EQUAL(0u, analysis.m_tempoMap[0].m_tick);
+	CHECK_EQUAL(0u, analysis.m_tempoMap[0].m_sample);
+	CHECK_EQUAL(480u, analysis.m_tempoMap[1].m_tick);
+	CHECK_EQUAL(250000, analysis.m_tempoMap[1].m_tempo);
+	CHECK_EQUAL(0u, analysis.m_tempoMap[1].m_sample % 64);
+	// Half a second in, give or take the block the player's rounding lands it on
+	CHECK(analysis.m_tempoMap[1].m_sample >= 22050 - 64 && analysis.m_tempoMap[1].m_sample <= 22050 + 64);
+
+	CHECK_EQUAL(250000, analysis.m_lastTempo);
+	CHECK_EQUAL(analysis.m_tempoMap[1].m_sample, analysis.m_lastTempoSample);
+}
+
+TEST_CASE(midianalysis, SampleAtTickFollowsTheTempoMap)
+{
+	MIDIAnalysis analysis = analyze({ { tempo(480, 250000), noteOn(480, 0, 60), noteOff(960, 0, 60) } });
+
+	// 480 ticks at 120 BPM, then 480 ticks at 240 BPM
+	CHECK_EQUAL(22050u, analysis.getSampleAtTick(480));
+	CHECK_EQUAL(22050u + 11025u, analysis.getSampleAtTick(960));
+	CHECK_EQUAL(0u, analysis.getSampleAtTick(0));
+}
+
+TEST_CASE(midianalysis, SamplesAtTicksMatchConvertingEachTick)
+{
+	// A ramp with a tempo change on every 48th tick, and ticks before, on and between the changes
+	std::vector<TestMIDIEvent> events;
+	for (uint32_t tick = 0; tick < 9600; tick += 48)
+	{
+		events.push_back(tempo(tick, 500000 - static_cast<int>(tick) * 20));
+	}
+	events.push_back(noteOn(9600, 0, 60));
+	events.push_back(noteOff(9660, 0, 60));
+	MIDIAnalysis analysis = analyze({ events });
+
+	std::vector<uint32_t> ticks = { 0, 0, 1, 47, 48, 49, 480, 480, 1000, 4799, 4800, 9599, 9660, 20000 };
+	std::vector<uint64_t> samples = analysis.getSamplesAtTicks(ticks);
+	CHECK_EQUAL(ticks.size(), samples.size());
+	for (size_t i = 0; i < ticks.size(); i++)
+	{
+		CHECK_EQUAL(analysis.getSampleAtTick(ticks[i]), samples[i]);
+	}
+	CHECK(analysis.getSamplesAtTicks({}).empty());
+}
+
+TEST_CASE(midianalysis, NextEventTickSkipsToTheNextTickWithAnEvent)
+{
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOff(480, 0, 60) }, { noteOn(480, 1, 60), noteOff(960, 1, 60) } });
+
+	CHECK_EQUAL(0, analysis.getNextEventTick(-1));
+	CHECK_EQUAL(480, analysis.getNextEventTick(0));
+	CHECK_EQUAL(480, analysis.getNextEventTick(479));
+	CHECK_EQUAL(960, analysis.getNextEventTick(480));
+	CHECK_EQUAL(-1, analysis.getNextEventTick(960));
+}
+
+TEST_CASE(midianalysis, BeatDivisionEndIsOnTheNextBeat)
+{
+	// A quarter note at 120 BPM is 22050 frames and an eighth note is 11025
+	CHECK_EQUAL(44100u, getBeatDivisionEndSample(40000, 0, 500000, 4));
+	CHECK_EQUAL(44100u, getBeatDivisionEndSample(33076, 0, 500000, 8));
+	// A song that ends right on a beat is still padded to the beat after it
+	CHECK_EQUAL(66150u, getBeatDivisionEndSample(44100, 0, 500000, 4));
+
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOff(960, 0, 60) } });
+	CHECK_EQUAL(analysis.m_endSample, analysis.getEndOnDivisionSample(-1));
+	CHECK(analysis.getEndOnDivisionSample(4) >= analysis.m_endSample);
+	CHECK_EQUAL(66150u, analysis.getEndOnDivisionSample(4));
+}
+
+TEST_CASE(midianalysis, SustainPedalDelaysRelease)
+{
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), controlChange(100, 0, 64, 127), noteOff(240, 0, 60),
+		noteOn(300, 0, 64), noteOff(400, 0, 64), controlChange(720, 0, 64, 0) } });
+
+	CHECK_EQUAL(size_t(2), analysis.m_notes.size());
+	CHECK_EQUAL(240u, analysis.m_notes[0].m_endTick);
+	CHECK_EQUAL(720u, analysis.m_notes[0].m_releaseTick);
+	CHECK_EQUAL(400u, analysis.m_notes[1].m_endTick);
+	CHECK_EQUAL(720u, analysis.m_notes[1].m_releaseTick);
+	CHECK_EQUAL(2, analysis.m_peakPolyphony);
+}
+
+TEST_CASE(midianalysis, PeakPolyphonyCountsOverlappingNotes)
+{
+	MIDIAnalysis analysis = analyze({ { noteOn(0, 0, 60), noteOn(0, 0, 64), noteOn(0, 0, 67), noteOff(480, 0, 60), noteOff(480, 0, 64), noteOff(480, 0, 67),
+		noteOn(960, 0, 72), noteOff(1440, 0, 72) } });
+
+	CHECK_EQUAL(size_t(4), analysis.m_notes.size());
+	CHECK_EQUAL(3, analysis.m_peakPolyphony);
+}
+
+TEST_CASE(midianalysis, RunningStatusAndZeroVelocityNoteOns)
+{
+	// A note on, a second note on with running status, and both ended by note ons with zero velocity
+	std::vector<unsigned char> file = buildMIDIFile(480, { { { 0, { 0x90, 60, 100 } }, { 0, { 62, 100 } }, { 480, { 60, 0 } }, { 480, { 62, 0 } } } });
+	MIDIAnalysis analysis = analyzeMIDIData(file.data(), file.size());
+
+	CHECK_EQUAL(size_t(2), analysis.m_notes.size());
+	CHECK_EQUAL(62, analysis.m_notes[1].m_key);
+	CHECK_EQUAL(480u, analysis.m_notes[0].m_endTick);
+	CHECK_EQUAL(480u, analysis.m_notes[1].m_endTick);
+}
+
+TEST_CASE(midianalysis, FlagsLinkedNotesAndOpaqueEvents)
+{
+	MIDIAnalysis plain = analyze({ { noteOn(0, 0, 60), noteOff(480, 0, 60) } });
+	CHECK_EQUAL(0, plain.m_channelsWithLinkedNotes);
+	CHECK(!plain.m_hasOpaqueEvents);
+
+	MIDIAnalysis portamento = analyze({ { controlChange(0, 2, 65, 127), noteOn(0, 2, 60), noteOff(480, 2, 60) } });
+	CHECK_EQUAL(1 << 2, portamento.m_channelsWithLinkedNotes);
+
+	MIDIAnalysis sysex = analyze({ { { 0, { 0xf0, 0x05, 0x7e, 0x7f, 0x09, 0x01, 0xf7 } }, noteOn(0, 0, 60), noteOff(480, 0, 60) } });
+	CHECK(sysex.m_hasOpaqueEvents);
+}
+
+TEST_CASE(midianalysis, RejectsInvalidFiles)
+{
+	std::vector<unsigned char> notMIDI = { 'R', 'I', 'F', 'F', 0, 0, 0, 0 };
+	CHECK_THROWS(std::invalid_argument, analyzeMIDIData(notMIDI.data(), notMIDI.size()));
+
+	std::vector<unsigned char> smpte = buildMIDIFile(480, { { noteOn(0, 0, 60) } });
+	smpte[12] = 0xe2;
+	smpte[13] = 0x50;
+	CHECK_THROWS(std::runtime_error, analyzeMIDIData(smpte.data(), smpte.size()));
+
+	std::vector<unsigned char> truncated = buildMIDIFile(480, { { noteOn(0, 0, 60), noteOff(480, 0, 60) } });
+	truncated.resize(truncated.size() - 4);
+	CHECK_THROWS(std::runtime_error, analyzeMIDIData(truncated.data(), truncated.size()));
+
+	std::vector<unsigned char> noStatus = buildMIDIFile(480, { { { 0, { 60, 100 } } } });
+	CHECK_THROWS(std::runtime_error, analyzeMIDIData(noStatus.data(), noStatus.size()));
+}
@@ -0,0 +1,74 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "mixutils.h"
+#include "testframework.h"
+
+using namespace midirenderer::utils;
+
+namespace
+{
+	std::vector<float> getRandomFrames(std::mt19937& random, size_t frameCount)
+	{
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<float> frames(frameCount);
+		for (float& frame : frames)
+		{
+			frame = distribution(random);
+		}
+		return frames;
+	}
+}
+
+TEST_CASE(mixutils, AddFramesMatchesAddingOneFrameAtATime)
+{
+	// Every length up to a few vectors' worth, from every offset within a vector, so both the
+	// vectorized loop and the frames left over after it are checked with unaligned pointers
+	std::mt19937 random(1);
+	for (size_t offset = 0; offset < 8; offset++)
+	{
+		for (size_t frameCount = 0; frameCount <= 40; frameCount++)
+		{
+			std::vector<float> source = getRandomFrames(random, offset + frameCount + 1);
+			std::vector<float> destination = getRandomFrames(random, offset + frameCount + 1);
+			std::vector<float> expected = destination;
+			for (size_t i = offset; i < offset + frameCount; i++)
+			{
+				expected[i] = source[i] + expected[i];
+			}
+
+			addFrames(&destination[offset], &source[offset], frameCount);
+			CHECK(destination == expected);
+		}
+	}
+}
+
+TEST_CASE(mixutils, PeakMatchesTheLargestAbsoluteFrame)
+{
+	std::mt19937 random(2);
+	for (size_t offset = 0; offset < 8; offset++)
+	{
+		for (size_t frameCount = 0; frameCount <= 40; frameCount++)
+		{
+			std::vector<float> frames = getRandomFrames(random, offset + frameCount);
+			float expected = 0.0f;
+			for (size_t i = offset; i < offset + frameCount; i++)
+			{
+				expected = std::fmax(expected, std::fabs(frames[i]));
+			}
+
+			CHECK_EQUAL(expected, getPeak(frames.data() + offset, frameCount));
+		}
+	}
+}
+
+TEST_CASE(mixutils, PeakFindsNegativeFramesInEveryLane)
+{
+	for (size_t position = 0; position < 19; position++)
+	{
+		std::vector<float> frames(19, 0.25f);
+		frames[position] = -0.75f;
+		CHECK_EQUAL(0.75f, getPeak(frames.data(), frames.size()));
+	}
+}
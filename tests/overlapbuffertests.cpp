@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "overlapbuffer.h"
+#include "rawaudioencoder.h"
+#include "testframework.h"
+
+namespace
+{
+	// Far more than the smallest storage the buffer allocates, so it has to grow
+	constexpr size_t s_longRegionFrames = 200000;
+
+	std::vector<float> getRandomFrames(std::mt19937& random, size_t frameCount)
+	{
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<float> frames(frameCount);
+		for (float& frame : frames)
+		{
+			frame = distribution(random);
+		}
+		return frames;
+	}
+
+	// Writes the frames to the sink in chunks of varying sizes, the way a render writes synth blocks
+	void writeInChunks(AudioSink& sink, const std::vector<float>& left, const std::vector<float>& right)
+	{
+		const size_t chunkSizes[] = { 1, 64, 7, 300, 4096, 33 };
+		size_t position = 0;
+		for (size_t i = 0; position < left.size(); i++)
+		{
+			size_t frameCount = std::min(chunkSizes[i % 6], left.size() - position);
+			sink.writeBuffers(&left[position], &right[position], frameCount);
+			position += frameCount;
+		}
+	}
+
+	// Renders the frames and returns them interleaved
+	std::vector<float> encodeRaw(const std::vector<float>& overlapLeft, const std::vector<float>& overlapRight,
+		const std::vector<float>& left, const std::vector<float>& right)
+	{
+		RawAudioEncoder encoder(44100);
+		encoder.startOverlapRegion();
+		writeInChunks(encoder, overlapLeft, overlapRight);
+		encoder.endOverlapRegion();
+		writeInChunks(encoder, left, right);
+		encoder.completeStream();
+
+		std::vector<unsigned char> output;
+		auto outputCallback = [&output](const unsigned char* data, size_t size)
+		{
+			output.insert(output.end(), data, data + size);
+		};
+		encoder.readHeader(outputCallback);
+		encoder.readEncodedData(outputCallback);
+
+		std::vector<float> frames(output.size() / sizeof(float));
+		std::memcpy(frames.data(), output.data(), output.size());
+		return frames;
+	}
+
+	void checkOverlapMix(size_t overlapFrameCount, size_t frameCount)
+	{
+		std::mt19937 random(static_cast<unsigned>(overlapFrameCount * 31 + frameCount));
+		std::vector<float> overlapLeft = getRandomFrames(random, overlapFrameCount);
+		std::vector<float> overlapRight = getRandomFrames(random, overlapFrameCount);
+		std::vector<float> left = getRandomFrames(random, frameCount);
+		std::vector<float> right = getRandomFrames(random, frameCount);
+
+		// The overlap is added to the frames after it one at a time, and whatever's left of it goes on the end
+		std::vector<float> expected;
+		for (size_t i = 0; i < std::max(overlapFrameCount, frameCount); i++)
+		{
+			float leftFrame = i < frameCount ? left[i] : 0.0f;
+			float rightFrame = i < frameCount ? right[i] : 0.0f;
+			if (i < overlapFrameCount)
+			{
+				leftFrame = i < frameCount ? overlapLeft[i] + leftFrame : overlapLeft[i];
+				rightFrame = i < frameCount ? overlapRight[i] + rightFrame : overlapRight[i];
+			}
+			expected.push_back(leftFrame);
+			expected.push_back(rightFrame);
+		}
+
+		CHECK(encodeRaw(overlapLeft, overlapRight, left, right) == expected);
+	}
+}
+
+TEST_CASE(overlapbuffer, ExtendKeepsEarlierFramesWhenItGrows)
+{
+	OverlapBuffer buffer;
+	float* left = nullptr;
+	float* right = nullptr;
+	for (size_t position = 0; position < s_longRegionFrames; position += 1000)
+	{
+		buffer.extend(1000, left, right);
+		for (size_t i = 0; i < 1000; i++)
+		{
+			left[i] = static_cast<float>(position + i);
+			right[i] = -static_cast<float>(position + i);
+		}
+	}
+
+	CHECK_EQUAL(s_longRegionFrames, buffer.getFrameCount());
+	bool isIntact = true;
+	for (size_t i = 0; i < s_longRegionFrames; i++)
+	{
+		isIntact = isIntact && buffer.getChannel(0)[i] == static_cast<float>(i) && buffer.getChannel(1)[i] == -static_cast<float>(i);
+	}
+	CHECK(isIntact);
+}
+
+TEST_CASE(overlapbuffer, TruncateAndClearDropFrames)
+{
+	OverlapBuffer buffer;
+	float* left = nullptr;
+	float* right = nullptr;
+	buffer.extend(100, left, right);
+	left[10] = 0.5f;
+
+	buffer.truncate(20);
+	CHECK_EQUAL(size_t(20), buffer.getFrameCount());
+	CHECK_EQUAL(0.5f, buffer.getChannel(0)[10]);
+	buffer.truncate(50);
+	CHECK_EQUAL(size_t(20), buffer.getFrameCount());
+
+	buffer.clear();
+	CHECK_EQUAL(size_t(0), buffer.getFrameCount());
+	buffer.extend(5, left, right);
+	CHECK_EQUAL(size_t(5), buffer.getFrameCount());
+	CHECK(left == buffer.getChannel(0));
+}
+
+TEST_CASE(overlapbuffer, EncoderMixesOverlapLikeAddingOneFrameAtATime)
+{
+	checkOverlapMix(0, 1000);
+	checkOverlapMix(1, 1000);
+	checkOverlapMix(517, 1000);
+	checkOverlapMix(1000, 1000);
+	// Overlaps longer than what's written after them, and long enough to come from the pool more than once
+	checkOverlapMix(1000, 517);
+	checkOverlapMix(s_longRegionFrames, 70000);
+	checkOverlapMix(70000, s_longRegionFrames);
+}
@@ -0,0 +1,211 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "pathresolution.h"
+#include "testfiles.h"
+#include "testframework.h"
+
+using namespace midirenderer::utils;
+using namespace midirenderer::testing;
+
+namespace
+{
+	// Files created out of order, in folders nested a couple of levels deep
+	void createSongTree(const TemporaryFolder& folder)
+	{
+		std::filesystem::create_directories(std::filesystem::u8path(folder.getPath("songs/b/deep")));
+		std::filesystem::create_directories(std::filesystem::u8path(folder.getPath("songs/a")));
+		for (const char* name : { "songs/c.mid", "songs/a.mid", "songs/b.mid", "songs/notes.txt", "songs/b/deep/z.mid",
+			"songs/a/y.mid", "songs/b/x.mid", "songs/[live].mid" })
+		{
+			writeFile(folder.getPath(name), "");
+		}
+	}
+
+	std::vector<std::string> resolve(const TemporaryFolder& folder, const std::string& pattern, unsigned int threadCount = 4,
+		const PathFilter& filter = nullptr)
+	{
+		return resolveWildcardedPaths({ folder.getPath(pattern) }, filter, threadCount)[0];
+	}
+
+	std::vector<std::string> getPaths(const TemporaryFolder& folder, const std::vector<std::string>& names)
+	{
+		std::vector<std::string> paths;
+		for (const std::string& name : names)
+		{
+			paths.push_back(std::filesystem::u8path(folder.getPath(name)).lexically_normal().u8string());
+		}
+		return paths;
+	}
+}
+
+TEST_CASE(pathresolution, StarsAndQuestionMarksMatchRuns)
+{
+	GlobPattern pattern("*.mid");
+	CHECK(pattern.matches("song.mid"));
+	CHECK(pattern.matches(".mid"));
+	CHECK(!pattern.matches("song.midi"));
+	CHECK(!pattern.matches("song.MID"));
+
+	GlobPattern middle("a*b*c");
+	CHECK(middle.matches("abc"));
+	CHECK(middle.matches("aXbYbZc"));
+	CHECK(!middle.matches("aXbYbZ"));
+
+	GlobPattern stars("***x");
+	CHECK(stars.matches("x"));
+	CHECK(stars.matches("yyx"));
+
+	GlobPattern single("track??.mid");
+	CHECK(single.matches("track01.mid"));
+	CHECK(!single.matches("track1.mid"));
+	// A question mark matches a whole UTF-8 character rather than a byte
+	CHECK(GlobPattern("?.mid").matches("\xc3\xa9.mid"));
+}
+
+TEST_CASE(pathresolution, SetsMatchOneCharacter)
+{
+	GlobPattern set("track[123].mid");
+	CHECK(set.matches("track2.mid"));
+	CHECK(!set.matches("track4.mid"));
+
+	GlobPattern range("[a-c]*");
+	CHECK(range.matches("beat"));
+	CHECK(!range.matches("drum"));
+
+	GlobPattern negated("[!a-c]*");
+	CHECK(!negated.matches("beat"));
+	CHECK(negated.matches("drum"));
+	CHECK(GlobPattern("[^a-c]*").matches("drum"));
+
+	// A ] straight after the opening bracket is part of the set
+	GlobPattern bracket("[]x]");
+	CHECK(bracket.matches("]"));
+	CHECK(bracket.matches("x"));
+	CHECK(!bracket.matches("["));
+}
+
+TEST_CASE(pathresolution, WildcardsCanBeMatchedLiterally)
+{
+	GlobPattern question("what[?].mid");
+	CHECK(question.matches("what?.mid"));
+	CHECK(!question.matches("whats.mid"));
+	CHECK(GlobPattern("[[]live].mid").matches("[live].mid"));
+	CHECK(GlobPattern("[*]").matches("*"));
+	CHECK(!GlobPattern("[*]").matches("a"));
+
+	// Brackets that aren't closed have no set to make
+	GlobPattern unclosed("song[1.mid");
+	CHECK(!unclosed.getHasWildcards());
+	CHECK(unclosed.matches("song[1.mid"));
+}
+
+TEST_CASE(pathresolution, ReportsWildcardsAndRecursion)
+{
+	CHECK(!GlobPattern("song.mid").getHasWildcards());
+	CHECK(GlobPattern("song.mid").matches("song.mid"));
+	CHECK(GlobPattern("s?ng.mid").getHasWildcards());
+	CHECK(GlobPattern("[ab].mid").getHasWildcards());
+	CHECK(GlobPattern("**").getIsRecursive());
+	CHECK(GlobPattern("**").getHasWildcards());
+	CHECK(!GlobPattern("**.mid").getIsRecursive());
+	CHECK_EQUAL(std::string("s?ng.mid"), GlobPattern("s?ng.mid").getText());
+}
+
+TEST_CASE(pathresolution, MatchesAreSorted)
+{
+	TemporaryFolder folder("glob_sorted");
+	createSongTree(folder);
+
+	CHECK(resolve(folder, "songs/*.mid") == getPaths(folder, { "songs/[live].mid", "songs/a.mid", "songs/b.mid", "songs/c.mid" }));
+	CHECK(resolve(folder, "songs/?.mid", 1) == getPaths(folder, { "songs/a.mid", "songs/b.mid", "songs/c.mid" }));
+}
+
+TEST_CASE(pathresolution, OrderDoesntDependOnTheThreadCount)
+{
+	TemporaryFolder folder("glob_threads");
+	createSongTree(folder);
+
+	std::vector<std::string> expected = resolve(folder, "**/*.mid", 1);
+	CHECK_EQUAL(size_t(7), expected.size());
+	for (unsigned int threadCount : { 2u, 3u, 8u })
+	{
+		CHECK(resolve(folder, "**/*.mid", threadCount) == expected);
+	}
+}
+
+TEST_CASE(pathresolution, RecursiveComponentMatchesAnyNumberOfFolders)
+{
+	TemporaryFolder folder("glob_recursive");
+	createSongTree(folder);
+
+	// Including none, so files straight in songs match too. Paths are ordered a component at a time,
+	// so a folder's files come before a file whose name starts with the folder's.
+	CHECK(resolve(folder, "songs/**/?.mid") == getPaths(folder, { "songs/a/y.mid", "songs/a.mid", "songs/b/deep/z.mid", "songs/b/x.mid",
+		"songs/b.mid", "songs/c.mid" }));
+	// A ** at the end matches everything under it
+	CHECK(resolve(folder, "songs/b/**") == getPaths(folder, { "songs/b/deep", "songs/b/deep/z.mid", "songs/b/x.mid" }));
+}
+
+TEST_CASE(pathresolution, TrailingSeparatorMatchesOnlyFolders)
+{
+	TemporaryFolder folder("glob_folders");
+	createSongTree(folder);
+
+	std::vector<std::string> folders = resolve(folder, "songs/*/");
+	CHECK(folders == getPaths(folder, { "songs/a", "songs/b" }));
+}
+
+TEST_CASE(pathresolution, ExistingNamesAreTakenLiterally)
+{
+	TemporaryFolder folder("glob_literal");
+	createSongTree(folder);
+
+	// [live] would otherwise be a set matching one of its letters
+	CHECK(resolve(folder, "songs/[live].mid") == getPaths(folder, { "songs/[live].mid" }));
+	CHECK(resolve(folder, "songs/missing.mid").empty());
+}
+
+TEST_CASE(pathresolution, FilterDecidesWhichMatchesAreKept)
+{
+	TemporaryFolder folder("glob_filter");
+	createSongTree(folder);
+
+	std::vector<std::string> matches = resolve(folder, "songs/*", 4, [](const std::string& path)
+		{
+			return path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") != 0;
+		});
+	CHECK(matches == getPaths(folder, { "songs/[live].mid", "songs/a", "songs/a.mid", "songs/b", "songs/b.mid", "songs/c.mid" }));
+}
+
+TEST_CASE(pathresolution, EachPathGetsItsOwnMatches)
+{
+	TemporaryFolder folder("glob_paths");
+	createSongTree(folder);
+
+	std::vector<std::vector<std::string>> matches = resolveWildcardedPaths({ folder.getPath("songs/c*"), folder.getPath("nothing/*"),
+		folder.getPath("songs/a*") }, nullptr, 4);
+	CHECK_EQUAL(size_t(3), matches.size());
+	CHECK(matches[0] == getPaths(folder, { "songs/c.mid" }));
+	CHECK(matches[1].empty());
+	CHECK(matches[2] == getPaths(folder, { "songs/a", "songs/a.mid" }));
+}
+
+TEST_CASE(pathresolution, WildcardRootIsFolderBeforeFirstWildcard)
+{
+	auto checkRoot = [](const std::string& path, const std::string& folder, bool isRecursive)
+	{
+		WildcardRoot root = getWildcardRoot(path);
+		CHECK_EQUAL(std::filesystem::u8path(folder).lexically_normal().u8string(), root.m_folder);
+		CHECK_EQUAL(isRecursive, root.m_isRecursive);
+	};
+
+	checkRoot("songs/*.mid", "songs", false);
+	checkRoot("songs/a.mid", "songs", false);
+	checkRoot("a.mid", ".", false);
+	checkRoot("songs/**", "songs", true);
+	checkRoot("songs/**/*.mid", "songs", true);
+	checkRoot("songs/b/*/x.mid", "songs/b", true);
+	checkRoot("/music/songs/*.mid", "/music/songs", false);
+}
@@ -0,0 +1,84 @@
+#include <string>
+#include <vector>
+
+#include "rendercache.h"
+#include "testfiles.h"
+#include "testframework.h"
+
+using namespace midirenderer;
+using namespace midirenderer::testing;
+
+TEST_CASE(rendercache, StoredRenderIsFetchedToNewOutputs)
+{
+	TemporaryFolder folder("cache_round_trip");
+	RenderCache cache(folder.getPath("cache"));
+	writeFile(folder.getPath("song.raw"), "frames");
+	writeFile(folder.getPath("song.raw.json"), "{}");
+	cache.store("0123456789abcdef", { folder.getPath("song.raw"), folder.getPath("song.raw.json") });
+
+	CHECK(cache.fetch("0123456789abcdef", { folder.getPath("copy.raw"), folder.getPath("copy.raw.json") }));
+	CHECK_EQUAL(std::string("frames"), readFile(folder.getPath("copy.raw")));
+	CHECK_EQUAL(std::string("{}"), readFile(folder.getPath("copy.raw.json")));
+	CHECK_EQUAL(size_t(2), getFolderEntryCount(folder.getPath("cache")));
+	CHECK_EQUAL(size_t(1), cache.getHitCount());
+	CHECK_EQUAL(size_t(0), cache.getMissCount());
+}
+
+TEST_CASE(rendercache, FetchReplacesExistingOutputs)
+{
+	TemporaryFolder folder("cache_replace");
+	RenderCache cache(folder.getPath("cache"));
+	writeFile(folder.getPath("song.ogg"), "new");
+	cache.store("key", { folder.getPath("song.ogg") });
+
+	writeFile(folder.getPath("old.ogg"), "old render");
+	CHECK(cache.fetch("key", { folder.getPath("old.ogg") }));
+	CHECK_EQUAL(std::string("new"), readFile(folder.getPath("old.ogg")));
+}
+
+TEST_CASE(rendercache, FetchMissesWhenAnyFileIsMissing)
+{
+	TemporaryFolder folder("cache_missing");
+	RenderCache cache(folder.getPath("cache"));
+	writeFile(folder.getPath("song.raw"), "frames");
+	cache.store("key", { folder.getPath("song.raw") });
+
+	CHECK(!cache.fetch("other", { folder.getPath("copy.raw") }));
+	CHECK(!cache.fetch("key", { folder.getPath("copy.raw"), folder.getPath("copy.raw.json") }));
+	CHECK(!getFileExists(folder.getPath("copy.raw")));
+	CHECK_EQUAL(size_t(0), cache.getHitCount());
+	CHECK_EQUAL(size_t(2), cache.getMissCount());
+}
+
+TEST_CASE(rendercache, FailedFetchLeavesNoOutputsBehind)
+{
+	TemporaryFolder folder("cache_rollback");
+	RenderCache cache(folder.getPath("cache"));
+	writeFile(folder.getPath("song.raw"), "frames");
+	writeFile(folder.getPath("song.raw.json"), "{}");
+	cache.store("key", { folder.getPath("song.raw"), folder.getPath("song.raw.json") });
+
+	// The second output's folder doesn't exist, so it can't be written after the first one has been
+	CHECK(!cache.fetch("key", { folder.getPath("copy.raw"), folder.getPath("missing/copy.raw.json") }));
+	CHECK(!getFileExists(folder.getPath("copy.raw")));
+	// Only the cache folder and the original outputs are left
+	CHECK_EQUAL(size_t(3), getFolderEntryCount(folder.getPath("")));
+	CHECK_EQUAL(size_t(1), cache.getMissCount());
+}
+
+TEST_CASE(rendercache, OutputsDontShareDataWithEntries)
+{
+	TemporaryFolder folder("cache_independent");
+	RenderCache cache(folder.getPath("cache"));
+	writeFile(folder.getPath("song.wav"), "original");
+	cache.store("key", { folder.getPath("song.wav") });
+
+	// Writing over the stored output or a fetched one in place mustn't change what's cached
+	writeFile(folder.getPath("song.wav"), "edited");
+	CHECK(cache.fetch("key", { folder.getPath("copy.wav") }));
+	CHECK_EQUAL(std::string("original"), readFile(folder.getPath("copy.wav")));
+	writeFile(folder.getPath("copy.wav"), "edited");
+
+	CHECK(cache.fetch("key", { folder.getPath("second.wav") }));
+	CHECK_EQUAL(std::string("original"), readFile(folder.getPath("second.wav")));
+}
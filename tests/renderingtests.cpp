@@ -0,0 +1,241 @@
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "midianalysis.h"
+#include "midivorbisrenderer.h"
+#include "rendercache.h"
+#include "testfiles.h"
+#include "testframework.h"
+#include "testmidi.h"
+
+using namespace midirenderer;
+using namespace midirenderer::testing;
+
+// These render with a real soundfont, given by the MIDIRENDERER_TEST_SOUNDFONT environment
+// variable, and are skipped without one. Each compares a render against a reference render,
+// which renders one frame at a time and takes none of the shortcuts the analysis allows.
+namespace
+{
+	std::string getTestSoundfont()
+	{
+		const char* soundfontPath = std::getenv("MIDIRENDERER_TEST_SOUNDFONT");
+		if (soundfontPath == nullptr || *soundfontPath == '\0')
+		{
+			throw TestSkipped("MIDIRENDERER_TEST_SOUNDFONT isn't set");
+		}
+		return soundfontPath;
+	}
+
+	// Renders to raw frames, with the runoff never trimmed so that it ends on the same frame however
+	// many frames each step renders
+	std::vector<unsigned char> renderRaw(const std::vector<unsigned char>& midiData, MIDIVorbisRenderer::LoopMode loopMode,
+		MIDIVorbisRenderer::RenderMode renderMode, RenderResult* result = nullptr, const std::function<void(MIDIVorbisRenderer&)>& configure = nullptr)
+	{
+		MIDIVorbisRenderer renderer(loopMode, -1, renderMode);
+		renderer.loadSoundfont(getTestSoundfont());
+		renderer.setOutputFormat(MIDIVorbisRenderer::OutputFormat::Raw);
+		renderer.setRunoffLimits(-std::numeric_limits<double>::infinity(), 0.0);
+		if (configure)
+		{
+			configure(renderer);
+		}
+
+		std::vector<unsigned char> output;
+		RenderResult renderResult = renderer.renderMemory(midiData, [&output](const unsigned char* data, size_t size)
+			{
+				output.insert(output.end(), data, data + size);
+			}, renderer.getSettings());
+		if (result != nullptr)
+		{
+			*result = renderResult;
+		}
+		return output;
+	}
+
+	void checkMatchesReference(const std::vector<unsigned char>& midiData, MIDIVorbisRenderer::LoopMode loopMode,
+		const std::function<void(MIDIVorbisRenderer&)>& configure = nullptr)
+	{
+		RenderResult result;
+		RenderResult referenceResult;
+		std::vector<unsigned char> output = renderRaw(midiData, loopMode, MIDIVorbisRenderer::RenderMode::Block, &result, configure);
+		std::vector<unsigned char> reference = renderRaw(midiData, loopMode, MIDIVorbisRenderer::RenderMode::PerFrame, &referenceResult, configure);
+
+		CHECK_EQUAL(referenceResult.m_outputFrames, result.m_outputFrames);
+		CHECK_EQUAL(referenceResult.m_loopStartFrame, result.m_loopStartFrame);
+		CHECK_EQUAL(reference.size(), output.size());
+		CHECK(output == reference);
+	}
+
+	// Two bars of chords, two bars of rest with a volume change in it, then the looped section, which
+	// starts with a note held over from before the loop point when isHoldingIntoLoop is set
+	std::vector<unsigned char> buildLoopedSong(bool isHoldingIntoLoop)
+	{
+		std::vector<TestMIDIEvent> events = { tempo(0, 500000), { 0, { 0xc0, 48 } }, controlChange(0, 0, 7, 100) };
+		for (uint32_t tick = 0; tick < 3840; tick += 480)
+		{
+			events.push_back(noteOn(tick, 0, 60));
+			events.push_back(noteOn(tick, 0, 64));
+			events.push_back(noteOff(tick + 400, 0, 60));
+			events.push_back(noteOff(tick + 400, 0, 64));
+		}
+		events.push_back(controlChange(5760, 0, 7, 80));
+		if (isHoldingIntoLoop)
+		{
+			events.push_back(noteOn(6720, 0, 55));
+		}
+		events.push_back(controlChange(7680, 0, 111, 0));
+		for (uint32_t tick = 7680; tick < 11520; tick += 480)
+		{
+			events.push_back(noteOn(tick, 0, 67));
+			events.push_back(noteOff(tick + 240, 0, 67));
+			if (isHoldingIntoLoop && tick == 7680)
+			{
+				events.push_back(noteOff(tick + 240, 0, 55));
+			}
+		}
+		return buildMIDIFile(480, { events });
+	}
+}
+
+TEST_CASE(rendering, UnloopedRenderLastsAsLongAsTheAnalysisSays)
+{
+	std::vector<unsigned char> midiData = buildLoopedSong(false);
+	MIDIAnalysis analysis = analyzeMIDIData(midiData.data(), midiData.size());
+
+	RenderResult result;
+	renderRaw(midiData, MIDIVorbisRenderer::LoopMode::None, MIDIVorbisRenderer::RenderMode::Block, &result);
+	CHECK_EQUAL(analysis.m_endSample, result.m_outputFrames);
+}
+
+TEST_CASE(rendering, SilentStretchesMatchReference)
+{
+	// The song and its double loop both have a rest long enough for the voices to finish, which is
+	// written as silence without copying it out of the synth
+	std::vector<unsigned char> midiData = buildLoopedSong(false);
+	checkMatchesReference(midiData, MIDIVorbisRenderer::LoopMode::None);
+	checkMatchesReference(midiData, MIDIVorbisRenderer::LoopMode::Double);
+
+	RenderResult result;
+	renderRaw(midiData, MIDIVorbisRenderer::LoopMode::None, MIDIVorbisRenderer::RenderMode::Block, &result, [](MIDIVorbisRenderer& renderer)
+		{
+			renderer.setCollectingStats(true);
+		});
+	CHECK(result.m_stats.m_silentFrames > 0);
+	CHECK(result.m_stats.m_silentFrames < result.m_outputFrames);
+}
+
+TEST_CASE(rendering, ShortLoopMatchesReference)
+{
+	// The pre-roll leaves out the intro's notes, which have all finished by the rest before the loop point
+	checkMatchesReference(buildLoopedSong(false), MIDIVorbisRenderer::LoopMode::Short);
+}
+
+TEST_CASE(rendering, ShortLoopWithNoteHeldOverLoopPointMatchesReference)
+{
+	checkMatchesReference(buildLoopedSong(true), MIDIVorbisRenderer::LoopMode::Short);
+}
+
+TEST_CASE(rendering, DoubleLoopWithoutCopyingMatchesReference)
+{
+	// Without memory to copy the first pass into, the whole second pass is synthesized like the reference's
+	checkMatchesReference(buildLoopedSong(true), MIDIVorbisRenderer::LoopMode::Double, [](MIDIVorbisRenderer& renderer)
+		{
+			renderer.setLoopCopyMemory(0);
+		});
+}
+
+TEST_CASE(rendering, DoubleLoopWithCopyingMatchesWithoutCopying)
+{
+	// The loop copy memory only decides how much of the second pass is synthesized, never what it sounds like
+	std::vector<unsigned char> midiData = buildLoopedSong(true);
+	RenderResult copiedResult;
+	RenderResult synthesizedResult;
+	std::vector<unsigned char> copied = renderRaw(midiData, MIDIVorbisRenderer::LoopMode::Double, MIDIVorbisRenderer::RenderMode::Block,
+		&copiedResult, [](MIDIVorbisRenderer& renderer)
+		{
+			renderer.setCollectingStats(true);
+		});
+	std::vector<unsigned char> synthesized = renderRaw(midiData, MIDIVorbisRenderer::LoopMode::Double, MIDIVorbisRenderer::RenderMode::Block,
+		&synthesizedResult, [](MIDIVorbisRenderer& renderer)
+		{
+			renderer.setCollectingStats(true);
+			renderer.setLoopCopyMemory(0);
+		});
+
+	CHECK_EQUAL(synthesizedResult.m_outputFrames, copiedResult.m_outputFrames);
+	CHECK_EQUAL(synthesizedResult.m_loopStartFrame, copiedResult.m_loopStartFrame);
+	CHECK_EQUAL(synthesized.size(), copied.size());
+	CHECK(copied == synthesized);
+	// Copying actually took over from the synth part of the way through the second pass
+	CHECK(copiedResult.m_stats.getStage(RenderStage::Synthesis).m_callCount < synthesizedResult.m_stats.getStage(RenderStage::Synthesis).m_callCount);
+}
+
+TEST_CASE(rendering, RenderCacheOnlyReusesRendersWithTheSameSettings)
+{
+	TemporaryFolder folder("rendering_cache");
+	RenderCache cache(folder.getPath("cache"));
+	std::vector<unsigned char> midiData = buildLoopedSong(false);
+
+	MIDIVorbisRenderer renderer(MIDIVorbisRenderer::LoopMode::None);
+	renderer.loadSoundfont(getTestSoundfont());
+	renderer.setOutputFormat(MIDIVorbisRenderer::OutputFormat::Raw);
+	renderer.setRenderCache(&cache);
+	MIDIVorbisRenderer::RenderSettings settings = renderer.getSettings();
+
+	CHECK(!renderer.renderData("song", midiData, folder.getPath("first.raw"), settings).m_isCached);
+	CHECK(renderer.renderData("song", midiData, folder.getPath("second.raw"), settings).m_isCached);
+	CHECK(readFile(folder.getPath("first.raw")) == readFile(folder.getPath("second.raw")));
+
+	MIDIVorbisRenderer::RenderSettings loopedSettings = settings;
+	loopedSettings.m_loopMode = MIDIVorbisRenderer::LoopMode::Short;
+	CHECK(!renderer.renderData("song", midiData, folder.getPath("looped.raw"), loopedSettings).m_isCached);
+
+	renderer.setRunoffLimits(-120.0, 0.0);
+	CHECK(!renderer.renderData("song", midiData, folder.getPath("runoff.raw"), settings).m_isCached);
+	CHECK_EQUAL(size_t(1), cache.getHitCount());
+	CHECK_EQUAL(size_t(3), cache.getMissCount());
+}
+
+TEST_CASE(rendering, TrimmedRunoffIsReportedWithoutStats)
+{
+	std::vector<unsigned char> midiData = buildLoopedSong(false);
+	RenderResult result;
+	RenderResult statsResult;
+	auto useDefaultRunoff = [](MIDIVorbisRenderer& renderer)
+	{
+		renderer.setRunoffLimits(MIDIVorbisRenderer::s_defaultRunoffFloorDecibels, MIDIVorbisRenderer::s_defaultMaxRunoffSeconds);
+	};
+	renderRaw(midiData, MIDIVorbisRenderer::LoopMode::None, MIDIVorbisRenderer::RenderMode::Block, &result, useDefaultRunoff);
+	renderRaw(midiData, MIDIVorbisRenderer::LoopMode::None, MIDIVorbisRenderer::RenderMode::Block, &statsResult, [&](MIDIVorbisRenderer& renderer)
+		{
+			useDefaultRunoff(renderer);
+			renderer.setCollectingStats(true);
+		});
+
+	CHECK(result.m_trimmedRunoffFrames > 0);
+	CHECK_EQUAL(statsResult.m_stats.m_trimmedRunoffFrames, result.m_trimmedRunoffFrames);
+}
+
+TEST_CASE(rendering, OutputNoteDescribesTheRender)
+{
+	RenderResult result;
+	CHECK_EQUAL(std::string(""), result.getOutputNote());
+
+	result.m_trimmedRunoffFrames = 22050;
+	CHECK_EQUAL(std::string(" (0.50 s of quiet runoff trimmed)"), result.getOutputNote());
+
+	result.m_isNormalized = true;
+	result.m_measuredLoudness = -20.0;
+	result.m_normalizationGain = 4.0;
+	CHECK_EQUAL(std::string(" (0.50 s of quiet runoff trimmed, -20.0 LUFS, normalized by +4.0 dB)"), result.getOutputNote());
+
+	result.m_trimmedRunoffFrames = 0;
+	result.m_measuredLoudness = -std::numeric_limits<double>::infinity();
+	CHECK_EQUAL(std::string(" (silent, not normalized)"), result.getOutputNote());
+
+	result.m_isCached = true;
+	CHECK_EQUAL(std::string(" (cached)"), result.getOutputNote());
+}
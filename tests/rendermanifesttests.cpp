@@ -0,0 +1,148 @@
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rendermanifest.h"
+#include "testfiles.h"
+#include "testframework.h"
+
+using namespace midirenderer;
+using namespace midirenderer::testing;
+
+namespace
+{
+	MIDIVorbisRenderer::RenderSettings getDefaultSettings()
+	{
+		return { MIDIVorbisRenderer::LoopMode::None, -1 };
+	}
+
+	std::vector<ManifestJob> readManifestText(const TemporaryFolder& folder, const std::string& name, const std::string& text)
+	{
+		writeFile(folder.getPath(name), text);
+		return readManifest(folder.getPath(name), getDefaultSettings());
+	}
+
+	// The message the manifest is rejected with, or an empty string if it's read
+	std::string getManifestError(const TemporaryFolder& folder, const std::string& name, const std::string& text)
+	{
+		try
+		{
+			readManifestText(folder, name, text);
+		}
+		catch (std::invalid_argument& e)
+		{
+			return e.what();
+		}
+		return "";
+	}
+
+	bool getContains(const std::string& text, const std::string& part)
+	{
+		return text.find(part) != std::string::npos;
+	}
+}
+
+TEST_CASE(rendermanifest, JSONJobsTakeTheirSettingsAndDefaults)
+{
+	TemporaryFolder folder("manifest_json");
+	std::vector<ManifestJob> jobs = readManifestText(folder, "jobs.json",
+		"[\n"
+		"  { \"input\": \"intro.mid\", \"loop-mode\": \"short\", \"end-on-division\": 8, \"quality\": 0.7 },\n"
+		"  { \"input\": \"/music/title.mid\", \"output\": \"out/title.ogg\", \"soundfont\": null, \"end-on-division\": \"none\" }\n"
+		"]\n");
+
+	CHECK_EQUAL(size_t(2), jobs.size());
+	CHECK_EQUAL(folder.getPath("intro.mid"), jobs[0].m_inputPath);
+	CHECK(jobs[0].m_outputPath.empty());
+	CHECK(jobs[0].m_settings.m_loopMode == MIDIVorbisRenderer::LoopMode::Short);
+	CHECK_EQUAL(8, jobs[0].m_settings.m_endingBeatDivision);
+	CHECK_EQUAL(0.7f, jobs[0].m_settings.m_vorbisQuality);
+
+	// Absolute paths are kept as they are, and null leaves a field to the defaults
+	CHECK_EQUAL(std::string("/music/title.mid"), jobs[1].m_inputPath);
+	CHECK_EQUAL(folder.getPath("out/title.ogg"), jobs[1].m_outputPath);
+	CHECK(jobs[1].m_soundfontPath.empty());
+	CHECK(jobs[1].m_settings.m_loopMode == MIDIVorbisRenderer::LoopMode::None);
+	CHECK_EQUAL(-1, jobs[1].m_settings.m_endingBeatDivision);
+	CHECK_EQUAL(MIDIVorbisRenderer::s_defaultVorbisQuality, jobs[1].m_settings.m_vorbisQuality);
+}
+
+TEST_CASE(rendermanifest, JSONStringsAreUnescaped)
+{
+	TemporaryFolder folder("manifest_escapes");
+	std::vector<ManifestJob> jobs = readManifestText(folder, "jobs.json",
+		"[{ \"input\": \"a \\\"b\\\"\\\\c\\u00e9\\ud83c\\udfb5.mid\" }]");
+
+	CHECK_EQUAL(size_t(1), jobs.size());
+	CHECK_EQUAL(folder.getPath("a \"b\"\\c\xc3\xa9\xf0\x9f\x8e\xb5.mid"), jobs[0].m_inputPath);
+	CHECK(readManifestText(folder, "empty.json", " [ ] ").empty());
+}
+
+TEST_CASE(rendermanifest, CSVJobsTakeTheirSettingsAndDefaults)
+{
+	TemporaryFolder folder("manifest_csv");
+	std::vector<ManifestJob> jobs = readManifestText(folder, "jobs.CSV",
+		"\xEF\xBB\xBF" "input, loop-mode ,end-on-division,output\r\n"
+		"intro.mid,double,16,\r\n"
+		"\r\n"
+		"\"title, \"\"final\"\".mid\",,,\"out\n/title.ogg\"\n");
+
+	CHECK_EQUAL(size_t(2), jobs.size());
+	CHECK_EQUAL(folder.getPath("intro.mid"), jobs[0].m_inputPath);
+	CHECK(jobs[0].m_settings.m_loopMode == MIDIVorbisRenderer::LoopMode::Double);
+	CHECK_EQUAL(16, jobs[0].m_settings.m_endingBeatDivision);
+	CHECK(jobs[0].m_outputPath.empty());
+
+	// Quoted fields hold commas, quotes and line breaks, and empty fields come from the defaults
+	CHECK_EQUAL(folder.getPath("title, \"final\".mid"), jobs[1].m_inputPath);
+	CHECK_EQUAL(folder.getPath("out\n/title.ogg"), jobs[1].m_outputPath);
+	CHECK(jobs[1].m_settings.m_loopMode == MIDIVorbisRenderer::LoopMode::None);
+}
+
+TEST_CASE(rendermanifest, ErrorsNameTheLine)
+{
+	TemporaryFolder folder("manifest_errors");
+	std::string unknownField = getManifestError(folder, "unknown.json", "[\n{ \"input\": \"a.mid\" },\n{ \"input\": \"b.mid\", \"tempo\": 2 }\n]");
+	CHECK(getContains(unknownField, "line 3"));
+	CHECK(getContains(unknownField, "Unknown field tempo"));
+
+	CHECK(getContains(getManifestError(folder, "twice.json", "[{ \"input\": \"a.mid\", \"input\": \"b.mid\" }]"), "given twice"));
+	CHECK(getContains(getManifestError(folder, "noinput.json", "[{ \"output\": \"a.ogg\" }]"), "no input"));
+	CHECK(getContains(getManifestError(folder, "unclosed.json", "[{ \"input\": \"a.mid }]"), "isn't closed"));
+	CHECK(getContains(getManifestError(folder, "trailing.json", "[] []"), "Unexpected text"));
+	CHECK(getContains(getManifestError(folder, "value.json", "[{ \"input\": a.mid }]"), "Expected a string, number"));
+
+	std::string shortRow = getManifestError(folder, "short.csv", "input,quality\na.mid,0.5\nb.mid\n");
+	CHECK(getContains(shortRow, "line 3"));
+	CHECK(getContains(shortRow, "1 fields, but the header has 2"));
+	CHECK(getContains(getManifestError(folder, "quote.csv", "input\n\"a.mid\n"), "isn't closed"));
+}
+
+TEST_CASE(rendermanifest, DivisionsMustBeWholePowersOfTwo)
+{
+	MIDIVorbisRenderer::RenderSettings settings = getDefaultSettings();
+	CHECK(setRenderSetting(settings, "end-on-division", "64"));
+	CHECK_EQUAL(64, settings.m_endingBeatDivision);
+	CHECK(setRenderSetting(settings, "end-on-division", "1"));
+	CHECK_EQUAL(1, settings.m_endingBeatDivision);
+	CHECK(setRenderSetting(settings, "end-on-division", "none"));
+	CHECK_EQUAL(-1, settings.m_endingBeatDivision);
+
+	for (const char* value : { "", "0", "3", "128", "-4", "4beats", "4.5", " ", "0x10", "4294967300" })
+	{
+		CHECK_THROWS(std::invalid_argument, setRenderSetting(settings, "end-on-division", value));
+	}
+	CHECK_EQUAL(-1, settings.m_endingBeatDivision);
+}
+
+TEST_CASE(rendermanifest, SettingsRejectInvalidValues)
+{
+	MIDIVorbisRenderer::RenderSettings settings = getDefaultSettings();
+	CHECK(!setRenderSetting(settings, "tempo", "120"));
+	CHECK_THROWS(std::invalid_argument, setRenderSetting(settings, "loop-mode", "triple"));
+	CHECK_THROWS(std::invalid_argument, setRenderSetting(settings, "quality", "1.5"));
+	CHECK_THROWS(std::invalid_argument, setRenderSetting(settings, "quality", "0.5x"));
+	CHECK_THROWS(std::invalid_argument, setRenderSetting(settings, "quality", ""));
+	CHECK(setRenderSetting(settings, "quality", "-0.1"));
+	CHECK_EQUAL(-0.1f, settings.m_vorbisQuality);
+}
@@ -0,0 +1,140 @@
+#include <vector>
+
+#include "retainingaudiosink.h"
+#include "testframework.h"
+
+using namespace midirenderer::testing;
+
+namespace
+{
+	// Keeps the left channel of everything written to it, with overlap regions kept apart
+	class CollectingAudioSink : public AudioSink
+	{
+	public:
+		void writeBuffers(const float* leftBuffer, const float*, size_t frameCount) override
+		{
+			std::vector<float>& frames = m_isInOverlap ? m_overlapFrames : m_frames;
+			frames.insert(frames.end(), leftBuffer, leftBuffer + frameCount);
+		}
+
+		size_t acquireBuffers(size_t frameCount, float*& leftBuffer, float*& rightBuffer) override
+		{
+			m_acquiredBuffers[0].assign(frameCount, 0.0f);
+			m_acquiredBuffers[1].assign(frameCount, 0.0f);
+			leftBuffer = m_acquiredBuffers[0].data();
+			rightBuffer = m_acquiredBuffers[1].data();
+			return frameCount;
+		}
+
+		void commitBuffers(size_t frameCount) override
+		{
+			writeBuffers(m_acquiredBuffers[0].data(), m_acquiredBuffers[1].data(), frameCount);
+			// Like an encoder that works on its buffers in place once they're committed
+			m_acquiredBuffers[0].assign(m_acquiredBuffers[0].size(), -1.0f);
+			m_acquiredBuffers[1].assign(m_acquiredBuffers[1].size(), -1.0f);
+		}
+
+		void startOverlapRegion() override { m_isInOverlap = true; }
+		void endOverlapRegion() override { m_isInOverlap = false; }
+
+		std::vector<float> m_frames;
+		std::vector<float> m_overlapFrames;
+
+	private:
+		std::vector<float> m_acquiredBuffers[2];
+		bool m_isInOverlap = false;
+	};
+
+	// Writes frames numbered from firstFrame, with the right channel negated
+	void writeNumberedFrames(AudioSink& sink, float firstFrame, size_t frameCount)
+	{
+		std::vector<float> left(frameCount);
+		std::vector<float> right(frameCount);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			left[i] = firstFrame + i;
+			right[i] = -left[i];
+		}
+		sink.writeBuffers(left.data(), right.data(), frameCount);
+	}
+
+	void commitNumberedFrames(AudioSink& sink, float firstFrame, size_t frameCount)
+	{
+		float* left = nullptr;
+		float* right = nullptr;
+		size_t acquiredFrameCount = sink.acquireBuffers(frameCount, left, right);
+		for (size_t i = 0; i < acquiredFrameCount; i++)
+		{
+			left[i] = firstFrame + i;
+			right[i] = -left[i];
+		}
+		sink.commitBuffers(acquiredFrameCount);
+	}
+}
+
+TEST_CASE(retainingaudiosink, KeepsFramesFromThePositionUntilTheOverlapRegion)
+{
+	CollectingAudioSink target;
+	RetainingAudioSink sink(target);
+	sink.retainFrom(10, 100);
+
+	writeNumberedFrames(sink, 0, 8);
+	commitNumberedFrames(sink, 8, 8);
+	writeNumberedFrames(sink, 16, 4);
+	sink.startOverlapRegion();
+	writeNumberedFrames(sink, 20, 4);
+	sink.endOverlapRegion();
+
+	CHECK(sink.getHasRetainedAll());
+	CHECK_EQUAL(size_t(10), sink.getLeftBuffer().size());
+	for (size_t i = 0; i < sink.getLeftBuffer().size(); i++)
+	{
+		CHECK_EQUAL(10.0f + i, sink.getLeftBuffer()[i]);
+		CHECK_EQUAL(-10.0f - i, sink.getRightBuffer()[i]);
+	}
+
+	// Everything is still passed on
+	CHECK_EQUAL(size_t(20), target.m_frames.size());
+	CHECK_EQUAL(size_t(4), target.m_overlapFrames.size());
+}
+
+TEST_CASE(retainingaudiosink, DropsEverythingOverTheLimit)
+{
+	CollectingAudioSink target;
+	RetainingAudioSink sink(target);
+	sink.retainFrom(0, 16);
+
+	writeNumberedFrames(sink, 0, 12);
+	writeNumberedFrames(sink, 12, 8);
+	sink.startOverlapRegion();
+
+	CHECK(!sink.getHasRetainedAll());
+	CHECK(sink.getLeftBuffer().empty());
+	CHECK_EQUAL(size_t(20), target.m_frames.size());
+}
+
+TEST_CASE(retainingaudiosink, HasNotRetainedAllWhenThePositionIsNeverReached)
+{
+	CollectingAudioSink target;
+	RetainingAudioSink sink(target);
+	sink.retainFrom(50, 100);
+
+	writeNumberedFrames(sink, 0, 20);
+	sink.startOverlapRegion();
+
+	CHECK(!sink.getHasRetainedAll());
+}
+
+TEST_CASE(retainingaudiosink, PositionInThePastKeepsNothing)
+{
+	CollectingAudioSink target;
+	RetainingAudioSink sink(target);
+
+	writeNumberedFrames(sink, 0, 20);
+	sink.retainFrom(10, 100);
+	writeNumberedFrames(sink, 20, 20);
+	sink.startOverlapRegion();
+
+	CHECK(!sink.getHasRetainedAll());
+	CHECK(sink.getLeftBuffer().empty());
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <vorbis/codec.h>
+
+#include "oggvorbisencoder.h"
+#include "segmentedvorbisencoder.h"
+#include "testframework.h"
+
+// These encode synthetic audio, so they don't need a soundfont. Each compares an encode cut into
+// segments on several threads with one encoded on a single thread.
+namespace
+{
+	constexpr long s_sampleRate = 44100;
+	constexpr float s_quality = 0.4f;
+
+	struct DecodedStream
+	{
+		std::array<std::vector<float>, 2> m_frames;
+		// The granule position of the last page, which is how many frames the stream plays for
+		int64_t m_finalGranule = -1;
+		bool m_isValid = true;
+	};
+
+	// Notes with sharp attacks over quiet noise, so that the encoder switches between short and
+	// long blocks and segments have to be lined up with both
+	std::array<std::vector<float>, 2> buildSource(size_t frameCount)
+	{
+		std::array<std::vector<float>, 2> frames = { std::vector<float>(frameCount), std::vector<float>(frameCount) };
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+		const double pi = std::acos(-1.0);
+		const size_t noteFrames = static_cast<size_t>(s_sampleRate * 0.37);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			size_t note = i / noteFrames;
+			double time = static_cast<double>(i % noteFrames) / s_sampleRate;
+			double frequency = 220.0 * std::pow(2.0, static_cast<double>(note * 7 % 24) / 12.0);
+			double envelope = 0.4 * std::exp(-time * 6.0);
+			frames[0][i] = static_cast<float>(envelope * std::sin(2 * pi * frequency * time)) + noise(random);
+			frames[1][i] = static_cast<float>(envelope * std::sin(2 * pi * frequency * 1.5 * time)) + noise(random);
+		}
+		return frames;
+	}
+
+	std::vector<unsigned char> encode(const std::array<std::vector<float>, 2>& source, unsigned int threadCount)
+	{
+		OggVorbisEncoder encoder(1, s_sampleRate, s_quality);
+		encoder.setEncoderThreadCount(threadCount);
+
+		const size_t chunkFrames = 4096;
+		size_t frameCount = source[0].size();
+		for (size_t offset = 0; offset < frameCount; offset += chunkFrames)
+		{
+			encoder.writeBuffers(&source[0][offset], &source[1][offset], std::min(chunkFrames, frameCount - offset));
+		}
+		encoder.completeStream();
+
+		std::vector<unsigned char> output;
+		auto append = [&output](const unsigned char* data, size_t size)
+		{
+			output.insert(output.end(), data, data + size);
+		};
+		encoder.readHeader(append);
+		encoder.readEncodedData(append);
+		return output;
+	}
+
+	DecodedStream decode(const std::vector<unsigned char>& data)
+	{
+		DecodedStream decoded;
+
+		ogg_sync_state sync;
+		ogg_sync_init(&sync);
+		char* syncBuffer = ogg_sync_buffer(&sync, static_cast<long>(data.size()));
+		std::memcpy(syncBuffer, data.data(), data.size());
+		ogg_sync_wrote(&sync, static_cast<long>(data.size()));
+
+		ogg_stream_state stream;
+		bool hasStream = false;
+		vorbis_info info;
+		vorbis_info_init(&info);
+		vorbis_comment comment;
+		vorbis_comment_init(&comment);
+		vorbis_dsp_state decoder;
+		vorbis_block block;
+		int headerCount = 0;
+
+		ogg_page page;
+		while (decoded.m_isValid && ogg_sync_pageout(&sync, &page) == 1)
+		{
+			if (!hasStream)
+			{
+				ogg_stream_init(&stream, ogg_page_serialno(&page));
+				hasStream = true;
+			}
+			ogg_stream_pagein(&stream, &page);
+			decoded.m_finalGranule = ogg_page_granulepos(&page);
+
+			ogg_packet packet;
+			while (decoded.m_isValid && ogg_stream_packetout(&stream, &packet) == 1)
+			{
+				if (headerCount < 3)
+				{
+					decoded.m_isValid = vorbis_synthesis_headerin(&info, &comment, &packet) == 0;
+					if (decoded.m_isValid && ++headerCount == 3)
+					{
+						vorbis_synthesis_init(&decoder, &info);
+						vorbis_block_init(&decoder, &block);
+					}
+					continue;
+				}
+
+				decoded.m_isValid = vorbis_synthesis(&block, &packet) == 0 && vorbis_synthesis_blockin(&decoder, &block) == 0;
+
+				float** pcm;
+				int frameCount;
+				while ((frameCount = vorbis_synthesis_pcmout(&decoder, &pcm)) > 0)
+				{
+					for (size_t channel = 0; channel < decoded.m_frames.size(); channel++)
+					{
+						decoded.m_frames[channel].insert(decoded.m_frames[channel].end(), pcm[channel], pcm[channel] + frameCount);
+					}
+					vorbis_synthesis_read(&decoder, frameCount);
+				}
+			}
+		}
+
+		if (headerCount == 3)
+		{
+			vorbis_block_clear(&block);
+			vorbis_dsp_clear(&decoder);
+		}
+		decoded.m_isValid = decoded.m_isValid && headerCount == 3;
+		if (hasStream)
+		{
+			ogg_stream_clear(&stream);
+		}
+		vorbis_comment_clear(&comment);
+		vorbis_info_clear(&info);
+		ogg_sync_clear(&sync);
+		return decoded;
+	}
+
+	// The summed squared difference between the decoded frames and the source over [start, end)
+	double getError(const DecodedStream& decoded, const std::array<std::vector<float>, 2>& source, size_t start, size_t end)
+	{
+		double error = 0;
+		for (size_t channel = 0; channel < source.size(); channel++)
+		{
+			for (size_t i = start; i < end; i++)
+			{
+				double difference = decoded.m_frames[channel][i] - source[channel][i];
+				error += difference * difference;
+			}
+		}
+		return error;
+	}
+}
+
+TEST_CASE(segmentedvorbisencoder, SegmentedEncodeHasNoSeams)
+{
+	// Long enough for five joins, ending part of the way through a segment
+	size_t frameCount = static_cast<size_t>(s_sampleRate * 170);
+	std::array<std::vector<float>, 2> source = buildSource(frameCount);
+
+	DecodedStream single = decode(encode(source, 1));
+	DecodedStream segmented = decode(encode(source, 4));
+	CHECK(single.m_isValid);
+	CHECK(segmented.m_isValid);
+
+	CHECK_EQUAL(static_cast<int64_t>(frameCount), single.m_finalGranule);
+	CHECK_EQUAL(static_cast<int64_t>(frameCount), segmented.m_finalGranule);
+	CHECK_EQUAL(frameCount, single.m_frames[0].size());
+	CHECK_EQUAL(frameCount, segmented.m_frames[0].size());
+
+	// Each join is made within a second of a segment boundary. Around it, the segmented encode is
+	// allowed to be only as much further from the source as the encoder allows a join to be.
+	uint64_t segmentFrames = SegmentedVorbisEncoder::getSegmentFrameCount(s_sampleRate);
+	size_t checkedFrames = static_cast<size_t>(s_sampleRate);
+	for (uint64_t boundary = segmentFrames; boundary + checkedFrames < frameCount; boundary += segmentFrames)
+	{
+		size_t start = static_cast<size_t>(boundary) - checkedFrames;
+		size_t end = static_cast<size_t>(boundary) + checkedFrames;
+		double singleError = getError(single, source, start, end);
+		double segmentedError = getError(segmented, source, start, end);
+		CHECK(std::isfinite(segmentedError));
+		CHECK(segmentedError <= singleError * 2.0 + 1e-10 * (end - start));
+	}
+}
+
+TEST_CASE(segmentedvorbisencoder, ShortStreamMatchesSingleThreadedEncode)
+{
+	// Streams shorter than a segment are encoded by a single segment's encoder, just like a single-threaded encode
+	std::array<std::vector<float>, 2> source = buildSource(static_cast<size_t>(s_sampleRate * 5));
+	DecodedStream single = decode(encode(source, 1));
+	DecodedStream segmented = decode(encode(source, 4));
+	CHECK(segmented.m_isValid);
+	CHECK_EQUAL(single.m_finalGranule, segmented.m_finalGranule);
+	CHECK(segmented.m_frames == single.m_frames);
+}
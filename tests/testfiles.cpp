@@ -0,0 +1,48 @@
+#include "testfiles.h"
+
+#include <fstream>
+#include <iterator>
+
+namespace midirenderer::testing
+{
+	TemporaryFolder::TemporaryFolder(const std::string& name) :
+		m_path(std::filesystem::temp_directory_path() / ("midirenderer_tests_" + name))
+	{
+		std::filesystem::remove_all(m_path);
+		std::filesystem::create_directories(m_path);
+	}
+
+	TemporaryFolder::~TemporaryFolder()
+	{
+		std::error_code error;
+		std::filesystem::remove_all(m_path, error);
+	}
+
+	std::string TemporaryFolder::getPath(const std::string& name) const
+	{
+		return (m_path / std::filesystem::u8path(name)).u8string();
+	}
+
+	void writeFile(const std::string& path, const std::string& contents)
+	{
+		std::ofstream file(std::filesystem::u8path(path), std::ios_base::out | std::ios_base::binary);
+		file << contents;
+	}
+
+	std::string readFile(const std::string& path)
+	{
+		std::ifstream file(std::filesystem::u8path(path), std::ios_base::in | std::ios_base::binary);
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	bool getFileExists(const std::string& path)
+	{
+		return std::filesystem::exists(std::filesystem::u8path(path));
+	}
+
+	size_t getFolderEntryCount(const std::string& path)
+	{
+		std::filesystem::directory_iterator entries(std::filesystem::u8path(path));
+		return static_cast<size_t>(std::distance(std::filesystem::begin(entries), std::filesystem::end(entries)));
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+namespace midirenderer::testing
+{
+	// A folder in the system's temporary folder for a test's files, which is emptied when it's
+	// created and removed when the test finishes
+	class TemporaryFolder
+	{
+	public:
+		TemporaryFolder(const std::string& name);
+		~TemporaryFolder();
+
+		TemporaryFolder(const TemporaryFolder& other) = delete;
+		TemporaryFolder& operator=(const TemporaryFolder& other) = delete;
+
+		std::string getPath(const std::string& name) const;
+
+	private:
+		std::filesystem::path m_path;
+	};
+
+	void writeFile(const std::string& path, const std::string& contents);
+	// The file's contents, or an empty string if it can't be read
+	std::string readFile(const std::string& path);
+	bool getFileExists(const std::string& path);
+	// How many files and folders are directly in the folder
+	size_t getFolderEntryCount(const std::string& path);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace midirenderer::testing
+{
+	struct TestCase
+	{
+		std::string m_suite;
+		std::string m_name;
+		std::function<void()> m_run;
+	};
+
+	// Every test case in the program, in the order they were registered
+	std::vector<TestCase>& getTestCases();
+
+	struct TestRegistration
+	{
+		TestRegistration(const char* suite, const char* name, std::function<void()> run);
+	};
+
+	// Thrown by a failed check, which ends the test case it's in
+	class TestFailure : public std::runtime_error
+	{
+	public:
+		TestFailure(const char* file, int line, const std::string& message);
+	};
+
+	// Thrown by a test case that can't run here, such as one that needs a soundfont when none was given
+	class TestSkipped : public std::runtime_error
+	{
+	public:
+		TestSkipped(const std::string& reason);
+	};
+
+	template<typename T>
+	std::string describeValue(const T& value)
+	{
+		std::ostringstream description;
+		description << value;
+		return description.str();
+	}
+
+	inline std::string describeValue(const std::string& value)
+	{
+		return "\"" + value + "\"";
+	}
+
+	inline std::string describeValue(bool value)
+	{
+		return value ? "true" : "false";
+	}
+}
+
+#define TEST_CASE(suite, name) \
+	static void suite##_##name(); \
+	static midirenderer::testing::TestRegistration s_##suite##_##name##Registration(#suite, #name, &suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			throw midirenderer::testing::TestFailure(__FILE__, __LINE__, "CHECK(" #condition ") failed"); \
+		} \
+	} while (false)
+
+#define CHECK_EQUAL(expected, actual) \
+	do \
+	{ \
+		auto&& expectedValue = (expected); \
+		auto&& actualValue = (actual); \
+		if (!(expectedValue == actualValue)) \
+		{ \
+			throw midirenderer::testing::TestFailure(__FILE__, __LINE__, "CHECK_EQUAL(" #expected ", " #actual ") failed: expected " + \
+				midirenderer::testing::describeValue(expectedValue) + ", got " + midirenderer::testing::describeValue(actualValue)); \
+		} \
+	} while (false)
+
+#define CHECK_THROWS(exceptionType, expression) \
+	do \
+	{ \
+		bool hasThrown = false; \
+		try \
+		{ \
+			expression; \
+		} \
+		catch (exceptionType&) \
+		{ \
+			hasThrown = true; \
+		} \
+		if (!hasThrown) \
+		{ \
+			throw midirenderer::testing::TestFailure(__FILE__, __LINE__, #expression " didn't throw " #exceptionType); \
+		} \
+	} while (false)
@@ -0,0 +1,70 @@
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "testframework.h"
+
+namespace midirenderer::testing
+{
+	std::vector<TestCase>& getTestCases()
+	{
+		static std::vector<TestCase> testCases;
+		return testCases;
+	}
+
+	TestRegistration::TestRegistration(const char* suite, const char* name, std::function<void()> run)
+	{
+		getTestCases().push_back({ suite, name, std::move(run) });
+	}
+
+	TestFailure::TestFailure(const char* file, int line, const std::string& message) :
+		std::runtime_error(std::string(file) + ":" + std::to_string(line) + ": " + message) { }
+
+	TestSkipped::TestSkipped(const std::string& reason) : std::runtime_error(reason) { }
+}
+
+using namespace midirenderer::testing;
+
+// The return code CTest is told means every test that ran was skipped
+constexpr int s_skippedReturnCode = 77;
+
+// Runs every test case, or only those in the suite given as the first argument
+int main(int argc, char** argv)
+{
+	std::string suite = argc > 1 ? argv[1] : "";
+
+	size_t passedCount = 0;
+	size_t failedCount = 0;
+	size_t skippedCount = 0;
+	for (const TestCase& testCase : getTestCases())
+	{
+		if (!suite.empty() && testCase.m_suite != suite) { continue; }
+
+		std::string testName = testCase.m_suite + "." + testCase.m_name;
+		try
+		{
+			testCase.m_run();
+			passedCount++;
+		}
+		catch (TestSkipped& e)
+		{
+			std::cout << "SKIPPED " << testName << ": " << e.what() << std::endl;
+			skippedCount++;
+		}
+		catch (std::exception& e)
+		{
+			std::cout << "FAILED " << testName << ": " << e.what() << std::endl;
+			failedCount++;
+		}
+	}
+
+	std::cout << passedCount << " passed, " << failedCount << " failed, " << skippedCount << " skipped" << std::endl;
+	if (failedCount > 0) { return 1; }
+	if (passedCount == 0 && skippedCount > 0) { return s_skippedReturnCode; }
+	if (passedCount == 0)
+	{
+		std::cout << "No tests found" << (suite.empty() ? "" : " in suite " + suite) << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include "testmidi.h"
+
+namespace midirenderer::testing
+{
+	namespace
+	{
+		void writeBigEndian(std::vector<unsigned char>& output, uint32_t value, int byteCount)
+		{
+			for (int i = byteCount - 1; i >= 0; i--)
+			{
+				output.push_back(static_cast<unsigned char>(value >> (i * 8)));
+			}
+		}
+
+		void writeVariableLength(std::vector<unsigned char>& output, uint32_t value)
+		{
+			unsigned char bytes[4];
+			int byteCount = 0;
+			do
+			{
+				bytes[byteCount++] = value & 0x7f;
+				value >>= 7;
+			} while (value > 0);
+
+			for (int i = byteCount - 1; i >= 0; i--)
+			{
+				output.push_back(static_cast<unsigned char>(bytes[i] | (i > 0 ? 0x80 : 0)));
+			}
+		}
+	}
+
+	std::vector<unsigned char> buildMIDIFile(int division, const std::vector<std::vector<TestMIDIEvent>>& tracks)
+	{
+		std::vector<unsigned char> file = { 'M', 'T', 'h', 'd' };
+		writeBigEndian(file, 6, 4);
+		writeBigEndian(file, 1, 2);
+		writeBigEndian(file, static_cast<uint32_t>(tracks.size()), 2);
+		writeBigEndian(file, static_cast<uint32_t>(division), 2);
+
+		for (const auto& events : tracks)
+		{
+			std::vector<unsigned char> data;
+			uint32_t lastTick = 0;
+			for (const TestMIDIEvent& event : events)
+			{
+				writeVariableLength(data, event.m_tick - lastTick);
+				data.insert(data.end(), event.m_bytes.begin(), event.m_bytes.end());
+				lastTick = event.m_tick;
+			}
+			writeVariableLength(data, 0);
+			data.insert(data.end(), { 0xff, 0x2f, 0x00 });
+
+			file.insert(file.end(), { 'M', 'T', 'r', 'k' });
+			writeBigEndian(file, static_cast<uint32_t>(data.size()), 4);
+			file.insert(file.end(), data.begin(), data.end());
+		}
+
+		return file;
+	}
+
+	TestMIDIEvent noteOn(uint32_t tick, int channel, int key, int velocity)
+	{
+		return { tick, { static_cast<unsigned char>(0x90 | channel), static_cast<unsigned char>(key), static_cast<unsigned char>(velocity) } };
+	}
+
+	TestMIDIEvent noteOff(uint32_t tick, int channel, int key)
+	{
+		return { tick, { static_cast<unsigned char>(0x80 | channel), static_cast<unsigned char>(key), 0 } };
+	}
+
+	TestMIDIEvent controlChange(uint32_t tick, int channel, int control, int value)
+	{
+		return { tick, { static_cast<unsigned char>(0xb0 | channel), static_cast<unsigned char>(control), static_cast<unsigned char>(value) } };
+	}
+
+	TestMIDIEvent tempo(uint32_t tick, int microsecondsPerQuarter)
+	{
+		return { tick, { 0xff, 0x51, 0x03, static_cast<unsigned char>(microsecondsPerQuarter >> 16),
+			static_cast<unsigned char>(microsecondsPerQuarter >> 8), static_cast<unsigned char>(microsecondsPerQuarter) } };
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace midirenderer::testing
+{
+	struct TestMIDIEvent
+	{
+		// Absolute, rather than the delta time written to the file
+		uint32_t m_tick;
+		std::vector<unsigned char> m_bytes;
+	};
+
+	// Writes a format 1 standard MIDI file with a track for each list of events, which must be in
+	// order. Each track is ended with an end of track event on its last event's tick.
+	std::vector<unsigned char> buildMIDIFile(int division, const std::vector<std::vector<TestMIDIEvent>>& tracks);
+
+	TestMIDIEvent noteOn(uint32_t tick, int channel, int key, int velocity = 100);
+	TestMIDIEvent noteOff(uint32_t tick, int channel, int key);
+	TestMIDIEvent controlChange(uint32_t tick, int channel, int control, int value);
+	TestMIDIEvent tempo(uint32_t tick, int microsecondsPerQuarter);
+}
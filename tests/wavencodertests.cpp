@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rawaudioencoder.h"
+#include "testframework.h"
+#include "wavencoder.h"
+
+namespace
+{
+	constexpr long s_sampleRate = 44100;
+
+	// Lets a test pretend a huge number of frames have been encoded, since the header only
+	// depends on how many there are
+	class SizedWavEncoder : public WavEncoder
+	{
+	public:
+		SizedWavEncoder(uint64_t frameCount) : WavEncoder(s_sampleRate)
+		{
+			m_frameCount = frameCount;
+		}
+	};
+
+	void writeRamp(AudioFileEncoder& encoder, size_t frameCount)
+	{
+		std::vector<float> left(frameCount);
+		std::vector<float> right(frameCount);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			left[i] = static_cast<float>(i) / frameCount;
+			right[i] = -left[i];
+		}
+		encoder.writeBuffers(left.data(), right.data(), frameCount);
+	}
+
+	std::vector<unsigned char> readHeader(AudioFileEncoder& encoder)
+	{
+		std::vector<unsigned char> header;
+		encoder.readHeader([&header](const unsigned char* data, size_t size) { header.insert(header.end(), data, data + size); });
+		return header;
+	}
+
+	std::vector<unsigned char> readFile(AudioFileEncoder& encoder)
+	{
+		std::vector<unsigned char> file = readHeader(encoder);
+		encoder.readEncodedData([&file](const unsigned char* data, size_t size) { file.insert(file.end(), data, data + size); });
+		return file;
+	}
+
+	uint64_t readValue(const std::vector<unsigned char>& data, size_t offset, int byteCount)
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < byteCount; i++)
+		{
+			value |= static_cast<uint64_t>(data[offset + i]) << (i * 8);
+		}
+		return value;
+	}
+
+	std::string readID(const std::vector<unsigned char>& data, size_t offset)
+	{
+		return std::string(data.begin() + offset, data.begin() + offset + 4);
+	}
+
+	// The offset of the first chunk with the ID after the RIFF header, or 0 if there isn't one
+	size_t findChunk(const std::vector<unsigned char>& file, const std::string& id)
+	{
+		size_t offset = 12;
+		while (offset + 8 <= file.size())
+		{
+			if (readID(file, offset) == id) { return offset; }
+			offset += 8 + static_cast<size_t>(readValue(file, offset + 4, 4));
+		}
+		return 0;
+	}
+}
+
+TEST_CASE(wavencoder, StreamedPlaceholderIsReplacedByFinalHeader)
+{
+	// A streamed file starts with a placeholder header, which is written over once the frame count is known
+	WavEncoder streamed(s_sampleRate);
+	std::vector<unsigned char> streamedFile;
+	streamed.startStreaming([&streamedFile](const unsigned char* data, size_t size) { streamedFile.insert(streamedFile.end(), data, data + size); });
+	size_t placeholderSize = streamedFile.size();
+	CHECK_EQUAL(std::string("JUNK"), readID(streamedFile, 12));
+	writeRamp(streamed, 1000);
+	streamed.setLoopPoints(100, 500);
+	streamed.completeStream();
+
+	std::vector<unsigned char> header = readHeader(streamed);
+	CHECK_EQUAL(placeholderSize, header.size());
+	std::copy(header.begin(), header.end(), streamedFile.begin());
+
+	WavEncoder inMemory(s_sampleRate);
+	writeRamp(inMemory, 1000);
+	inMemory.setLoopPoints(100, 500);
+	inMemory.completeStream();
+	CHECK(streamedFile == readFile(inMemory));
+}
+
+TEST_CASE(wavencoder, SmallFilesAreRIFF)
+{
+	WavEncoder encoder(s_sampleRate);
+	writeRamp(encoder, 1000);
+	encoder.completeStream();
+	std::vector<unsigned char> file = readFile(encoder);
+
+	CHECK_EQUAL(std::string("RIFF"), readID(file, 0));
+	CHECK_EQUAL(static_cast<uint64_t>(file.size() - 8), readValue(file, 4, 4));
+	CHECK_EQUAL(std::string("JUNK"), readID(file, 12));
+	size_t dataChunk = findChunk(file, "data");
+	CHECK(dataChunk > 0);
+	CHECK_EQUAL(static_cast<uint64_t>(1000 * 2 * 4), readValue(file, dataChunk + 4, 4));
+	CHECK_EQUAL(static_cast<size_t>(0), findChunk(file, "smpl"));
+}
+
+TEST_CASE(wavencoder, FilesPast4GiBAreRF64)
+{
+	// Enough frames for the data alone to overflow a 32-bit chunk size
+	uint64_t frameCount = (uint64_t(1) << 29) + 1;
+	uint64_t dataSize = frameCount * 2 * 4;
+	SizedWavEncoder encoder(frameCount);
+	std::vector<unsigned char> header = readHeader(encoder);
+
+	WavEncoder smallEncoder(s_sampleRate);
+	CHECK_EQUAL(readHeader(smallEncoder).size(), header.size());
+
+	CHECK_EQUAL(std::string("RF64"), readID(header, 0));
+	CHECK_EQUAL(static_cast<uint64_t>(UINT32_MAX), readValue(header, 4, 4));
+	CHECK_EQUAL(std::string("ds64"), readID(header, 12));
+	CHECK_EQUAL(static_cast<uint64_t>(header.size() - 8) + dataSize, readValue(header, 20, 8));
+	CHECK_EQUAL(dataSize, readValue(header, 28, 8));
+	CHECK_EQUAL(frameCount, readValue(header, 36, 8));
+
+	// The data chunk is last in the header, with its size left to the ds64 chunk
+	CHECK_EQUAL(std::string("data"), readID(header, header.size() - 8));
+	CHECK_EQUAL(static_cast<uint64_t>(UINT32_MAX), readValue(header, header.size() - 4, 4));
+}
+
+TEST_CASE(wavencoder, LoopChunkEndIsInclusive)
+{
+	WavEncoder encoder(s_sampleRate);
+	writeRamp(encoder, 1000);
+	encoder.setLoopPoints(100, 500);
+	encoder.completeStream();
+	std::vector<unsigned char> file = readFile(encoder);
+
+	size_t smplChunk = findChunk(file, "smpl");
+	CHECK(smplChunk > findChunk(file, "data"));
+	CHECK_EQUAL(file.size(), smplChunk + 8 + static_cast<size_t>(readValue(file, smplChunk + 4, 4)));
+	// One loop, which starts after the nine fields before it and its cue point ID and type
+	size_t loop = smplChunk + 8 + 36;
+	CHECK_EQUAL(static_cast<uint64_t>(1), readValue(file, smplChunk + 8 + 28, 4));
+	CHECK_EQUAL(static_cast<uint64_t>(100), readValue(file, loop + 8, 4));
+	CHECK_EQUAL(static_cast<uint64_t>(599), readValue(file, loop + 12, 4));
+	CHECK_EQUAL(static_cast<uint64_t>(file.size() - 8), readValue(file, 4, 4));
+}
+
+TEST_CASE(wavencoder, RawSidecarDescribesFrames)
+{
+	RawAudioEncoder encoder(s_sampleRate);
+	writeRamp(encoder, 300);
+	encoder.setLoopPoints(10, 200);
+	encoder.completeStream();
+	std::vector<unsigned char> file = readFile(encoder);
+
+	CHECK_EQUAL(std::string("{\"format\":\"f32le\",\"channels\":2,\"sampleRate\":44100,\"frames\":300,\"loopStart\":10,\"loopLength\":200}\n"),
+		encoder.getSidecarContents());
+	// Frames are interleaved with no header
+	CHECK_EQUAL(static_cast<size_t>(300 * 2 * 4), file.size());
+	float secondLeft = 0;
+	float secondRight = 0;
+	std::memcpy(&secondLeft, &file[8], sizeof(float));
+	std::memcpy(&secondRight, &file[12], sizeof(float));
+	CHECK_EQUAL(1.0f / 300, secondLeft);
+	CHECK_EQUAL(-1.0f / 300, secondRight);
+
+	// Without a loop, the sidecar leaves out the loop fields
+	RawAudioEncoder unlooped(s_sampleRate);
+	writeRamp(unlooped, 300);
+	unlooped.completeStream();
+	CHECK_EQUAL(std::string("{\"format\":\"f32le\",\"channels\":2,\"sampleRate\":44100,\"frames\":300}\n"), unlooped.getSidecarContents());
+}